@@ -0,0 +1,108 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_cashash.h>
+#include <buildboxcommon_temporaryfile.h>
+
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+using namespace buildboxcommon;
+
+namespace {
+
+std::string makeData(size_t size)
+{
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i++) {
+        data[i] = static_cast<char>(i % 251);
+    }
+    return data;
+}
+
+void configureThreads(benchmark::State &state)
+{
+    const auto threads = static_cast<size_t>(state.range(1));
+    DigestGenerator::setParallelHashing(threads);
+    state.counters["threads"] = static_cast<double>(threads);
+}
+
+} // namespace
+
+// Hash an in-memory blob of `range(0)` bytes on `range(1)` threads.
+static void BM_Blake3ZccString(benchmark::State &state)
+{
+    const std::string data = makeData(static_cast<size_t>(state.range(0)));
+    const DigestGenerator generator(DigestFunction_Value_BLAKE3ZCC);
+    configureThreads(state);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(generator.hash(data));
+    }
+
+    DigestGenerator::setParallelHashing(0);
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            state.range(0));
+}
+
+// Hash a file of `range(0)` bytes (which will be in the page cache after the
+// first iteration) on `range(1)` threads.
+static void BM_Blake3ZccFile(benchmark::State &state)
+{
+    TemporaryFile file;
+    const std::string data = makeData(static_cast<size_t>(state.range(0)));
+    if (write(file.fd(), data.data(), data.size()) !=
+        static_cast<ssize_t>(data.size())) {
+        state.SkipWithError("Could not write the test file");
+        return;
+    }
+
+    const int fd = open(file.name(), O_RDONLY);
+    const DigestGenerator generator(DigestFunction_Value_BLAKE3ZCC);
+    configureThreads(state);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(generator.hash(fd));
+    }
+
+    DigestGenerator::setParallelHashing(0);
+    close(fd);
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            state.range(0));
+}
+
+static void fileSizesAndThreads(benchmark::internal::Benchmark *b)
+{
+    for (const int64_t size : {1 << 20, 16 << 20, 128 << 20, 512 << 20}) {
+        for (const int64_t threads : {1, 2, 4, 8}) {
+            b->Args({size, threads});
+        }
+    }
+}
+
+BENCHMARK(BM_Blake3ZccString)
+    ->Apply(fileSizesAndThreads)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_Blake3ZccFile)
+    ->Apply(fileSizesAndThreads)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,465 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_cashash.h>
+#include <buildboxcommon_client.h>
+#include <buildboxcommon_protos.h>
+#include <buildboxcommon_temporaryfile.h>
+
+#include <benchmark/benchmark.h>
+#include <grpcpp/security/server_credentials.h>
+#include <grpcpp/server.h>
+#include <grpcpp/server_builder.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace buildboxcommon;
+
+namespace {
+
+const size_t MAX_BATCH_SIZE_BYTES = 256 * 1024;
+
+// Blobs shared by the fake services below. Every RPC sleeps for `d_latency`
+// before doing its work, which stands in for the round-trip time to a remote
+// CAS server. ByteStream writes also sleep for `d_chunkLatency` per
+// request received, to model limited bandwidth.
+struct BlobStore {
+    std::chrono::milliseconds d_latency{5};
+    std::chrono::microseconds d_chunkLatency{0};
+    // Whether ByteStream writes keep the data (or only its size).
+    bool d_storeWrites = true;
+    std::mutex d_mutex;
+    std::unordered_map<std::string, std::shared_ptr<const std::string>>
+        d_blobs;
+
+    void delay() const { std::this_thread::sleep_for(d_latency); }
+
+    void put(const std::string &hash, std::string data)
+    {
+        const auto blob = std::make_shared<const std::string>(std::move(data));
+        const std::lock_guard<std::mutex> lock(d_mutex);
+        d_blobs[hash] = blob;
+    }
+
+    // Return the blob without copying it, or null if it is missing.
+    std::shared_ptr<const std::string> find(const std::string &hash)
+    {
+        const std::lock_guard<std::mutex> lock(d_mutex);
+        const auto it = d_blobs.find(hash);
+        return it == d_blobs.cend() ? nullptr : it->second;
+    }
+
+    bool get(const std::string &hash, std::string *data)
+    {
+        const auto blob = find(hash);
+        if (blob == nullptr) {
+            return false;
+        }
+        *data = *blob;
+        return true;
+    }
+};
+
+// Extract the hash from a "[{instance}/][uploads/{uuid}/]blobs/{hash}/{size}"
+// resource name.
+std::string hashFromResourceName(const std::string &resourceName)
+{
+    const std::string marker = "blobs/";
+    const size_t start = resourceName.find(marker) + marker.size();
+    return resourceName.substr(start, resourceName.find('/', start) - start);
+}
+
+class FakeCas final : public ContentAddressableStorage::Service {
+  public:
+    explicit FakeCas(BlobStore *store) : d_store(store) {}
+
+    grpc::Status FindMissingBlobs(grpc::ServerContext *,
+                                  const FindMissingBlobsRequest *request,
+                                  FindMissingBlobsResponse *response) override
+    {
+        d_store->delay();
+        for (const Digest &digest : request->blob_digests()) {
+            if (d_store->find(digest.hash_other()) == nullptr) {
+                *response->add_missing_blob_digests() = digest;
+            }
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status BatchUpdateBlobs(grpc::ServerContext *,
+                                  const BatchUpdateBlobsRequest *request,
+                                  BatchUpdateBlobsResponse *response) override
+    {
+        d_store->delay();
+        for (const auto &entry : request->requests()) {
+            d_store->put(entry.digest().hash_other(), entry.data());
+            auto responseEntry = response->add_responses();
+            *responseEntry->mutable_digest() = entry.digest();
+            responseEntry->mutable_status()->set_code(grpc::StatusCode::OK);
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status BatchReadBlobs(grpc::ServerContext *,
+                                const BatchReadBlobsRequest *request,
+                                BatchReadBlobsResponse *response) override
+    {
+        d_store->delay();
+        for (const Digest &digest : request->digests()) {
+            auto responseEntry = response->add_responses();
+            *responseEntry->mutable_digest() = digest;
+            if (d_store->get(digest.hash_other(),
+                             responseEntry->mutable_data())) {
+                responseEntry->mutable_status()->set_code(
+                    grpc::StatusCode::OK);
+            }
+            else {
+                responseEntry->mutable_status()->set_code(
+                    grpc::StatusCode::NOT_FOUND);
+            }
+        }
+        return grpc::Status::OK;
+    }
+
+  private:
+    BlobStore *d_store;
+};
+
+class FakeByteStream final : public ByteStream::Service {
+  public:
+    explicit FakeByteStream(BlobStore *store) : d_store(store) {}
+
+    grpc::Status Read(grpc::ServerContext *, const ReadRequest *request,
+                      grpc::ServerWriter<ReadResponse> *writer) override
+    {
+        d_store->delay();
+        const auto data =
+            d_store->find(hashFromResourceName(request->resource_name()));
+        if (data == nullptr) {
+            return grpc::Status(grpc::StatusCode::NOT_FOUND, "Not found");
+        }
+
+        const size_t chunkSize = Client::bytestreamChunkSizeBytes();
+        ReadResponse response;
+        for (size_t offset = 0; offset < data->size(); offset += chunkSize) {
+            response.set_data(data->data() + offset,
+                              std::min(chunkSize, data->size() - offset));
+            writer->Write(response);
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status Write(grpc::ServerContext *,
+                       grpc::ServerReader<WriteRequest> *reader,
+                       WriteResponse *response) override
+    {
+        d_store->delay();
+        std::string resourceName;
+        std::string data;
+        size_t committedSize = 0;
+        WriteRequest request;
+        while (reader->Read(&request)) {
+            std::this_thread::sleep_for(d_store->d_chunkLatency);
+            if (!request.resource_name().empty()) {
+                resourceName = request.resource_name();
+            }
+            if (d_store->d_storeWrites) {
+                data.append(request.data());
+            }
+            committedSize += request.data().size();
+        }
+
+        response->set_committed_size(
+            static_cast<google::protobuf::int64>(committedSize));
+        if (d_store->d_storeWrites) {
+            d_store->put(hashFromResourceName(resourceName), std::move(data));
+        }
+        return grpc::Status::OK;
+    }
+
+  private:
+    BlobStore *d_store;
+};
+
+// An in-process server running the fake services, and a client connected
+// to it. If `channelCount` is not 0, the client connects over TCP with that
+// many channels instead of through an in-process channel.
+class FakeRemote {
+  public:
+    explicit FakeRemote(int channelCount = 0)
+        : d_cas(&d_store), d_byteStream(&d_store)
+    {
+        grpc::ServerBuilder builder;
+        builder.RegisterService(&d_cas);
+        builder.RegisterService(&d_byteStream);
+        int port = 0;
+        if (channelCount > 0) {
+            builder.AddListeningPort(
+                "localhost:0", grpc::InsecureServerCredentials(), &port);
+        }
+        d_server = builder.BuildAndStart();
+
+        if (channelCount > 0) {
+            d_url = "http://localhost:" + std::to_string(port);
+            d_channelCount = std::to_string(channelCount);
+            ConnectionOptions options;
+            options.d_url = d_url.c_str();
+            options.d_channelCount = d_channelCount.c_str();
+            d_client = std::make_shared<Client>();
+            d_client->init(options);
+            return;
+        }
+
+        const auto channel =
+            d_server->InProcessChannel(grpc::ChannelArguments());
+        d_client = std::make_shared<Client>(
+            ByteStream::NewStub(channel),
+            ContentAddressableStorage::NewStub(channel),
+            LocalContentAddressableStorage::NewStub(channel),
+            Capabilities::NewStub(channel), MAX_BATCH_SIZE_BYTES);
+    }
+
+    ~FakeRemote() { d_server->Shutdown(); }
+
+    BlobStore d_store;
+    std::shared_ptr<Client> d_client;
+
+  private:
+    FakeCas d_cas;
+    FakeByteStream d_byteStream;
+    std::unique_ptr<grpc::Server> d_server;
+    std::string d_url;
+    std::string d_channelCount;
+};
+
+// A mix of blobs that is sent in 16 batches of 16 KiB blobs plus 8
+// ByteStream transfers of 2 MiB blobs.
+std::vector<Client::UploadRequest> makeRequests()
+{
+    std::vector<Client::UploadRequest> requests;
+    for (int i = 0; i < 8 * 16 * 2; i++) {
+        const std::string data = std::to_string(i) + std::string(16000, 'x');
+        requests.emplace_back(CASHash::hash(data), data);
+    }
+    for (int i = 0; i < 8; i++) {
+        const std::string data =
+            std::to_string(i) + std::string(2 * 1024 * 1024, 'y');
+        requests.emplace_back(CASHash::hash(data), data);
+    }
+    return requests;
+}
+
+int64_t totalBytes(const std::vector<Client::UploadRequest> &requests)
+{
+    int64_t total = 0;
+    for (const auto &request : requests) {
+        total += request.digest.size_bytes();
+    }
+    return total;
+}
+
+} // namespace
+
+// Upload the blobs with `range(0)` concurrent batch requests and `range(1)`
+// concurrent ByteStream transfers.
+static void BM_UploadBlobs(benchmark::State &state)
+{
+    FakeRemote remote;
+    remote.d_client->setTransferConcurrency(
+        static_cast<size_t>(state.range(0)),
+        static_cast<size_t>(state.range(1)));
+    const auto requests = makeRequests();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(remote.d_client->uploadBlobs(requests));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            totalBytes(requests));
+}
+
+// Download the blobs with `range(0)` concurrent batch requests and
+// `range(1)` concurrent ByteStream transfers.
+static void BM_DownloadBlobs(benchmark::State &state)
+{
+    FakeRemote remote;
+    remote.d_client->setTransferConcurrency(
+        static_cast<size_t>(state.range(0)),
+        static_cast<size_t>(state.range(1)));
+
+    std::vector<Digest> digests;
+    const auto requests = makeRequests();
+    for (const auto &request : requests) {
+        remote.d_store.put(request.digest.hash_other(), request.data);
+        digests.push_back(request.digest);
+    }
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(remote.d_client->downloadBlobs(digests));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            totalBytes(requests));
+}
+
+// Read a single blob of `range(0)` bytes with ByteStream into memory.
+static void BM_FetchString(benchmark::State &state)
+{
+    FakeRemote remote;
+    const std::string data(static_cast<size_t>(state.range(0)), 'z');
+    const Digest digest = CASHash::hash(data);
+    remote.d_store.put(digest.hash_other(), data);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(remote.d_client->fetchString(digest));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            state.range(0));
+}
+
+// Read a single blob of `range(0)` bytes with ByteStream into a file.
+static void BM_DownloadToFile(benchmark::State &state)
+{
+    FakeRemote remote;
+    const std::string data(static_cast<size_t>(state.range(0)), 'z');
+    const Digest digest = CASHash::hash(data);
+    remote.d_store.put(digest.hash_other(), data);
+
+    TemporaryFile file;
+    for (auto _ : state) {
+        state.PauseTiming();
+        if (ftruncate(file.fd(), 0) != 0 ||
+            lseek(file.fd(), 0, SEEK_SET) != 0) {
+            state.SkipWithError("Could not reset the output file");
+            break;
+        }
+        state.ResumeTiming();
+
+        remote.d_client->download(file.fd(), digest);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            state.range(0));
+}
+
+// Upload a file of `range(0)` bytes with ByteStream to a server that takes
+// 1 ms to receive each 1 MiB chunk. The file is evicted from the page cache
+// before each iteration, so that it is read from disk.
+static void BM_UploadFile(benchmark::State &state)
+{
+    FakeRemote remote;
+    remote.d_store.d_chunkLatency = std::chrono::milliseconds(1);
+    remote.d_store.d_storeWrites = false;
+
+    const auto size = static_cast<size_t>(state.range(0));
+    TemporaryFile file;
+    const std::string chunk(Client::bytestreamChunkSizeBytes(), 'u');
+    for (size_t written = 0; written < size; written += chunk.size()) {
+        const size_t length = std::min(chunk.size(), size - written);
+        if (write(file.fd(), chunk.data(), length) !=
+            static_cast<ssize_t>(length)) {
+            state.SkipWithError("Could not write the input file");
+            return;
+        }
+    }
+    Digest digest;
+    digest.set_hash_other("upload-benchmark");
+    digest.set_size_bytes(state.range(0));
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        fsync(file.fd());
+        posix_fadvise(file.fd(), 0, 0, POSIX_FADV_DONTNEED);
+        state.ResumeTiming();
+
+        remote.d_client->upload(file.fd(), digest);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            state.range(0));
+}
+
+// Upload 64 blobs of 4 MiB over TCP with `range(0)` channels and 16
+// concurrent ByteStream transfers.
+static void BM_UploadBlobsOverChannels(benchmark::State &state)
+{
+    FakeRemote remote(static_cast<int>(state.range(0)));
+    remote.d_store.d_latency = std::chrono::milliseconds(0);
+    remote.d_store.d_storeWrites = false;
+    remote.d_client->setTransferConcurrency(1, 16);
+
+    std::vector<Client::UploadRequest> requests;
+    for (int i = 0; i < 64; i++) {
+        const std::string data =
+            std::to_string(i) + std::string(4 * 1024 * 1024, 'c');
+        requests.emplace_back(CASHash::hash(data), data);
+    }
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(remote.d_client->uploadBlobs(requests));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            totalBytes(requests));
+}
+
+static void transferConcurrency(benchmark::internal::Benchmark *b)
+{
+    b->ArgNames({"batches", "bytestreams"});
+    b->Args({1, 1});
+    b->Args({4, 2});
+    b->Args({16, 8});
+}
+
+BENCHMARK(BM_UploadBlobs)
+    ->Apply(transferConcurrency)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_DownloadBlobs)
+    ->Apply(transferConcurrency)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_UploadBlobsOverChannels)
+    ->ArgName("channels")
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_FetchString)
+    ->Arg(64 * 1024 * 1024)
+    ->Arg(1024 * 1024 * 1024)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_DownloadToFile)
+    ->Arg(64 * 1024 * 1024)
+    ->Arg(1024 * 1024 * 1024)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_UploadFile)
+    ->Arg(256LL * 1024 * 1024)
+    ->Arg(2LL * 1024 * 1024 * 1024)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_merklize.h>
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+using namespace buildboxcommon;
+
+namespace {
+
+// Build a tree that is `depth` levels deep. Every level holds `width` files,
+// `width` leaf subdirectories with `width` files each, and the directory that
+// continues down to the next level.
+NestedDirectory makeTree(int depth, int width)
+{
+    NestedDirectory root;
+    std::string prefix;
+    for (int level = 0; level < depth; level++) {
+        for (int i = 0; i < width; i++) {
+            File file;
+            file.d_digest = make_digest(std::to_string(level * width + i));
+            file.d_digest.set_size_bytes(i);
+            file.d_executable = false;
+
+            const std::string name = "file" + std::to_string(i);
+            root.add(file, (prefix + name).c_str());
+            for (int j = 0; j < width; j++) {
+                root.add(file, (prefix + "leaf" + std::to_string(j) + "/" +
+                                name)
+                                   .c_str());
+            }
+        }
+        prefix += "level" + std::to_string(level) + "/";
+    }
+    return root;
+}
+
+} // namespace
+
+static void BM_ToDigest(benchmark::State &state)
+{
+    const NestedDirectory tree = makeTree(static_cast<int>(state.range(0)),
+                                          static_cast<int>(state.range(1)));
+    for (auto _ : state) {
+        digest_string_map digestMap;
+        benchmark::DoNotOptimize(tree.to_digest(&digestMap));
+    }
+}
+
+static void BM_ToTree(benchmark::State &state)
+{
+    const NestedDirectory tree = makeTree(static_cast<int>(state.range(0)),
+                                          static_cast<int>(state.range(1)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.to_tree());
+    }
+}
+
+// What `Client::uploadDirectory()` needs: the root digest, the serialized
+// Directory messages and the Tree, all from a single traversal.
+static void BM_ToDigestWithTree(benchmark::State &state)
+{
+    const NestedDirectory tree = makeTree(static_cast<int>(state.range(0)),
+                                          static_cast<int>(state.range(1)));
+    for (auto _ : state) {
+        digest_string_map digestMap;
+        Tree result;
+        benchmark::DoNotOptimize(tree.to_digest(&digestMap, &result));
+    }
+}
+
+static void treeShapes(benchmark::internal::Benchmark *b)
+{
+    b->ArgNames({"depth", "width"});
+    b->Args({16, 16});
+    b->Args({128, 8});
+    b->Args({512, 4});
+}
+
+BENCHMARK(BM_ToDigest)->Apply(treeShapes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ToTree)->Apply(treeShapes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ToDigestWithTree)
+    ->Apply(treeShapes)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
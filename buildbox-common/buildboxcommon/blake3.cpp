@@ -22,7 +22,9 @@ INLINE void chunk_state_init(blake3_chunk_state *self, const uint32_t key[8],
 INLINE void chunk_state_reset(blake3_chunk_state *self, const uint32_t key[8],
                               uint64_t chunk_counter) {
   memcpy(self->cv, key, BLAKE3_KEY_LEN);
-  self->chunk_counter = 0;
+  // BLAKE3ZCC never feeds the counter into a compression, but the hasher
+  // still relies on it to track the shape of the tree.
+  self->chunk_counter = chunk_counter;
   self->blocks_compressed = 0;
   memset(self->buf, 0, BLAKE3_BLOCK_LEN);
   self->buf_len = 0;
@@ -301,8 +303,9 @@ static size_t blake3_compress_subtree_wide(const uint8_t *input,
   }
   uint8_t *right_cvs = &cv_array[degree * BLAKE3_OUT_LEN];
 
-  // Recurse! If this implementation adds multi-threading support in the
-  // future, this is where it will go.
+  // Recurse! Multi-threading happens one level up, in
+  // compress_subtree_to_parent_node_parallel(), which splits the input into
+  // equal subtrees before they get here.
   size_t left_n = blake3_compress_subtree_wide(input, left_input_len, key,
                                                0, flags, cv_array);
   size_t right_n = blake3_compress_subtree_wide(
@@ -355,6 +358,78 @@ INLINE void compress_subtree_to_parent_node(
   memcpy(out, cv_array, 2 * BLAKE3_OUT_LEN);
 }
 
+typedef struct {
+  size_t max_parts;
+  blake3_parallel_for_fn parallel_for;
+  void *context;
+} blake3_parallelism;
+
+typedef struct {
+  const uint8_t *input;
+  size_t part_len;
+  const uint32_t *key;
+  uint8_t flags;
+  uint8_t *cvs;
+} subtree_parts_task;
+
+// Reduce one part of a larger subtree all the way down to its chaining value.
+// The part is never the root, so its topmost parent node can be finalized.
+static void compress_subtree_part(void *task_context, size_t index) {
+  const subtree_parts_task *task = (const subtree_parts_task *)task_context;
+  uint8_t cv_pair[2 * BLAKE3_OUT_LEN];
+  compress_subtree_to_parent_node(&task->input[index * task->part_len],
+                                  task->part_len, task->key, 0, task->flags,
+                                  cv_pair);
+  output_t output = parent_output(cv_pair, task->key, task->flags);
+  output_chaining_value(&output, &task->cvs[index * BLAKE3_OUT_LEN]);
+}
+
+#define BLAKE3_MAX_PARALLEL_PARTS 256
+
+// The multi-threaded counterpart of compress_subtree_to_parent_node(). The
+// input must be a power-of-2 number of chunks, so the tree above it is
+// perfectly balanced: splitting it into a power-of-2 number of equal parts
+// yields exactly the nodes of one level of that tree. Those parts are hashed
+// concurrently, and the levels above them are then condensed down to the
+// final pair of chaining values on the calling thread.
+static void compress_subtree_to_parent_node_parallel(
+    const uint8_t *input, size_t input_len, const uint32_t key[8],
+    uint8_t flags, const blake3_parallelism *parallelism,
+    uint8_t out[2 * BLAKE3_OUT_LEN]) {
+  size_t num_parts = input_len / BLAKE3_PARALLEL_MIN_PART_LEN;
+  if (num_parts > parallelism->max_parts) {
+    num_parts = parallelism->max_parts;
+  }
+  if (num_parts > BLAKE3_MAX_PARALLEL_PARTS) {
+    num_parts = BLAKE3_MAX_PARALLEL_PARTS;
+  }
+  num_parts = (size_t)round_down_to_power_of_2(num_parts);
+  if (num_parts < 2) {
+    compress_subtree_to_parent_node(input, input_len, key, 0, flags, out);
+    return;
+  }
+
+  uint8_t cvs[BLAKE3_MAX_PARALLEL_PARTS * BLAKE3_OUT_LEN];
+  subtree_parts_task task;
+  task.input = input;
+  task.part_len = input_len / num_parts;
+  task.key = key;
+  task.flags = flags;
+  task.cvs = cvs;
+  parallelism->parallel_for(parallelism->context, num_parts,
+                            compress_subtree_part, &task);
+
+  while (num_parts > 2) {
+    for (size_t i = 0; i < num_parts / 2; i++) {
+      output_t output =
+          parent_output(&cvs[2 * i * BLAKE3_OUT_LEN], key, flags);
+      output_chaining_value(&output, &cvs[i * BLAKE3_OUT_LEN]);
+    }
+    num_parts /= 2;
+  }
+  memcpy(out, cvs, 2 * BLAKE3_OUT_LEN);
+}
+
 INLINE void hasher_init_base(blake3_hasher *self, const uint32_t key[8],
                              uint8_t flags) {
   memcpy(self->key, key, BLAKE3_KEY_LEN);
@@ -448,8 +523,9 @@ INLINE void hasher_push_cv(blake3_hasher *self, uint8_t new_cv[BLAKE3_OUT_LEN],
   self->cv_stack_len += 1;
 }
 
-void blake3_hasher_update(blake3_hasher *self, const void *input,
-                          size_t input_len) {
+static void hasher_update_base(blake3_hasher *self, const void *input,
+                               size_t input_len,
+                               const blake3_parallelism *parallelism) {
   // Explicitly checking for zero avoids causing UB by passing a null pointer
   // to memcpy. This comes up in practice with things like:
   //   std::vector<uint8_t> v;
@@ -485,8 +561,9 @@ void blake3_hasher_update(blake3_hasher *self, const void *input,
 
   // Now the chunk_state is clear, and we have more input. If there's more than
   // a single chunk (so, definitely not the root chunk), hash the largest whole
-  // subtree we can, with the full benefits of SIMD (and maybe in the future,
-  // multi-threading) parallelism. Two restrictions:
+  // subtree we can, with the full benefits of SIMD (and, when called through
+  // blake3_hasher_update_parallel(), multi-threading) parallelism. Two
+  // restrictions:
   // - The subtree has to be a power-of-2 number of chunks. Only subtrees along
   //   the right edge can be incomplete, and we don't know where the right edge
   //   is going to be until we get to finalize().
@@ -533,9 +610,16 @@ void blake3_hasher_update(blake3_hasher *self, const void *input,
       // This is the high-performance happy path, though getting here depends
       // on the caller giving us a long enough input.
       uint8_t cv_pair[2 * BLAKE3_OUT_LEN];
-      compress_subtree_to_parent_node(input_bytes, subtree_len, self->key,
-                                      0,
-                                      self->chunk.flags, cv_pair);
+      if (parallelism != NULL &&
+          subtree_len >= 2 * BLAKE3_PARALLEL_MIN_PART_LEN) {
+        compress_subtree_to_parent_node_parallel(input_bytes, subtree_len,
+                                                 self->key, self->chunk.flags,
+                                                 parallelism, cv_pair);
+      } else {
+        compress_subtree_to_parent_node(input_bytes, subtree_len, self->key,
+                                        0,
+                                        self->chunk.flags, cv_pair);
+      }
       hasher_push_cv(self, cv_pair, self->chunk.chunk_counter);
       hasher_push_cv(self, &cv_pair[BLAKE3_OUT_LEN],
                      self->chunk.chunk_counter + (subtree_chunks / 2));
@@ -557,6 +641,26 @@ void blake3_hasher_update(blake3_hasher *self, const void *input,
   }
 }
 
+void blake3_hasher_update(blake3_hasher *self, const void *input,
+                          size_t input_len) {
+  hasher_update_base(self, input, input_len, NULL);
+}
+
+void blake3_hasher_update_parallel(blake3_hasher *self, const void *input,
+                                   size_t input_len, size_t max_parts,
+                                   blake3_parallel_for_fn parallel_for,
+                                   void *parallel_for_context) {
+  if (max_parts < 2 || parallel_for == NULL) {
+    hasher_update_base(self, input, input_len, NULL);
+    return;
+  }
+  blake3_parallelism parallelism;
+  parallelism.max_parts = max_parts;
+  parallelism.parallel_for = parallel_for;
+  parallelism.context = parallel_for_context;
+  hasher_update_base(self, input, input_len, &parallelism);
+}
+
 void blake3_hasher_finalize(const blake3_hasher *self, uint8_t *out,
                             size_t out_len) {
   blake3_hasher_finalize_seek(self, 0, out, out_len);
@@ -48,6 +48,24 @@ void blake3_hasher_init_derive_key_raw(blake3_hasher *self, const void *context,
                                        size_t context_len);
 void blake3_hasher_update(blake3_hasher *self, const void *input,
                           size_t input_len);
+
+// Invokes `task(task_context, i)` for every `i` in `[0, count)`, possibly
+// concurrently, and returns once all of those calls have completed.
+typedef void (*blake3_parallel_for_fn)(void *context, size_t count,
+                                       void (*task)(void *task_context,
+                                                    size_t index),
+                                       void *task_context);
+
+// Like blake3_hasher_update(), but splits every complete subtree of at least
+// 2 * BLAKE3_PARALLEL_MIN_PART_LEN bytes into up to `max_parts` pieces that
+// are hashed through `parallel_for`. The result is identical to that of
+// blake3_hasher_update().
+#define BLAKE3_PARALLEL_MIN_PART_LEN (128 * BLAKE3_CHUNK_LEN)
+void blake3_hasher_update_parallel(blake3_hasher *self, const void *input,
+                                   size_t input_len, size_t max_parts,
+                                   blake3_parallel_for_fn parallel_for,
+                                   void *parallel_for_context);
+
 void blake3_hasher_finalize(const blake3_hasher *self, uint8_t *out,
                             size_t out_len);
 void blake3_hasher_finalize_seek(const blake3_hasher *self, uint64_t seek,
@@ -0,0 +1,308 @@
+#include "blake3_impl.h"
+
+#if defined(IS_X86) && !defined(BLAKE3_NO_AVX512)
+
+#include <immintrin.h>
+
+#define DEGREE 16
+
+INLINE __m128i loadu(const uint8_t src[16]) {
+  return _mm_loadu_si128((const __m128i *)src);
+}
+
+INLINE void storeu(__m128i src, uint8_t dest[16]) {
+  _mm_storeu_si128((__m128i *)dest, src);
+}
+
+INLINE __m128i addv(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }
+
+// Note that clang-format doesn't like the name "xor" for some reason.
+INLINE __m128i xorv(__m128i a, __m128i b) { return _mm_xor_si128(a, b); }
+
+INLINE __m128i set1(uint32_t x) { return _mm_set1_epi32((int32_t)x); }
+
+INLINE __m128i set4(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+  return _mm_setr_epi32((int32_t)a, (int32_t)b, (int32_t)c, (int32_t)d);
+}
+
+INLINE __m128i rot16(__m128i x) { return _mm_ror_epi32(x, 16); }
+
+INLINE __m128i rot12(__m128i x) { return _mm_ror_epi32(x, 12); }
+
+INLINE __m128i rot8(__m128i x) { return _mm_ror_epi32(x, 8); }
+
+INLINE __m128i rot7(__m128i x) { return _mm_ror_epi32(x, 7); }
+
+/*
+ * ----------------------------------------------------------------------------
+ * compress_avx512
+ * ----------------------------------------------------------------------------
+ */
+
+INLINE void g1(__m128i *row0, __m128i *row1, __m128i *row2, __m128i *row3,
+               __m128i m) {
+  *row0 = addv(addv(*row0, m), *row1);
+  *row3 = xorv(*row3, *row0);
+  *row3 = rot16(*row3);
+  *row2 = addv(*row2, *row3);
+  *row1 = xorv(*row1, *row2);
+  *row1 = rot12(*row1);
+}
+
+INLINE void g2(__m128i *row0, __m128i *row1, __m128i *row2, __m128i *row3,
+               __m128i m) {
+  *row0 = addv(addv(*row0, m), *row1);
+  *row3 = xorv(*row3, *row0);
+  *row3 = rot8(*row3);
+  *row2 = addv(*row2, *row3);
+  *row1 = xorv(*row1, *row2);
+  *row1 = rot7(*row1);
+}
+
+// Rotate rows 1-3 so that the diagonals line up as columns, and back.
+INLINE void diagonalize(__m128i *row1, __m128i *row2, __m128i *row3) {
+  *row1 = _mm_shuffle_epi32(*row1, _MM_SHUFFLE(0, 3, 2, 1));
+  *row2 = _mm_shuffle_epi32(*row2, _MM_SHUFFLE(1, 0, 3, 2));
+  *row3 = _mm_shuffle_epi32(*row3, _MM_SHUFFLE(2, 1, 0, 3));
+}
+
+INLINE void undiagonalize(__m128i *row1, __m128i *row2, __m128i *row3) {
+  *row1 = _mm_shuffle_epi32(*row1, _MM_SHUFFLE(2, 1, 0, 3));
+  *row2 = _mm_shuffle_epi32(*row2, _MM_SHUFFLE(1, 0, 3, 2));
+  *row3 = _mm_shuffle_epi32(*row3, _MM_SHUFFLE(0, 3, 2, 1));
+}
+
+INLINE void round_fn(__m128i rows[4], const uint32_t m[16], size_t r) {
+  const uint8_t *s = MSG_SCHEDULE[r];
+  g1(&rows[0], &rows[1], &rows[2], &rows[3],
+     set4(m[s[0]], m[s[2]], m[s[4]], m[s[6]]));
+  g2(&rows[0], &rows[1], &rows[2], &rows[3],
+     set4(m[s[1]], m[s[3]], m[s[5]], m[s[7]]));
+  diagonalize(&rows[1], &rows[2], &rows[3]);
+  g1(&rows[0], &rows[1], &rows[2], &rows[3],
+     set4(m[s[8]], m[s[10]], m[s[12]], m[s[14]]));
+  g2(&rows[0], &rows[1], &rows[2], &rows[3],
+     set4(m[s[9]], m[s[11]], m[s[13]], m[s[15]]));
+  undiagonalize(&rows[1], &rows[2], &rows[3]);
+}
+
+// As in the portable implementation, the BLAKE3ZCC variant always uses a
+// chunk counter of zero, so `counter` is ignored.
+INLINE void compress_pre(__m128i rows[4], const uint32_t cv[8],
+                         const uint8_t block[BLAKE3_BLOCK_LEN],
+                         uint8_t block_len, uint8_t flags) {
+  rows[0] = loadu((const uint8_t *)&cv[0]);
+  rows[1] = loadu((const uint8_t *)&cv[4]);
+  rows[2] = set4(IV[0], IV[1], IV[2], IV[3]);
+  rows[3] = set4(counter_low(0), counter_high(0), (uint32_t)block_len,
+                 (uint32_t)flags);
+
+  uint32_t m[16];
+  for (size_t i = 0; i < 16; i++) {
+    m[i] = load32(&block[4 * i]);
+  }
+
+  round_fn(rows, m, 0);
+  round_fn(rows, m, 1);
+  round_fn(rows, m, 2);
+  round_fn(rows, m, 3);
+  round_fn(rows, m, 4);
+  round_fn(rows, m, 5);
+  round_fn(rows, m, 6);
+}
+
+void blake3_compress_xof_avx512(const uint32_t cv[8],
+                               const uint8_t block[BLAKE3_BLOCK_LEN],
+                               uint8_t block_len, uint64_t counter,
+                               uint8_t flags, uint8_t out[64]) {
+  (void)counter;
+  __m128i rows[4];
+  compress_pre(rows, cv, block, block_len, flags);
+  storeu(xorv(rows[0], rows[2]), &out[0]);
+  storeu(xorv(rows[1], rows[3]), &out[16]);
+  storeu(xorv(rows[2], loadu((const uint8_t *)&cv[0])), &out[32]);
+  storeu(xorv(rows[3], loadu((const uint8_t *)&cv[4])), &out[48]);
+}
+
+void blake3_compress_in_place_avx512(uint32_t cv[8],
+                                    const uint8_t block[BLAKE3_BLOCK_LEN],
+                                    uint8_t block_len, uint64_t counter,
+                                    uint8_t flags) {
+  (void)counter;
+  __m128i rows[4];
+  compress_pre(rows, cv, block, block_len, flags);
+  storeu(xorv(rows[0], rows[2]), (uint8_t *)&cv[0]);
+  storeu(xorv(rows[1], rows[3]), (uint8_t *)&cv[4]);
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * hash16_avx512
+ * ----------------------------------------------------------------------------
+ */
+
+INLINE __m512i add512(__m512i a, __m512i b) { return _mm512_add_epi32(a, b); }
+
+INLINE __m512i xor512(__m512i a, __m512i b) { return _mm512_xor_si512(a, b); }
+
+INLINE __m512i set1_512(uint32_t x) { return _mm512_set1_epi32((int32_t)x); }
+
+INLINE void g16(__m512i v[16], size_t a, size_t b, size_t c, size_t d,
+                __m512i x, __m512i y) {
+  v[a] = add512(add512(v[a], v[b]), x);
+  v[d] = _mm512_ror_epi32(xor512(v[d], v[a]), 16);
+  v[c] = add512(v[c], v[d]);
+  v[b] = _mm512_ror_epi32(xor512(v[b], v[c]), 12);
+  v[a] = add512(add512(v[a], v[b]), y);
+  v[d] = _mm512_ror_epi32(xor512(v[d], v[a]), 8);
+  v[c] = add512(v[c], v[d]);
+  v[b] = _mm512_ror_epi32(xor512(v[b], v[c]), 7);
+}
+
+INLINE void round_fn16(__m512i v[16], const __m512i m[16], size_t r) {
+  const uint8_t *s = MSG_SCHEDULE[r];
+  // Mix the columns.
+  g16(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+  g16(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+  g16(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+  g16(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+  // Mix the rows.
+  g16(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+  g16(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+  g16(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+  g16(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+}
+
+// Select 128-bit lanes 0 and 2 (resp. 1 and 3) from each of `a` and `b`.
+INLINE __m512i unpack_lo_128(__m512i a, __m512i b) {
+  return _mm512_shuffle_i32x4(a, b, 0x88);
+}
+
+INLINE __m512i unpack_hi_128(__m512i a, __m512i b) {
+  return _mm512_shuffle_i32x4(a, b, 0xdd);
+}
+
+// Transpose a 16x16 matrix of 32-bit words held one row per vector.
+INLINE void transpose_vecs_512(__m512i vecs[16]) {
+  // Interleave 32-bit lanes. Within each 128-bit lane, the low unpack holds
+  // words 0/1 of its pair of rows and the high unpack holds words 2/3.
+  __m512i lo32[8], hi32[8];
+  for (size_t i = 0; i < 8; i++) {
+    lo32[i] = _mm512_unpacklo_epi32(vecs[2 * i], vecs[2 * i + 1]);
+    hi32[i] = _mm512_unpackhi_epi32(vecs[2 * i], vecs[2 * i + 1]);
+  }
+
+  // Interleave 64-bit lanes. Each 128-bit lane `k` of `cols[g][j]` now holds
+  // column `4k + j` of rows `4g` to `4g + 3`.
+  __m512i cols[4][4];
+  for (size_t i = 0; i < 4; i++) {
+    cols[i][0] = _mm512_unpacklo_epi64(lo32[2 * i], lo32[2 * i + 1]);
+    cols[i][1] = _mm512_unpackhi_epi64(lo32[2 * i], lo32[2 * i + 1]);
+    cols[i][2] = _mm512_unpacklo_epi64(hi32[2 * i], hi32[2 * i + 1]);
+    cols[i][3] = _mm512_unpackhi_epi64(hi32[2 * i], hi32[2 * i + 1]);
+  }
+
+  // Interleave 128-bit lanes, first pairing rows 0-7 and 8-15.
+  __m512i half[2][8];
+  for (size_t i = 0; i < 2; i++) {
+    for (size_t j = 0; j < 4; j++) {
+      half[i][j] = unpack_lo_128(cols[2 * i][j], cols[2 * i + 1][j]);
+      half[i][j + 4] = unpack_hi_128(cols[2 * i][j], cols[2 * i + 1][j]);
+    }
+  }
+
+  // ...and then again for the final outputs.
+  for (size_t j = 0; j < 8; j++) {
+    vecs[j] = unpack_lo_128(half[0][j], half[1][j]);
+    vecs[j + 8] = unpack_hi_128(half[0][j], half[1][j]);
+  }
+}
+
+INLINE void transpose_msg_vecs16(const uint8_t *const *inputs,
+                                 size_t block_offset, __m512i out[16]) {
+  for (size_t i = 0; i < DEGREE; i++) {
+    out[i] = _mm512_loadu_si512((const void *)&inputs[i][block_offset]);
+  }
+  for (size_t i = 0; i < DEGREE; i++) {
+    _mm_prefetch((const char *)&inputs[i][block_offset + 256], _MM_HINT_T0);
+  }
+  transpose_vecs_512(out);
+}
+
+static void blake3_hash16_avx512(const uint8_t *const *inputs, size_t blocks,
+                                 const uint32_t key[8], uint8_t flags,
+                                 uint8_t flags_start, uint8_t flags_end,
+                                 uint8_t *out) {
+  __m512i h_vecs[16] = {
+      set1_512(key[0]), set1_512(key[1]), set1_512(key[2]), set1_512(key[3]),
+      set1_512(key[4]), set1_512(key[5]), set1_512(key[6]), set1_512(key[7]),
+  };
+  // BLAKE3ZCC: every lane uses a chunk counter of zero.
+  const __m512i counter_low_vec = set1_512(counter_low(0));
+  const __m512i counter_high_vec = set1_512(counter_high(0));
+  uint8_t block_flags = flags | flags_start;
+
+  for (size_t block = 0; block < blocks; block++) {
+    if (block + 1 == blocks) {
+      block_flags |= flags_end;
+    }
+    __m512i block_len_vec = set1_512(BLAKE3_BLOCK_LEN);
+    __m512i block_flags_vec = set1_512(block_flags);
+    __m512i msg_vecs[16];
+    transpose_msg_vecs16(inputs, block * BLAKE3_BLOCK_LEN, msg_vecs);
+
+    __m512i v[16] = {
+        h_vecs[0],       h_vecs[1],        h_vecs[2],     h_vecs[3],
+        h_vecs[4],       h_vecs[5],        h_vecs[6],     h_vecs[7],
+        set1_512(IV[0]), set1_512(IV[1]),  set1_512(IV[2]), set1_512(IV[3]),
+        counter_low_vec, counter_high_vec, block_len_vec, block_flags_vec,
+    };
+    round_fn16(v, msg_vecs, 0);
+    round_fn16(v, msg_vecs, 1);
+    round_fn16(v, msg_vecs, 2);
+    round_fn16(v, msg_vecs, 3);
+    round_fn16(v, msg_vecs, 4);
+    round_fn16(v, msg_vecs, 5);
+    round_fn16(v, msg_vecs, 6);
+    for (size_t i = 0; i < 8; i++) {
+      h_vecs[i] = xor512(v[i], v[i + 8]);
+    }
+
+    block_flags = flags;
+  }
+
+  // The upper eight vectors stay zero, so after transposing, the low half of
+  // each vector is the chaining value of one input.
+  transpose_vecs_512(h_vecs);
+  for (size_t i = 0; i < DEGREE; i++) {
+    _mm256_storeu_si256((__m256i *)&out[i * BLAKE3_OUT_LEN],
+                        _mm512_castsi512_si256(h_vecs[i]));
+  }
+}
+
+void blake3_hash_many_avx512(const uint8_t *const *inputs, size_t num_inputs,
+                             size_t blocks, const uint32_t key[8],
+                             uint64_t counter, bool increment_counter,
+                             uint8_t flags, uint8_t flags_start,
+                             uint8_t flags_end, uint8_t *out) {
+  while (num_inputs >= DEGREE) {
+    blake3_hash16_avx512(inputs, blocks, key, flags, flags_start, flags_end,
+                         out);
+    inputs += DEGREE;
+    num_inputs -= DEGREE;
+    out = &out[DEGREE * BLAKE3_OUT_LEN];
+  }
+#if !defined(BLAKE3_NO_AVX2)
+  blake3_hash_many_avx2(inputs, num_inputs, blocks, key, counter,
+                        increment_counter, flags, flags_start, flags_end, out);
+#elif !defined(BLAKE3_NO_SSE41)
+  blake3_hash_many_sse41(inputs, num_inputs, blocks, key, counter,
+                         increment_counter, flags, flags_start, flags_end, out);
+#else
+  blake3_hash_many_portable(inputs, num_inputs, blocks, key, counter,
+                            increment_counter, flags, flags_start, flags_end,
+                            out);
+#endif
+}
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_actioncacheclient.h>
+
+#include <buildboxcommon_channelregistry.h>
+#include <buildboxcommon_grpcretrier.h>
+#include <buildboxcommon_grpcretry.h>
+#include <buildboxcommon_logging.h>
+#include <buildboxcommonmetrics_countingmetricutil.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace buildboxcommon {
+
+namespace {
+void throwGrpcErrorException(const grpc::Status &errorStatus)
+{
+    throw GrpcError(std::to_string(errorStatus.error_code()) + ": " +
+                        errorStatus.error_message(),
+                    errorStatus);
+}
+} // namespace
+
+const std::string ActionCacheClient::s_localHitsMetricName =
+    "action_cache_local_hits";
+const std::string ActionCacheClient::s_localMissesMetricName =
+    "action_cache_local_misses";
+
+ActionCacheClient::ActionCacheClient(
+    const ConnectionOptions &connectionOptions, size_t cacheEntries)
+    : ActionCacheClient(
+          ActionCache::NewStub(ChannelRegistry::channel(connectionOptions)),
+          connectionOptions.d_instanceName != nullptr
+              ? connectionOptions.d_instanceName
+              : "",
+          std::stoi(connectionOptions.d_retryLimit),
+          std::stoi(connectionOptions.d_retryDelay), cacheEntries)
+{
+}
+
+ActionCacheClient::ActionCacheClient(
+    std::shared_ptr<ActionCache::StubInterface> actionCacheClient,
+    const std::string &instanceName, int grpcRetryLimit, int grpcRetryDelay,
+    size_t cacheEntries)
+    : d_actionCacheClient(actionCacheClient), d_instanceName(instanceName),
+      d_grpcRetryLimit(static_cast<unsigned int>(grpcRetryLimit)),
+      d_grpcRetryDelay(grpcRetryDelay), d_cacheEntries(cacheEntries)
+{
+}
+
+bool ActionCacheClient::getActionResult(
+    const Digest &actionDigest, ActionResult *result, bool inlineStdout,
+    bool inlineStderr, const std::vector<std::string> &inlineOutputFiles)
+{
+    if (d_cacheEntries > 0) {
+        const bool hit = readCache(actionDigest, inlineStdout, inlineStderr,
+                                   inlineOutputFiles, result);
+        buildboxcommonmetrics::CountingMetricUtil::recordCounterMetric(
+            hit ? s_localHitsMetricName : s_localMissesMetricName, 1);
+        if (hit) {
+            return true;
+        }
+    }
+
+    GetActionResultRequest request;
+    request.set_instance_name(d_instanceName);
+    *request.mutable_action_digest() = actionDigest;
+    request.set_inline_stdout(inlineStdout);
+    request.set_inline_stderr(inlineStderr);
+    for (const std::string &path : inlineOutputFiles) {
+        request.add_inline_output_files(path);
+    }
+
+    ActionResult response;
+    const auto getActionResultLambda = [&](grpc::ClientContext &context) {
+        return d_actionCacheClient->GetActionResult(&context, request,
+                                                    &response);
+    };
+
+    GrpcRetrier retrier(d_grpcRetryLimit, d_grpcRetryDelay,
+                        getActionResultLambda,
+                        "ActionCache.GetActionResult()");
+    retrier.setMetadataAttacher([this](grpc::ClientContext *context) {
+        d_metadataGenerator.attach_request_metadata(context);
+    });
+    // A miss is the common answer, which callers probing the cache for every
+    // action would otherwise flood the logs with.
+    retrier.setExpectedStatusCodes({grpc::StatusCode::NOT_FOUND});
+
+    if (retrier.issueRequest() &&
+        retrier.status().error_code() == grpc::StatusCode::NOT_FOUND) {
+        BUILDBOX_LOG_DEBUG("Action \"" << toString(actionDigest)
+                                       << "\" not found in the ActionCache");
+        return false;
+    }
+    if (!retrier.status().ok()) {
+        throwGrpcErrorException(retrier.status());
+    }
+
+    CacheEntry entry;
+    entry.d_actionDigest = actionDigest;
+    entry.d_result = response;
+    entry.d_stdoutInlined = inlineStdout;
+    entry.d_stderrInlined = inlineStderr;
+    entry.d_outputFilesInlined.insert(inlineOutputFiles.cbegin(),
+                                      inlineOutputFiles.cend());
+    writeCache(std::move(entry));
+
+    *result = std::move(response);
+    return true;
+}
+
+ActionResult ActionCacheClient::updateActionResult(const Digest &actionDigest,
+                                                   const ActionResult &result)
+{
+    UpdateActionResultRequest request;
+    request.set_instance_name(d_instanceName);
+    *request.mutable_action_digest() = actionDigest;
+    *request.mutable_action_result() = result;
+
+    ActionResult response;
+    const auto updateActionResultLambda = [&](grpc::ClientContext &context) {
+        return d_actionCacheClient->UpdateActionResult(&context, request,
+                                                       &response);
+    };
+
+    GrpcRetrier retrier(d_grpcRetryLimit, d_grpcRetryDelay,
+                        updateActionResultLambda,
+                        "ActionCache.UpdateActionResult()");
+    retrier.setMetadataAttacher([this](grpc::ClientContext *context) {
+        d_metadataGenerator.attach_request_metadata(context);
+    });
+
+    if (!retrier.issueRequest() || !retrier.status().ok()) {
+        throwGrpcErrorException(retrier.status());
+    }
+
+    // Nothing was requested inline, so this only answers lookups that do
+    // not ask for inline outputs either.
+    CacheEntry entry;
+    entry.d_actionDigest = actionDigest;
+    entry.d_result = response;
+    entry.d_stdoutInlined = false;
+    entry.d_stderrInlined = false;
+    writeCache(std::move(entry));
+
+    return response;
+}
+
+void ActionCacheClient::set_tool_details(const std::string &tool_name,
+                                         const std::string &tool_version)
+{
+    d_metadataGenerator.set_tool_details(tool_name, tool_version);
+}
+
+void ActionCacheClient::set_request_metadata(
+    const std::string &action_id, const std::string &tool_invocation_id,
+    const std::string &correlated_invocations_id)
+{
+    d_metadataGenerator.set_action_id(action_id);
+    d_metadataGenerator.set_tool_invocation_id(tool_invocation_id);
+    d_metadataGenerator.set_correlated_invocations_id(
+        correlated_invocations_id);
+}
+
+void ActionCacheClient::clearCache()
+{
+    const std::lock_guard<std::mutex> lock(d_cacheMutex);
+    d_entries.clear();
+    d_index.clear();
+}
+
+size_t ActionCacheClient::cacheSize() const
+{
+    const std::lock_guard<std::mutex> lock(d_cacheMutex);
+    return d_entries.size();
+}
+
+bool ActionCacheClient::readCache(
+    const Digest &actionDigest, bool inlineStdout, bool inlineStderr,
+    const std::vector<std::string> &inlineOutputFiles, ActionResult *result)
+{
+    const std::lock_guard<std::mutex> lock(d_cacheMutex);
+    const auto it = d_index.find(actionDigest);
+    if (it == d_index.end()) {
+        return false;
+    }
+
+    const CacheEntry &entry = *it->second;
+    if ((inlineStdout && !entry.d_stdoutInlined) ||
+        (inlineStderr && !entry.d_stderrInlined) ||
+        !std::all_of(inlineOutputFiles.cbegin(), inlineOutputFiles.cend(),
+                     [&entry](const std::string &path) {
+                         return entry.d_outputFilesInlined.count(path) > 0;
+                     })) {
+        return false;
+    }
+
+    d_entries.splice(d_entries.begin(), d_entries, it->second);
+    *result = entry.d_result;
+    return true;
+}
+
+void ActionCacheClient::writeCache(CacheEntry entry)
+{
+    if (d_cacheEntries == 0) {
+        return;
+    }
+
+    const std::lock_guard<std::mutex> lock(d_cacheMutex);
+    const auto it = d_index.find(entry.d_actionDigest);
+    if (it != d_index.end()) {
+        d_entries.erase(it->second);
+        d_index.erase(it);
+    }
+
+    d_entries.push_front(std::move(entry));
+    d_index.emplace(d_entries.front().d_actionDigest, d_entries.begin());
+
+    if (d_entries.size() > d_cacheEntries) {
+        d_index.erase(d_entries.back().d_actionDigest);
+        d_entries.pop_back();
+    }
+}
+
+} // namespace buildboxcommon
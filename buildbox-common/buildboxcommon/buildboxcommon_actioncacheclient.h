@@ -0,0 +1,138 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDED_BUILDBOXCOMMON_ACTIONCACHECLIENT
+#define INCLUDED_BUILDBOXCOMMON_ACTIONCACHECLIENT
+
+#include <buildboxcommon_connectionoptions.h>
+#include <buildboxcommon_protos.h>
+#include <buildboxcommon_requestmetadata.h>
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace buildboxcommon {
+
+class ActionCacheClient final {
+    /*
+     * Looks up and stores results in an ActionCache service, retrying
+     * requests that fail with transient errors.
+     *
+     * If `cacheEntries` is not 0, the results found or stored are also
+     * remembered in process for the most recently used actions, so that
+     * repeated lookups of an action are answered without a request. Results
+     * are not expected to change for an action, so entries only leave the
+     * cache when it is full.
+     *
+     * It is safe to use from multiple threads.
+     */
+  public:
+    // Counters recorded with buildboxcommonmetrics by `getActionResult()`.
+    static const std::string s_localHitsMetricName;
+    static const std::string s_localMissesMetricName;
+
+    ActionCacheClient(const ConnectionOptions &connectionOptions,
+                      size_t cacheEntries = 0);
+
+    // Constructor method for unit testing (allows mocking the ActionCache
+    // client.)
+    ActionCacheClient(
+        std::shared_ptr<ActionCache::StubInterface> actionCacheClient,
+        const std::string &instanceName, int grpcRetryLimit,
+        int grpcRetryDelay, size_t cacheEntries = 0);
+
+    ActionCacheClient(const ActionCacheClient &) = delete;
+    ActionCacheClient &operator=(const ActionCacheClient &) = delete;
+
+    // Issue a `GetActionResult()` request for the action, asking the server
+    // to inline the given outputs, which saves fetching them from the CAS
+    // afterwards. Return whether the action was found and, if so, write its
+    // result to `result`.
+    //
+    // A result remembered from a request that inlined at least the same
+    // outputs is returned without contacting the server.
+    //
+    // On errors other than `NOT_FOUND` throws `GrpcError`.
+    bool getActionResult(const Digest &actionDigest, ActionResult *result,
+                         bool inlineStdout = false, bool inlineStderr = false,
+                         const std::vector<std::string> &inlineOutputFiles =
+                             std::vector<std::string>());
+
+    // Issue an `UpdateActionResult()` request and return the result stored
+    // by the server, which is then remembered.
+    //
+    // On errors throws `GrpcError`.
+    ActionResult updateActionResult(const Digest &actionDigest,
+                                    const ActionResult &result);
+
+    void set_tool_details(const std::string &tool_name,
+                          const std::string &tool_version);
+
+    // Set the optional ID values to be attached to requests.
+    void set_request_metadata(const std::string &action_id,
+                              const std::string &tool_invocation_id,
+                              const std::string &correlated_invocations_id);
+
+    // Forget the remembered results.
+    void clearCache();
+
+    size_t cacheSize() const;
+
+  private:
+    struct CacheEntry {
+        Digest d_actionDigest;
+        ActionResult d_result;
+
+        // Outputs that were requested inline when fetching `d_result`.
+        bool d_stdoutInlined;
+        bool d_stderrInlined;
+        std::set<std::string> d_outputFilesInlined;
+    };
+
+    // Most recently used entries first.
+    typedef std::list<CacheEntry> EntryList;
+
+    std::shared_ptr<ActionCache::StubInterface> d_actionCacheClient;
+    const std::string d_instanceName;
+    const unsigned int d_grpcRetryLimit;
+    const std::chrono::milliseconds d_grpcRetryDelay;
+
+    RequestMetadataGenerator d_metadataGenerator;
+
+    const size_t d_cacheEntries;
+    mutable std::mutex d_cacheMutex;
+    EntryList d_entries;
+    std::unordered_map<Digest, EntryList::iterator> d_index;
+
+    // Return whether a remembered result covers the requested outputs and,
+    // if so, write it to `result`.
+    bool readCache(const Digest &actionDigest, bool inlineStdout,
+                   bool inlineStderr,
+                   const std::vector<std::string> &inlineOutputFiles,
+                   ActionResult *result);
+
+    void writeCache(CacheEntry entry);
+};
+
+} // namespace buildboxcommon
+
+#endif
@@ -0,0 +1,372 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_assetclient.h>
+
+#include <buildboxcommon_channelregistry.h>
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_grpcretry.h>
+#include <buildboxcommon_logging.h>
+#include <buildboxcommonmetrics_countingmetricutil.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace buildboxcommon {
+
+namespace {
+void throwGrpcErrorException(const grpc::Status &errorStatus)
+{
+    throw GrpcError(std::to_string(errorStatus.error_code()) + ": " +
+                        errorStatus.error_message(),
+                    errorStatus);
+}
+
+// Errors that the server reports in the `status` field of a response.
+void throwOnResponseError(const google::rpc::Status &status)
+{
+    if (status.code() != grpc::StatusCode::OK) {
+        throwGrpcErrorException(
+            grpc::Status(static_cast<grpc::StatusCode>(status.code()),
+                         status.message()));
+    }
+}
+
+int64_t secondsSinceEpoch()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+} // namespace
+
+const std::string AssetClient::s_memoHitsMetricName = "asset_memo_hits";
+const std::string AssetClient::s_memoMissesMetricName = "asset_memo_misses";
+
+AssetClient::AssetClient(const ConnectionOptions &connectionOptions,
+                         const std::string &memoPath)
+    : AssetClient(
+          Fetch::NewStub(ChannelRegistry::channel(connectionOptions)),
+          Push::NewStub(ChannelRegistry::channel(connectionOptions)),
+          connectionOptions.d_instanceName != nullptr
+              ? connectionOptions.d_instanceName
+              : "",
+          std::stoi(connectionOptions.d_retryLimit),
+          std::stoi(connectionOptions.d_retryDelay), memoPath)
+{
+    if (connectionOptions.d_url != nullptr) {
+        d_remoteUrl = connectionOptions.d_url;
+    }
+}
+
+AssetClient::AssetClient(std::shared_ptr<Fetch::StubInterface> fetchClient,
+                         std::shared_ptr<Push::StubInterface> pushClient,
+                         const std::string &instanceName, int grpcRetryLimit,
+                         int grpcRetryDelay, const std::string &memoPath)
+    : d_fetchClient(fetchClient), d_pushClient(pushClient),
+      d_instanceName(instanceName),
+      d_grpcRetryLimit(static_cast<unsigned int>(grpcRetryLimit)),
+      d_grpcRetryDelay(grpcRetryDelay), d_memoPath(memoPath)
+{
+    if (!d_memoPath.empty()) {
+        loadMemo();
+    }
+}
+
+FetchBlobResponse
+AssetClient::fetchBlob(const std::vector<std::string> &uris,
+                       const std::vector<Qualifier> &qualifiers)
+{
+    FetchBlobResponse response;
+    if (lookUpMemo(AssetType::Blob, uris, qualifiers, response.mutable_uri(),
+                   response.mutable_blob_digest())) {
+        response.mutable_qualifiers()->Add(qualifiers.cbegin(),
+                                           qualifiers.cend());
+        return response;
+    }
+
+    FetchBlobRequest request;
+    request.set_instance_name(d_instanceName);
+    request.mutable_uris()->Add(uris.cbegin(), uris.cend());
+    request.mutable_qualifiers()->Add(qualifiers.cbegin(), qualifiers.cend());
+
+    issueRequest(
+        [&](grpc::ClientContext &context) {
+            return d_fetchClient->FetchBlob(&context, request, &response);
+        },
+        "Fetch.FetchBlob()");
+    throwOnResponseError(response.status());
+
+    memoize(AssetType::Blob, {response.uri()}, qualifiers,
+            response.blob_digest(),
+            response.has_expires_at() ? response.expires_at().seconds() : 0);
+    return response;
+}
+
+FetchDirectoryResponse
+AssetClient::fetchDirectory(const std::vector<std::string> &uris,
+                            const std::vector<Qualifier> &qualifiers)
+{
+    FetchDirectoryResponse response;
+    if (lookUpMemo(AssetType::Directory, uris, qualifiers,
+                   response.mutable_uri(),
+                   response.mutable_root_directory_digest())) {
+        response.mutable_qualifiers()->Add(qualifiers.cbegin(),
+                                           qualifiers.cend());
+        return response;
+    }
+
+    FetchDirectoryRequest request;
+    request.set_instance_name(d_instanceName);
+    request.mutable_uris()->Add(uris.cbegin(), uris.cend());
+    request.mutable_qualifiers()->Add(qualifiers.cbegin(), qualifiers.cend());
+
+    issueRequest(
+        [&](grpc::ClientContext &context) {
+            return d_fetchClient->FetchDirectory(&context, request,
+                                                 &response);
+        },
+        "Fetch.FetchDirectory()");
+    throwOnResponseError(response.status());
+
+    memoize(AssetType::Directory, {response.uri()}, qualifiers,
+            response.root_directory_digest(),
+            response.has_expires_at() ? response.expires_at().seconds() : 0);
+    return response;
+}
+
+void AssetClient::pushBlob(const std::vector<std::string> &uris,
+                           const std::vector<Qualifier> &qualifiers,
+                           const Digest &blobDigest)
+{
+    PushBlobRequest request;
+    request.set_instance_name(d_instanceName);
+    request.mutable_uris()->Add(uris.cbegin(), uris.cend());
+    request.mutable_qualifiers()->Add(qualifiers.cbegin(), qualifiers.cend());
+    *request.mutable_blob_digest() = blobDigest;
+
+    PushBlobResponse response;
+    issueRequest(
+        [&](grpc::ClientContext &context) {
+            return d_pushClient->PushBlob(&context, request, &response);
+        },
+        "Push.PushBlob()");
+
+    memoize(AssetType::Blob, uris, qualifiers, blobDigest, 0);
+}
+
+void AssetClient::pushDirectory(const std::vector<std::string> &uris,
+                                const std::vector<Qualifier> &qualifiers,
+                                const Digest &rootDirectoryDigest)
+{
+    PushDirectoryRequest request;
+    request.set_instance_name(d_instanceName);
+    request.mutable_uris()->Add(uris.cbegin(), uris.cend());
+    request.mutable_qualifiers()->Add(qualifiers.cbegin(), qualifiers.cend());
+    *request.mutable_root_directory_digest() = rootDirectoryDigest;
+
+    PushDirectoryResponse response;
+    issueRequest(
+        [&](grpc::ClientContext &context) {
+            return d_pushClient->PushDirectory(&context, request, &response);
+        },
+        "Push.PushDirectory()");
+
+    memoize(AssetType::Directory, uris, qualifiers, rootDirectoryDigest, 0);
+}
+
+void AssetClient::set_tool_details(const std::string &tool_name,
+                                   const std::string &tool_version)
+{
+    d_metadataGenerator.set_tool_details(tool_name, tool_version);
+}
+
+void AssetClient::set_request_metadata(
+    const std::string &action_id, const std::string &tool_invocation_id,
+    const std::string &correlated_invocations_id)
+{
+    d_metadataGenerator.set_action_id(action_id);
+    d_metadataGenerator.set_tool_invocation_id(tool_invocation_id);
+    d_metadataGenerator.set_correlated_invocations_id(
+        correlated_invocations_id);
+}
+
+size_t AssetClient::memoSize() const
+{
+    const std::lock_guard<std::mutex> lock(d_memoMutex);
+    return d_memo.size();
+}
+
+std::string AssetClient::memoKey(const std::string &remoteUrl,
+                                 const std::string &instanceName,
+                                 AssetType type, const std::string &uri,
+                                 const std::vector<Qualifier> &qualifiers,
+                                 DigestFunction_Value digestFunction)
+{
+    // The order of the qualifiers is not significant.
+    std::vector<std::pair<std::string, std::string>> sortedQualifiers;
+    for (const Qualifier &qualifier : qualifiers) {
+        sortedQualifiers.emplace_back(qualifier.name(), qualifier.value());
+    }
+    std::sort(sortedQualifiers.begin(), sortedQualifiers.end());
+
+    std::string key(remoteUrl);
+    key.append(1, '\0').append(instanceName);
+    key.append(1, '\0').append(type == AssetType::Blob ? "blob" : "directory");
+    key.append(1, '\0').append(uri);
+    for (const auto &qualifier : sortedQualifiers) {
+        key.append(1, '\0').append(qualifier.first);
+        key.append(1, '\0').append(qualifier.second);
+    }
+    return hashToHex(DigestGenerator(digestFunction).hash(key));
+}
+
+bool AssetClient::lookUpMemo(AssetType type,
+                             const std::vector<std::string> &uris,
+                             const std::vector<Qualifier> &qualifiers,
+                             std::string *uri, Digest *digest)
+{
+    const int64_t now = secondsSinceEpoch();
+    bool hit = false;
+    {
+        const std::lock_guard<std::mutex> lock(d_memoMutex);
+        for (const std::string &candidate : uris) {
+            const auto it = d_memo.find(memoKey(
+                d_remoteUrl, d_instanceName, type, candidate, qualifiers));
+            if (it != d_memo.end() &&
+                (it->second.d_expiresAt == 0 ||
+                 it->second.d_expiresAt > now)) {
+                *uri = candidate;
+                *digest = it->second.d_digest;
+                hit = true;
+                break;
+            }
+        }
+    }
+
+    buildboxcommonmetrics::CountingMetricUtil::recordCounterMetric(
+        hit ? s_memoHitsMetricName : s_memoMissesMetricName, 1);
+    return hit;
+}
+
+void AssetClient::memoize(AssetType type, const std::vector<std::string> &uris,
+                          const std::vector<Qualifier> &qualifiers,
+                          const Digest &digest, int64_t expiresAt)
+{
+    std::ostringstream lines;
+    const std::lock_guard<std::mutex> lock(d_memoMutex);
+    for (const std::string &uri : uris) {
+        const std::string key =
+            memoKey(d_remoteUrl, d_instanceName, type, uri, qualifiers);
+        d_memo[key] = MemoEntry{digest, expiresAt};
+        lines << memoLine(key, d_memo[key]);
+    }
+
+    if (d_memoPath.empty()) {
+        return;
+    }
+
+    // Later lines take precedence when loading, so entries are only ever
+    // appended.
+    std::ofstream file(d_memoPath, std::ios::app);
+    file << lines.str();
+    if (!file) {
+        BUILDBOX_LOG_WARNING("Could not write to the asset memo at \""
+                             << d_memoPath << "\"");
+    }
+}
+
+void AssetClient::loadMemo()
+{
+    std::ifstream file(d_memoPath);
+    if (!file) {
+        // The file is created by the first entry.
+        return;
+    }
+
+    const int64_t now = secondsSinceEpoch();
+    size_t lineCount = 0;
+    std::string line;
+    while (std::getline(file, line)) {
+        lineCount++;
+        std::istringstream fields(line);
+        std::string key, digestHex, serializedDigest;
+        int64_t expiresAt = 0;
+        Digest digest;
+        if (!(fields >> key >> digestHex >> expiresAt) ||
+            !hexToBytes(digestHex, &serializedDigest) ||
+            !digest.ParseFromString(serializedDigest)) {
+            BUILDBOX_LOG_WARNING(
+                "Skipping invalid line in the asset memo at \"" << d_memoPath
+                                                                 << "\"");
+            continue;
+        }
+
+        // Later lines supersede earlier ones for the same key.
+        if (expiresAt != 0 && expiresAt <= now) {
+            d_memo.erase(key);
+        }
+        else {
+            d_memo[key] = MemoEntry{digest, expiresAt};
+        }
+    }
+    file.close();
+
+    if (lineCount == d_memo.size()) {
+        return;
+    }
+
+    // Compacting the file so that it only grows with the live entries. Lines
+    // that other processes append while this runs may be lost, which only
+    // costs them a request later.
+    std::ostringstream lines;
+    for (const auto &entry : d_memo) {
+        lines << memoLine(entry.first, entry.second);
+    }
+    try {
+        FileUtils::writeFileAtomically(d_memoPath, lines.str());
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not compact the asset memo at \""
+                             << d_memoPath << "\": " << e.what());
+    }
+}
+
+std::string AssetClient::memoLine(const std::string &key,
+                                  const MemoEntry &entry)
+{
+    // Digests are stored as their serialized message in hexadecimal, which
+    // covers every hash field.
+    return key + " " + bytesToHex(entry.d_digest.SerializeAsString()) + " " +
+           std::to_string(entry.d_expiresAt) + "\n";
+}
+
+void AssetClient::issueRequest(const GrpcRetrier::GrpcInvocation &invocation,
+                               const std::string &invocationName)
+{
+    GrpcRetrier retrier(d_grpcRetryLimit, d_grpcRetryDelay, invocation,
+                        invocationName);
+    retrier.setMetadataAttacher([this](grpc::ClientContext *context) {
+        d_metadataGenerator.attach_request_metadata(context);
+    });
+
+    if (!retrier.issueRequest() || !retrier.status().ok()) {
+        throwGrpcErrorException(retrier.status());
+    }
+}
+
+} // namespace buildboxcommon
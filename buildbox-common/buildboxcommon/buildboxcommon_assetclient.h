@@ -0,0 +1,165 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDED_BUILDBOXCOMMON_ASSETCLIENT
+#define INCLUDED_BUILDBOXCOMMON_ASSETCLIENT
+
+#include <buildboxcommon_cashash.h>
+#include <buildboxcommon_connectionoptions.h>
+#include <buildboxcommon_grpcretrier.h>
+#include <buildboxcommon_protos.h>
+#include <buildboxcommon_requestmetadata.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace buildboxcommon {
+
+class AssetClient final {
+    /*
+     * Resolves and publishes assets with the Remote Asset API `Fetch` and
+     * `Push` services, retrying requests that fail with transient errors.
+     *
+     * The digests that URIs and qualifiers resolve to are memoized, until
+     * they expire if the server said so, and answer later fetches of any of
+     * those URIs with the same qualifiers without a request. If a memo path
+     * is given, the memo is loaded from and appended to that file, so that
+     * it survives the process. Loading it drops the expired and superseded
+     * lines from the file, which keeps it from growing across runs.
+     *
+     * It is safe to use from multiple threads.
+     */
+  public:
+    // Counters recorded with buildboxcommonmetrics by the fetch methods.
+    static const std::string s_memoHitsMetricName;
+    static const std::string s_memoMissesMetricName;
+
+    explicit AssetClient(const ConnectionOptions &connectionOptions,
+                         const std::string &memoPath = "");
+
+    // Constructor method for unit testing (allows mocking the Fetch and
+    // Push clients.)
+    AssetClient(std::shared_ptr<Fetch::StubInterface> fetchClient,
+                std::shared_ptr<Push::StubInterface> pushClient,
+                const std::string &instanceName, int grpcRetryLimit,
+                int grpcRetryDelay, const std::string &memoPath = "");
+
+    AssetClient(const AssetClient &) = delete;
+    AssetClient &operator=(const AssetClient &) = delete;
+
+    // Issue a `FetchBlob()` request for the given URIs and qualifiers, and
+    // return the response. If one of the URIs was memoized with the same
+    // qualifiers, return a response built from the memo instead.
+    //
+    // On errors, including those reported in the `status` of the
+    // response, throws `GrpcError`.
+    FetchBlobResponse fetchBlob(const std::vector<std::string> &uris,
+                                const std::vector<Qualifier> &qualifiers =
+                                    std::vector<Qualifier>());
+
+    // Same as `fetchBlob()`, for a Directory tree.
+    FetchDirectoryResponse
+    fetchDirectory(const std::vector<std::string> &uris,
+                   const std::vector<Qualifier> &qualifiers =
+                       std::vector<Qualifier>());
+
+    // Issue a `PushBlob()` request associating the URIs and qualifiers with
+    // the blob, and memoize it.
+    //
+    // On errors throws `GrpcError`.
+    void pushBlob(const std::vector<std::string> &uris,
+                  const std::vector<Qualifier> &qualifiers,
+                  const Digest &blobDigest);
+
+    // Same as `pushBlob()`, for a Directory tree.
+    void pushDirectory(const std::vector<std::string> &uris,
+                       const std::vector<Qualifier> &qualifiers,
+                       const Digest &rootDirectoryDigest);
+
+    void set_tool_details(const std::string &tool_name,
+                          const std::string &tool_version);
+
+    // Set the optional ID values to be attached to requests.
+    void set_request_metadata(const std::string &action_id,
+                              const std::string &tool_invocation_id,
+                              const std::string &correlated_invocations_id);
+
+    size_t memoSize() const;
+
+    enum class AssetType { Blob, Directory };
+
+    // Return the key an asset is memoized under: the hash of the remote URL
+    // and instance name it was resolved by, and of its type, URI and
+    // qualifiers, in hexadecimal and computed with `digestFunction`. Clients
+    // of different remotes or instances can thus share a memo file.
+    static std::string
+    memoKey(const std::string &remoteUrl, const std::string &instanceName,
+            AssetType type, const std::string &uri,
+            const std::vector<Qualifier> &qualifiers,
+            DigestFunction_Value digestFunction = CASHash::digestFunction());
+
+  private:
+
+    struct MemoEntry {
+        Digest d_digest;
+        // Seconds since the epoch, or 0 if the entry does not expire.
+        int64_t d_expiresAt;
+    };
+
+    std::shared_ptr<Fetch::StubInterface> d_fetchClient;
+    std::shared_ptr<Push::StubInterface> d_pushClient;
+    const std::string d_instanceName;
+    // Empty for clients built from stubs.
+    std::string d_remoteUrl;
+    const unsigned int d_grpcRetryLimit;
+    const std::chrono::milliseconds d_grpcRetryDelay;
+
+    RequestMetadataGenerator d_metadataGenerator;
+
+    // Keyed by `memoKey()`.
+    mutable std::mutex d_memoMutex;
+    std::unordered_map<std::string, MemoEntry> d_memo;
+    const std::string d_memoPath;
+
+    // Return whether one of `uris` is memoized and, if so, write it to
+    // `uri` and its digest to `digest`.
+    bool lookUpMemo(AssetType type, const std::vector<std::string> &uris,
+                    const std::vector<Qualifier> &qualifiers, std::string *uri,
+                    Digest *digest);
+
+    void memoize(AssetType type, const std::vector<std::string> &uris,
+                 const std::vector<Qualifier> &qualifiers,
+                 const Digest &digest, int64_t expiresAt);
+
+    // Load the memo file, then rewrite it without its expired and
+    // superseded lines if there are any.
+    void loadMemo();
+
+    static std::string memoLine(const std::string &key,
+                                const MemoEntry &entry);
+
+    void issueRequest(const GrpcRetrier::GrpcInvocation &invocation,
+                      const std::string &invocationName);
+};
+
+} // namespace buildboxcommon
+
+#endif
@@ -18,8 +18,13 @@
 
 #include <buildboxcommon_exception.h>
 #include <buildboxcommon_logging.h>
+#include <buildboxcommon_threadpool.h>
 
+#include <algorithm>
+#include <cstring>
 #include <fcntl.h>
+#include <mutex>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -28,6 +33,28 @@ namespace buildboxcommon {
 
 const size_t DigestGenerator::HASH_BUFFER_SIZE_BYTES = (1024 * 64);
 
+const size_t DigestGenerator::DEFAULT_PARALLEL_HASHING_THRESHOLD_BYTES =
+    (1024 * 1024 * 4);
+
+namespace {
+// Process-wide parallel hashing configuration, see
+// `DigestGenerator::setParallelHashing()`.
+std::mutex s_parallelHashingMutex;
+std::shared_ptr<ThreadPool> s_parallelHashingPool;
+size_t s_parallelHashingThresholdBytes = 0;
+
+// Adapts `ThreadPool::parallelFor()` to the callback used by BLAKE3.
+void blake3ParallelFor(void *context, size_t count,
+                       void (*task)(void *task_context, size_t index),
+                       void *task_context)
+{
+    static_cast<ThreadPool *>(context)->parallelFor(
+        count, [task, task_context](size_t index) {
+            task(task_context, index);
+        });
+}
+} // namespace
+
 const std::set<DigestFunction_Value>
     DigestGenerator::s_supportedDigestFunctions = {
         DigestFunction_Value_MD5, DigestFunction_Value_SHA1,
@@ -105,7 +132,14 @@ Digest DigestGenerator::hash(int fd) const
                                                    size_t data_size) {
         digest_context.update(buffer, data_size);
     };
-    processFile(fd, update_function);
+
+    // Parallel hashing needs large updates to split, so in that case hand
+    // over the whole file at once.
+    if (!digest_context.d_parallelPool ||
+        !processMappedFile(fd, digest_context.d_parallelThresholdBytes,
+                           update_function)) {
+        processFile(fd, update_function);
+    }
 
     // Generating hash string:
     return digest_context.finalizeDigest();
@@ -145,6 +179,12 @@ void DigestContext::update(const char *data, size_t data_size)
     if (d_context) {
       throwIfNotSuccessful(EVP_DigestUpdate(d_context, data, data_size),
           "EVP_DigestUpdate()");
+    } else if (d_parallelPool && data_size >= d_parallelThresholdBytes) {
+      // Split into a few parts per thread so that uneven progress between
+      // threads evens out.
+      blake3_hasher_update_parallel(&b, data, data_size,
+                                    4 * (d_parallelPool->size() + 1),
+                                    blake3ParallelFor, d_parallelPool.get());
     } else {
       blake3_hasher_update(&b, data, data_size);
     }
@@ -213,6 +253,40 @@ DigestGenerator::processFile(int fd,
     return total_bytes_read;
 }
 
+bool DigestGenerator::processMappedFile(
+    int fd, size_t minimumSize,
+    const IncrementalUpdateFunction &update_function)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        static_cast<size_t>(st.st_size) < minimumSize ||
+        st.st_size <= 0) {
+        return false;
+    }
+
+    const size_t size = static_cast<size_t>(st.st_size);
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        BUILDBOX_LOG_DEBUG("mmap() failed for file descriptor "
+                           << fd << ", falling back to read(): "
+                           << strerror(errno));
+        return false;
+    }
+    // The parts of the file are hashed concurrently, so let the kernel read
+    // ahead of all of them.
+    madvise(data, size, MADV_WILLNEED);
+
+    try {
+        update_function(static_cast<const char *>(data), size);
+    }
+    catch (...) {
+        munmap(data, size);
+        throw;
+    }
+    munmap(data, size);
+    return true;
+}
+
 void DigestContext::throwIfNotSuccessful(int status_code,
                                          const std::string &function_name)
 {
@@ -228,9 +302,32 @@ DigestContext DigestGenerator::createDigestContext() const
 {
     DigestContext context;
     context.init(d_digestFunctionStruct);
+
+    if (d_digestFunction == DigestFunction_Value_BLAKE3ZCC) {
+        const std::lock_guard<std::mutex> lock(s_parallelHashingMutex);
+        context.d_parallelPool = s_parallelHashingPool;
+        context.d_parallelThresholdBytes = s_parallelHashingThresholdBytes;
+    }
     return context;
 }
 
+void DigestGenerator::setParallelHashing(size_t numThreads,
+                                         size_t thresholdBytes)
+{
+    // The calling thread takes part in the hashing, so the pool only needs
+    // the remaining threads.
+    std::shared_ptr<ThreadPool> pool;
+    if (numThreads > 1) {
+        pool = std::make_shared<ThreadPool>(numThreads - 1);
+    }
+
+    const std::lock_guard<std::mutex> lock(s_parallelHashingMutex);
+    // Contexts that are still in use keep the previous pool alive.
+    s_parallelHashingPool = pool;
+    s_parallelHashingThresholdBytes =
+        std::max<size_t>(thresholdBytes, 2 * BLAKE3_PARALLEL_MIN_PART_LEN);
+}
+
 DigestContext::DigestContext()
 {
     d_context = EVP_MD_CTX_create();
@@ -21,6 +21,7 @@
 #include <buildboxcommon_protos.h>
 
 #include <iomanip>
+#include <memory>
 #include <openssl/evp.h>
 #include <set>
 
@@ -30,6 +31,7 @@
 namespace buildboxcommon {
 
 class DigestGenerator;
+class ThreadPool;
 
 class CASHash {
   public:
@@ -80,6 +82,11 @@ class DigestContext {
     bool d_finalized = false;
     blake3_hasher b;
 
+    // When set, BLAKE3ZCC updates of at least `d_parallelThresholdBytes`
+    // are spread across this pool.
+    std::shared_ptr<ThreadPool> d_parallelPool;
+    size_t d_parallelThresholdBytes = 0;
+
     // Create and initialize an OpenSSL digest context to be used during a
     // call to `hash_other()`.
     DigestContext();
@@ -130,6 +137,20 @@ class DigestGenerator {
 
     DigestContext createDigestContext() const;
 
+    /**
+     * Hash BLAKE3ZCC inputs of at least `thresholdBytes` using up to
+     * `numThreads` threads. This applies process-wide to the contexts
+     * created afterwards, and a `numThreads` value smaller than 2 disables
+     * it (the default). Digests do not depend on this setting.
+     *
+     * Other digest functions are inherently sequential and not affected.
+     */
+    static void setParallelHashing(
+        size_t numThreads,
+        size_t thresholdBytes = DEFAULT_PARALLEL_HASHING_THRESHOLD_BYTES);
+
+    static const size_t DEFAULT_PARALLEL_HASHING_THRESHOLD_BYTES;
+
   private:
     const DigestFunction_Value d_digestFunction;
     const EVP_MD *d_digestFunctionStruct;
@@ -149,11 +170,19 @@ class DigestGenerator {
 
     // Helper to read a file in chunks and for each of them invoke an
     // update function.
-    typedef std::function<void(char *, size_t)> IncrementalUpdateFunction;
+    typedef std::function<void(const char *, size_t)>
+        IncrementalUpdateFunction;
 
     // Read a file in chunks and calculate its hash incrementally.
     static size_t
     processFile(int fd, const IncrementalUpdateFunction &update_function);
+
+    // If `fd` is a regular file of at least `minimumSize` bytes, map it
+    // into memory and pass its whole contents to `update_function` at once,
+    // returning true. Otherwise return false without reading anything.
+    static bool processMappedFile(
+        int fd, size_t minimumSize,
+        const IncrementalUpdateFunction &update_function);
 };
 
 } // namespace buildboxcommon
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_channelregistry.h>
+
+#include <buildboxcommon_logging.h>
+
+namespace buildboxcommon {
+
+namespace {
+// Unset options are distinguished from empty ones.
+void appendField(std::string *key, const char *value)
+{
+    if (value == nullptr) {
+        key->push_back('\0');
+    }
+    else {
+        key->push_back('\1');
+        key->append(value);
+    }
+    key->push_back('\0');
+}
+} // namespace
+
+std::mutex ChannelRegistry::s_mutex;
+std::map<std::string, std::weak_ptr<grpc::Channel>>
+    ChannelRegistry::s_channels;
+
+std::shared_ptr<grpc::Channel>
+ChannelRegistry::channel(const ConnectionOptions &options)
+{
+    const std::string channelKey = key(options);
+
+    const std::lock_guard<std::mutex> lock(s_mutex);
+    const auto it = s_channels.find(channelKey);
+    if (it != s_channels.end()) {
+        std::shared_ptr<grpc::Channel> channel = it->second.lock();
+        if (channel) {
+            BUILDBOX_LOG_DEBUG("Reusing grpc channel to [" << options.d_url
+                                                            << "]");
+            return channel;
+        }
+    }
+
+    // Dropping the entries of the channels that were closed since:
+    for (auto entry = s_channels.begin(); entry != s_channels.end();) {
+        if (entry->second.expired()) {
+            entry = s_channels.erase(entry);
+        }
+        else {
+            ++entry;
+        }
+    }
+
+    const std::shared_ptr<grpc::Channel> channel = options.createChannel();
+    s_channels[channelKey] = channel;
+    return channel;
+}
+
+std::vector<std::shared_ptr<grpc::Channel>>
+ChannelRegistry::channels(const ConnectionOptions &options)
+{
+    if (options.d_channelCount == nullptr ||
+        std::stoi(options.d_channelCount) == 1) {
+        return {channel(options)};
+    }
+    return options.createChannels();
+}
+
+size_t ChannelRegistry::size()
+{
+    const std::lock_guard<std::mutex> lock(s_mutex);
+    size_t count = 0;
+    for (const auto &entry : s_channels) {
+        if (!entry.second.expired()) {
+            count++;
+        }
+    }
+    return count;
+}
+
+std::string ChannelRegistry::key(const ConnectionOptions &options)
+{
+    std::string key;
+    appendField(&key, options.d_url);
+    appendField(&key, options.d_serverCert);
+    appendField(&key, options.d_serverCertPath);
+    appendField(&key, options.d_clientKey);
+    appendField(&key, options.d_clientKeyPath);
+    appendField(&key, options.d_clientCert);
+    appendField(&key, options.d_clientCertPath);
+    appendField(&key, options.d_accessTokenPath);
+    appendField(&key, options.d_tokenReloadInterval);
+    appendField(&key, options.d_loadBalancingPolicy);
+    appendField(&key, options.d_useGoogleApiAuth ? "" : nullptr);
+    return key;
+}
+
+} // namespace buildboxcommon
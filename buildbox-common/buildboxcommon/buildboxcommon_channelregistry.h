@@ -0,0 +1,70 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDED_BUILDBOXCOMMON_CHANNELREGISTRY
+#define INCLUDED_BUILDBOXCOMMON_CHANNELREGISTRY
+
+#include <buildboxcommon_connectionoptions.h>
+
+#include <grpcpp/channel.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace buildboxcommon {
+
+class ChannelRegistry {
+    /*
+     * Shares gRPC channels across the process, so that the clients of one
+     * server use a single connection to it and only pay for its TLS
+     * handshake once.
+     *
+     * Options are equivalent if they lead to the same channel: the same URL,
+     * credentials, token reload interval and load balancing policy. The
+     * instance name and retry settings do not matter.
+     *
+     * The registry only keeps weak references: a channel is closed as soon
+     * as the last of its users releases it, and the next request for it
+     * opens a new one.
+     */
+  public:
+    // Return the channel for the options, creating it if no equivalent
+    // channel is in use. Throws like `ConnectionOptions::createChannel()`.
+    static std::shared_ptr<grpc::Channel>
+    channel(const ConnectionOptions &options);
+
+    // Same as `ConnectionOptions::createChannels()`, except that a single
+    // channel is taken from the registry. Several channels are always new,
+    // since they are meant to use separate connections.
+    static std::vector<std::shared_ptr<grpc::Channel>>
+    channels(const ConnectionOptions &options);
+
+    // Number of channels that are currently in use.
+    static size_t size();
+
+  private:
+    static std::string key(const ConnectionOptions &options);
+
+    static std::mutex s_mutex;
+    static std::map<std::string, std::weak_ptr<grpc::Channel>> s_channels;
+};
+
+} // namespace buildboxcommon
+
+#endif
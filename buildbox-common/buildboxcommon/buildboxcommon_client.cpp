@@ -15,23 +15,36 @@
  */
 
 #include <buildboxcommon_client.h>
+#include <buildboxcommon_channelregistry.h>
+#include <buildboxcommon_completionqueuerunner.h>
+#include <buildboxcommon_compression.h>
 #include <buildboxcommon_exception.h>
 #include <buildboxcommon_fileutils.h>
 #include <buildboxcommon_grpcretry.h>
 #include <buildboxcommon_logging.h>
 #include <buildboxcommon_mergeutil.h>
+#include <buildboxcommonmetrics_countingmetricutil.h>
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <errno.h>
 #include <fcntl.h>
+#include <exception>
 #include <fstream>
+#include <future>
+#include <google/protobuf/io/coded_stream.h>
 #include <grpc/grpc.h>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_set>
 #include <uuid/uuid.h>
 
 namespace {
@@ -42,35 +55,520 @@ void throwGrpcErrorException(const grpc::Status &errorStatus)
                                     errorStatus);
 }
 
+// Number of chunks that `Client::upload(int fd, ...)` reads ahead of the
+// ones being sent.
+const size_t UPLOAD_READ_AHEAD_CHUNKS = 3;
+
+// Reads the bytes in [`offset`, `size`) of a file in chunks on a background
+// thread, keeping up to `maxReadyChunks` of them ready for the consumer.
+// Buffers are handed over by swapping, so the data is never copied.
+class ReadAheadFileReader {
+  public:
+    ReadAheadFileReader(int fd, size_t offset, size_t size, size_t chunkSize,
+                        size_t maxReadyChunks)
+        : d_fd(fd), d_offset(offset), d_size(size), d_chunkSize(chunkSize),
+          d_maxReadyChunks(maxReadyChunks)
+    {
+        d_thread = std::thread(&ReadAheadFileReader::run, this);
+    }
+
+    ~ReadAheadFileReader()
+    {
+        {
+            const std::lock_guard<std::mutex> lock(d_mutex);
+            d_stopping = true;
+        }
+        d_condition.notify_all();
+        d_thread.join();
+    }
+
+    ReadAheadFileReader(const ReadAheadFileReader &) = delete;
+    ReadAheadFileReader &operator=(const ReadAheadFileReader &) = delete;
+
+    // Swap the next chunk into `data`, whose previous contents are recycled
+    // as a buffer. Return false if the file ended before `size` bytes were
+    // read, and throw `std::system_error` if reading failed.
+    bool next(std::string *data)
+    {
+        std::unique_lock<std::mutex> lock(d_mutex);
+        d_condition.wait(lock, [this]() {
+            return !d_ready.empty() || d_finished;
+        });
+        if (d_ready.empty()) {
+            if (d_readErrno != 0) {
+                BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                    std::system_error, d_readErrno, std::generic_category,
+                    "Error in read on descriptor " << d_fd);
+            }
+            return false;
+        }
+
+        data->swap(d_ready.front());
+        d_free.push_back(std::move(d_ready.front()));
+        d_ready.pop_front();
+        lock.unlock();
+        d_condition.notify_all();
+        return true;
+    }
+
+  private:
+    void run()
+    {
+        const off_t start = static_cast<off_t>(d_offset);
+        if (lseek(d_fd, start, SEEK_SET) != start &&
+            (errno != ESPIPE || d_offset != 0)) {
+            finish(errno);
+            return;
+        }
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(d_fd, start, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        size_t offset = d_offset;
+        while (offset < d_size) {
+            std::string buffer;
+            {
+                std::unique_lock<std::mutex> lock(d_mutex);
+                d_condition.wait(lock, [this]() {
+                    return d_ready.size() < d_maxReadyChunks || d_stopping;
+                });
+                if (d_stopping) {
+                    return;
+                }
+                if (!d_free.empty()) {
+                    buffer = std::move(d_free.back());
+                    d_free.pop_back();
+                }
+            }
+
+            buffer.resize(std::min(d_chunkSize, d_size - offset));
+            size_t filled = 0;
+            while (filled < buffer.size()) {
+                const ssize_t bytesRead =
+                    read(d_fd, &buffer[filled], buffer.size() - filled);
+                if (bytesRead < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (bytesRead < 0) {
+                    finish(errno);
+                    return;
+                }
+                if (bytesRead == 0) {
+                    break;
+                }
+                filled += static_cast<size_t>(bytesRead);
+            }
+            if (filled == 0) {
+                break;
+            }
+            buffer.resize(filled);
+            offset += filled;
+
+            {
+                const std::lock_guard<std::mutex> lock(d_mutex);
+                d_ready.push_back(std::move(buffer));
+            }
+            d_condition.notify_all();
+        }
+        finish(0);
+    }
+
+    void finish(int readErrno)
+    {
+        {
+            const std::lock_guard<std::mutex> lock(d_mutex);
+            d_finished = true;
+            d_readErrno = readErrno;
+        }
+        d_condition.notify_all();
+    }
+
+    const int d_fd;
+    const size_t d_offset;
+    const size_t d_size;
+    const size_t d_chunkSize;
+    const size_t d_maxReadyChunks;
+
+    std::mutex d_mutex;
+    std::condition_variable d_condition;
+    std::deque<std::string> d_ready;
+    std::vector<std::string> d_free;
+    bool d_finished = false;
+    bool d_stopping = false;
+    int d_readErrno = 0;
+
+    std::thread d_thread;
+};
+
 } // namespace
 
 namespace buildboxcommon {
 
+namespace {
+std::exception_ptr grpcErrorExceptionPtr(const grpc::Status &errorStatus)
+{
+    try {
+        throwGrpcErrorException(errorStatus);
+    }
+    catch (...) {
+        return std::current_exception();
+    }
+    return nullptr;
+}
+
+// Downloads a blob with `ByteStream.Read()` on a completion queue. Like
+// `Client::fetchString()`, it decompresses the data as it arrives and
+// verifies it against the digest.
+class AsyncByteStreamRead final : public AsyncGrpcCall {
+  public:
+    // Invoked with the blob, or with the exception that made it fail.
+    typedef std::function<void(std::exception_ptr error, std::string *data)>
+        Callback;
+
+    AsyncByteStreamRead(CompletionQueueRunner *runner,
+                        const GrpcRetrier &retrier,
+                        ByteStream::StubInterface *stub,
+                        const std::string &resourceName,
+                        Compressor::Value compressor, const Digest &digest,
+                        const DigestGenerator *digestGenerator,
+                        const Callback &callback)
+        : AsyncGrpcCall(runner, retrier), d_stub(stub),
+          d_resourceName(resourceName), d_compressor(compressor),
+          d_digest(digest), d_digestGenerator(digestGenerator),
+          d_callback(callback)
+    {
+    }
+
+  protected:
+    void startAttempt(grpc::ClientContext *context,
+                      grpc::CompletionQueue *queue) override
+    {
+        const size_t expected_size =
+            static_cast<size_t>(d_digest.size_bytes());
+        d_data.clear();
+        d_bytesReceived = 0;
+        d_decompressionError.clear();
+        d_decompressor.reset();
+        if (d_compressor != Compressor::IDENTITY) {
+            d_decompressor =
+                Compression::makeDecompressor(d_compressor, expected_size);
+            d_data.reserve(expected_size);
+        }
+
+        ReadRequest request;
+        request.set_resource_name(d_resourceName);
+        request.set_read_offset(0);
+
+        d_context = context;
+        d_state = State::STARTING;
+        d_reader = d_stub->PrepareAsyncRead(context, request, queue);
+        d_reader->StartCall(this);
+    }
+
+    bool handleEvent(bool ok, grpc::Status *status) override
+    {
+        switch (d_state) {
+            case State::READING:
+                if (ok) {
+                    processChunk();
+                }
+                // fall through
+            case State::STARTING:
+                if (ok && d_decompressionError.empty()) {
+                    d_state = State::READING;
+                    d_reader->Read(&d_response, this);
+                }
+                else {
+                    d_state = State::FINISHING;
+                    d_reader->Finish(&d_status, this);
+                }
+                return false;
+            case State::FINISHING:
+                break;
+        }
+
+        if (d_decompressor && d_decompressionError.empty() && d_status.ok()) {
+            try {
+                d_decompressor->process(nullptr, 0, true, &d_data);
+            }
+            catch (const std::runtime_error &e) {
+                d_decompressionError = e.what();
+            }
+            d_bytesReceived = d_data.size();
+        }
+        if (!d_decompressionError.empty()) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(std::runtime_error,
+                                           "Could not decompress "
+                                               << d_resourceName << ": "
+                                               << d_decompressionError);
+        }
+
+        if (d_status.ok()) {
+            const auto bytes_downloaded =
+                static_cast<google::protobuf::int64>(d_bytesReceived);
+            if (bytes_downloaded != d_digest.size_bytes()) {
+                BUILDBOXCOMMON_THROW_EXCEPTION(
+                    std::runtime_error,
+                    "Expected " << d_digest.size_bytes()
+                                << " bytes, but downloaded blob was "
+                                << bytes_downloaded << " bytes");
+            }
+
+            if (d_digestGenerator != nullptr) {
+                const auto downloaded_digest = d_digestGenerator->hash(d_data);
+                if (downloaded_digest != d_digest) {
+                    BUILDBOXCOMMON_THROW_EXCEPTION(
+                        std::runtime_error,
+                        "Expected blob with digest "
+                            << d_digest << ", but downloaded blob has digest "
+                            << downloaded_digest);
+                }
+            }
+        }
+
+        *status = d_status;
+        return true;
+    }
+
+    void onDone(const grpc::Status &status, std::exception_ptr error) override
+    {
+        if (!error && !status.ok()) {
+            error = grpcErrorExceptionPtr(status);
+        }
+        d_callback(error, error ? nullptr : &d_data);
+    }
+
+  private:
+    enum class State { STARTING, READING, FINISHING };
+
+    ByteStream::StubInterface *d_stub;
+    const std::string d_resourceName;
+    const Compressor::Value d_compressor;
+    const Digest d_digest;
+    // Null if the data is not to be verified.
+    const DigestGenerator *d_digestGenerator;
+    const Callback d_callback;
+
+    grpc::ClientContext *d_context = nullptr;
+    std::unique_ptr<grpc::ClientAsyncReaderInterface<ReadResponse>> d_reader;
+    State d_state = State::STARTING;
+    ReadResponse d_response;
+    grpc::Status d_status;
+
+    std::string d_data;
+    size_t d_bytesReceived = 0;
+    std::unique_ptr<CompressionStream> d_decompressor;
+    std::string d_decompressionError;
+
+    void processChunk()
+    {
+        std::string *chunk = d_response.mutable_data();
+        const size_t chunk_size = chunk->size();
+        const size_t expected_size =
+            static_cast<size_t>(d_digest.size_bytes());
+        if (d_decompressor) {
+            try {
+                d_decompressor->process(chunk->data(), chunk_size, false,
+                                        &d_data);
+            }
+            catch (const std::runtime_error &e) {
+                d_decompressionError = e.what();
+                d_context->TryCancel();
+            }
+        }
+        else if (d_bytesReceived == 0 && chunk_size >= expected_size) {
+            d_data.swap(*chunk);
+        }
+        else if (d_bytesReceived + chunk_size <= expected_size) {
+            if (d_data.capacity() < expected_size) {
+                d_data.reserve(expected_size);
+            }
+            d_data.append(*chunk);
+        }
+        d_bytesReceived += chunk_size;
+    }
+};
+
+// Uploads a blob with `ByteStream.Write()` on a completion queue. `payload`
+// holds the bytes to send, which for a "compressed-blobs" resource are the
+// compressed ones. Every attempt starts from the beginning of the blob.
+class AsyncByteStreamWrite final : public AsyncGrpcCall {
+  public:
+    // Invoked with the exception that made the upload fail, if any.
+    typedef std::function<void(std::exception_ptr error)> Callback;
+
+    AsyncByteStreamWrite(CompletionQueueRunner *runner,
+                         const GrpcRetrier &retrier,
+                         ByteStream::StubInterface *stub,
+                         const std::string &resourceName,
+                         const std::shared_ptr<const std::string> &payload,
+                         bool compressed, const Digest &digest,
+                         size_t chunkSize, const Callback &callback)
+        : AsyncGrpcCall(runner, retrier), d_stub(stub),
+          d_resourceName(resourceName), d_payload(payload),
+          d_compressed(compressed), d_digest(digest), d_chunkSize(chunkSize),
+          d_callback(callback)
+    {
+    }
+
+  protected:
+    void startAttempt(grpc::ClientContext *context,
+                      grpc::CompletionQueue *queue) override
+    {
+        d_offset = 0;
+        d_lastChunkSent = false;
+        d_response.Clear();
+        d_state = State::STARTING;
+        d_writer = d_stub->PrepareAsyncWrite(context, &d_response, queue);
+        d_writer->StartCall(this);
+    }
+
+    bool handleEvent(bool ok, grpc::Status *status) override
+    {
+        switch (d_state) {
+            case State::STARTING:
+            case State::WRITING:
+                if (ok && !d_lastChunkSent) {
+                    writeNextChunk();
+                }
+                else if (ok) {
+                    d_state = State::WRITES_DONE;
+                    d_writer->WritesDone(this);
+                }
+                else {
+                    // The server closed the stream, possibly because it
+                    // already has the blob. `Finish()` tells.
+                    finishStream();
+                }
+                return false;
+            case State::WRITES_DONE:
+                finishStream();
+                return false;
+            case State::FINISHING:
+                break;
+        }
+
+        if (d_status.ok()) {
+            const auto committed_size = d_response.committed_size();
+            const bool valid_size =
+                committed_size == d_digest.size_bytes() ||
+                (d_compressed &&
+                 (committed_size == -1 ||
+                  committed_size ==
+                      static_cast<google::protobuf::int64>(d_offset)));
+            if (!valid_size) {
+                BUILDBOXCOMMON_THROW_EXCEPTION(
+                    std::runtime_error,
+                    "Expected to upload "
+                        << d_digest.size_bytes() << " bytes for "
+                        << d_digest.hash_other() << ", but server reports "
+                        << committed_size << " bytes committed");
+            }
+        }
+
+        *status = d_status;
+        return true;
+    }
+
+    void onDone(const grpc::Status &status, std::exception_ptr error) override
+    {
+        if (!error && !status.ok()) {
+            error = grpcErrorExceptionPtr(status);
+        }
+        d_callback(error);
+    }
+
+  private:
+    enum class State { STARTING, WRITING, WRITES_DONE, FINISHING };
+
+    ByteStream::StubInterface *d_stub;
+    const std::string d_resourceName;
+    const std::shared_ptr<const std::string> d_payload;
+    const bool d_compressed;
+    const Digest d_digest;
+    const size_t d_chunkSize;
+    const Callback d_callback;
+
+    std::unique_ptr<grpc::ClientAsyncWriterInterface<WriteRequest>> d_writer;
+    State d_state = State::STARTING;
+    WriteRequest d_request;
+    WriteResponse d_response;
+    grpc::Status d_status;
+
+    size_t d_offset = 0;
+    bool d_lastChunkSent = false;
+
+    void writeNextChunk()
+    {
+        const size_t length =
+            std::min(d_chunkSize, d_payload->size() - d_offset);
+
+        d_request.Clear();
+        d_request.set_resource_name(d_resourceName);
+        d_request.set_write_offset(
+            static_cast<google::protobuf::int64>(d_offset));
+        d_request.set_data(d_payload->data() + d_offset, length);
+        d_offset += length;
+
+        d_lastChunkSent = (d_offset == d_payload->size());
+        if (d_lastChunkSent) {
+            d_request.set_finish_write(true);
+        }
+
+        d_state = State::WRITING;
+        d_writer->Write(d_request, this);
+    }
+
+    void finishStream()
+    {
+        d_state = State::FINISHING;
+        d_writer->Finish(&d_status, this);
+    }
+};
+} // namespace
+
 const size_t Client::s_bytestreamChunkSizeBytes = 1024 * 1024;
 // The default limit for gRPC messages is 4 MiB.
 // Limit payload to 1 MiB to leave sufficient headroom for metadata.
 
+const std::string Client::s_bytesVerifiedMetricName =
+    "cas_download_bytes_verified";
+const std::string Client::s_bytesNotVerifiedMetricName =
+    "cas_download_bytes_not_verified";
+
 void Client::init(const ConnectionOptions &options)
 {
-    std::shared_ptr<grpc::Channel> channel = options.createChannel();
+    std::vector<std::shared_ptr<grpc::Channel>> channels =
+        ChannelRegistry::channels(options);
     this->d_grpcRetryLimit = std::stoi(options.d_retryLimit);
     this->d_grpcRetryDelay = std::stoi(options.d_retryDelay);
-    this->d_channel = channel;
+    this->d_verifyDownloads = !options.d_trustedEndpoint;
+    this->d_channels = channels;
 
     if (options.d_instanceName != nullptr) {
         this->d_instanceName = std::string(options.d_instanceName);
     }
 
-    std::shared_ptr<ByteStream::Stub> bytestreamClient =
-        ByteStream::NewStub(this->d_channel);
-    std::shared_ptr<ContentAddressableStorage::Stub> casClient =
-        ContentAddressableStorage::NewStub(this->d_channel);
+    // ByteStream and CAS requests are spread over all the channels, the
+    // rest only use the first one.
+    std::vector<std::shared_ptr<ByteStream::StubInterface>> bytestreamClients;
+    std::vector<std::shared_ptr<ContentAddressableStorage::StubInterface>>
+        casClients;
+    for (const auto &channel : this->d_channels) {
+        bytestreamClients.push_back(ByteStream::NewStub(channel));
+        casClients.push_back(ContentAddressableStorage::NewStub(channel));
+    }
+
     std::shared_ptr<Capabilities::Stub> capabilitiesClient =
-        Capabilities::NewStub(this->d_channel);
+        Capabilities::NewStub(this->d_channels.front());
     std::shared_ptr<LocalContentAddressableStorage::StubInterface>
         localCasClient =
-            LocalContentAddressableStorage::NewStub(this->d_channel);
-    init(bytestreamClient, casClient, localCasClient, capabilitiesClient);
+            LocalContentAddressableStorage::NewStub(this->d_channels.front());
+    init(bytestreamClients.front(), casClients.front(), localCasClient,
+         capabilitiesClient);
+
+    this->d_bytestreamClients = bytestreamClients;
+    this->d_casClients = casClients;
 }
 
 void Client::init(
@@ -84,6 +582,8 @@ void Client::init(
     this->d_casClient = casClient;
     this->d_localCasClient = localCasClient;
     this->d_capabilitiesClient = capabilitiesClient;
+    this->d_bytestreamClients.clear();
+    this->d_casClients.clear();
 
     // Somewhat arbitrary value used as an estimate for
     // the space consumed by gRPC class metadata
@@ -107,6 +607,19 @@ void Client::init(
         auto status = this->d_capabilitiesClient->GetCapabilities(
             &context, request, &response);
         if (status.ok()) {
+            const CacheCapabilities &cache = response.cache_capabilities();
+            this->d_serverCompressors.clear();
+            for (const int compressor : cache.supported_compressors()) {
+                this->d_serverCompressors.push_back(
+                    static_cast<Compressor::Value>(compressor));
+            }
+            this->d_serverBatchUpdateCompressors.clear();
+            for (const int compressor :
+                 cache.supported_batch_update_compressors()) {
+                this->d_serverBatchUpdateCompressors.push_back(
+                    static_cast<Compressor::Value>(compressor));
+            }
+
             const size_t serverMaxBatchTotalSizeBytes =
                 response.cache_capabilities().max_batch_total_size_bytes();
             // 0 means no server limit
@@ -146,6 +659,23 @@ void Client::init(
 
 std::string Client::instanceName() const { return d_instanceName; }
 
+ByteStream::StubInterface *Client::nextByteStreamClient()
+{
+    if (d_bytestreamClients.empty()) {
+        return d_bytestreamClient.get();
+    }
+    return d_bytestreamClients[d_nextChannel++ % d_bytestreamClients.size()]
+        .get();
+}
+
+ContentAddressableStorage::StubInterface *Client::nextCasClient()
+{
+    if (d_casClients.empty()) {
+        return d_casClient.get();
+    }
+    return d_casClients[d_nextChannel++ % d_casClients.size()].get();
+}
+
 void Client::setInstanceName(const std::string &instance_name)
 {
     d_instanceName = instance_name;
@@ -172,7 +702,141 @@ void Client::set_request_metadata(const std::string &action_id,
         correlated_invocations_id);
 }
 
-std::string Client::makeResourceName(const Digest &digest, bool isUpload)
+void Client::setDirectoryCapturePool(const std::shared_ptr<ThreadPool> &pool)
+{
+    d_directoryCapturePool = pool;
+}
+
+void Client::setUploadMemoryLimit(size_t limitBytes)
+{
+    d_uploadMemoryLimitBytes = limitBytes;
+}
+
+void Client::setTransferConcurrency(size_t maxBatchRequests,
+                                    size_t maxByteStreamTransfers)
+{
+    if (maxBatchRequests == 0 || maxByteStreamTransfers == 0) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(
+            std::invalid_argument,
+            "The transfer concurrency must be at least 1, got "
+                << maxBatchRequests << " batch requests and "
+                << maxByteStreamTransfers << " ByteStream transfers");
+    }
+
+    d_maxConcurrentBatchRequests = maxBatchRequests;
+    d_maxConcurrentByteStreamTransfers = maxByteStreamTransfers;
+
+    // The calling thread handles one of the batch requests, so that is one
+    // worker fewer than the number of transfers that can be in flight.
+    const size_t workers = maxBatchRequests + maxByteStreamTransfers - 1;
+    if (workers > 1) {
+        d_transferPool = std::make_shared<ThreadPool>(workers);
+    }
+    else {
+        d_transferPool.reset();
+    }
+}
+
+void Client::setFindMissingBlobsConcurrency(size_t maxRequests)
+{
+    if (maxRequests == 0) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(
+            std::invalid_argument,
+            "The FindMissingBlobs() concurrency must be at least 1");
+    }
+
+    d_maxConcurrentFindMissingBlobsRequests = maxRequests;
+
+    // The calling thread issues one of the requests.
+    if (maxRequests > 1) {
+        d_findMissingBlobsPool = std::make_shared<ThreadPool>(maxRequests - 1);
+    }
+    else {
+        d_findMissingBlobsPool.reset();
+    }
+}
+
+void Client::setDownloadHardLinks(bool allowHardLinks)
+{
+    d_downloadHardLinks = allowHardLinks;
+}
+
+void Client::setPresenceCache(const std::shared_ptr<PresenceCache> &cache)
+{
+    d_presenceCache = cache;
+}
+
+void Client::setLocalBlobCache(const std::shared_ptr<LocalBlobCache> &cache)
+{
+    d_localBlobCache = cache;
+}
+
+void Client::setVerifyDownloads(bool verify) { d_verifyDownloads = verify; }
+
+void Client::recordDownloadVerification(size_t bytes) const
+{
+    buildboxcommonmetrics::CountingMetricUtil::recordCounterMetric(
+        d_verifyDownloads ? s_bytesVerifiedMetricName
+                          : s_bytesNotVerifiedMetricName,
+        static_cast<buildboxcommonmetrics::CountingMetricValue::Count>(
+            bytes));
+}
+
+void Client::setReadHedging(
+    const std::shared_ptr<RequestHedger> &byteStreamReads,
+    const std::shared_ptr<RequestHedger> &batchReads)
+{
+    d_byteStreamReadHedger = byteStreamReads;
+    d_batchReadHedger = batchReads;
+}
+
+void Client::setCompressor(Compressor::Value compressor)
+{
+    if (!Compression::isSupported(compressor)) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(
+            std::invalid_argument,
+            "Compressor \"" << Compression::name(compressor)
+                            << "\" is not supported by this build");
+    }
+    d_compressor = compressor;
+}
+
+void Client::setCompletionQueueThreads(size_t numThreads)
+{
+    if (numThreads == 0) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(
+            std::invalid_argument,
+            "The number of completion queue threads must be positive");
+    }
+
+    const std::lock_guard<std::mutex> lock(d_completionQueueRunnerMutex);
+    d_completionQueueRunner.reset();
+    d_completionQueueThreads = numThreads;
+}
+
+Compressor::Value Client::transferCompressor() const
+{
+    if (d_compressor != Compressor::IDENTITY &&
+        std::find(d_serverCompressors.cbegin(), d_serverCompressors.cend(),
+                  d_compressor) != d_serverCompressors.cend()) {
+        return d_compressor;
+    }
+    return Compressor::IDENTITY;
+}
+
+Compressor::Value Client::batchUpdateCompressor() const
+{
+    if (d_compressor != Compressor::IDENTITY &&
+        std::find(d_serverBatchUpdateCompressors.cbegin(),
+                  d_serverBatchUpdateCompressors.cend(),
+                  d_compressor) != d_serverBatchUpdateCompressors.cend()) {
+        return d_compressor;
+    }
+    return Compressor::IDENTITY;
+}
+
+std::string Client::makeResourceName(const Digest &digest, bool isUpload,
+                                     Compressor::Value compressor)
 {
     std::string resourceName;
 
@@ -187,13 +851,50 @@ std::string Client::makeResourceName(const Digest &digest, bool isUpload)
         resourceName.append("/");
     }
 
-    resourceName.append("blobs/");
+    if (compressor != Compressor::IDENTITY) {
+        resourceName.append("compressed-blobs/");
+        resourceName.append(Compression::name(compressor));
+        resourceName.append("/");
+    }
+    else {
+        resourceName.append("blobs/");
+    }
     resourceName.append(digest.hash_other());
     resourceName.append("/");
     resourceName.append(std::to_string(digest.size_bytes()));
     return resourceName;
 }
 
+size_t Client::queryCommittedSize(ByteStream::StubInterface *bytestream,
+                                  const std::string &resourceName,
+                                  size_t size)
+{
+    grpc::ClientContext context;
+    d_metadata_attach_function(&context);
+
+    QueryWriteStatusRequest request;
+    request.set_resource_name(resourceName);
+    QueryWriteStatusResponse response;
+    const grpc::Status status =
+        bytestream->QueryWriteStatus(&context, request, &response);
+    if (!status.ok()) {
+        BUILDBOX_LOG_DEBUG("QueryWriteStatus() for "
+                           << resourceName << " failed, restarting upload: "
+                           << status.error_code() << ": "
+                           << status.error_message());
+        return 0;
+    }
+
+    if (response.committed_size() < 0 ||
+        static_cast<size_t>(response.committed_size()) > size) {
+        BUILDBOX_LOG_WARNING("Ignoring committed size of "
+                             << response.committed_size() << " bytes for "
+                             << resourceName << ", restarting upload");
+        return 0;
+    }
+    return static_cast<size_t>(response.committed_size());
+}
+
 void Client::issueRequestAndThrowOnErrors(
     const GrpcRetrier::GrpcInvocation &invocation,
     const std::string &invocationName) const
@@ -216,32 +917,114 @@ GrpcRetrier Client::makeRetrier(const GrpcRetrier::GrpcInvocation &invocation,
     return retrier;
 }
 
+CompletionQueueRunner *Client::completionQueueRunner()
+{
+    const std::lock_guard<std::mutex> lock(d_completionQueueRunnerMutex);
+    if (!d_completionQueueRunner) {
+        d_completionQueueRunner.reset(
+            new CompletionQueueRunner(d_completionQueueThreads));
+    }
+    return d_completionQueueRunner.get();
+}
+
 std::string Client::fetchString(const Digest &digest)
 {
     BUILDBOX_LOG_TRACE("Downloading " << digest.hash_other() << " to string");
-    const std::string resourceName = this->makeResourceName(digest, false);
-
     std::string result;
+    if (d_localBlobCache && d_localBlobCache->read(digest, &result)) {
+        return result;
+    }
 
-    auto fetchLambda = [&](grpc::ClientContext &context) {
+    const Compressor::Value compressor = transferCompressor();
+    const std::string resourceName =
+        this->makeResourceName(digest, false, compressor);
+
+    const auto fetchAttempt = [&](grpc::ClientContext &context,
+                                  std::string *output) {
         ReadRequest request;
         request.set_resource_name(resourceName);
         request.set_read_offset(0);
 
-        auto reader = this->d_bytestreamClient->Read(&context, request);
+        auto reader = nextByteStreamClient()->Read(&context, request);
 
+        const size_t expected_size = static_cast<size_t>(digest.size_bytes());
         std::string downloaded_data;
-        downloaded_data.reserve(digest.size_bytes());
+        size_t bytes_received = 0;
+
+        std::unique_ptr<CompressionStream> decompressor;
+        std::string decompression_error;
+        if (compressor != Compressor::IDENTITY) {
+            decompressor =
+                Compression::makeDecompressor(compressor, expected_size);
+            downloaded_data.reserve(expected_size);
+        }
+
+        // The data is hashed as it arrives, so that verifying it overlaps
+        // with receiving the rest.
+        auto digestContext = d_digestGenerator.createDigestContext();
+        size_t bytes_hashed = 0;
+        const auto hashNewData = [&]() {
+            if (d_verifyDownloads && downloaded_data.size() > bytes_hashed) {
+                digestContext.update(downloaded_data.data() + bytes_hashed,
+                                     downloaded_data.size() - bytes_hashed);
+                bytes_hashed = downloaded_data.size();
+            }
+        };
 
         ReadResponse response;
         while (reader->Read(&response)) {
-            downloaded_data += response.data();
+            std::string *chunk = response.mutable_data();
+            const size_t chunk_size = chunk->size();
+            if (decompressor) {
+                try {
+                    decompressor->process(chunk->data(), chunk_size, false,
+                                          &downloaded_data);
+                }
+                catch (const std::runtime_error &e) {
+                    decompression_error = e.what();
+                    context.TryCancel();
+                    break;
+                }
+            }
+            else if (bytes_received == 0 && chunk_size >= expected_size) {
+                // The whole blob arrived in one message (always the case
+                // for blobs smaller than a chunk): take over its buffer
+                // instead of copying it.
+                downloaded_data.swap(*chunk);
+            }
+            else if (bytes_received + chunk_size <= expected_size) {
+                if (downloaded_data.capacity() < expected_size) {
+                    downloaded_data.reserve(expected_size);
+                }
+                downloaded_data.append(*chunk);
+            }
+            // Otherwise the server sent more data than the digest allows
+            // for. Only count it, the size check below will fail.
+            bytes_received += chunk_size;
+            hashNewData();
         }
 
         const grpc::Status read_status = reader->Finish();
+        if (decompressor && decompression_error.empty() && read_status.ok()) {
+            try {
+                decompressor->process(nullptr, 0, true, &downloaded_data);
+            }
+            catch (const std::runtime_error &e) {
+                decompression_error = e.what();
+            }
+            bytes_received = downloaded_data.size();
+            hashNewData();
+        }
+        if (!decompression_error.empty()) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(std::runtime_error,
+                                           "Could not decompress "
+                                               << resourceName << ": "
+                                               << decompression_error);
+        }
+
         if (read_status.ok()) {
             const auto bytes_downloaded =
-                static_cast<google::protobuf::int64>(downloaded_data.size());
+                static_cast<google::protobuf::int64>(bytes_received);
             if (bytes_downloaded != digest.size_bytes()) {
                 BUILDBOXCOMMON_THROW_EXCEPTION(
                     std::runtime_error,
@@ -250,57 +1033,147 @@ std::string Client::fetchString(const Digest &digest)
                                 << bytes_downloaded << " bytes");
             }
 
-            const auto downloaded_digest =
-                d_digestGenerator.hash(downloaded_data);
-            if (downloaded_digest != digest) {
-                BUILDBOXCOMMON_THROW_EXCEPTION(
-                    std::runtime_error,
-                    "Expected blob with digest "
-                        << digest << ", but downloaded blob has digest "
-                        << downloaded_digest);
+            if (d_verifyDownloads) {
+                const auto downloaded_digest = digestContext.finalizeDigest();
+                if (downloaded_digest != digest) {
+                    BUILDBOXCOMMON_THROW_EXCEPTION(
+                        std::runtime_error,
+                        "Expected blob with digest "
+                            << digest << ", but downloaded blob has digest "
+                            << downloaded_digest);
+                }
             }
 
             BUILDBOX_LOG_TRACE(resourceName << ": " << bytes_downloaded
                                             << " bytes retrieved");
-            result = std::move(downloaded_data);
+            *output = std::move(downloaded_data);
         }
 
         return read_status;
     };
 
+    auto fetchLambda = [&](grpc::ClientContext &context) {
+        if (!d_byteStreamReadHedger) {
+            return fetchAttempt(context, &result);
+        }
+
+        std::string outputs[2];
+        size_t winner = 0;
+        const grpc::Status status = d_byteStreamReadHedger->issue(
+            context,
+            [&](grpc::ClientContext &attemptContext, size_t attempt) {
+                return fetchAttempt(attemptContext, &outputs[attempt]);
+            },
+            d_metadata_attach_function, &winner);
+        result = std::move(outputs[winner]);
+        return status;
+    };
+
     issueRequestAndThrowOnErrors(fetchLambda, "ByteStream.Read()");
+    // Recorded once the request is done, so that a hedged read that also
+    // completed is not counted.
+    recordDownloadVerification(result.size());
+    if (d_localBlobCache) {
+        d_localBlobCache->insert(digest, result);
+    }
     return result;
 }
 
 void Client::download(int fd, const Digest &digest)
 {
     BUILDBOX_LOG_TRACE("Downloading " << digest.hash_other() << " to file");
-    const std::string resourceName = this->makeResourceName(digest, false);
+    if (d_localBlobCache && d_localBlobCache->readToFile(digest, fd)) {
+        return;
+    }
+
+    const Compressor::Value compressor = transferCompressor();
+    const std::string resourceName =
+        this->makeResourceName(digest, false, compressor);
 
     size_t bytesDownloaded = 0;
     auto digestContext = d_digestGenerator.createDigestContext();
 
+    const auto writeData = [&](const std::string &data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            const ssize_t result =
+                write(fd, data.data() + written, data.size() - written);
+            if (result == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                    std::system_error, errno, std::generic_category,
+                    "Error in write to descriptor " << fd);
+            }
+            written += static_cast<size_t>(result);
+        }
+        if (d_verifyDownloads) {
+            digestContext.update(data.data(), data.size());
+        }
+        bytesDownloaded += data.size();
+    };
+
     auto downloadLambda = [&](grpc::ClientContext &context) {
+        // The offset of a compressed read refers to the uncompressed data,
+        // and the server starts a new compressed stream from there.
         ReadRequest request;
         request.set_resource_name(resourceName);
-        request.set_read_offset(bytesDownloaded);
+        request.set_read_offset(
+            static_cast<google::protobuf::int64>(bytesDownloaded));
+
+        std::unique_ptr<CompressionStream> decompressor;
+        std::string decompressed;
+        std::string decompression_error;
+        if (compressor != Compressor::IDENTITY) {
+            decompressor = Compression::makeDecompressor(
+                compressor,
+                static_cast<size_t>(digest.size_bytes()) - bytesDownloaded);
+        }
 
-        auto reader = this->d_bytestreamClient->Read(&context, request);
+        auto reader = nextByteStreamClient()->Read(&context, request);
 
+        // The message is reused for every chunk and its data is written
+        // straight from the buffer it was parsed into.
         ReadResponse response;
         while (reader->Read(&response)) {
-            const auto data = response.data();
-            if (write(fd, data.c_str(), data.size()) !=
-                static_cast<ssize_t>(data.size())) {
-                BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
-                    std::system_error, errno, std::generic_category,
-                    "Error in write to descriptor " << fd);
+            if (!decompressor) {
+                writeData(response.data());
+                continue;
             }
-            digestContext.update(data.c_str(), data.size());
-            bytesDownloaded += data.size();
+
+            try {
+                decompressed.clear();
+                decompressor->process(response.data().data(),
+                                      response.data().size(), false,
+                                      &decompressed);
+            }
+            catch (const std::runtime_error &e) {
+                decompression_error = e.what();
+                context.TryCancel();
+                break;
+            }
+            writeData(decompressed);
         }
 
         const auto read_status = reader->Finish();
+        if (decompressor && decompression_error.empty() && read_status.ok()) {
+            decompressed.clear();
+            try {
+                decompressor->process(nullptr, 0, true, &decompressed);
+            }
+            catch (const std::runtime_error &e) {
+                decompression_error = e.what();
+            }
+            writeData(decompressed);
+        }
+        if (!decompression_error.empty()) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(std::runtime_error,
+                                           "Could not decompress "
+                                               << resourceName << ": "
+                                               << decompression_error);
+        }
+
         if (read_status.ok()) {
             struct stat st;
             fstat(fd, &st);
@@ -312,14 +1185,17 @@ void Client::download(int fd, const Digest &digest)
                                 << st.st_size << " bytes");
             }
 
-            const auto downloaded_digest = digestContext.finalizeDigest();
-            if (downloaded_digest != digest) {
-                BUILDBOXCOMMON_THROW_EXCEPTION(
-                    std::runtime_error,
-                    "Expected blob with digest "
-                        << digest << ", but downloaded blob has digest "
-                        << downloaded_digest);
+            if (d_verifyDownloads) {
+                const auto downloaded_digest = digestContext.finalizeDigest();
+                if (downloaded_digest != digest) {
+                    BUILDBOXCOMMON_THROW_EXCEPTION(
+                        std::runtime_error,
+                        "Expected blob with digest "
+                            << digest << ", but downloaded blob has digest "
+                            << downloaded_digest);
+                }
             }
+            recordDownloadVerification(bytesDownloaded);
 
             BUILDBOX_LOG_TRACE(resourceName << ": " << st.st_size
                                             << " bytes retrieved");
@@ -329,6 +1205,12 @@ void Client::download(int fd, const Digest &digest)
     };
 
     issueRequestAndThrowOnErrors(downloadLambda, "ByteStream.Read()");
+
+    // The blob can only be cached if it can be read back from `fd`.
+    const int flags = fcntl(fd, F_GETFL);
+    if (d_localBlobCache && flags != -1 && (flags & O_ACCMODE) != O_WRONLY) {
+        d_localBlobCache->insertFile(digest, fd);
+    }
 }
 
 void Client::downloadDirectory(
@@ -336,74 +1218,328 @@ void Client::downloadDirectory(
     const download_callback_t &download_callback,
     const return_directory_callback_t &return_directory_callback)
 {
-    const Directory directory = return_directory_callback(digest);
+    const return_directories_callback_t fetch_directories =
+        [&return_directory_callback](const std::vector<Digest> &digests) {
+            std::vector<Directory> directories;
+            directories.reserve(digests.size());
+            for (const Digest &directory_digest : digests) {
+                directories.push_back(
+                    return_directory_callback(directory_digest));
+            }
+            return directories;
+        };
+
+    downloadDirectoryByLevel(digest, path, download_callback,
+                             fetch_directories);
+}
+
+void Client::downloadDirectoryByLevel(
+    const Digest &digest, const std::string &path,
+    const download_callback_t &download_callback,
+    const return_directories_callback_t &return_directories_callback)
+{
+    // Fetching the whole tree, one level at a time. Subdirectories that
+    // appear several times in the tree are only requested once.
+    std::unordered_map<Digest, Directory> directories;
+    std::unordered_set<Digest> requested_digests = {digest};
+    std::vector<Digest> level = {digest};
+    while (!level.empty()) {
+        std::vector<Directory> level_directories =
+            return_directories_callback(level);
+        if (level_directories.size() != level.size()) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(
+                std::runtime_error,
+                "Requested " << level.size() << " Directory messages, got "
+                             << level_directories.size());
+        }
+
+        std::vector<Digest> next_level;
+        for (size_t i = 0; i < level.size(); i++) {
+            for (const DirectoryNode &node :
+                 level_directories[i].directories()) {
+                if (requested_digests.insert(node.digest()).second) {
+                    next_level.push_back(node.digest());
+                }
+            }
+            directories.emplace(level[i], std::move(level_directories[i]));
+        }
+        level = std::move(next_level);
+    }
+
+    // Creating the directories and symlinks one level at a time, and
+    // collecting the files of the whole tree:
+    typedef std::pair<const Directory *, std::string> PendingDirectory;
+    std::vector<PendingDirectory> pending = {
+        PendingDirectory(&directories.at(digest), path)};
 
-    // Downloading the files in this directory:
     OutputMap outputs;
     std::vector<Digest> file_digests;
-    file_digests.reserve(static_cast<size_t>(directory.files_size()));
+    std::unordered_set<Digest> file_digests_seen;
+    while (!pending.empty()) {
+        const auto create_entries = [&pending](size_t i) {
+            createDirectoryEntries(*pending[i].first, pending[i].second);
+        };
 
-    for (const FileNode &file : directory.files()) {
-        file_digests.push_back(file.digest());
+        if (d_transferPool) {
+            d_transferPool->parallelFor(pending.size(), create_entries);
+        }
+        else {
+            for (size_t i = 0; i < pending.size(); i++) {
+                create_entries(i);
+            }
+        }
 
-        const std::string file_path = path + "/" + file.name();
-        outputs.emplace(
-            file.digest().hash_other(),
-            std::pair<std::string, bool>(file_path, file.is_executable()));
+        std::vector<PendingDirectory> next_pending;
+        for (const PendingDirectory &entry : pending) {
+            for (const FileNode &file : entry.first->files()) {
+                if (file_digests_seen.insert(file.digest()).second) {
+                    file_digests.push_back(file.digest());
+                }
+
+                const std::string file_path = entry.second + "/" + file.name();
+                outputs.emplace(file.digest().hash_other(),
+                                std::pair<std::string, bool>(
+                                    file_path, file.is_executable()));
+            }
+            for (const DirectoryNode &node : entry.first->directories()) {
+                next_pending.emplace_back(&directories.at(node.digest()),
+                                          entry.second + "/" + node.name());
+            }
+        }
+        pending = std::move(next_pending);
     }
+
+    // Downloading the files of the whole tree:
     download_callback(file_digests, outputs);
+}
+
+void Client::createDirectoryEntries(const Directory &directory,
+                                    const std::string &directory_path)
+{
+    for (const DirectoryNode &node : directory.directories()) {
+        const std::string subdirectory_path =
+            directory_path + "/" + node.name();
+        if (mkdir(subdirectory_path.c_str(), 0777) == -1) {
+            BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                std::system_error, errno, std::system_category,
+                "Error in mkdir for directory \""
+                    << subdirectory_path << "\"");
+        }
+    }
+
+    // Create symlinks, note: we just create the symlink. It's not
+    // the responsibility of the worker/casd, to ensure the target is
+    // valid and has contents.
+    for (const SymlinkNode &symlink_node : directory.symlinks()) {
+        if (symlink_node.target().empty() || symlink_node.name().empty()) {
+            BUILDBOX_LOG_WARNING(
+                "Symlink Node name or target empty skipping.");
+            continue;
+        }
+        // Prepend the path to the symlink_node name.
+        const std::string symlink_path =
+            directory_path + "/" + symlink_node.name();
+
+        if (symlink(symlink_node.target().c_str(),
+                    symlink_path.c_str()) != 0) {
+            BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                std::system_error, errno, std::system_category,
+                "Unable to create symlink: \""
+                    << symlink_path + "\" to target: \""
+                    << symlink_node.target() << "\"");
+        }
+    }
+}
+
+void Client::downloadDirectory(const Digest &digest, const std::string &path)
+{
+    download_callback_t download_blobs =
+        [this](const std::vector<Digest> &file_digests,
+               const OutputMap &outputs) {
+            this->downloadBlobs(file_digests, outputs);
+        };
+
+    // Fetching all the Directory messages of a level with batch requests:
+    return_directories_callback_t download_directories =
+        [this](const std::vector<Digest> &digests) {
+            const DownloadBlobsResult blobs = this->downloadBlobs(digests);
+
+            std::vector<Directory> directories(digests.size());
+            for (size_t i = 0; i < digests.size(); i++) {
+                const auto it = blobs.find(digests[i].hash_other());
+                if (it == blobs.cend() ||
+                    it->second.first.code() != grpc::StatusCode::OK) {
+                    BUILDBOXCOMMON_THROW_EXCEPTION(
+                        std::runtime_error,
+                        "Failed to fetch Directory \""
+                            << toString(digests[i]) << "\": "
+                            << (it == blobs.cend()
+                                    ? "not returned by the server"
+                                    : it->second.first.message()));
+                }
+                if (!directories[i].ParseFromString(it->second.second)) {
+                    throw std::runtime_error(
+                        "Could not deserialize fetched message");
+                }
+            }
+            return directories;
+        };
+
+    this->downloadDirectoryByLevel(digest, path, download_blobs,
+                                   download_directories);
+}
+
+void Client::downloadDirectoryFromTree(const Digest &digest,
+                                       const std::string &path)
+{
+    // Every Directory received is kept, as subdirectories that appear
+    // several times in the tree are only returned once. Those that were
+    // referenced before being received wait for it with their paths.
+    std::unordered_map<Digest, Directory> directories;
+    std::unordered_map<Digest, std::vector<std::string>> waiting_paths = {
+        {digest, {path}}};
+
+    // The files are downloaded in the background while the following pages
+    // are read. One transfer runs at a time, and the files placed meanwhile
+    // are queued for the next one. Each blob is requested once for the
+    // whole tree: the paths found after its transfer started are copied
+    // from the first one written.
+    struct FileCopy {
+        std::string source;
+        bool source_is_executable;
+        std::string destination;
+        bool is_executable;
+    };
+    struct FileTransfer {
+        std::vector<Digest> digests;
+        OutputMap outputs;
+        std::vector<FileCopy> copies;
+    };
+    std::unordered_map<Digest, std::pair<std::string, bool>> first_paths;
+    auto queued = std::make_shared<FileTransfer>();
+    std::future<void> in_flight;
+
+    const auto transfer = [this](const FileTransfer &files) {
+        if (!files.digests.empty()) {
+            this->downloadBlobs(files.digests, files.outputs);
+        }
+        for (const FileCopy &copy : files.copies) {
+            mode_t file_permissions =
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH; // 0644
+            if (copy.is_executable) {
+                file_permissions |= S_IXUSR | S_IXGRP | S_IXOTH; // 0755
+            }
+            if (!d_downloadHardLinks ||
+                copy.source_is_executable != copy.is_executable ||
+                !linkFile(copy.source, copy.destination)) {
+                FileUtils::copyFileAtomically(copy.source, copy.destination,
+                                              file_permissions);
+            }
+        }
+    };
+
+    const auto start_transfer = [&]() {
+        if (in_flight.valid()) {
+            in_flight.get(); // Rethrows the errors of the previous transfer
+        }
+        const std::shared_ptr<FileTransfer> files = std::move(queued);
+        queued = std::make_shared<FileTransfer>();
+        const auto task = [transfer, files]() { transfer(*files); };
+        in_flight = d_transferPool ? d_transferPool->async(task)
+                                   : std::async(std::launch::async, task);
+    };
+
+    const auto queue_file = [&](const FileNode &file,
+                                const std::string &file_path) {
+        const auto first = first_paths.emplace(
+            file.digest(), std::make_pair(file_path, file.is_executable()));
+        if (first.second) {
+            queued->digests.push_back(file.digest());
+        }
+        else if (queued->outputs.count(file.digest().hash_other()) == 0) {
+            queued->copies.push_back({first.first->second.first,
+                                      first.first->second.second, file_path,
+                                      file.is_executable()});
+            return;
+        }
+        queued->outputs.emplace(
+            file.digest().hash_other(),
+            std::pair<std::string, bool>(file_path, file.is_executable()));
+    };
 
-    // Creating the subdirectories in this level and recursively fetching
-    // their contents:
-    for (const DirectoryNode &directory_node : directory.directories()) {
-        const std::string directory_path = path + "/" + directory_node.name();
-        if (mkdir(directory_path.c_str(), 0777) == -1) {
-            BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
-                std::system_error, errno, std::system_category,
-                "Error in mkdir for directory \"" << directory_path << "\"");
+    const auto visit_page = [&](const GetTreeResponse &page) {
+        std::vector<std::pair<const Directory *, std::string>> placeable;
+        for (const Directory &directory : page.directories()) {
+            const Digest directory_digest =
+                d_digestGenerator.hash(directory.SerializeAsString());
+            const auto inserted =
+                directories.emplace(directory_digest, directory);
+            const auto waiting = waiting_paths.find(directory_digest);
+            if (!inserted.second || waiting == waiting_paths.end()) {
+                continue;
+            }
+            for (const std::string &directory_path : waiting->second) {
+                placeable.emplace_back(&inserted.first->second,
+                                       directory_path);
+            }
+            waiting_paths.erase(waiting);
         }
 
-        downloadDirectory(directory_node.digest(), directory_path,
-                          download_callback, return_directory_callback);
-    }
+        while (!placeable.empty()) {
+            const Directory *directory = placeable.back().first;
+            const std::string directory_path = placeable.back().second;
+            placeable.pop_back();
 
-    // Create symlinks, note: we just create the symlink. It's not the
-    // responsibility of the worker/casd, to ensure the target is valid and
-    // has contents.
-    for (const SymlinkNode &symlink_node : directory.symlinks()) {
-        if (symlink_node.target().empty() || symlink_node.name().empty()) {
-            BUILDBOX_LOG_WARNING(
-                "Symlink Node name or target empty skipping.");
-            continue;
+            createDirectoryEntries(*directory, directory_path);
+            for (const FileNode &file : directory->files()) {
+                queue_file(file, directory_path + "/" + file.name());
+            }
+            for (const DirectoryNode &node : directory->directories()) {
+                const std::string subdirectory_path =
+                    directory_path + "/" + node.name();
+                const auto it = directories.find(node.digest());
+                if (it != directories.end()) {
+                    placeable.emplace_back(&it->second, subdirectory_path);
+                }
+                else {
+                    waiting_paths[node.digest()].push_back(subdirectory_path);
+                }
+            }
         }
-        // Prepend the path to the symlink_node name.
-        const std::string symlink_path = path + "/" + symlink_node.name();
 
-        if (symlink(symlink_node.target().c_str(), symlink_path.c_str()) !=
-            0) {
-            BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
-                std::system_error, errno, std::system_category,
-                "Unable to create symlink: \""
-                    << symlink_path + "\" to target: \""
-                    << symlink_node.target() << "\"");
+        const bool idle = !in_flight.valid() ||
+                          in_flight.wait_for(std::chrono::seconds(0)) ==
+                              std::future_status::ready;
+        if (idle && (!queued->digests.empty() || !queued->copies.empty())) {
+            start_transfer();
         }
-    }
-}
-
-void Client::downloadDirectory(const Digest &digest, const std::string &path)
-{
-    download_callback_t download_blobs =
-        [this](const std::vector<Digest> &file_digests,
-               const OutputMap &outputs) {
-            this->downloadBlobs(file_digests, outputs);
-        };
+        return true;
+    };
 
-    return_directory_callback_t download_directory =
-        [this](const Digest &message_digest) {
-            return this->fetchMessage<Directory>(message_digest);
-        };
+    try {
+        getTree(digest, visit_page);
+    }
+    catch (...) {
+        // The transfer in flight writes into the tree being created.
+        if (in_flight.valid()) {
+            in_flight.wait();
+        }
+        throw;
+    }
+    if (in_flight.valid()) {
+        in_flight.get();
+    }
 
-    this->downloadDirectory(digest, path, download_blobs, download_directory);
+    if (!waiting_paths.empty()) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(
+            std::runtime_error,
+            "GetTree() for \"" << toString(digest) << "\" did not return "
+                                << waiting_paths.size()
+                                << " Directory messages, including \""
+                                << toString(waiting_paths.begin()->first)
+                                << "\"");
+    }
+    transfer(*queued);
 }
 
 void Client::upload(const std::string &data, const Digest &digest)
@@ -420,14 +1556,42 @@ void Client::upload(const std::string &data, const Digest &digest)
                                   << data_size << " bytes");
     }
 
-    const std::string resourceName = this->makeResourceName(digest, true);
+    const Compressor::Value compressor = transferCompressor();
+    const std::string resourceName =
+        this->makeResourceName(digest, true, compressor);
 
+    // Resuming an upload only works on the connection that started it.
+    ByteStream::StubInterface *bytestream = nextByteStreamClient();
     WriteResponse response;
+    bool retrying = false;
 
     auto uploadLambda = [&](grpc::ClientContext &context) {
-        auto writer = this->d_bytestreamClient->Write(&context, &response);
+        if (compressor != Compressor::IDENTITY) {
+            size_t offset = 0;
+            return writeCompressed(
+                bytestream, context, resourceName, compressor, digest,
+                [&](std::string *chunk) {
+                    const size_t length = std::min(
+                        bytestreamChunkSizeBytes(), data.size() - offset);
+                    chunk->assign(data, offset, length);
+                    offset += length;
+                    return length > 0;
+                });
+        }
 
+        // A retry continues from whatever the server already committed.
         size_t offset = 0;
+        if (retrying) {
+            offset = queryCommittedSize(bytestream, resourceName, data.size());
+        }
+        retrying = true;
+        if (offset == data.size() && offset > 0) {
+            response.set_committed_size(digest.size_bytes());
+            return grpc::Status::OK;
+        }
+
+        auto writer = bytestream->Write(&context, &response);
+
         bool lastChunk = false;
         while (!lastChunk) {
             WriteRequest request;
@@ -471,55 +1635,75 @@ void Client::upload(const std::string &data, const Digest &digest)
     };
 
     issueRequestAndThrowOnErrors(uploadLambda, "ByteStream.Write()");
+    if (d_presenceCache) {
+        d_presenceCache->insert(digest);
+    }
 }
 
 void Client::upload(int fd, const Digest &digest)
 {
-    std::vector<char> buffer(bytestreamChunkSizeBytes());
     BUILDBOX_LOG_DEBUG("Uploading " << digest.hash_other() << " from file");
 
-    const std::string resourceName = this->makeResourceName(digest, true);
-
-    lseek(fd, 0, SEEK_SET);
+    const Compressor::Value compressor = transferCompressor();
+    const std::string resourceName =
+        this->makeResourceName(digest, true, compressor);
+    const auto size = static_cast<size_t>(digest.size_bytes());
 
+    ByteStream::StubInterface *bytestream = nextByteStreamClient();
     WriteResponse response;
+    bool retrying = false;
     auto uploadLambda = [&](grpc::ClientContext &context) {
-        auto writer = this->d_bytestreamClient->Write(&context, &response);
+        if (compressor != Compressor::IDENTITY) {
+            ReadAheadFileReader fileReader(fd, 0, size,
+                                           bytestreamChunkSizeBytes(),
+                                           UPLOAD_READ_AHEAD_CHUNKS);
+            return writeCompressed(
+                bytestream, context, resourceName, compressor, digest,
+                [&fileReader](std::string *chunk) {
+                    return fileReader.next(chunk);
+                });
+        }
+
+        // A retry continues from whatever the server already committed.
+        size_t offset = 0;
+        if (retrying) {
+            offset = queryCommittedSize(bytestream, resourceName, size);
+        }
+        retrying = true;
+        if (offset == size && offset > 0) {
+            response.set_committed_size(digest.size_bytes());
+            return grpc::Status::OK;
+        }
+
+        auto writer = bytestream->Write(&context, &response);
 
-        ssize_t offset = 0;
+        // The file is read on another thread while the previous chunks are
+        // being sent, so that disk and network transfers overlap.
+        ReadAheadFileReader fileReader(fd, offset, size,
+                                       bytestreamChunkSizeBytes(),
+                                       UPLOAD_READ_AHEAD_CHUNKS);
+
+        WriteRequest request;
         bool lastChunk = false;
         while (!lastChunk) {
-            const ssize_t bytesRead =
-                read(fd, &buffer[0], bytestreamChunkSizeBytes());
-            if (bytesRead < 0) {
-                BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
-                    std::system_error, errno, std::generic_category,
-                    "Error in read on descriptor " << fd);
+            // An empty blob is sent as a single empty request.
+            if (offset < size && !fileReader.next(request.mutable_data())) {
+                BUILDBOXCOMMON_THROW_EXCEPTION(
+                    std::runtime_error,
+                    "Upload of " << digest.hash_other()
+                                 << " failed: unexpected end of file");
             }
 
-            WriteRequest request;
             request.set_resource_name(resourceName);
-            request.set_write_offset(offset);
-            request.set_data(&buffer[0], static_cast<size_t>(bytesRead));
-
-            if (offset + bytesRead < digest.size_bytes()) {
-                if (bytesRead == 0) {
-                    BUILDBOXCOMMON_THROW_EXCEPTION(
-                        std::runtime_error,
-                        "Upload of " << digest.hash_other()
-                                     << " failed: unexpected end of file");
-                }
-            }
-            else {
-                lastChunk = true;
-                request.set_finish_write(true);
-            }
+            request.set_write_offset(
+                static_cast<google::protobuf::int64>(offset));
+            offset += request.data().size();
+            lastChunk = (offset >= size);
+            request.set_finish_write(lastChunk);
 
             if (!writer->Write(request)) {
                 break;
             }
-
-            offset += bytesRead;
         }
 
         writer->WritesDone();
@@ -541,6 +1725,91 @@ void Client::upload(int fd, const Digest &digest)
     };
 
     issueRequestAndThrowOnErrors(uploadLambda, "ByteStream.Write()");
+    if (d_presenceCache) {
+        d_presenceCache->insert(digest);
+    }
+}
+
+grpc::Status
+Client::writeCompressed(ByteStream::StubInterface *bytestream,
+                        grpc::ClientContext &context,
+                        const std::string &resourceName,
+                        Compressor::Value compressor, const Digest &digest,
+                        const std::function<bool(std::string *)> &next_chunk)
+{
+    // The server cannot tell how much of a compressed stream it committed
+    // in terms of a stream that we would produce again, so unlike plain
+    // uploads every attempt starts from the beginning.
+    WriteResponse response;
+    auto writer = bytestream->Write(&context, &response);
+    const auto compressorStream = Compression::makeCompressor(compressor);
+
+    const auto size = static_cast<size_t>(digest.size_bytes());
+    size_t bytes_read = 0;
+    bool input_finished = false;
+    std::string input;
+    std::string compressed;
+
+    // The first request is at offset 0 of the uncompressed data, the
+    // following ones at the number of compressed bytes sent before them.
+    google::protobuf::int64 write_offset = 0;
+    WriteRequest request;
+    bool lastChunk = false;
+    while (!lastChunk) {
+        while (!input_finished &&
+               compressed.size() < bytestreamChunkSizeBytes()) {
+            input.clear();
+            if (bytes_read < size && !next_chunk(&input)) {
+                BUILDBOXCOMMON_THROW_EXCEPTION(
+                    std::runtime_error,
+                    "Upload of " << digest.hash_other()
+                                 << " failed: unexpected end of data");
+            }
+            bytes_read += input.size();
+            input_finished = (bytes_read >= size);
+            compressorStream->process(input.data(), input.size(),
+                                      input_finished, &compressed);
+        }
+
+        const size_t length =
+            std::min(bytestreamChunkSizeBytes(), compressed.size());
+        lastChunk = input_finished && length == compressed.size();
+
+        request.set_resource_name(resourceName);
+        request.set_write_offset(write_offset);
+        request.set_data(compressed.data(), length);
+        request.set_finish_write(lastChunk);
+        compressed.erase(0, length);
+        write_offset += static_cast<google::protobuf::int64>(length);
+
+        if (!writer->Write(request)) {
+            break;
+        }
+    }
+
+    writer->WritesDone();
+    const grpc::Status status = writer->Finish();
+    if (status.ok()) {
+        // Servers report either the size of the blob, that of the
+        // compressed data they received, or -1 if the blob was already
+        // present.
+        if (response.committed_size() != digest.size_bytes() &&
+            response.committed_size() != write_offset &&
+            response.committed_size() != -1) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(
+                std::runtime_error,
+                "Expected to upload "
+                    << digest.size_bytes() << " bytes for "
+                    << digest.hash_other() << ", but server reports "
+                    << response.committed_size() << " bytes committed");
+        }
+
+        BUILDBOX_LOG_DEBUG(resourceName << ": " << bytes_read
+                                        << " bytes uploaded as "
+                                        << write_offset
+                                        << " compressed bytes");
+    }
+    return status;
 }
 
 void Client::uploadRequest(const UploadRequest &request)
@@ -566,6 +1835,150 @@ void Client::uploadRequest(const UploadRequest &request)
     }
 }
 
+size_t Client::maxUploadBatchSizeBytes() const
+{
+    // Each batch is read into memory in full, so the batches that can be in
+    // flight at the same time share the upload memory limit.
+    size_t max_batch_size = d_maxBatchTotalSizeBytes;
+    if (d_uploadMemoryLimitBytes > 0) {
+        max_batch_size =
+            std::min(max_batch_size,
+                     d_uploadMemoryLimitBytes / d_maxConcurrentBatchRequests);
+    }
+    return max_batch_size;
+}
+
+bool Client::hashFileForUpload(int fd, Digest *digest, std::string *data)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+            std::system_error, errno, std::system_category,
+            "Error in fstat on descriptor " << fd);
+    }
+    const off_t file_size = st.st_size;
+
+    Digest size_only;
+    size_only.set_size_bytes(file_size);
+    if (makeBatches({size_only}, maxUploadBatchSizeBytes()).empty()) {
+        if (lseek(fd, 0, SEEK_SET) != 0) {
+            BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                std::system_error, errno, std::system_category,
+                "Error in lseek on descriptor " << fd);
+        }
+        *digest = d_digestGenerator.hash(fd);
+        return false;
+    }
+
+    data->resize(static_cast<size_t>(file_size));
+    size_t bytes_read = 0;
+    while (bytes_read < data->size()) {
+        const ssize_t result =
+            pread(fd, &(*data)[bytes_read], data->size() - bytes_read,
+                  static_cast<off_t>(bytes_read));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result < 0) {
+            BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                std::system_error, errno, std::system_category,
+                "Error in read on descriptor " << fd);
+        }
+        if (result == 0) {
+            // The file was truncated since `fstat()`.
+            data->resize(bytes_read);
+        }
+        bytes_read += static_cast<size_t>(result);
+    }
+
+    *digest = d_digestGenerator.hash(*data);
+    return true;
+}
+
+Digest Client::hashAndUploadFile(int fd)
+{
+    Digest digest;
+    std::string data;
+    if (hashFileForUpload(fd, &digest, &data)) {
+        const auto failures = uploadBlobs({UploadRequest(digest, data)});
+        if (!failures.empty()) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(
+                std::runtime_error,
+                "Failed to upload " << digest.hash_other() << ": "
+                                    << failures[0].status.error_message());
+        }
+    }
+    else if (!findMissingBlobs({digest}).empty()) {
+        upload(fd, digest);
+    }
+    else {
+        BUILDBOX_LOG_DEBUG(digest.hash_other()
+                           << " is already present, not uploading it");
+    }
+    return digest;
+}
+
+std::vector<Client::UploadResult>
+Client::hashAndUploadFiles(const std::vector<std::string> &paths)
+{
+    std::vector<UploadResult> results;
+    std::vector<UploadRequest> requests;
+    std::vector<UploadRequest> large_files;
+    for (const std::string &path : paths) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                std::system_error, errno, std::system_category,
+                "Error in open for file \"" << path << "\"");
+        }
+
+        Digest digest;
+        std::string data;
+        bool batchable;
+        try {
+            batchable = hashFileForUpload(fd, &digest, &data);
+        }
+        catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+
+        if (batchable) {
+            requests.emplace_back(digest, data);
+        }
+        else {
+            large_files.push_back(UploadRequest::from_path(digest, path));
+        }
+        results.emplace_back(digest, grpc::Status::OK);
+    }
+
+    // Only the large files that the server is missing are read again.
+    if (!large_files.empty()) {
+        std::vector<Digest> large_digests;
+        for (const auto &request : large_files) {
+            large_digests.push_back(request.digest);
+        }
+        const auto missing = findMissingBlobs(large_digests);
+        const std::unordered_set<Digest> missing_set(missing.cbegin(),
+                                                     missing.cend());
+        for (auto &request : large_files) {
+            if (missing_set.count(request.digest) > 0) {
+                requests.push_back(std::move(request));
+            }
+        }
+    }
+
+    for (const auto &failure : uploadBlobs(requests)) {
+        for (auto &result : results) {
+            if (result.digest == failure.digest) {
+                result.status = failure.status;
+            }
+        }
+    }
+    return results;
+}
+
 std::vector<Client::UploadResult>
 Client::uploadBlobs(const std::vector<UploadRequest> &requests)
 {
@@ -576,12 +1989,29 @@ std::vector<Client::UploadResult>
 Client::uploadBlobs(const std::vector<UploadRequest> &requests,
                     const bool throw_on_error)
 {
-    std::vector<Client::UploadResult> results;
+    // Blobs that the server is known to have are not sent again.
+    std::vector<UploadRequest> request_list;
+    if (d_presenceCache) {
+        std::vector<Digest> digests;
+        for (const auto &r : requests) {
+            digests.push_back(r.digest);
+        }
+        const auto unknown = d_presenceCache->filterUnknown(digests);
+        const std::unordered_set<Digest> unknown_set(unknown.cbegin(),
+                                                     unknown.cend());
+        for (const auto &r : requests) {
+            if (unknown_set.count(r.digest) > 0) {
+                request_list.push_back(r);
+            }
+        }
+    }
+    else {
+        request_list = requests;
+    }
 
     // We first sort the requests by their sizes in ascending order, so
     // that we can then iterate through that result greedily trying to add
     // as many digests as possible to each request.
-    std::vector<UploadRequest> request_list(requests);
     std::sort(request_list.begin(), request_list.end(),
               [](const UploadRequest &r1, const UploadRequest &r2) {
                   return r1.digest.size_bytes() < r2.digest.size_bytes();
@@ -594,17 +2024,27 @@ Client::uploadBlobs(const std::vector<UploadRequest> &requests,
         digests.push_back(r.digest);
     }
 
-    const auto batches = makeBatches(digests);
-    for (const auto &batch_range : batches) {
-        const size_t batch_start = batch_range.first;
-        const size_t batch_end = batch_range.second;
+    const auto batches = makeBatches(digests, maxUploadBatchSizeBytes());
+
+    // Those digests that might need to be uploaded using the Bytestream API
+    // will be in the range [batch_end, request_list.size()).
+    const size_t batch_end = batches.empty() ? 0 : batches.rbegin()->second;
+    const size_t bytestream_count = request_list.size() - batch_end;
+
+    // The results are collected separately for each request so that they
+    // are reported in the same order no matter when the requests complete.
+    std::vector<std::vector<Client::UploadResult>> batch_results(
+        batches.size());
+    std::vector<std::vector<Client::UploadResult>> bytestream_results(
+        bytestream_count);
+
+    const auto upload_batch = [&](size_t i) {
+        const size_t range_start = batches[i].first;
+        const size_t range_end = batches[i].second;
 
         try {
-            const std::vector<Client::UploadResult> digests_not_uploaded =
-                batchUpload(request_list, batch_start, batch_end);
-            std::move(digests_not_uploaded.cbegin(),
-                      digests_not_uploaded.cend(),
-                      std::back_inserter(results));
+            batch_results[i] =
+                batchUpload(request_list, range_start, range_end);
         }
         catch (const std::runtime_error &e) {
             BUILDBOX_LOG_ERROR("Batch upload failed: " +
@@ -619,20 +2059,17 @@ Client::uploadBlobs(const std::vector<UploadRequest> &requests,
             // there is no throw.
             const auto failed_status = grpc::Status(grpc::StatusCode::INTERNAL,
                                                     grpc::string(e.what()));
-            for (auto d = batch_start; d < batch_end; d++) {
-                results.emplace_back(request_list.at(d).digest, failed_status);
+            for (auto d = range_start; d < range_end; d++) {
+                batch_results[i].emplace_back(request_list.at(d).digest,
+                                              failed_status);
             }
         }
-    }
-
-    // Fetching all those digests that might need to be uploaded using the
-    // Bytestream API. Those will be in the range [batch_end,
-    // batches.size()).
-    const size_t batch_end = batches.empty() ? 0 : batches.rbegin()->second;
+    };
 
-    for (auto d = batch_end; d < request_list.size(); d++) {
+    const auto upload_blob = [&](size_t i) {
+        const UploadRequest &request = request_list[batch_end + i];
         try {
-            uploadRequest(request_list[d]);
+            uploadRequest(request);
         }
         catch (const GrpcError &e) {
             if (throw_on_error) {
@@ -640,7 +2077,7 @@ Client::uploadBlobs(const std::vector<UploadRequest> &requests,
                                                "Failed to upload blob: " +
                                                    e.status.error_message());
             }
-            results.emplace_back(request_list[d].digest, e.status);
+            bytestream_results[i].emplace_back(request.digest, e.status);
         }
         catch (const std::runtime_error &e) {
             BUILDBOX_LOG_ERROR("Failed to upload blob: " +
@@ -648,12 +2085,33 @@ Client::uploadBlobs(const std::vector<UploadRequest> &requests,
             if (throw_on_error) {
                 throw e;
             }
-            results.emplace_back(
-                request_list[d].digest,
+            bytestream_results[i].emplace_back(
+                request.digest,
                 grpc::Status(grpc::StatusCode::INTERNAL, e.what()));
         }
+    };
+
+    runTransfers(batches.size(), upload_batch, bytestream_count, upload_blob);
+
+    std::vector<Client::UploadResult> results;
+    for (const auto &result_list : {&batch_results, &bytestream_results}) {
+        for (auto &request_results : *result_list) {
+            std::move(request_results.begin(), request_results.end(),
+                      std::back_inserter(results));
+        }
     }
 
+    if (d_presenceCache) {
+        std::unordered_set<Digest> failed_set;
+        for (const auto &result : results) {
+            failed_set.insert(result.digest);
+        }
+        for (const auto &request : request_list) {
+            if (failed_set.count(request.digest) == 0) {
+                d_presenceCache->insert(request.digest);
+            }
+        }
+    }
     return results;
 }
 
@@ -672,8 +2130,32 @@ Client::downloadBlobs(const std::vector<Digest> &digests,
         downloaded_data.emplace(hash, std::make_pair(status, data));
     };
 
+    // Blobs found in the local cache are not requested from the server.
+    std::vector<Digest> remote_digests;
+    if (d_localBlobCache) {
+        for (const Digest &digest : digests) {
+            const std::string &hash = digest.hash_other();
+            if (temp_directory) {
+                const std::string path = *temp_directory + "/" + hash;
+                if (d_localBlobCache->stage(digest, path, 0600, false)) {
+                    write_blob(hash, path);
+                    continue;
+                }
+            }
+            else {
+                std::string data;
+                if (d_localBlobCache->read(digest, &data)) {
+                    write_blob(hash, data);
+                    continue;
+                }
+            }
+            remote_digests.push_back(digest);
+        }
+    }
+
     const Client::DownloadResults download_results =
-        downloadBlobs(digests, write_blob, temp_directory, false);
+        downloadBlobs(d_localBlobCache ? remote_digests : digests, write_blob,
+                      temp_directory, false);
 
     // And adding the codes of the hashes that failed into the result:
     for (const auto &entry : download_results) {
@@ -704,11 +2186,27 @@ Client::downloadBlobsToDirectory(const std::vector<Digest> &digests,
 void Client::downloadBlobs(const std::vector<Digest> &digests,
                            const OutputMap &outputs)
 {
+    // Every path sharing a blob is written from a single download, so each
+    // digest only needs to be requested once.
+    std::vector<Digest> unique_digests;
+    unique_digests.reserve(digests.size());
+    std::unordered_set<Digest> seen_digests;
+    for (const Digest &digest : digests) {
+        if (seen_digests.insert(digest).second &&
+            !stageFromLocalBlobCache(digest, outputs)) {
+            unique_digests.push_back(digest);
+        }
+    }
 
     auto write_blob = [&](const std::string &hash, const std::string &data) {
         const std::pair<OutputMap::const_iterator, OutputMap::const_iterator>
             range = outputs.equal_range(hash);
 
+        // The first path written for this blob, and the first one written
+        // with each executable bit (the candidates for hardlinking).
+        std::string first_path;
+        std::string first_path_by_mode[2];
+
         for (auto it = range.first; it != range.second; it++) {
             const std::string path = it->second.first;
             const bool is_executable = it->second.second;
@@ -719,23 +2217,94 @@ void Client::downloadBlobs(const std::vector<Digest> &digests,
                 file_permissions |= S_IXUSR | S_IXGRP | S_IXOTH; // 0755
             }
 
-            FileUtils::writeFileAtomically(path, data, file_permissions);
+            std::string &link_source = first_path_by_mode[is_executable];
+            if (first_path.empty()) {
+                FileUtils::writeFileAtomically(path, data, file_permissions);
+                first_path = path;
+            }
+            else if (!d_downloadHardLinks || link_source.empty() ||
+                     !linkFile(link_source, path)) {
+                FileUtils::copyFileAtomically(first_path, path,
+                                              file_permissions);
+            }
+
+            if (link_source.empty()) {
+                link_source = path;
+            }
         }
     };
 
-    downloadBlobs(digests, write_blob, nullptr, true);
+    downloadBlobs(unique_digests, write_blob, nullptr, true);
     // ^ If an error is encountered during download, aborts by throwing an
     // exception.
 }
 
+bool Client::stageFromLocalBlobCache(const Digest &digest,
+                                     const OutputMap &outputs)
+{
+    if (!d_localBlobCache) {
+        return false;
+    }
+
+    const std::pair<OutputMap::const_iterator, OutputMap::const_iterator>
+        range = outputs.equal_range(digest.hash_other());
+
+    std::string first_path;
+    for (auto it = range.first; it != range.second; it++) {
+        const std::string &path = it->second.first;
+        const bool is_executable = it->second.second;
+
+        mode_t file_permissions = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+        if (is_executable) {
+            file_permissions |= S_IXUSR | S_IXGRP | S_IXOTH;
+        }
+
+        if (d_localBlobCache->stage(digest, path, file_permissions,
+                                    d_downloadHardLinks)) {
+            first_path = path;
+        }
+        else if (first_path.empty()) {
+            return false;
+        }
+        else {
+            // The entry was evicted after the first path was staged.
+            FileUtils::copyFileAtomically(first_path, path,
+                                          file_permissions);
+        }
+    }
+    return range.first != range.second;
+}
+
+bool Client::linkFile(const std::string &source_path,
+                      const std::string &path)
+{
+    int result = link(source_path.c_str(), path.c_str());
+    if (result != 0 && errno == EEXIST) {
+        // Match `writeFileAtomically()`, which replaces existing files.
+        if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+            BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                std::system_error, errno, std::system_category,
+                "Could not remove \"" << path << "\" to replace it");
+        }
+        result = link(source_path.c_str(), path.c_str());
+    }
+
+    if (result != 0) {
+        // For instance, the paths are on different filesystems or the
+        // source has too many links already. The caller copies instead.
+        BUILDBOX_LOG_DEBUG("Could not hardlink \"" << path << "\" to \""
+                                                   << source_path << "\": "
+                                                   << strerror(errno));
+        return false;
+    }
+    return true;
+}
+
 Client::DownloadResults
 Client::downloadBlobs(const std::vector<Digest> &digests,
                       const WriteBlobCallback &write_blob,
                       const std::string *temp_directory, bool throw_on_error)
 {
-    DownloadResults download_results;
-    download_results.reserve(digests.size());
-
     // We first sort the digests by their sizes in ascending order, so that
     // we can then iterate through that result greedily trying to add as
     // many digests as possible to each request.
@@ -746,18 +2315,43 @@ Client::downloadBlobs(const std::vector<Digest> &digests,
               });
 
     const auto batches = makeBatches(request_list);
-    for (const auto &batch_range : batches) {
-        const size_t batch_start = batch_range.first;
-        const size_t batch_end = batch_range.second;
+
+    // Fetching all those digests that might need to be downloaded using
+    // the Bytestream API. Those will be in the range [batch_end,
+    // batches.size()).
+    size_t batch_end;
+    if (batches.empty()) {
+        batch_end = 0;
+    }
+    else {
+        batch_end = batches.rbegin()->second;
+    }
+    const size_t bytestream_count = request_list.size() - batch_end;
+
+    // Downloads may complete concurrently, but the callback is only invoked
+    // from one thread at a time.
+    std::mutex write_blob_mutex;
+    const WriteBlobCallback serialized_write_blob =
+        [&](const std::string &hash, const std::string &data) {
+            const std::lock_guard<std::mutex> lock(write_blob_mutex);
+            write_blob(hash, data);
+        };
+
+    // The results are collected separately for each request so that they
+    // are reported in the same order no matter when the requests complete.
+    std::vector<DownloadResults> batch_results(batches.size());
+    std::vector<DownloadResults> bytestream_results(bytestream_count);
+
+    const auto download_batch = [&](size_t i) {
+        const size_t range_start = batches[i].first;
+        const size_t range_end = batches[i].second;
 
         // For each batch, we make the request and then store whether it was
         // successful in the result:
         try {
-            const auto batch_results =
-                batchDownload(request_list, batch_start, batch_end, write_blob,
-                              temp_directory);
-            std::move(batch_results.cbegin(), batch_results.cend(),
-                      std::back_inserter(download_results));
+            batch_results[i] =
+                batchDownload(request_list, range_start, range_end,
+                              serialized_write_blob, temp_directory);
         }
         catch (const std::runtime_error &e) {
             BUILDBOX_LOG_ERROR("Batch download failed: " +
@@ -768,44 +2362,33 @@ Client::downloadBlobs(const std::vector<Digest> &digests,
                 throw e;
             }
 
-            // If we don't throw, we need to report in the result that the
-            // requested digests failed:
-            google::rpc::Status failed_status;
-            failed_status.set_code(grpc::StatusCode::INTERNAL);
-
-            for (auto d = batch_start; d < batch_end; d++) {
-                const Digest digest = request_list.at(d);
-                download_results.emplace_back(digest, failed_status);
-            }
-        }
-    }
-
-    // Fetching all those digests that might need to be downloaded using
-    // the Bytestream API. Those will be in the range [batch_end,
-    // batches.size()).
-    size_t batch_end;
-    if (batches.empty()) {
-        batch_end = 0;
-    }
-    else {
-        batch_end = batches.rbegin()->second;
-    }
+            // If we don't throw, we need to report in the result that the
+            // requested digests failed:
+            google::rpc::Status failed_status;
+            failed_status.set_code(grpc::StatusCode::INTERNAL);
+
+            for (auto d = range_start; d < range_end; d++) {
+                const Digest digest = request_list.at(d);
+                batch_results[i].emplace_back(digest, failed_status);
+            }
+        }
+    };
 
-    for (auto d = batch_end; d < request_list.size(); d++) {
-        const Digest digest = request_list[d];
+    const auto download_blob = [&](size_t i) {
+        const Digest &digest = request_list[batch_end + i];
 
         google::rpc::Status download_status;
         try {
             if (!temp_directory) {
                 const auto data = fetchString(digest);
-                write_blob(digest.hash_other(), data);
+                serialized_write_blob(digest.hash_other(), data);
             }
             else {
                 // Download blob directly into a file to avoid excessive
                 // memory usage for large files.
                 const auto path = *temp_directory + "/" + digest.hash_other();
-                int fd =
-                    open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+                // Readable so that `download()` can add it to the cache.
+                int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
                 if (fd < 0) {
                     BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
                         std::system_error, errno, std::generic_category,
@@ -821,7 +2404,7 @@ Client::downloadBlobs(const std::vector<Digest> &digests,
                 }
                 close(fd);
 
-                write_blob(digest.hash_other(), path);
+                serialized_write_blob(digest.hash_other(), path);
             }
             download_status.set_code(grpc::StatusCode::OK);
         }
@@ -845,12 +2428,82 @@ Client::downloadBlobs(const std::vector<Digest> &digests,
             download_status.set_code(grpc::StatusCode::INTERNAL);
         }
 
-        download_results.emplace_back(digest, download_status);
-    }
+        bytestream_results[i].emplace_back(digest, download_status);
+    };
+
+    runTransfers(batches.size(), download_batch, bytestream_count,
+                 download_blob);
 
+    DownloadResults download_results;
+    download_results.reserve(digests.size());
+    for (const auto &result_list : {&batch_results, &bytestream_results}) {
+        for (auto &request_results : *result_list) {
+            std::move(request_results.begin(), request_results.end(),
+                      std::back_inserter(download_results));
+        }
+    }
     return download_results;
 }
 
+void Client::runTransfers(
+    size_t batch_count, const std::function<void(size_t)> &batch_function,
+    size_t bytestream_count,
+    const std::function<void(size_t)> &bytestream_function)
+{
+    std::exception_ptr batch_exception;
+    std::exception_ptr bytestream_exception;
+    if (!d_transferPool) {
+        // Like `ThreadPool::parallelFor()`, the remaining calls are still
+        // made after one of them threw.
+        const auto run_all = [](size_t count,
+                                const std::function<void(size_t)> &function,
+                                std::exception_ptr *exception) {
+            for (size_t i = 0; i < count; i++) {
+                try {
+                    function(i);
+                }
+                catch (...) {
+                    if (!*exception) {
+                        *exception = std::current_exception();
+                    }
+                }
+            }
+        };
+        run_all(batch_count, batch_function, &batch_exception);
+        run_all(bytestream_count, bytestream_function, &bytestream_exception);
+    }
+    else {
+        // Both kinds of transfers proceed side by side, each one with its
+        // own limit. `parallelFor()` lets the calling thread take part in
+        // the work, so this cannot deadlock even if every worker of the
+        // pool is busy.
+        ThreadPool &pool = *d_transferPool;
+        pool.parallelFor(2, [&](size_t kind) {
+            try {
+                if (kind == 0) {
+                    pool.parallelFor(batch_count, batch_function,
+                                     d_maxConcurrentBatchRequests);
+                }
+                else {
+                    pool.parallelFor(bytestream_count, bytestream_function,
+                                     d_maxConcurrentByteStreamTransfers);
+                }
+            }
+            catch (...) {
+                (kind == 0 ? batch_exception : bytestream_exception) =
+                    std::current_exception();
+            }
+        });
+    }
+
+    if (batch_exception) {
+        std::rethrow_exception(batch_exception);
+    }
+    if (bytestream_exception) {
+        std::rethrow_exception(bytestream_exception);
+    }
+}
+
 std::unique_ptr<Client::StagedDirectory>
 Client::stage(const Digest &root_digest, const std::string &path) const
 {
@@ -893,33 +2546,64 @@ Client::stage(const Digest &root_digest, const std::string &path) const
 
 std::vector<Directory> Client::getTree(const Digest &root_digest)
 {
-    grpc::ClientContext context;
+    std::vector<Directory> tree;
+    getTree(root_digest, [&tree](const GetTreeResponse &page) {
+        tree.insert(tree.end(), page.directories().begin(),
+                    page.directories().end());
+        return true;
+    });
+    return tree;
+}
+
+std::string Client::getTree(const Digest &root_digest,
+                            const GetTreeVisitor &visitor, int page_size,
+                            const std::string &page_token)
+{
     GetTreeRequest request;
     request.set_instance_name(d_instanceName);
     request.mutable_root_digest()->CopyFrom(root_digest);
+    request.set_page_size(page_size);
+    request.set_page_token(page_token);
+
+    // Each attempt resumes from the page following the last one received.
+    // Servers that stream the tree without page tokens cannot be resumed, so
+    // those attempts are only retried if nothing was visited yet.
+    bool stopped = false;
+    bool visited = false;
+    const auto getTreeLambda = [&](grpc::ClientContext &context) {
+        std::unique_ptr<grpc::ClientReaderInterface<GetTreeResponse>> reader(
+            nextCasClient()->GetTree(&context, request));
+
+        GetTreeResponse response;
+        try {
+            while (!stopped && reader->Read(&response)) {
+                BUILDBOX_LOG_TRACE("\n" << response.directories());
+                request.set_page_token(response.next_page_token());
+                visited = true;
+                stopped = !visitor(response);
+            }
+        }
+        catch (...) {
+            context.TryCancel();
+            reader->Finish();
+            throw;
+        }
 
-    std::unique_ptr<grpc::ClientReaderInterface<GetTreeResponse>> reader(
-        d_casClient->GetTree(&context, request));
-
-    std::vector<Directory> tree;
-    GetTreeResponse response;
-    while (reader->Read(&response)) {
-        BUILDBOX_LOG_TRACE("\n" << response.directories());
-        tree.insert(tree.end(), response.directories().begin(),
-                    response.directories().end());
-    }
+        if (stopped) {
+            context.TryCancel();
+            reader->Finish();
+            return grpc::Status::OK;
+        }
 
-    grpc::Status status = reader->Finish();
-    if (!status.ok()) {
-        BUILDBOXCOMMON_THROW_EXCEPTION(std::runtime_error,
-                                       "Error getting tree for digest \""
-                                           << toString(root_digest)
-                                           << "\", status = ["
-                                           << status.error_code() << ": \""
-                                           << status.error_message() + "\"]");
-    }
+        const grpc::Status status = reader->Finish();
+        if (!status.ok() && visited && request.page_token().empty()) {
+            throwGrpcErrorException(status);
+        }
+        return status;
+    };
 
-    return tree;
+    issueRequestAndThrowOnErrors(getTreeLambda, "CAS.GetTree()");
+    return stopped ? request.page_token() : "";
 }
 
 FetchTreeResponse Client::fetchTree(const Digest &digest,
@@ -1005,6 +2689,7 @@ Client::batchUpload(const std::vector<UploadRequest> &requests,
     BatchUpdateBlobsRequest request;
     request.set_instance_name(d_instanceName);
 
+    const Compressor::Value compressor = batchUpdateCompressor();
     for (auto d = start_index; d < end_index; d++) {
         auto entry = request.add_requests();
         entry->mutable_digest()->CopyFrom(requests[d].digest);
@@ -1012,6 +2697,16 @@ Client::batchUpload(const std::vector<UploadRequest> &requests,
             requests[d].path.empty()
                 ? requests[d].data
                 : FileUtils::getFileContents(requests[d].path.c_str()));
+
+        if (compressor != Compressor::IDENTITY) {
+            // Data that does not shrink is sent as is.
+            std::string compressed =
+                Compression::compress(compressor, entry->data());
+            if (compressed.size() < entry->data().size()) {
+                entry->mutable_data()->swap(compressed);
+                entry->set_compressor(compressor);
+            }
+        }
     }
 
     BUILDBOX_LOG_TRACE("BatchUpdateBlobs Request serialized message size = "
@@ -1020,7 +2715,7 @@ Client::batchUpload(const std::vector<UploadRequest> &requests,
     BatchUpdateBlobsResponse response;
     auto batchUploadLamda = [&](grpc::ClientContext &context) {
         const auto status =
-            this->d_casClient->BatchUpdateBlobs(&context, request, &response);
+            nextCasClient()->BatchUpdateBlobs(&context, request, &response);
         return status;
     };
 
@@ -1050,20 +2745,28 @@ Client::batchDownload(const std::vector<Digest> &digests,
     assert(start_index <= end_index);
     assert(end_index <= digests.size());
 
-    BatchReadBlobsRequest request;
-    request.set_instance_name(d_instanceName);
-
-    for (auto d = start_index; d < end_index; d++) {
-        auto digest = request.add_digests();
-        digest->CopyFrom(digests[d]);
-    }
+    const BatchReadBlobsRequest request =
+        makeBatchReadRequest(digests, start_index, end_index);
     BUILDBOX_LOG_TRACE("BatchReadBlobs Request serialized message size = "
                        << request.ByteSizeLong());
 
     BatchReadBlobsResponse response;
     auto batchDownloadLamda = [&](grpc::ClientContext &context) {
-        const auto status =
-            this->d_casClient->BatchReadBlobs(&context, request, &response);
+        if (!d_batchReadHedger) {
+            return nextCasClient()->BatchReadBlobs(&context, request,
+                                                   &response);
+        }
+
+        BatchReadBlobsResponse responses[2];
+        size_t winner = 0;
+        const grpc::Status status = d_batchReadHedger->issue(
+            context,
+            [&](grpc::ClientContext &attemptContext, size_t attempt) {
+                return nextCasClient()->BatchReadBlobs(
+                    &attemptContext, request, &responses[attempt]);
+            },
+            d_metadata_attach_function, &winner);
+        response.Swap(&responses[winner]);
         return status;
     };
 
@@ -1075,24 +2778,14 @@ Client::batchDownload(const std::vector<Digest> &digests,
     DownloadResults download_results;
     download_results.reserve(static_cast<size_t>(response.responses_size()));
 
-    for (const auto &downloadResponse : response.responses()) {
-        if (downloadResponse.status().code() == GRPC_STATUS_OK) {
-            const auto downloaded_digest =
-                d_digestGenerator.hash(downloadResponse.data());
-            if (downloaded_digest != downloadResponse.digest()) {
-                google::rpc::Status status;
-                status.set_code(grpc::StatusCode::INTERNAL);
-                std::ostringstream error;
-                error << "Expected blob with digest "
-                      << downloadResponse.digest()
-                      << ", but downloaded blob has digest "
-                      << downloaded_digest;
-                status.set_message(error.str());
-                download_results.emplace_back(downloadResponse.digest(),
-                                              status);
-                continue;
+    for (auto &downloadResponse : *response.mutable_responses()) {
+        const google::rpc::Status status =
+            checkBatchReadResponse(&downloadResponse);
+        if (status.code() == GRPC_STATUS_OK) {
+            if (d_localBlobCache) {
+                d_localBlobCache->insert(downloadResponse.digest(),
+                                         downloadResponse.data());
             }
-
             if (!temp_directory) {
                 write_blob_function(downloadResponse.digest().hash_other(),
                                     downloadResponse.data());
@@ -1113,15 +2806,99 @@ Client::batchDownload(const std::vector<Digest> &digests,
             }
         }
 
-        download_results.emplace_back(downloadResponse.digest(),
-                                      downloadResponse.status());
+        download_results.emplace_back(downloadResponse.digest(), status);
     }
 
     return download_results;
 }
 
+BatchReadBlobsRequest
+Client::makeBatchReadRequest(const std::vector<Digest> &digests,
+                             const size_t start_index,
+                             const size_t end_index) const
+{
+    assert(start_index <= end_index);
+    assert(end_index <= digests.size());
+
+    BatchReadBlobsRequest request;
+    request.set_instance_name(d_instanceName);
+
+    for (auto d = start_index; d < end_index; d++) {
+        auto digest = request.add_digests();
+        digest->CopyFrom(digests[d]);
+    }
+    const Compressor::Value compressor = transferCompressor();
+    if (compressor != Compressor::IDENTITY) {
+        request.add_acceptable_compressors(compressor);
+    }
+    return request;
+}
+
+google::rpc::Status Client::checkBatchReadResponse(
+    BatchReadBlobsResponse::Response *response) const
+{
+    if (response->status().code() != GRPC_STATUS_OK) {
+        return response->status();
+    }
+
+    google::rpc::Status status;
+    if (response->compressor() != Compressor::IDENTITY) {
+        const auto expected_size =
+            static_cast<size_t>(response->digest().size_bytes());
+        try {
+            std::string decompressed = Compression::decompress(
+                response->compressor(), response->data(), expected_size);
+            response->mutable_data()->swap(decompressed);
+        }
+        catch (const std::exception &e) {
+            status.set_code(grpc::StatusCode::INTERNAL);
+            status.set_message(std::string("Could not decompress blob: ") +
+                               e.what());
+            return status;
+        }
+    }
+
+    if (!d_verifyDownloads) {
+        // Still catch truncated or mixed-up responses, which is cheap.
+        if (static_cast<google::protobuf::int64>(response->data().size()) !=
+            response->digest().size_bytes()) {
+            status.set_code(grpc::StatusCode::INTERNAL);
+            std::ostringstream error;
+            error << "Expected " << response->digest().size_bytes()
+                  << " bytes for " << response->digest().hash_other()
+                  << ", but downloaded blob was " << response->data().size()
+                  << " bytes";
+            status.set_message(error.str());
+            return status;
+        }
+    }
+    else {
+        const auto downloaded_digest =
+            d_digestGenerator.hash(response->data());
+        if (downloaded_digest != response->digest()) {
+            status.set_code(grpc::StatusCode::INTERNAL);
+            std::ostringstream error;
+            error << "Expected blob with digest " << response->digest()
+                  << ", but downloaded blob has digest " << downloaded_digest;
+            status.set_message(error.str());
+            return status;
+        }
+    }
+    recordDownloadVerification(response->data().size());
+
+    status.set_code(grpc::StatusCode::OK);
+    return status;
+}
+
 std::vector<std::pair<size_t, size_t>>
 Client::makeBatches(const std::vector<Digest> &digests)
+{
+    return makeBatches(digests, d_maxBatchTotalSizeBytes);
+}
+
+std::vector<std::pair<size_t, size_t>>
+Client::makeBatches(const std::vector<Digest> &digests,
+                    size_t maxBatchTotalSizeBytes)
 {
     // The below value is set based on rounding up of static data sizes
     // in the gRPC classes BatchUpdateBlobsRequest(upload) and
@@ -1136,11 +2913,14 @@ Client::makeBatches(const std::vector<Digest> &digests)
     static const size_t PER_BLOB_METADATA_SIZE = 256;
 
     // A batch is a pair of indexes into the vector of `digests` that
-    // can all fit in one `d_maxBatchTotalSizeBytes` sized buffer;
+    // can all fit in one `maxBatchTotalSizeBytes` sized buffer;
     // The indices are semantically represented by [batch_start, batch_end)
     std::vector<std::pair<size_t, size_t>> batches;
+    if (maxBatchTotalSizeBytes <= SIZEOF_ESTIMATED_TOP_LEVEL_GRPC_CONTAINER) {
+        return batches;
+    }
     const size_t max_batch_size =
-        d_maxBatchTotalSizeBytes - SIZEOF_ESTIMATED_TOP_LEVEL_GRPC_CONTAINER;
+        maxBatchTotalSizeBytes - SIZEOF_ESTIMATED_TOP_LEVEL_GRPC_CONTAINER;
     size_t batch_start = 0;
     size_t batch_end = 0;
     while (batch_end < digests.size()) {
@@ -1172,107 +2952,460 @@ Client::makeBatches(const std::vector<Digest> &digests)
 std::vector<Digest>
 Client::findMissingBlobs(const std::vector<Digest> &digests)
 {
+    std::vector<Digest> digests_to_query;
+    const std::vector<FindMissingBlobsRequest> requests_to_issue =
+        makeFindMissingBlobsRequests(digests, &digests_to_query);
+    if (requests_to_issue.empty()) {
+        return {};
+    }
+
+    std::vector<FindMissingBlobsResponse> responses(requests_to_issue.size());
+    const auto issueRequest = [&](size_t i) {
+        auto findMissingBlobsLambda = [&](grpc::ClientContext &context) {
+            return nextCasClient()->FindMissingBlobs(
+                &context, requests_to_issue[i], &responses[i]);
+        };
+
+        issueRequestAndThrowOnErrors(findMissingBlobsLambda,
+                                     "FindMissingBlobs()");
+    };
+
+    if (d_findMissingBlobsPool && requests_to_issue.size() > 1) {
+        d_findMissingBlobsPool->parallelFor(
+            requests_to_issue.size(), issueRequest,
+            d_maxConcurrentFindMissingBlobsRequests);
+    }
+    else {
+        for (size_t i = 0; i < requests_to_issue.size(); i++) {
+            issueRequest(i);
+        }
+    }
+
+    return collectMissingBlobs(responses, digests_to_query);
+}
+
+std::vector<FindMissingBlobsRequest> Client::makeFindMissingBlobsRequests(
+    const std::vector<Digest> &digests,
+    std::vector<Digest> *queried_digests) const
+{
+    // Blobs that the server recently confirmed having are not queried again.
+    std::vector<Digest> unknown_digests;
+    if (d_presenceCache) {
+        unknown_digests = d_presenceCache->filterUnknown(digests);
+        if (unknown_digests.empty()) {
+            queried_digests->clear();
+            return {};
+        }
+    }
+    const std::vector<Digest> &candidate_digests =
+        d_presenceCache ? unknown_digests : digests;
+
+    // Asking about the same blob twice is of no use:
+    std::vector<Digest> &digests_to_query = *queried_digests;
+    digests_to_query.clear();
+    digests_to_query.reserve(candidate_digests.size());
+    {
+        std::unordered_set<Digest> seen;
+        seen.reserve(candidate_digests.size());
+        for (const Digest &digest : candidate_digests) {
+            if (seen.insert(digest).second) {
+                digests_to_query.push_back(digest);
+            }
+        }
+    }
+
     FindMissingBlobsRequest request;
     request.set_instance_name(d_instanceName);
 
     // We take the given digests and split them across requests to not exceed
-    // the maximum size of a gRPC message:
+    // the maximum size of a gRPC message. Each entry of the repeated field
+    // costs its own size plus a one-byte tag and a length prefix.
+    const size_t empty_request_size = request.ByteSizeLong();
     std::vector<FindMissingBlobsRequest> requests_to_issue;
-    size_t batch_size = 0;
-    for (const Digest &digest : digests) {
+    size_t request_size = empty_request_size;
+    for (const Digest &digest : digests_to_query) {
         const size_t digest_size = digest.ByteSizeLong();
-        if (batch_size + digest_size > bytestreamChunkSizeBytes()) {
+        const size_t entry_size =
+            1 +
+            google::protobuf::io::CodedOutputStream::VarintSize64(
+                digest_size) +
+            digest_size;
+        if (request.blob_digests_size() > 0 &&
+            request_size + entry_size > bytestreamChunkSizeBytes()) {
             requests_to_issue.push_back(request);
             request.clear_blob_digests();
-            batch_size = 0;
-        }
-        else {
-            batch_size += digest_size;
+            request_size = empty_request_size;
         }
 
-        auto entry = request.add_blob_digests();
-        entry->CopyFrom(digest);
+        request.add_blob_digests()->CopyFrom(digest);
+        request_size += entry_size;
     }
-    requests_to_issue.push_back(request);
+    requests_to_issue.push_back(std::move(request));
+    return requests_to_issue;
+}
 
+std::vector<Digest> Client::collectMissingBlobs(
+    const std::vector<FindMissingBlobsResponse> &responses,
+    const std::vector<Digest> &queried_digests)
+{
     std::vector<Digest> missing_blobs;
-    for (const auto &request_to_issue : requests_to_issue) {
-        FindMissingBlobsResponse response;
-        auto findMissingBlobsLambda = [&](grpc::ClientContext &context) {
-            const auto status = this->d_casClient->FindMissingBlobs(
-                &context, request_to_issue, &response);
-            return status;
-        };
-
-        issueRequestAndThrowOnErrors(findMissingBlobsLambda,
-                                     "FindMissingBlobs()");
-
+    for (const FindMissingBlobsResponse &response : responses) {
         missing_blobs.insert(missing_blobs.end(),
                              response.missing_blob_digests().cbegin(),
                              response.missing_blob_digests().cend());
     }
 
+    if (d_presenceCache) {
+        const std::unordered_set<Digest> missing_set(missing_blobs.cbegin(),
+                                                     missing_blobs.cend());
+        for (const Digest &digest : queried_digests) {
+            if (missing_set.count(digest) == 0) {
+                d_presenceCache->insert(digest);
+            }
+        }
+    }
+
     return missing_blobs;
 }
 
-std::vector<Client::UploadResult>
-Client::uploadDirectory(const std::string &path, Digest *root_directory_digest,
-                        Tree *tree)
+std::future<std::string> Client::fetchStringAsync(const Digest &digest)
 {
-    // Recursing through the directory and building a map:
-    digest_string_map directory_map;
-    const NestedDirectory nested_dir =
-        make_nesteddirectory(path.c_str(), &directory_map);
+    const auto promise = std::make_shared<std::promise<std::string>>();
+    startFetchAsync(digest,
+                    [promise](std::exception_ptr error, std::string *data) {
+                        if (error) {
+                            promise->set_exception(error);
+                        }
+                        else {
+                            promise->set_value(std::move(*data));
+                        }
+                    });
+    return promise->get_future();
+}
 
-    const Digest directory_digest = nested_dir.to_digest(&directory_map);
-    if (root_directory_digest != nullptr) {
-        root_directory_digest->CopyFrom(directory_digest);
+void Client::startFetchAsync(const Digest &digest,
+                             const AsyncFetchCallback &callback)
+{
+    BUILDBOX_LOG_TRACE("Downloading " << digest.hash_other()
+                                      << " to string asynchronously");
+    const Compressor::Value compressor = transferCompressor();
+    (new AsyncByteStreamRead(
+         completionQueueRunner(), makeRetrier(nullptr, "ByteStream.Read()"),
+         nextByteStreamClient(),
+         makeResourceName(digest, false, compressor), compressor, digest,
+         d_verifyDownloads ? &d_digestGenerator : nullptr,
+         [this, callback](std::exception_ptr error, std::string *data) {
+             if (data != nullptr) {
+                 recordDownloadVerification(data->size());
+             }
+             callback(error, data);
+         }))
+        ->start();
+}
+
+std::future<void> Client::uploadAsync(const std::string &data,
+                                      const Digest &digest)
+{
+    BUILDBOX_LOG_DEBUG("Uploading " << digest.hash_other()
+                                    << " from string asynchronously");
+    const auto data_size = static_cast<google::protobuf::int64>(data.size());
+    if (data_size != digest.size_bytes()) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(
+            std::logic_error, "Digest length of "
+                                  << digest.size_bytes() << " bytes for "
+                                  << digest.hash_other()
+                                  << " does not match string length of "
+                                  << data_size << " bytes");
     }
 
-    // FindMissingBlobs():
-    directory_map = missingDigests(directory_map);
+    const Compressor::Value compressor = transferCompressor();
+    const auto payload = std::make_shared<const std::string>(
+        compressor == Compressor::IDENTITY
+            ? data
+            : Compression::compress(compressor, data));
+
+    const auto promise = std::make_shared<std::promise<void>>();
+    const auto callback = [this, promise, digest](std::exception_ptr error) {
+        if (error) {
+            promise->set_exception(error);
+            return;
+        }
+        if (d_presenceCache) {
+            d_presenceCache->insert(digest);
+        }
+        promise->set_value();
+    };
 
-    // Batch upload the blobs missing in the remote:
-    std::vector<UploadRequest> upload_requests;
-    upload_requests.reserve(directory_map.size());
-    for (const auto &entry : directory_map) {
-        const Digest digest = entry.first;
+    (new AsyncByteStreamWrite(
+         completionQueueRunner(), makeRetrier(nullptr, "ByteStream.Write()"),
+         nextByteStreamClient(), makeResourceName(digest, true, compressor),
+         payload, compressor != Compressor::IDENTITY, digest,
+         bytestreamChunkSizeBytes(), callback))
+        ->start();
+    return promise->get_future();
+}
+
+std::future<std::vector<Digest>>
+Client::findMissingBlobsAsync(const std::vector<Digest> &digests)
+{
+    struct State {
+        std::mutex mutex;
+        size_t pending;
+        std::vector<Digest> queried_digests;
+        std::vector<FindMissingBlobsResponse> responses;
+        std::exception_ptr error;
+        std::promise<std::vector<Digest>> promise;
+    };
+    const auto state = std::make_shared<State>();
+    auto future = state->promise.get_future();
+
+    const auto requests =
+        makeFindMissingBlobsRequests(digests, &state->queried_digests);
+    if (requests.empty()) {
+        state->promise.set_value({});
+        return future;
+    }
+
+    state->pending = requests.size();
+    state->responses.resize(requests.size());
+    for (size_t i = 0; i < requests.size(); i++) {
+        const auto callback = [this, state, i](
+                                  const grpc::Status &status,
+                                  std::exception_ptr error,
+                                  FindMissingBlobsResponse *response) {
+            if (!error && !status.ok()) {
+                error = grpcErrorExceptionPtr(status);
+            }
+
+            const std::lock_guard<std::mutex> lock(state->mutex);
+            if (error) {
+                if (!state->error) {
+                    state->error = error;
+                }
+            }
+            else {
+                state->responses[i].Swap(response);
+            }
+
+            if (--state->pending > 0) {
+                return;
+            }
+            if (state->error) {
+                state->promise.set_exception(state->error);
+                return;
+            }
+            try {
+                state->promise.set_value(collectMissingBlobs(
+                    state->responses, state->queried_digests));
+            }
+            catch (...) {
+                state->promise.set_exception(std::current_exception());
+            }
+        };
+
+        const FindMissingBlobsRequest &request = requests[i];
+        ContentAddressableStorage::StubInterface *stub = nextCasClient();
+        (new AsyncUnaryCall<FindMissingBlobsResponse>(
+             completionQueueRunner(),
+             makeRetrier(nullptr, "FindMissingBlobs()"),
+             [stub, request](grpc::ClientContext *context,
+                             grpc::CompletionQueue *queue) {
+                 return stub->AsyncFindMissingBlobs(context, request, queue);
+             },
+             callback))
+            ->start();
+    }
+    return future;
+}
 
-        Directory directory;
-        if (directory.ParseFromString(entry.second)) {
-            upload_requests.emplace_back(UploadRequest(digest, entry.second));
+std::future<Client::DownloadBlobsResult>
+Client::downloadBlobsAsync(const std::vector<Digest> &digests)
+{
+    struct State {
+        std::mutex mutex;
+        size_t pending;
+        DownloadBlobsResult result;
+        std::promise<DownloadBlobsResult> promise;
+
+        // Record the outcome of one of the requests.
+        void addResult(const std::string &hash,
+                       const google::rpc::Status &status,
+                       std::string *data)
+        {
+            auto &entry = result[hash];
+            entry.first = status;
+            if (data != nullptr) {
+                entry.second.swap(*data);
+            }
         }
-        else {
-            const std::string file_contents =
-                FileUtils::getFileContents(entry.second.c_str());
-            upload_requests.emplace_back(UploadRequest(digest, file_contents));
+
+        void requestFinished()
+        {
+            if (--pending == 0) {
+                promise.set_value(std::move(result));
+            }
         }
+    };
+    const auto state = std::make_shared<State>();
+    auto future = state->promise.get_future();
+
+    // As in `downloadBlobs()`, the smallest blobs are grouped into batches
+    // and the rest fetched with ByteStream.
+    auto request_list(digests);
+    std::sort(request_list.begin(), request_list.end(),
+              [](const Digest &d1, const Digest &d2) {
+                  return d1.size_bytes() < d2.size_bytes();
+              });
+    const auto batches = makeBatches(request_list);
+    const size_t batch_end = batches.empty() ? 0 : batches.rbegin()->second;
+
+    state->pending = batches.size() + (request_list.size() - batch_end);
+    if (state->pending == 0) {
+        state->promise.set_value({});
+        return future;
+    }
+
+    for (const auto &batch : batches) {
+        std::vector<Digest> batch_digests(
+            request_list.cbegin() + static_cast<long>(batch.first),
+            request_list.cbegin() + static_cast<long>(batch.second));
+        const auto callback = [this, state, batch_digests](
+                                  const grpc::Status &status,
+                                  std::exception_ptr error,
+                                  BatchReadBlobsResponse *response) {
+            // As in `downloadBlobs()`, if the whole request failed every
+            // digest in it is reported with an INTERNAL error.
+            google::rpc::Status failed_status;
+            try {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+                if (!status.ok()) {
+                    throwGrpcErrorException(status);
+                }
+            }
+            catch (const std::exception &e) {
+                BUILDBOX_LOG_ERROR("Batch download failed: " +
+                                   std::string(e.what()));
+                failed_status.set_code(grpc::StatusCode::INTERNAL);
+                failed_status.set_message(e.what());
+            }
+
+            const std::lock_guard<std::mutex> lock(state->mutex);
+            if (failed_status.code() != grpc::StatusCode::OK) {
+                for (const Digest &digest : batch_digests) {
+                    state->addResult(digest.hash_other(), failed_status,
+                                     nullptr);
+                }
+            }
+            else {
+                for (auto &entry : *response->mutable_responses()) {
+                    const google::rpc::Status entry_status =
+                        checkBatchReadResponse(&entry);
+                    state->addResult(entry.digest().hash_other(),
+                                     entry_status,
+                                     entry_status.code() == GRPC_STATUS_OK
+                                         ? entry.mutable_data()
+                                         : nullptr);
+                }
+            }
+            state->requestFinished();
+        };
+
+        const BatchReadBlobsRequest request =
+            makeBatchReadRequest(request_list, batch.first, batch.second);
+        ContentAddressableStorage::StubInterface *stub = nextCasClient();
+        (new AsyncUnaryCall<BatchReadBlobsResponse>(
+             completionQueueRunner(), makeRetrier(nullptr, "BatchReadBlobs()"),
+             [stub, request](grpc::ClientContext *context,
+                             grpc::CompletionQueue *queue) {
+                 return stub->AsyncBatchReadBlobs(context, request, queue);
+             },
+             callback))
+            ->start();
     }
 
-    if (tree != nullptr) {
-        tree->CopyFrom(nested_dir.to_tree());
+    for (size_t i = batch_end; i < request_list.size(); i++) {
+        const std::string hash = request_list[i].hash_other();
+        const auto callback = [state, hash](std::exception_ptr error,
+                                            std::string *data) {
+            google::rpc::Status status;
+            try {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+                status.set_code(grpc::StatusCode::OK);
+            }
+            catch (const GrpcError &e) {
+                status.set_code(e.status.error_code());
+                status.set_message(e.status.error_message());
+            }
+            catch (const std::exception &e) {
+                BUILDBOX_LOG_ERROR("Error: fetchStringAsync(): " +
+                                   std::string(e.what()));
+                status.set_code(grpc::StatusCode::INTERNAL);
+                status.set_message(e.what());
+            }
+
+            const std::lock_guard<std::mutex> lock(state->mutex);
+            state->addResult(hash, status, error ? nullptr : data);
+            state->requestFinished();
+        };
+        startFetchAsync(request_list[i], callback);
     }
 
-    return uploadBlobs(upload_requests);
+    return future;
 }
 
-digest_string_map
-Client::missingDigests(const digest_string_map &directory_map)
+std::vector<Client::UploadResult>
+Client::uploadDirectory(const std::string &path, Digest *root_directory_digest,
+                        Tree *tree)
 {
-    std::vector<Digest> digests_in_directory;
-    digests_in_directory.reserve(directory_map.size());
-    for (const auto &entry : directory_map) {
-        digests_in_directory.push_back(entry.first);
+    // Recursing through the directory and building a map of the files'
+    // paths:
+    digest_string_map file_map;
+    const NestedDirectory nested_dir =
+        d_directoryCapturePool
+            ? make_nesteddirectory_parallel(*d_directoryCapturePool,
+                                            path.c_str(), &file_map)
+            : make_nesteddirectory(path.c_str(), &file_map);
+
+    // ...and one of the serialized Directory messages:
+    digest_string_map directory_map;
+    const Digest directory_digest = nested_dir.to_digest(&directory_map, tree);
+    if (root_directory_digest != nullptr) {
+        root_directory_digest->CopyFrom(directory_digest);
     }
 
-    const std::vector<Digest> missing_blobs =
-        findMissingBlobs(digests_in_directory);
+    // FindMissingBlobs():
+    std::vector<Digest> digests;
+    digests.reserve(directory_map.size() + file_map.size());
+    for (const auto &entry : directory_map) {
+        digests.push_back(entry.first);
+    }
+    for (const auto &entry : file_map) {
+        digests.push_back(entry.first);
+    }
+    const std::vector<Digest> missing_blobs = findMissingBlobs(digests);
 
-    digest_string_map missing_files;
+    // Upload the blobs missing in the remote. Files are referenced by path
+    // and only read when their batch is sent or streamed with ByteStream,
+    // so the memory used does not grow with the size of the directory.
+    std::vector<UploadRequest> upload_requests;
+    upload_requests.reserve(missing_blobs.size());
     for (const Digest &digest : missing_blobs) {
-        missing_files[digest] = directory_map.at(digest);
+        const auto directory_it = directory_map.find(digest);
+        if (directory_it != directory_map.cend()) {
+            upload_requests.emplace_back(
+                UploadRequest(digest, directory_it->second));
+        }
+        else {
+            upload_requests.emplace_back(
+                UploadRequest::from_path(digest, file_map.at(digest)));
+        }
     }
-    return missing_files;
+
+    return uploadBlobs(upload_requests);
 }
 
 Client::StagedDirectory::StagedDirectory(
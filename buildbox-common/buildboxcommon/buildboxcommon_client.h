@@ -17,16 +17,25 @@
 #ifndef INCLUDED_BUILDBOXCOMMON_CLIENT
 #define INCLUDED_BUILDBOXCOMMON_CLIENT
 
+#include <atomic>
 #include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 
 #include <buildboxcommon_cashash.h>
+#include <buildboxcommon_completionqueuerunner.h>
+#include <buildboxcommon_compression.h>
 #include <buildboxcommon_connectionoptions.h>
 #include <buildboxcommon_grpcretrier.h>
+#include <buildboxcommon_localblobcache.h>
 #include <buildboxcommon_merklize.h>
+#include <buildboxcommon_presencecache.h>
 #include <buildboxcommon_protos.h>
+#include <buildboxcommon_requesthedger.h>
 #include <buildboxcommon_requestmetadata.h>
+#include <buildboxcommon_threadpool.h>
 
 namespace buildboxcommon {
 
@@ -37,6 +46,12 @@ namespace buildboxcommon {
  */
 class Client {
   public:
+    // Counters of the downloaded bytes that were checked against their
+    // digest, and of those that were not because of
+    // `setVerifyDownloads(false)`.
+    static const std::string s_bytesVerifiedMetricName;
+    static const std::string s_bytesNotVerifiedMetricName;
+
     Client(){};
 
     Client(std::shared_ptr<ByteStream::StubInterface> bytestreamClient,
@@ -53,6 +68,11 @@ class Client {
     }
     /**
      * Connect to the CAS server with the given connection options.
+     *
+     * If `options.d_channelCount` is greater than one, ByteStream and CAS
+     * requests are spread over that many connections. Otherwise the channel
+     * is shared with the other users of equivalent options, as obtained
+     * from `ChannelRegistry`.
      */
     void init(const ConnectionOptions &options);
 
@@ -75,6 +95,118 @@ class Client {
                               const std::string &tool_invocation_id,
                               const std::string &correlated_invocations_id);
 
+    /**
+     * Set a pool on which `uploadDirectory()` reads directories and hashes
+     * files concurrently. By default, or if `pool` is null, the directory is
+     * walked serially on the calling thread.
+     */
+    void setDirectoryCapturePool(const std::shared_ptr<ThreadPool> &pool);
+
+    /**
+     * Limit the amount of blob data that uploads read into memory at once.
+     * Blobs are grouped into `BatchUpdateBlobs()` requests of at most
+     * `limitBytes` (or the server's maximum batch size, if smaller), and
+     * larger ones are streamed from their source with ByteStream, one chunk
+     * of `bytestreamChunkSizeBytes()` at a time. The default, 0, leaves only
+     * the server's limit in place.
+     */
+    void setUploadMemoryLimit(size_t limitBytes);
+
+    /**
+     * Allow `uploadBlobs()` and `downloadBlobs()` to keep up to
+     * `maxBatchRequests` batch requests in flight and, at the same time, up
+     * to `maxByteStreamTransfers` ByteStream transfers of the blobs that are
+     * too large to be batched. The default, 1 and 1, issues every request in
+     * turn on the calling thread.
+     *
+     * When a memory limit is set, it is shared between the concurrent batch
+     * requests.
+     *
+     * Throws `std::invalid_argument` if either value is 0.
+     */
+    void setTransferConcurrency(size_t maxBatchRequests,
+                                size_t maxByteStreamTransfers);
+
+    /**
+     * Allow `findMissingBlobs()` to keep up to `maxRequests` requests in
+     * flight when the digests do not fit in a single one. The default, 1,
+     * issues them in turn on the calling thread.
+     *
+     * Throws `std::invalid_argument` if `maxRequests` is 0.
+     */
+    void setFindMissingBlobsConcurrency(size_t maxRequests);
+
+    /**
+     * Allow `downloadBlobs()` to hardlink output paths that share a digest
+     * and executable bit instead of giving each of them its own copy. This
+     * is only safe if the files will not be modified in place. Disabled by
+     * default.
+     */
+    void setDownloadHardLinks(bool allowHardLinks);
+
+    /**
+     * Remember which blobs the server is known to have in `cache`. Digests
+     * found there are left out of `findMissingBlobs()` queries and skipped
+     * by `uploadBlobs()`. The cache is filled from `FindMissingBlobs()`
+     * responses and successful uploads. By default, or if `cache` is null,
+     * every digest is sent to the server.
+     */
+    void setPresenceCache(const std::shared_ptr<PresenceCache> &cache);
+
+    /**
+     * Keep downloaded blobs in `cache`. `fetchString()`, `download()`,
+     * `downloadBlobs()` and `downloadDirectory()` look blobs up there before
+     * requesting them from the server, and files are staged from it with a
+     * reflink or a copy, or with a hardlink if `setDownloadHardLinks()`
+     * allows it. By default, or if `cache` is null, every blob is fetched.
+     */
+    void setLocalBlobCache(const std::shared_ptr<LocalBlobCache> &cache);
+
+    /**
+     * Check downloaded blobs against their digests, which is the default.
+     * Disabling it saves hashing their contents when the server is trusted,
+     * such as a local casd; the sizes of `BatchReadBlobs()` responses are
+     * still checked. `init(ConnectionOptions)` disables it for endpoints
+     * marked as trusted.
+     */
+    void setVerifyDownloads(bool verify);
+
+    /**
+     * Send slow reads a second time and keep the first response: the
+     * ByteStream reads of `fetchString()` with `byteStreamReads`, and
+     * `BatchReadBlobs()` requests with `batchReads`. Either can be null,
+     * which is the default, to not hedge those reads. Since each hedger
+     * tracks the latency of its requests, they should not be shared.
+     */
+    void setReadHedging(const std::shared_ptr<RequestHedger> &byteStreamReads,
+                        const std::shared_ptr<RequestHedger> &batchReads);
+
+    /**
+     * Transfer blobs compressed with `compressor` when the server supports
+     * it, as reported by `GetCapabilities()` in `init()`. ByteStream
+     * transfers and `BatchReadBlobs()` use it if the server lists it in
+     * `supported_compressors`, and `BatchUpdateBlobs()` if it lists it in
+     * `supported_batch_update_compressors`. Digests are always verified
+     * against the uncompressed data. The default, `IDENTITY`, disables
+     * compression.
+     *
+     * Throws `std::invalid_argument` if `compressor` is not available in
+     * this build (see `Compression::isSupported()`).
+     */
+    void setCompressor(Compressor::Value compressor);
+
+    /**
+     * Set the number of threads that drive the calls of the asynchronous
+     * methods (`fetchStringAsync()`, `uploadAsync()`,
+     * `findMissingBlobsAsync()` and `downloadBlobsAsync()`) on a gRPC
+     * completion queue. The default is 1. The threads are started by the
+     * first asynchronous call; if they are running already, this waits for
+     * the calls in flight to complete.
+     *
+     * Throws `std::invalid_argument` if `numThreads` is 0.
+     */
+    void setCompletionQueueThreads(size_t numThreads);
+
     /**
      * Download the blob with the given digest and return it.
      *
@@ -92,20 +224,66 @@ class Client {
      */
     void download(int fd, const Digest &digest);
 
+    /**
+     * Download the directory with the given digest into `path`, which must
+     * exist.
+     *
+     * The tree is fetched one level at a time, with all the Directory
+     * messages of a level requested together. The directories are then
+     * created, and the files of the whole tree downloaded in one go, each
+     * distinct blob being requested once.
+     *
+     * It does not rely on `GetTree()`, which not every server implements.
+     * See `downloadDirectoryFromTree()` for those that do.
+     */
     void downloadDirectory(const Digest &digest, const std::string &path);
 
+    /**
+     * Download the directory with the given digest into `path`, which must
+     * exist, listing the tree with a single streamed `getTree()` call.
+     *
+     * Each page is processed as soon as it is received: the directories
+     * and symlinks it allows to place are created, and their files are
+     * downloaded in the background while the following pages are read.
+     * Each distinct blob is requested once for the whole tree.
+     *
+     * If the server does not return every Directory of the tree, throw an
+     * `std::runtime_error` exception.
+     */
+    void downloadDirectoryFromTree(const Digest &digest,
+                                   const std::string &path);
+
     /**
      * Upload the given string. If it can't be uploaded successfully, throw
      * an exception.
+     *
+     * Retried attempts resume from the offset the server reports as
+     * committed with `QueryWriteStatus()`.
      */
     void upload(const std::string &data, const Digest &digest);
 
     /**
      * Upload a blob from the given file descriptor. If it can't be uploaded
      * successfully, throw an exception.
+     *
+     * Retried attempts resume from the offset the server reports as
+     * committed with `QueryWriteStatus()`.
      */
     void upload(int fd, const Digest &digest);
 
+    /**
+     * Hash the file open at `fd` and upload it unless the server already
+     * has it. Return its digest.
+     *
+     * A file small enough for a batch request is read into memory once,
+     * hashed from there and sent with `BatchUpdateBlobs()`. A larger one is
+     * hashed, and read a second time to be streamed only if
+     * `FindMissingBlobs()` reports it missing.
+     *
+     * If the file cannot be read or uploaded, throw an exception.
+     */
+    Digest hashAndUploadFile(int fd);
+
     struct UploadRequest {
         Digest digest;
         std::string data;
@@ -144,6 +322,17 @@ class Client {
     std::vector<UploadResult>
     uploadBlobs(const std::vector<UploadRequest> &requests);
 
+    /* Hash the files in `paths` and upload the ones that the server does
+     * not have yet, like `hashAndUploadFile()`, in as few requests as
+     * possible.
+     *
+     * Return the digest of each file, in the order of `paths`, together with
+     * the status of its upload. If a file cannot be read, throw an
+     * `std::system_error` exception.
+     */
+    std::vector<UploadResult>
+    hashAndUploadFiles(const std::vector<std::string> &paths);
+
     typedef std::unordered_map<std::string,
                                std::pair<google::rpc::Status, std::string>>
         DownloadBlobsResult;
@@ -177,6 +366,10 @@ class Client {
      * path specified by the entry's first member in the `outputs` map. If the
      * second member of the tuple is true, mark the file as executable.
      *
+     * Each distinct blob is fetched once. When several paths share it, the
+     * first one is written with the downloaded data and the rest are copied
+     * from it locally (or hardlinked, see `setDownloadHardLinks()`).
+     *
      * If any errors are encountered in the process of fetching the blobs, it
      * aborts and throws an `std::runtime_error` exception. (It might leave
      * directories in an inconsistent state, i.e. with missing files.)
@@ -187,14 +380,38 @@ class Client {
                        const OutputMap &outputs);
 
     /**
-     * Given a list of digests, creates and sends a `FindMissingBlobsRequest`
-     * to the server.
+     * Given a list of digests, creates and sends `FindMissingBlobsRequest`s
+     * to the server. Duplicate digests are only sent once, and they are
+     * split across as many requests as needed to keep each one under
+     * `bytestreamChunkSizeBytes()`.
      *
      * Returns a list of Digests that the remote server reports not having,
-     * or throws a runtime_exception if the request failed.
+     * in the order in which the requests were made, or throws a
+     * runtime_exception if any request failed.
      */
     std::vector<Digest> findMissingBlobs(const std::vector<Digest> &digests);
 
+    /**
+     * Asynchronous versions of `fetchString()`, `upload()`,
+     * `findMissingBlobs()` and `downloadBlobs()`. They return as soon as
+     * the requests are issued, without blocking a thread per request, and
+     * the futures become ready when they complete. Failures are retried as
+     * in the synchronous methods, and the exceptions those would throw are
+     * stored in the futures instead.
+     *
+     * `uploadAsync()` keeps a copy of `data` and, unlike `upload()`, starts
+     * retried attempts from the beginning of the blob. It throws
+     * `std::logic_error` right away if `data` does not match the size in
+     * `digest`.
+     */
+    std::future<std::string> fetchStringAsync(const Digest &digest);
+    std::future<void> uploadAsync(const std::string &data,
+                                  const Digest &digest);
+    std::future<std::vector<Digest>>
+    findMissingBlobsAsync(const std::vector<Digest> &digests);
+    std::future<DownloadBlobsResult>
+    downloadBlobsAsync(const std::vector<Digest> &digests);
+
     /**
      * Uploads the contents of the given path.
      *
@@ -290,6 +507,32 @@ class Client {
      */
     std::vector<Directory> getTree(const Digest &digest);
 
+    /**
+     * Called with each page of a tree as it is received by `getTree()`.
+     * Returning `false` stops the traversal.
+     */
+    typedef std::function<bool(const GetTreeResponse &page)> GetTreeVisitor;
+
+    /**
+     * Stream the Directory tree whose root digest is `digest` with the CAS
+     * GetTree() call, invoking `visitor` on each page as it arrives instead
+     * of collecting the whole tree.
+     *
+     * If `page_size` is not 0, pages hold at most that many directories.
+     * The listing starts from `page_token`, which is either empty or a
+     * `next_page_token` returned by the server. Attempts that fail with a
+     * retryable error resume from the last page received.
+     *
+     * Return the token of the next page if `visitor` stopped the traversal,
+     * or an empty string once the whole tree was visited.
+     *
+     * On error throw a `GrpcError` exception. Exceptions thrown by
+     * `visitor` are propagated.
+     */
+    std::string getTree(const Digest &digest, const GetTreeVisitor &visitor,
+                        int page_size = 0,
+                        const std::string &page_token = "");
+
     /**
      * Issue a LocalCAS `FetchTree()` call and return the response.
      *
@@ -373,12 +616,30 @@ class Client {
         download_callback_t;
     typedef std::function<Directory(const Digest &digest)>
         return_directory_callback_t;
+    typedef std::function<std::vector<Directory>(
+        const std::vector<Digest> &digests)>
+        return_directories_callback_t;
 
     void downloadDirectory(
         const Digest &digest, const std::string &path,
         const download_callback_t &download_callback,
         const return_directory_callback_t &return_directory_callback);
 
+    /* Breadth-first implementation of `downloadDirectory()`. The
+     * `return_directories_callback` is invoked once per level of the tree
+     * with the digests of the Directory messages in it, and must return
+     * those messages in the same order. `download_callback` is invoked once,
+     * after all directories and symlinks were created.
+     */
+    void downloadDirectoryByLevel(
+        const Digest &digest, const std::string &path,
+        const download_callback_t &download_callback,
+        const return_directories_callback_t &return_directories_callback);
+
+    /* Create the subdirectories and symlinks of `directory` in `path`. */
+    static void createDirectoryEntries(const Directory &directory,
+                                       const std::string &path);
+
     /* Upload multiple digests in an efficient way, allowing each digest to
      * potentially fail separately.
      *
@@ -403,18 +664,54 @@ class Client {
     int d_grpcRetryDelay = 100;
 
   private:
-    std::shared_ptr<grpc::Channel> d_channel;
+    std::vector<std::shared_ptr<grpc::Channel>> d_channels;
     std::shared_ptr<ByteStream::StubInterface> d_bytestreamClient;
     std::shared_ptr<ContentAddressableStorage::StubInterface> d_casClient;
     std::shared_ptr<LocalContentAddressableStorage::StubInterface>
         d_localCasClient;
     std::shared_ptr<Capabilities::StubInterface> d_capabilitiesClient;
 
+    // One stub per channel when connected with `init(ConnectionOptions)`,
+    // used in turn by transfers. Empty if the stubs were given directly.
+    std::vector<std::shared_ptr<ByteStream::StubInterface>>
+        d_bytestreamClients;
+    std::vector<std::shared_ptr<ContentAddressableStorage::StubInterface>>
+        d_casClients;
+    std::atomic<size_t> d_nextChannel{0};
+
     size_t d_maxBatchTotalSizeBytes;
 
+    std::shared_ptr<ThreadPool> d_directoryCapturePool;
+    size_t d_uploadMemoryLimitBytes = 0;
+
+    size_t d_maxConcurrentBatchRequests = 1;
+    size_t d_maxConcurrentByteStreamTransfers = 1;
+    std::shared_ptr<ThreadPool> d_transferPool;
+
+    size_t d_maxConcurrentFindMissingBlobsRequests = 1;
+    std::shared_ptr<ThreadPool> d_findMissingBlobsPool;
+
+    bool d_downloadHardLinks = false;
+
+    std::shared_ptr<PresenceCache> d_presenceCache;
+
+    std::shared_ptr<LocalBlobCache> d_localBlobCache;
+
+    bool d_verifyDownloads = true;
+
+    std::shared_ptr<RequestHedger> d_byteStreamReadHedger;
+    std::shared_ptr<RequestHedger> d_batchReadHedger;
+
+    Compressor::Value d_compressor = Compressor::IDENTITY;
+    // Compressors advertised by the server in its `CacheCapabilities`.
+    std::vector<Compressor::Value> d_serverCompressors;
+    std::vector<Compressor::Value> d_serverBatchUpdateCompressors;
+
     std::string d_uuid;
     std::string d_instanceName;
 
+    size_t d_completionQueueThreads = 1;
+
     DigestGenerator d_digestGenerator;
 
     RequestMetadataGenerator d_metadata_generator;
@@ -426,7 +723,71 @@ class Client {
     // Maximum number of bytes that can be sent in a single gRPC message.
     static const size_t s_bytestreamChunkSizeBytes;
 
-    std::string makeResourceName(const Digest &digest, bool is_upload);
+    std::string
+    makeResourceName(const Digest &digest, bool is_upload,
+                     Compressor::Value compressor = Compressor::IDENTITY);
+
+    /* Return the compressor to use for ByteStream transfers and
+     * `BatchReadBlobs()`, or `IDENTITY` if the server does not support the
+     * one that was set.
+     */
+    Compressor::Value transferCompressor() const;
+
+    /* Likewise for `BatchUpdateBlobs()`. */
+    Compressor::Value batchUpdateCompressor() const;
+
+    /* Count `bytes` of a downloaded blob as verified or not. */
+    void recordDownloadVerification(size_t bytes) const;
+
+    /* Return the stub to use for the next ByteStream or CAS request,
+     * cycling through the channels.
+     */
+    ByteStream::StubInterface *nextByteStreamClient();
+    ContentAddressableStorage::StubInterface *nextCasClient();
+
+    /* Stream the blob with the given digest to `resourceName` on
+     * `bytestream`, compressing it with `compressor` on the fly. Its
+     * uncompressed contents are obtained, in order, from `next_chunk`, which
+     * returns false if there is no more data.
+     */
+    grpc::Status
+    writeCompressed(ByteStream::StubInterface *bytestream,
+                    grpc::ClientContext &context,
+                    const std::string &resourceName,
+                    Compressor::Value compressor, const Digest &digest,
+                    const std::function<bool(std::string *)> &next_chunk);
+
+    /* Ask the server with `QueryWriteStatus()` on `bytestream` how many
+     * bytes of the upload to `resourceName` it has committed, so that a
+     * retried `Write()` on it can continue from there. Return 0 if the
+     * server cannot tell or reports a value that is not usable for a blob of
+     * `size` bytes.
+     */
+    size_t queryCommittedSize(ByteStream::StubInterface *bytestream,
+                              const std::string &resourceName, size_t size);
+
+    /* Largest `BatchUpdateBlobs()` request to send, taking the upload
+     * memory limit into account.
+     */
+    size_t maxUploadBatchSizeBytes() const;
+
+    /* Hash the file open at `fd`. If it is small enough to be uploaded in a
+     * batch request, also store its contents in `data`, read in the same
+     * pass, and return true.
+     */
+    bool hashFileForUpload(int fd, Digest *digest, std::string *data);
+
+    /* Replace `path` with a hardlink to `source_path`. Return false, leaving
+     * `path` untouched or removed, if the link could not be created.
+     */
+    static bool linkFile(const std::string &source_path,
+                         const std::string &path);
+
+    /* Write every path of `digest` in `outputs` from the local blob cache.
+     * Return false, without writing any of them, if it is not cached.
+     */
+    bool stageFromLocalBlobCache(const Digest &digest,
+                                 const OutputMap &outputs);
 
     /* Given a list of digests, download the data and return it in a map
      * indexed by hash. Allow each digest to potentially fail separately.
@@ -469,19 +830,31 @@ class Client {
                                   const std::string *temp_directory = nullptr);
 
     /* Given a list of digests sorted by increasing size, forms batches
-     * according to the value of `d_maxBatchTotalSizeBytes`.
+     * according to the value of `d_maxBatchTotalSizeBytes`, or to
+     * `maxBatchTotalSizeBytes` if specified.
      */
     std::vector<std::pair<size_t, size_t>>
     makeBatches(const std::vector<Digest> &digests);
-
-    /* Given a directory map, invoke `findMissingBlobs()` and return a map
-     * with the subset of protos that need to be uploaded.
-     */
-    digest_string_map missingDigests(const digest_string_map &directory_map);
+    std::vector<std::pair<size_t, size_t>>
+    makeBatches(const std::vector<Digest> &digests,
+                size_t maxBatchTotalSizeBytes);
 
     /* Upload a single request. */
     void uploadRequest(const UploadRequest &request);
 
+    /* Invoke `batch_function(i)` for every `i` in `[0, batch_count)` and
+     * `bytestream_function(j)` for every `j` in `[0, bytestream_count)`,
+     * keeping in flight at most as many calls of each kind as configured
+     * with `setTransferConcurrency()`. Returns once all of them completed,
+     * even if some threw; in that case, the first exception thrown by
+     * `batch_function` is rethrown, or else the first one thrown by
+     * `bytestream_function`.
+     */
+    void runTransfers(size_t batch_count,
+                      const std::function<void(size_t)> &batch_function,
+                      size_t bytestream_count,
+                      const std::function<void(size_t)> &bytestream_function);
+
     /*
      * RequestMetadata values. They will be attached to requests sent by this
      * client.
@@ -497,6 +870,52 @@ class Client {
 
     GrpcRetrier makeRetrier(const GrpcRetrier::GrpcInvocation &invocation,
                             const std::string &name) const;
+
+    /* Split the digests that `findMissingBlobs()` needs to ask about into
+     * requests, leaving out duplicates and those in the presence cache.
+     * `queried_digests` is set to the digests that are included.
+     */
+    std::vector<FindMissingBlobsRequest>
+    makeFindMissingBlobsRequests(const std::vector<Digest> &digests,
+                                 std::vector<Digest> *queried_digests) const;
+
+    /* Return the digests reported missing in `responses`, in order, and
+     * remember the rest of `queried_digests` in the presence cache.
+     */
+    std::vector<Digest> collectMissingBlobs(
+        const std::vector<FindMissingBlobsResponse> &responses,
+        const std::vector<Digest> &queried_digests);
+
+    /* Build the `BatchReadBlobs()` request for the digests in
+     * [start_index, end_index).
+     */
+    BatchReadBlobsRequest makeBatchReadRequest(
+        const std::vector<Digest> &digests, const size_t start_index,
+        const size_t end_index) const;
+
+    /* Decompress the data of an entry of a `BatchReadBlobs()` response in
+     * place and verify it against its digest. Return the status of the
+     * entry, which is not OK if it failed either way.
+     */
+    google::rpc::Status
+    checkBatchReadResponse(BatchReadBlobsResponse::Response *response) const;
+
+    typedef std::function<void(std::exception_ptr error, std::string *data)>
+        AsyncFetchCallback;
+
+    /* Start downloading a blob on the completion queue and invoke
+     * `callback` when done, possibly from within this call.
+     */
+    void startFetchAsync(const Digest &digest,
+                         const AsyncFetchCallback &callback);
+
+    /* Return the runner of asynchronous calls, starting it if needed. */
+    CompletionQueueRunner *completionQueueRunner();
+
+    // Declared last so that it is destroyed first, waiting for the calls in
+    // flight, which use the rest of the members.
+    std::mutex d_completionQueueRunnerMutex;
+    std::unique_ptr<CompletionQueueRunner> d_completionQueueRunner;
 };
 
 } // namespace buildboxcommon
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_completionqueuerunner.h>
+
+#include <buildboxcommon_exception.h>
+#include <buildboxcommon_logging.h>
+
+#include <chrono>
+#include <stdexcept>
+
+namespace buildboxcommon {
+
+CompletionQueueRunner::CompletionQueueRunner(size_t numThreads)
+    : d_activeOperations(0)
+{
+    if (numThreads == 0) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(
+            std::invalid_argument,
+            "A completion queue needs at least one thread");
+    }
+
+    d_threads.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; i++) {
+        d_threads.emplace_back(&CompletionQueueRunner::run, this);
+    }
+}
+
+CompletionQueueRunner::~CompletionQueueRunner()
+{
+    {
+        std::unique_lock<std::mutex> lock(d_mutex);
+        d_idleCondition.wait(lock, [this] { return d_activeOperations == 0; });
+    }
+
+    d_queue.Shutdown();
+    for (auto &thread : d_threads) {
+        thread.join();
+    }
+}
+
+void CompletionQueueRunner::operationStarted()
+{
+    const std::lock_guard<std::mutex> lock(d_mutex);
+    d_activeOperations++;
+}
+
+void CompletionQueueRunner::operationFinished()
+{
+    const std::lock_guard<std::mutex> lock(d_mutex);
+    d_activeOperations--;
+    if (d_activeOperations == 0) {
+        d_idleCondition.notify_all();
+    }
+}
+
+void CompletionQueueRunner::run()
+{
+    void *tag;
+    bool ok;
+    while (d_queue.Next(&tag, &ok)) {
+        static_cast<Operation *>(tag)->proceed(ok);
+    }
+}
+
+AsyncGrpcCall::AsyncGrpcCall(CompletionQueueRunner *runner,
+                             const GrpcRetrier &retrier)
+    : d_runner(runner), d_retrier(retrier), d_waitingForRetry(false)
+{
+}
+
+void AsyncGrpcCall::start()
+{
+    d_runner->operationStarted();
+    startNextAttempt();
+}
+
+void AsyncGrpcCall::startNextAttempt()
+{
+    d_context.reset(new grpc::ClientContext());
+    d_retrier.prepareContext(d_context.get());
+
+    try {
+        startAttempt(d_context.get(), d_runner->queue());
+    }
+    catch (...) {
+        finish(grpc::Status::OK, std::current_exception());
+    }
+}
+
+void AsyncGrpcCall::proceed(bool ok)
+{
+    if (d_waitingForRetry) {
+        d_waitingForRetry = false;
+        startNextAttempt();
+        return;
+    }
+
+    grpc::Status status;
+    try {
+        if (!handleEvent(ok, &status)) {
+            return;
+        }
+    }
+    catch (...) {
+        d_context->TryCancel();
+        finish(status, std::current_exception());
+        return;
+    }
+
+    std::chrono::milliseconds retryDelay;
+    if (d_retrier.attemptFinished(status, &retryDelay) ==
+        GrpcRetrier::AttemptResult::Retry) {
+        d_waitingForRetry = true;
+        d_retryAlarm.reset(new grpc::Alarm());
+        d_retryAlarm->Set(d_runner->queue(),
+                          std::chrono::system_clock::now() + retryDelay,
+                          this);
+        return;
+    }
+
+    finish(status, nullptr);
+}
+
+void AsyncGrpcCall::finish(const grpc::Status &status,
+                           std::exception_ptr error)
+{
+    CompletionQueueRunner *runner = d_runner;
+    onDone(status, error);
+    delete this;
+    runner->operationFinished();
+}
+
+} // namespace buildboxcommon
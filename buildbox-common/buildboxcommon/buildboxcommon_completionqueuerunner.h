@@ -0,0 +1,202 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDED_BUILDBOXCOMMON_COMPLETIONQUEUERUNNER
+#define INCLUDED_BUILDBOXCOMMON_COMPLETIONQUEUERUNNER
+
+#include <buildboxcommon_grpcretrier.h>
+#include <buildboxcommon_protos.h>
+
+#include <grpcpp/alarm.h>
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace buildboxcommon {
+
+class CompletionQueueRunner final {
+    /*
+     * Owns a `grpc::CompletionQueue` and the threads that wait on it.
+     *
+     * Every tag placed in the queue must point to an `Operation`, whose
+     * `proceed()` is invoked on one of the threads when the event
+     * completes. Operations must be registered with `operationStarted()` and
+     * `operationFinished()`: the destructor waits for all of them to finish
+     * before shutting the queue down.
+     */
+  public:
+    class Operation {
+      public:
+        virtual ~Operation() {}
+
+        // Handle the completion of an event tagged with this operation.
+        // `ok` is the value returned by `grpc::CompletionQueue::Next()`.
+        virtual void proceed(bool ok) = 0;
+    };
+
+    // Throws `std::invalid_argument` if `numThreads` is 0.
+    explicit CompletionQueueRunner(size_t numThreads = 1);
+    ~CompletionQueueRunner();
+
+    CompletionQueueRunner(const CompletionQueueRunner &) = delete;
+    CompletionQueueRunner &operator=(const CompletionQueueRunner &) = delete;
+
+    grpc::CompletionQueue *queue() { return &d_queue; }
+
+    void operationStarted();
+    void operationFinished();
+
+  private:
+    grpc::CompletionQueue d_queue;
+
+    std::mutex d_mutex;
+    std::condition_variable d_idleCondition;
+    size_t d_activeOperations;
+
+    std::vector<std::thread> d_threads;
+
+    void run();
+};
+
+class AsyncGrpcCall : public CompletionQueueRunner::Operation {
+    /*
+     * Base for a gRPC call issued on a `CompletionQueueRunner` and retried
+     * as configured in a `GrpcRetrier`, waiting between attempts with a
+     * `grpc::Alarm` instead of blocking a thread.
+     *
+     * Subclasses issue an attempt in `startAttempt()` and handle its events
+     * in `handleEvent()`. At most one event may be pending at a time, and
+     * its tag must be `this`. Since it can complete on another thread right
+     * away, nothing may be touched after issuing it; streaming calls must
+     * therefore be created with `PrepareAsyncFoo()` and then started.
+     *
+     * Once the call is over, successfully or not, `onDone()` is invoked and
+     * the object deletes itself.
+     */
+  public:
+    AsyncGrpcCall(CompletionQueueRunner *runner, const GrpcRetrier &retrier);
+
+    // Issue the first attempt. From then on the object owns itself.
+    void start();
+
+    void proceed(bool ok) override;
+
+  protected:
+    // Issue an attempt of the call on `context`, which is fresh for each
+    // attempt.
+    virtual void startAttempt(grpc::ClientContext *context,
+                              grpc::CompletionQueue *queue) = 0;
+
+    // Handle the completion of the pending event. Return false if another
+    // one was issued, or true and set `status` if the attempt ended.
+    //
+    // If this (or `startAttempt()`) throws, the call is cancelled and
+    // finishes with that exception. They must therefore not throw while an
+    // event is pending.
+    virtual bool handleEvent(bool ok, grpc::Status *status) = 0;
+
+    // Invoked once with the status of the last attempt, which is not OK if
+    // the retry limit was exceeded, or with the exception that aborted the
+    // call. Must not throw.
+    virtual void onDone(const grpc::Status &status,
+                        std::exception_ptr error) = 0;
+
+  private:
+    CompletionQueueRunner *d_runner;
+    GrpcRetrier d_retrier;
+
+    std::unique_ptr<grpc::ClientContext> d_context;
+
+    // Wakes the call up to issue the next attempt. It is only replaced by
+    // the following retry, once it has certainly fired.
+    std::unique_ptr<grpc::Alarm> d_retryAlarm;
+    bool d_waitingForRetry;
+
+    void startNextAttempt();
+    void finish(const grpc::Status &status, std::exception_ptr error);
+};
+
+template <typename Response>
+class AsyncUnaryCall final : public AsyncGrpcCall {
+    /*
+     * Issues a unary call, for instance with a stub's `AsyncFoo()` method:
+     *
+     * ```
+     * (new AsyncUnaryCall<FooResponse>(
+     *     runner, retrier,
+     *     [=](grpc::ClientContext *context, grpc::CompletionQueue *queue) {
+     *         return stub->AsyncFoo(context, request, queue);
+     *     },
+     *     callback))
+     *     ->start();
+     * ```
+     */
+  public:
+    typedef std::function<
+        std::unique_ptr<grpc::ClientAsyncResponseReaderInterface<Response>>(
+            grpc::ClientContext *, grpc::CompletionQueue *)>
+        Invocation;
+
+    // Invoked with the final status and the response received with it.
+    typedef std::function<void(const grpc::Status &status,
+                               std::exception_ptr error, Response *response)>
+        Callback;
+
+    AsyncUnaryCall(CompletionQueueRunner *runner, const GrpcRetrier &retrier,
+                   const Invocation &invocation, const Callback &callback)
+        : AsyncGrpcCall(runner, retrier), d_invocation(invocation),
+          d_callback(callback)
+    {
+    }
+
+  protected:
+    void startAttempt(grpc::ClientContext *context,
+                      grpc::CompletionQueue *queue) override
+    {
+        d_response.Clear();
+        d_reader = d_invocation(context, queue);
+        d_reader->Finish(&d_response, &d_status, this);
+    }
+
+    bool handleEvent(bool, grpc::Status *status) override
+    {
+        *status = d_status;
+        return true;
+    }
+
+    void onDone(const grpc::Status &status, std::exception_ptr error) override
+    {
+        d_callback(status, error, &d_response);
+    }
+
+  private:
+    const Invocation d_invocation;
+    const Callback d_callback;
+
+    std::unique_ptr<grpc::ClientAsyncResponseReaderInterface<Response>>
+        d_reader;
+    Response d_response;
+    grpc::Status d_status;
+};
+
+} // namespace buildboxcommon
+
+#endif
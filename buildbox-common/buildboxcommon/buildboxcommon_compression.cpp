@@ -0,0 +1,411 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_compression.h>
+
+#include <buildboxcommon_exception.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <zlib.h>
+
+#ifdef BUILDBOXCOMMON_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace buildboxcommon {
+
+namespace {
+
+// Amount by which the output buffer is grown each time it fills up.
+const size_t OUTPUT_CHUNK_SIZE = 64 * 1024;
+
+// Make room for `OUTPUT_CHUNK_SIZE` more bytes at the end of `out` and
+// return a pointer to them. The caller shrinks it back to what was written.
+char *growOutput(std::string *out)
+{
+    const size_t used = out->size();
+    out->resize(used + OUTPUT_CHUNK_SIZE);
+    return &(*out)[used];
+}
+
+class IdentityStream : public CompressionStream {
+  public:
+    explicit IdentityStream(size_t maxOutputSize)
+        : d_maxOutputSize(maxOutputSize), d_outputSize(0)
+    {
+    }
+
+    void process(const char *data, size_t size, bool,
+                 std::string *out) override
+    {
+        d_outputSize += size;
+        if (d_outputSize > d_maxOutputSize) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(
+                std::runtime_error, "Data exceeds the expected "
+                                        << d_maxOutputSize << " bytes");
+        }
+        out->append(data, size);
+    }
+
+  private:
+    const size_t d_maxOutputSize;
+    size_t d_outputSize;
+};
+
+// zlib counts bytes in `uInt`, so larger inputs are fed in pieces.
+const size_t MAX_ZLIB_INPUT_SIZE = std::numeric_limits<uInt>::max();
+
+// Window size for raw deflate streams, without zlib or gzip headers. The
+// negative sign is what selects the raw format.
+const int RAW_DEFLATE_WINDOW_BITS = -15;
+
+class DeflateCompressor : public CompressionStream {
+  public:
+    DeflateCompressor()
+    {
+        std::memset(&d_stream, 0, sizeof(d_stream));
+        // Compression competes with the network transfer for time, so the
+        // fastest level is used.
+        if (deflateInit2(&d_stream, Z_BEST_SPEED, Z_DEFLATED,
+                         RAW_DEFLATE_WINDOW_BITS, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(
+                std::runtime_error, "Could not initialize deflate stream");
+        }
+    }
+
+    ~DeflateCompressor() override { deflateEnd(&d_stream); }
+
+    DeflateCompressor(const DeflateCompressor &) = delete;
+    DeflateCompressor &operator=(const DeflateCompressor &) = delete;
+
+    void process(const char *data, size_t size, bool finish,
+                 std::string *out) override
+    {
+        size_t offset = 0;
+        do {
+            const size_t piece = std::min(size - offset, MAX_ZLIB_INPUT_SIZE);
+            d_stream.next_in =
+                reinterpret_cast<Bytef *>(const_cast<char *>(data + offset));
+            d_stream.avail_in = static_cast<uInt>(piece);
+            offset += piece;
+
+            const bool last = finish && offset == size;
+            int ret;
+            do {
+                const size_t used = out->size();
+                d_stream.next_out = reinterpret_cast<Bytef *>(growOutput(out));
+                d_stream.avail_out = static_cast<uInt>(OUTPUT_CHUNK_SIZE);
+                ret = deflate(&d_stream, last ? Z_FINISH : Z_NO_FLUSH);
+                out->resize(used + OUTPUT_CHUNK_SIZE - d_stream.avail_out);
+                if (ret == Z_STREAM_ERROR) {
+                    BUILDBOXCOMMON_THROW_EXCEPTION(std::runtime_error,
+                                                   "deflate() failed");
+                }
+            } while (last ? ret != Z_STREAM_END : d_stream.avail_out == 0);
+        } while (offset < size);
+    }
+
+  private:
+    z_stream d_stream;
+};
+
+class DeflateDecompressor : public CompressionStream {
+  public:
+    explicit DeflateDecompressor(size_t maxOutputSize)
+        : d_maxOutputSize(maxOutputSize), d_outputSize(0), d_finished(false)
+    {
+        std::memset(&d_stream, 0, sizeof(d_stream));
+        if (inflateInit2(&d_stream, RAW_DEFLATE_WINDOW_BITS) != Z_OK) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(
+                std::runtime_error, "Could not initialize inflate stream");
+        }
+    }
+
+    ~DeflateDecompressor() override { inflateEnd(&d_stream); }
+
+    DeflateDecompressor(const DeflateDecompressor &) = delete;
+    DeflateDecompressor &operator=(const DeflateDecompressor &) = delete;
+
+    void process(const char *data, size_t size, bool finish,
+                 std::string *out) override
+    {
+        size_t offset = 0;
+        while (offset < size) {
+            if (d_finished) {
+                BUILDBOXCOMMON_THROW_EXCEPTION(
+                    std::runtime_error,
+                    "Unexpected data after the end of the deflate stream");
+            }
+
+            const size_t piece = std::min(size - offset, MAX_ZLIB_INPUT_SIZE);
+            d_stream.next_in =
+                reinterpret_cast<Bytef *>(const_cast<char *>(data + offset));
+            d_stream.avail_in = static_cast<uInt>(piece);
+
+            do {
+                const size_t used = out->size();
+                d_stream.next_out = reinterpret_cast<Bytef *>(growOutput(out));
+                d_stream.avail_out = static_cast<uInt>(OUTPUT_CHUNK_SIZE);
+                const int ret = inflate(&d_stream, Z_NO_FLUSH);
+                const size_t produced = OUTPUT_CHUNK_SIZE - d_stream.avail_out;
+                out->resize(used + produced);
+
+                if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                    BUILDBOXCOMMON_THROW_EXCEPTION(
+                        std::runtime_error,
+                        "Malformed deflate stream: "
+                            << (d_stream.msg ? d_stream.msg : "error")
+                            << " (" << ret << ")");
+                }
+
+                d_outputSize += produced;
+                if (d_outputSize > d_maxOutputSize) {
+                    BUILDBOXCOMMON_THROW_EXCEPTION(
+                        std::runtime_error,
+                        "Data decompresses to more than the expected "
+                            << d_maxOutputSize << " bytes");
+                }
+
+                if (ret == Z_STREAM_END) {
+                    d_finished = true;
+                    break;
+                }
+            } while (d_stream.avail_out == 0);
+
+            offset += piece - d_stream.avail_in;
+        }
+
+        if (finish && !d_finished) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(std::runtime_error,
+                                           "Truncated deflate stream");
+        }
+    }
+
+  private:
+    const size_t d_maxOutputSize;
+    size_t d_outputSize;
+    bool d_finished;
+    z_stream d_stream;
+};
+
+#ifdef BUILDBOXCOMMON_HAVE_ZSTD
+class ZstdCompressor : public CompressionStream {
+  public:
+    ZstdCompressor() : d_context(ZSTD_createCCtx())
+    {
+        if (d_context == nullptr) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(
+                std::runtime_error, "Could not create zstd context");
+        }
+    }
+
+    ~ZstdCompressor() override { ZSTD_freeCCtx(d_context); }
+
+    ZstdCompressor(const ZstdCompressor &) = delete;
+    ZstdCompressor &operator=(const ZstdCompressor &) = delete;
+
+    void process(const char *data, size_t size, bool finish,
+                 std::string *out) override
+    {
+        ZSTD_inBuffer input = {data, size, 0};
+        const ZSTD_EndDirective mode = finish ? ZSTD_e_end : ZSTD_e_continue;
+        bool done = false;
+        while (!done) {
+            const size_t used = out->size();
+            ZSTD_outBuffer output = {growOutput(out), OUTPUT_CHUNK_SIZE, 0};
+            const size_t remaining =
+                ZSTD_compressStream2(d_context, &output, &input, mode);
+            out->resize(used + output.pos);
+            if (ZSTD_isError(remaining)) {
+                BUILDBOXCOMMON_THROW_EXCEPTION(
+                    std::runtime_error, "zstd compression failed: "
+                                            << ZSTD_getErrorName(remaining));
+            }
+            done = finish ? remaining == 0 : input.pos == input.size;
+        }
+    }
+
+  private:
+    ZSTD_CCtx *d_context;
+};
+
+class ZstdDecompressor : public CompressionStream {
+  public:
+    explicit ZstdDecompressor(size_t maxOutputSize)
+        : d_context(ZSTD_createDCtx()), d_maxOutputSize(maxOutputSize),
+          d_outputSize(0), d_frameComplete(false)
+    {
+        if (d_context == nullptr) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(
+                std::runtime_error, "Could not create zstd context");
+        }
+    }
+
+    ~ZstdDecompressor() override { ZSTD_freeDCtx(d_context); }
+
+    ZstdDecompressor(const ZstdDecompressor &) = delete;
+    ZstdDecompressor &operator=(const ZstdDecompressor &) = delete;
+
+    void process(const char *data, size_t size, bool finish,
+                 std::string *out) override
+    {
+        ZSTD_inBuffer input = {data, size, 0};
+        bool outputFull = false;
+        while (input.pos < input.size || outputFull) {
+            const size_t used = out->size();
+            ZSTD_outBuffer output = {growOutput(out), OUTPUT_CHUNK_SIZE, 0};
+            const size_t ret =
+                ZSTD_decompressStream(d_context, &output, &input);
+            out->resize(used + output.pos);
+            if (ZSTD_isError(ret)) {
+                BUILDBOXCOMMON_THROW_EXCEPTION(std::runtime_error,
+                                               "Malformed zstd stream: "
+                                                   << ZSTD_getErrorName(ret));
+            }
+
+            d_outputSize += output.pos;
+            if (d_outputSize > d_maxOutputSize) {
+                BUILDBOXCOMMON_THROW_EXCEPTION(
+                    std::runtime_error,
+                    "Data decompresses to more than the expected "
+                        << d_maxOutputSize << " bytes");
+            }
+
+            // 0 means that a frame was completely decoded and flushed.
+            d_frameComplete = (ret == 0);
+            outputFull = (output.pos == output.size);
+        }
+
+        if (finish && !d_frameComplete) {
+            BUILDBOXCOMMON_THROW_EXCEPTION(std::runtime_error,
+                                           "Truncated zstd stream");
+        }
+    }
+
+  private:
+    ZSTD_DCtx *d_context;
+    const size_t d_maxOutputSize;
+    size_t d_outputSize;
+    bool d_frameComplete;
+};
+#endif
+
+void checkSupported(Compressor::Value compressor)
+{
+    if (!Compression::isSupported(compressor)) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(std::invalid_argument,
+                                       "Unsupported compressor \""
+                                           << Compression::name(compressor)
+                                           << "\"");
+    }
+}
+
+} // namespace
+
+bool Compression::isSupported(Compressor::Value compressor)
+{
+    switch (compressor) {
+        case Compressor::IDENTITY:
+        case Compressor::DEFLATE:
+            return true;
+#ifdef BUILDBOXCOMMON_HAVE_ZSTD
+        case Compressor::ZSTD:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+std::vector<Compressor::Value> Compression::supportedCompressors()
+{
+    std::vector<Compressor::Value> compressors;
+#ifdef BUILDBOXCOMMON_HAVE_ZSTD
+    compressors.push_back(Compressor::ZSTD);
+#endif
+    compressors.push_back(Compressor::DEFLATE);
+    return compressors;
+}
+
+std::string Compression::name(Compressor::Value compressor)
+{
+    std::string result = Compressor::Value_Name(compressor);
+    std::transform(result.begin(), result.end(), result.begin(), ::tolower);
+    return result;
+}
+
+std::unique_ptr<CompressionStream>
+Compression::makeCompressor(Compressor::Value compressor)
+{
+    checkSupported(compressor);
+    switch (compressor) {
+        case Compressor::DEFLATE:
+            return std::unique_ptr<CompressionStream>(new DeflateCompressor());
+#ifdef BUILDBOXCOMMON_HAVE_ZSTD
+        case Compressor::ZSTD:
+            return std::unique_ptr<CompressionStream>(new ZstdCompressor());
+#endif
+        default:
+            return std::unique_ptr<CompressionStream>(new IdentityStream(
+                std::numeric_limits<size_t>::max()));
+    }
+}
+
+std::unique_ptr<CompressionStream>
+Compression::makeDecompressor(Compressor::Value compressor,
+                              size_t maxOutputSize)
+{
+    checkSupported(compressor);
+    switch (compressor) {
+        case Compressor::DEFLATE:
+            return std::unique_ptr<CompressionStream>(
+                new DeflateDecompressor(maxOutputSize));
+#ifdef BUILDBOXCOMMON_HAVE_ZSTD
+        case Compressor::ZSTD:
+            return std::unique_ptr<CompressionStream>(
+                new ZstdDecompressor(maxOutputSize));
+#endif
+        default:
+            return std::unique_ptr<CompressionStream>(
+                new IdentityStream(maxOutputSize));
+    }
+}
+
+std::string Compression::compress(Compressor::Value compressor,
+                                  const std::string &data)
+{
+    std::string result;
+    makeCompressor(compressor)->process(data.data(), data.size(), true,
+                                        &result);
+    return result;
+}
+
+std::string Compression::decompress(Compressor::Value compressor,
+                                    const std::string &data,
+                                    size_t maxOutputSize)
+{
+    std::string result;
+    result.reserve(maxOutputSize);
+    makeDecompressor(compressor, maxOutputSize)
+        ->process(data.data(), data.size(), true, &result);
+    return result;
+}
+
+} // namespace buildboxcommon
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDED_BUILDBOXCOMMON_COMPRESSION
+#define INCLUDED_BUILDBOXCOMMON_COMPRESSION
+
+#include <buildboxcommon_protos.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace buildboxcommon {
+
+class CompressionStream {
+    /*
+     * Compresses or decompresses a blob that is fed to it in pieces.
+     */
+  public:
+    virtual ~CompressionStream() {}
+
+    // Process the next `size` bytes of input and append the output produced
+    // so far to `out`. `finish` must be set with the last piece of input
+    // (which can be empty), so that all the remaining output is flushed.
+    //
+    // Throws `std::runtime_error` if the input cannot be processed.
+    virtual void process(const char *data, size_t size, bool finish,
+                         std::string *out) = 0;
+};
+
+struct Compression {
+    // Return whether `compressor` is available in this build. `IDENTITY`
+    // always is, `DEFLATE` is provided by zlib, and `ZSTD` requires the
+    // library to be built with libzstd.
+    static bool isSupported(Compressor::Value compressor);
+
+    // Return the compressors other than `IDENTITY` that are available.
+    static std::vector<Compressor::Value> supportedCompressors();
+
+    // Return the lowercase name of `compressor`, as used in
+    // "compressed-blobs" resource names.
+    static std::string name(Compressor::Value compressor);
+
+    // Create a stream that compresses its input with `compressor`.
+    // Throws `std::invalid_argument` if it is not supported.
+    static std::unique_ptr<CompressionStream>
+    makeCompressor(Compressor::Value compressor);
+
+    // Create a stream that decompresses its input with `compressor`. It
+    // throws `std::runtime_error` if the input is malformed or truncated or
+    // if it decompresses to more than `maxOutputSize` bytes.
+    // Throws `std::invalid_argument` if `compressor` is not supported.
+    static std::unique_ptr<CompressionStream>
+    makeDecompressor(Compressor::Value compressor, size_t maxOutputSize);
+
+    // One-shot versions of the above.
+    static std::string compress(Compressor::Value compressor,
+                                const std::string &data);
+    static std::string decompress(Compressor::Value compressor,
+                                  const std::string &data,
+                                  size_t maxOutputSize);
+};
+
+} // namespace buildboxcommon
+
+#endif
@@ -119,11 +119,21 @@ void ConnectionOptions::setUseGoogleApiAuth(const bool value)
     this->d_useGoogleApiAuth = value;
 }
 
+void ConnectionOptions::setTrustedEndpoint(const bool value)
+{
+    this->d_trustedEndpoint = value;
+}
+
 void ConnectionOptions::setLoadBalancingPolicy(const std::string &value)
 {
     this->d_loadBalancingPolicy = value.c_str();
 }
 
+void ConnectionOptions::setChannelCount(const std::string &value)
+{
+    this->d_channelCount = value.c_str();
+}
+
 bool ConnectionOptions::parseArg(const char *arg, const char *prefix)
 {
     if (arg == nullptr || arg[0] != '-' || arg[1] != '-') {
@@ -181,11 +191,19 @@ bool ConnectionOptions::parseArg(const char *arg, const char *prefix)
             this->d_loadBalancingPolicy = value;
             return true;
         }
+        else if (key == "channel-count") {
+            this->d_channelCount = value;
+            return true;
+        }
     }
     else if (std::string(arg) == "googleapi-auth") {
         this->d_useGoogleApiAuth = true;
         return true;
     }
+    else if (std::string(arg) == "trusted-endpoint") {
+        this->d_trustedEndpoint = true;
+        return true;
+    }
     return false;
 }
 
@@ -231,18 +249,53 @@ void ConnectionOptions::putArgs(std::vector<std::string> *out,
     if (this->d_useGoogleApiAuth) {
         out->push_back("--googleapi-auth");
     }
+    if (this->d_trustedEndpoint) {
+        out->push_back("--" + p + "trusted-endpoint");
+    }
     if (this->d_loadBalancingPolicy != nullptr) {
         out->push_back("--" + p + "load-balancing-policy=" +
                        std::string(this->d_loadBalancingPolicy));
     }
+    if (this->d_channelCount != nullptr) {
+        out->push_back("--" + p +
+                       "channel-count=" + std::string(this->d_channelCount));
+    }
 }
 
 std::shared_ptr<grpc::Channel> ConnectionOptions::createChannel() const
+{
+    return createChannel(grpc::ChannelArguments());
+}
+
+std::vector<std::shared_ptr<grpc::Channel>>
+ConnectionOptions::createChannels() const
+{
+    const int count =
+        this->d_channelCount == nullptr ? 1 : std::stoi(this->d_channelCount);
+    if (count <= 0) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(std::invalid_argument,
+                                       "Invalid channel count: " << count);
+    }
+
+    std::vector<std::shared_ptr<grpc::Channel>> channels;
+    for (int i = 0; i < count; i++) {
+        grpc::ChannelArguments channel_args;
+        if (count > 1) {
+            // Channels with the same target and arguments share the
+            // connections in gRPC's global subchannel pool.
+            channel_args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+        }
+        channels.push_back(createChannel(channel_args));
+    }
+    return channels;
+}
+
+std::shared_ptr<grpc::Channel>
+ConnectionOptions::createChannel(grpc::ChannelArguments channel_args) const
 {
     BUILDBOX_LOG_DEBUG("Creating grpc channel to [" << this->d_url << "]");
     std::string target;
     std::shared_ptr<grpc::ChannelCredentials> creds;
-    grpc::ChannelArguments channel_args;
     bool secure = false;
 
     if (strncmp(this->d_url, HTTP_PREFIX, strlen(HTTP_PREFIX)) == 0) {
@@ -393,6 +446,13 @@ void ConnectionOptions::printArgHelp(int padWidth, const char *serviceName,
     printPadded(padWidth, "--" + p + "load-balancing-policy");
     std::clog << "Which grpc load balancing policy to use. "
                  "Valid options are 'round_robin' and 'grpclb'\n";
+
+    printPadded(padWidth, "--" + p + "channel-count=INT");
+    std::clog << "Number of connections to open to the server\n";
+
+    printPadded(padWidth, "--" + p + "trusted-endpoint");
+    std::clog << "Do not verify the digests of blobs downloaded from the "
+                 "server, for instance a local casd\n";
 }
 
 std::ostream &operator<<(std::ostream &out, const ConnectionOptions &obj)
@@ -412,7 +472,10 @@ std::ostream &operator<<(std::ostream &out, const ConnectionOptions &obj)
         << ", retry-limit = \"" << safeStream(obj.d_retryLimit)
         << "\", retry-delay = \"" << safeStream(obj.d_retryDelay) << "\""
         << "\", load-balancing-policy = \""
-        << safeStream(obj.d_loadBalancingPolicy) << "\"";
+        << safeStream(obj.d_loadBalancingPolicy) << "\", channel-count = \""
+        << safeStream(obj.d_channelCount)
+        << "\", trusted-endpoint = " << std::boolalpha
+        << obj.d_trustedEndpoint;
 
     return out;
 }
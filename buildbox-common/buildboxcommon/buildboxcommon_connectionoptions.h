@@ -18,6 +18,7 @@
 #define INCLUDED_BUILDBOXCOMMON_CONNECTIONOPTIONS
 
 #include <grpcpp/channel.h>
+#include <grpcpp/support/channel_arguments.h>
 #include <memory>
 #include <string>
 #include <vector>
@@ -35,8 +36,14 @@ struct ConnectionOptions {
     const char *d_serverCertPath = nullptr;
     const char *d_url = nullptr;
     bool d_useGoogleApiAuth = false;
+    // Whether the server can be trusted to return the blobs matching the
+    // digests requested, such as a local casd, so that they need not be
+    // hashed again.
+    bool d_trustedEndpoint = false;
     const char *d_tokenReloadInterval = nullptr;
     const char *d_loadBalancingPolicy = nullptr;
+    // Number of channels for `createChannels()` to open; 1 if unset.
+    const char *d_channelCount = nullptr;
 
     /*
      * These are strings to allow for easier
@@ -72,7 +79,9 @@ struct ConnectionOptions {
     void setServerCertPath(const std::string &value);
     void setUrl(const std::string &value);
     void setUseGoogleApiAuth(const bool value);
+    void setTrustedEndpoint(const bool value);
     void setLoadBalancingPolicy(const std::string &value);
+    void setChannelCount(const std::string &value);
 
     /**
      * Add arguments corresponding to this struct's settings to the given
@@ -87,6 +96,16 @@ struct ConnectionOptions {
      */
     std::shared_ptr<grpc::Channel> createChannel() const;
 
+    /**
+     * Create `d_channelCount` gRPC Channels from the options in this
+     * struct. If there is more than one, each of them gets its own
+     * connection to the server, so that they can be used to spread
+     * requests over several HTTP/2 flow-control windows.
+     *
+     * Throws `std::invalid_argument` if `d_channelCount` is not positive.
+     */
+    std::vector<std::shared_ptr<grpc::Channel>> createChannels() const;
+
     /**
      * Print usage-style help messages for each of the arguments parsed
      * by ConnectionOptions.
@@ -98,6 +117,10 @@ struct ConnectionOptions {
      */
     static void printArgHelp(int padWidth, const char *serviceName = "CAS",
                              const char *prefix = nullptr);
+
+  private:
+    std::shared_ptr<grpc::Channel>
+    createChannel(grpc::ChannelArguments channel_args) const;
 };
 
 std::ostream &operator<<(std::ostream &out, const ConnectionOptions &obj);
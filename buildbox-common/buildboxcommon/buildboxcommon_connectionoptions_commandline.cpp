@@ -92,6 +92,18 @@ ConnectionOptionsCommandLine::ConnectionOptionsCommandLine(
                             "Valid options are 'round_robin' and 'grpclb'",
                         TypeInfo(DataType::COMMANDLINE_DT_STRING),
                         ArgumentSpec::O_OPTIONAL, ArgumentSpec::C_WITH_ARG);
+    d_spec.emplace_back(commandLinePrefix + "trusted-endpoint",
+                        "Do not verify the digests of blobs downloaded from "
+                        "the " +
+                            serviceName + " service",
+                        TypeInfo(DataType::COMMANDLINE_DT_BOOL),
+                        ArgumentSpec::O_OPTIONAL, ArgumentSpec::C_WITH_ARG,
+                        DefaultValue(false));
+    d_spec.emplace_back(commandLinePrefix + "channel-count",
+                        "Number of connections to open to the " +
+                            serviceName + " service",
+                        TypeInfo(DataType::COMMANDLINE_DT_STRING),
+                        ArgumentSpec::O_OPTIONAL, ArgumentSpec::C_WITH_ARG);
 }
 
 bool ConnectionOptionsCommandLine::configureChannel(
@@ -147,6 +159,14 @@ bool ConnectionOptionsCommandLine::configureChannel(
     channel->d_loadBalancingPolicy =
         cml.exists(optionName) ? cml.getString(optionName).c_str() : nullptr;
 
+    optionName = commandLinePrefix + "trusted-endpoint";
+    channel->d_trustedEndpoint =
+        cml.exists(optionName) ? cml.getBool(optionName) : false;
+
+    optionName = commandLinePrefix + "channel-count";
+    channel->d_channelCount =
+        cml.exists(optionName) ? cml.getString(optionName).c_str() : nullptr;
+
     return true;
 }
 
@@ -68,9 +68,10 @@ OutputFile FallbackStagedDirectory::captureFile(const char *relative_path,
                                                 const Command &command) const
 {
 
-    const auto upload_file_function = [this](const int fd,
-                                             const Digest &digest) {
-        this->d_casClient->upload(fd, digest);
+    // Hashing and uploading together lets the client avoid reading the
+    // file twice.
+    const auto hash_and_upload_file_function = [this](const int fd) {
+        return this->d_casClient->hashAndUploadFile(fd);
     };
 
     bool capture_mtime = false;
@@ -80,7 +81,8 @@ OutputFile FallbackStagedDirectory::captureFile(const char *relative_path,
         }
     }
 
-    return captureFile(relative_path, upload_file_function, capture_mtime);
+    return captureFile(relative_path, hash_and_upload_file_function,
+                       capture_mtime);
 }
 
 OutputDirectory
@@ -135,6 +137,22 @@ OutputFile FallbackStagedDirectory::captureFile(
     const std::function<void(const int fd, const Digest &digest)>
         &upload_file_function,
     const bool capture_mtime) const
+{
+    const auto hash_and_upload_file_function =
+        [&upload_file_function](const int fd) {
+            const Digest digest = CASHash::hash(fd);
+            upload_file_function(fd, digest);
+            return digest;
+        };
+
+    return captureFile(relative_path, hash_and_upload_file_function,
+                       capture_mtime);
+}
+
+OutputFile FallbackStagedDirectory::captureFile(
+    const char *relative_path,
+    const std::function<Digest(const int fd)> &hash_and_upload_file_function,
+    const bool capture_mtime) const
 {
     int fd;
     try {
@@ -148,10 +166,9 @@ OutputFile FallbackStagedDirectory::captureFile(
         throw;
     }
 
-    const Digest digest = CASHash::hash(fd);
-
+    Digest digest;
     try {
-        upload_file_function(fd, digest);
+        digest = hash_and_upload_file_function(fd);
     }
     catch (...) {
         close(fd);
@@ -59,6 +59,14 @@ class FallbackStagedDirectory : public StagedDirectory {
                     &upload_file_function,
                 const bool capture_mtime = false) const;
 
+    // As above, with a single function that hashes and uploads the file
+    // and returns its digest.
+    OutputFile
+    captureFile(const char *relative_path,
+                const std::function<Digest(const int fd)>
+                    &hash_and_upload_file_function,
+                const bool capture_mtime = false) const;
+
     OutputDirectory
     captureDirectory(const char *relative_path,
                      const std::function<Digest(const std::string &path)>
@@ -37,13 +37,91 @@
 #include <unistd.h>
 #include <vector>
 
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
 #if __APPLE__
 #define st_mtim st_mtimespec
 #define st_atim st_atimespec
 #endif
 
+#if defined(__linux__) && defined(__GLIBC__) &&                               \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define BUILDBOXCOMMON_HAVE_COPY_FILE_RANGE 1
+#endif
+
 namespace buildboxcommon {
 
+namespace {
+std::string parentDirectoryForAtomicWrite(const std::string &path)
+{
+    // `dirname()` modifies its input, so we give it a copy.
+    std::vector<char> output_path(path.cbegin(), path.cend());
+    output_path.push_back('\0');
+    const char *parent_directory = dirname(&output_path[0]);
+    if (parent_directory == nullptr) {
+        BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+            std::system_error, errno, std::system_category,
+            "Could not determine intermediate "
+                << "directory with `dirname(3)` for atomic write to path "
+                   "\""
+                << path << "\"");
+    }
+    return std::string(parent_directory);
+}
+
+// Copy the whole contents of `src` into the empty file `dest`. Where the
+// filesystem allows it the data is shared with a reflink or copied inside the
+// kernel, otherwise it goes through a user-space buffer. Returns 0 or an
+// `errno` value.
+int copyFileContents(int src, int dest)
+{
+#ifdef FICLONE
+    if (ioctl(dest, FICLONE, src) == 0) {
+        return 0;
+    }
+#endif
+
+#ifdef BUILDBOXCOMMON_HAVE_COPY_FILE_RANGE
+    ssize_t copied;
+    bool copiedAny = false;
+    while ((copied = copy_file_range(src, nullptr, dest, nullptr,
+                                     1024 * 1024 * 1024, 0)) > 0) {
+        copiedAny = true;
+    }
+    if (copied == 0) {
+        return 0;
+    }
+    // Fall back to `read()`/`write()` if the kernel or filesystem does not
+    // support the call for these files. Nothing has been written yet in that
+    // case, so the offsets are still at the start.
+    if (copiedAny || (errno != ENOSYS && errno != EXDEV && errno != EINVAL &&
+                      errno != EOPNOTSUPP)) {
+        return errno;
+    }
+#endif
+
+    const size_t bufsize = 65536;
+    std::vector<char> buf(bufsize);
+    ssize_t rdsize;
+    while ((rdsize = read(src, buf.data(), bufsize)) > 0) {
+        const char *p = buf.data();
+        while (rdsize > 0) {
+            const ssize_t wrsize =
+                write(dest, p, static_cast<size_t>(rdsize));
+            if (wrsize == -1) {
+                return errno;
+            }
+            p += wrsize;
+            rdsize -= wrsize;
+        }
+    }
+    return rdsize == -1 ? errno : 0;
+}
+} // namespace
+
 bool FileUtils::isRegularFileNoFollow(const char *path)
 {
     struct stat statResult;
@@ -400,20 +478,7 @@ void FileUtils::writeFileAtomically(const std::string &path,
     else {
         // If no intermediate directory is specified, we use the parent
         // directory in `path`.
-
-        // `dirname()` modifies its input, so we give it a copy.
-        std::vector<char> output_path(path.cbegin(), path.cend());
-        output_path.push_back('\0');
-        const char *parent_directory = dirname(&output_path[0]);
-        if (parent_directory == nullptr) {
-            BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
-                std::system_error, errno, std::system_category,
-                "Could not determine intermediate "
-                    << "directory with `dirname(3)` for atomic write to path "
-                       "\""
-                    << path << "\"");
-        }
-        temporary_directory = std::string(parent_directory);
+        temporary_directory = parentDirectoryForAtomicWrite(path);
     }
 
     std::unique_ptr<buildboxcommon::TemporaryFile> temp_file = nullptr;
@@ -453,6 +518,45 @@ void FileUtils::writeFileAtomically(const std::string &path,
     }
 }
 
+void FileUtils::copyFileAtomically(const std::string &src_path,
+                                   const std::string &dest_path, mode_t mode)
+{
+    const int src = open(src_path.c_str(), O_RDONLY);
+    if (src == -1) {
+        BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+            std::system_error, errno, std::system_category,
+            "Failed to open file \"" << src_path << "\" for copying");
+    }
+
+    try {
+        // `temp_file`'s destructor will `unlink()` the created file if it
+        // was not renamed.
+        TemporaryFile temp_file(
+            parentDirectoryForAtomicWrite(dest_path).c_str(),
+            TempDefaults::DEFAULT_TMP_PREFIX, mode);
+
+        const int err = copyFileContents(src, temp_file.fd());
+        if (err != 0) {
+            BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                std::system_error, err, std::system_category,
+                "Failed copying \"" << src_path << "\" to temporary file \""
+                                     << temp_file.name() << "\"");
+        }
+
+        if (rename(temp_file.name(), dest_path.c_str()) != 0) {
+            BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                std::system_error, errno, std::system_category,
+                "Could not atomically rename temporary file \""
+                    << temp_file.name() << "\" to \"" << dest_path << "\"");
+        }
+    }
+    catch (...) {
+        close(src);
+        throw;
+    }
+    close(src);
+}
+
 void FileUtils::deleteRecursively(const char *path,
                                   const bool delete_root_directory)
 {
@@ -236,6 +236,20 @@ struct FileUtils {
         const std::string &intermediate_directory = "",
         const std::string &prefix = TempDefaults::DEFAULT_TMP_PREFIX);
 
+    /**
+     * Copy the file at `src_path` to `dest_path` with the given `mode`,
+     * replacing `dest_path` atomically if it already exists.
+     *
+     * Where supported, the data is shared with a reflink (`FICLONE`) or
+     * copied within the kernel (`copy_file_range(2)`) rather than read into
+     * user space.
+     *
+     * On errors, throw an `std::system_error` exception.
+     */
+    static void copyFileAtomically(const std::string &src_path,
+                                   const std::string &dest_path,
+                                   mode_t mode = 0600);
+
     /**
      * Traverse and apply functions on files and directories recursively.
      *
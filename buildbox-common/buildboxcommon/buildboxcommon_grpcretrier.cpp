@@ -67,58 +67,80 @@ bool GrpcRetrier::issueRequest()
 
     while (true) {
         grpc::ClientContext context;
-        if (d_metadataAttacher) {
-            d_metadataAttacher(&context);
+        prepareContext(&context);
+
+        std::chrono::milliseconds retryDelay;
+        switch (attemptFinished(d_grpcInvocation(context), &retryDelay)) {
+            case AttemptResult::Done:
+                return true;
+            case AttemptResult::RetryLimitExceeded:
+                return false;
+            case AttemptResult::Retry:
+                std::this_thread::sleep_for(retryDelay);
+                break;
         }
+    }
+}
 
-        d_status = d_grpcInvocation(context);
-        if (d_status.ok() || !statusIsRetryable(d_status)) {
-            if (!d_status.ok()) {
-                BUILDBOX_LOG_ERROR(d_grpcInvocationName + " failed with: " +
-                                   std::to_string(d_status.error_code()) +
-                                   ": " + d_status.error_message());
-            }
+void GrpcRetrier::prepareContext(grpc::ClientContext *context) const
+{
+    if (d_metadataAttacher) {
+        d_metadataAttacher(context);
+    }
+}
 
-            return true;
+GrpcRetrier::AttemptResult
+GrpcRetrier::attemptFinished(const grpc::Status &status,
+                             std::chrono::milliseconds *retryDelay)
+{
+    d_status = status;
+    if (d_status.ok() || !statusIsRetryable(d_status)) {
+        if (!d_status.ok() &&
+            d_expectedStatusCodes.count(d_status.error_code()) == 0) {
+            BUILDBOX_LOG_ERROR(d_grpcInvocationName + " failed with: " +
+                               std::to_string(d_status.error_code()) + ": " +
+                               d_status.error_message());
         }
 
-        // The error might contain a `RetryInfo` message specifying a number of
-        // seconds to wait before retrying. If so, use it for the base value.
-        if (d_retryAttempts == 0 && !d_status.error_details().empty()) {
-            google::rpc::RetryInfo retryInfo;
-            if (retryInfo.ParseFromString(d_status.error_details())) {
-                const google::protobuf::int64 serverDelay =
-                    google::protobuf::util::TimeUtil::DurationToMilliseconds(
-                        retryInfo.retry_delay());
-
-                if (serverDelay > 0) {
-                    d_retryDelayBase = std::chrono::milliseconds(serverDelay);
-                    BUILDBOX_LOG_DEBUG("Overriding retry delay base with "
-                                       "value specified by server: "
-                                       << d_retryDelayBase.count() << " ms");
-                }
+        return AttemptResult::Done;
+    }
+
+    // The error might contain a `RetryInfo` message specifying a number of
+    // seconds to wait before retrying. If so, use it for the base value.
+    if (d_retryAttempts == 0 && !d_status.error_details().empty()) {
+        google::rpc::RetryInfo retryInfo;
+        if (retryInfo.ParseFromString(d_status.error_details())) {
+            const google::protobuf::int64 serverDelay =
+                google::protobuf::util::TimeUtil::DurationToMilliseconds(
+                    retryInfo.retry_delay());
+
+            if (serverDelay > 0) {
+                d_retryDelayBase = std::chrono::milliseconds(serverDelay);
+                BUILDBOX_LOG_DEBUG("Overriding retry delay base with "
+                                   "value specified by server: "
+                                   << d_retryDelayBase.count() << " ms");
             }
         }
+    }
 
-        // The call failed and could be retryable on its own.
-        if (d_retryAttempts >= d_retryLimit) {
-            const std::string errorMessage = retryAttemptsExceededErrorMessage(
-                d_grpcInvocationName, d_status, d_retryLimit);
-            BUILDBOX_LOG_ERROR(errorMessage);
+    // The call failed and could be retryable on its own.
+    if (d_retryAttempts >= d_retryLimit) {
+        const std::string errorMessage = retryAttemptsExceededErrorMessage(
+            d_grpcInvocationName, d_status, d_retryLimit);
+        BUILDBOX_LOG_ERROR(errorMessage);
 
-            return false;
-        }
-
-        // Delay the next call based on the number of attempts made:
-        const auto retryDelay = d_retryDelayBase * pow(1.6, d_retryAttempts);
-        BUILDBOX_LOG_WARNING(retryingInvocationWarningMessage(
-            d_grpcInvocationName, d_status, d_retryAttempts, d_retryLimit,
-            retryDelay.count()));
+        return AttemptResult::RetryLimitExceeded;
+    }
 
-        std::this_thread::sleep_for(retryDelay);
+    // Delay the next call based on the number of attempts made:
+    *retryDelay = std::chrono::duration_cast<std::chrono::milliseconds>(
+        d_retryDelayBase * pow(1.6, d_retryAttempts));
+    BUILDBOX_LOG_WARNING(retryingInvocationWarningMessage(
+        d_grpcInvocationName, d_status, d_retryAttempts, d_retryLimit,
+        static_cast<double>(retryDelay->count())));
 
-        d_retryAttempts++;
-    }
+    d_retryAttempts++;
+    return AttemptResult::Retry;
 }
 
 bool GrpcRetrier::statusIsRetryable(const grpc::Status &status) const
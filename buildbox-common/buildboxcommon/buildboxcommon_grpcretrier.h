@@ -87,7 +87,7 @@ class GrpcRetrier final {
           d_grpcInvocationName(grpcInvocationName), d_retryLimit(retryLimit),
           d_retryDelayBase(retryDelayBase),
           d_retryableStatusCodes(retryableStatusCodes),
-          d_metadataAttacher(nullptr)
+          d_metadataAttacher(nullptr), d_retryAttempts(0)
     {
         // Always retry on UNAVAILABLE
         d_retryableStatusCodes.insert(grpc::StatusCode::UNAVAILABLE);
@@ -116,6 +116,22 @@ class GrpcRetrier final {
      */
     bool issueRequest();
 
+    /* The steps of `issueRequest()`, for callers that issue each attempt
+     * themselves, for instance asynchronously. The invocation passed to the
+     * constructor is not used by them.
+     *
+     * `prepareContext()` sets up the context of an attempt, and
+     * `attemptFinished()` records the status it ended with. If the attempt
+     * should be retried, it returns `Retry` and sets `retryDelay` to the
+     * time to wait before the next one.
+     */
+    enum class AttemptResult { Done, Retry, RetryLimitExceeded };
+
+    void prepareContext(grpc::ClientContext *context) const;
+
+    AttemptResult attemptFinished(const grpc::Status &status,
+                                  std::chrono::milliseconds *retryDelay);
+
     /* Set of codes that enable to retry the request.  (Should contain errors
      * that are transient.)
      */
@@ -129,6 +145,19 @@ class GrpcRetrier final {
         d_metadataAttacher = metadataAttacher;
     }
 
+    /* Set of final codes that are an expected answer rather than a failure,
+     * such as `NOT_FOUND` for a cache lookup, and are not logged as errors.
+     */
+    void setExpectedStatusCodes(const GrpcStatusCodes &expectedStatusCodes)
+    {
+        d_expectedStatusCodes = expectedStatusCodes;
+    }
+
+    const GrpcStatusCodes &expectedStatusCodes() const
+    {
+        return d_expectedStatusCodes;
+    }
+
     /* Return the `grpc::Status` received on the last attempt. */
     grpc::Status status() const { return d_status; }
 
@@ -159,6 +188,9 @@ class GrpcRetrier final {
     // Status codes to retry:
     GrpcStatusCodes d_retryableStatusCodes;
 
+    // Final status codes that are not logged as errors:
+    GrpcStatusCodes d_expectedStatusCodes;
+
     // Optional callback to attach metadata to the request before issuing it:
     MetadataAttacher d_metadataAttacher;
 
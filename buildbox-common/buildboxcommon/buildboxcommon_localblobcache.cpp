@@ -0,0 +1,422 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_localblobcache.h>
+
+#include <buildboxcommon_direntwrapper.h>
+#include <buildboxcommon_exception.h>
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_logging.h>
+#include <buildboxcommon_tempconstants.h>
+#include <buildboxcommon_temporaryfile.h>
+#include <buildboxcommonmetrics_countingmetricutil.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iterator>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <system_error>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+namespace buildboxcommon {
+
+namespace {
+// Entries are read-only so that hardlinks to them are not modified by
+// accident.
+const mode_t ENTRY_MODE = S_IRUSR | S_IRGRP | S_IROTH; // 0444
+
+void recordLookup(bool hit)
+{
+    buildboxcommonmetrics::CountingMetricUtil::recordCounterMetric(
+        hit ? LocalBlobCache::s_hitsMetricName
+            : LocalBlobCache::s_missesMetricName,
+        1);
+}
+
+// Write the whole of `data` to `fd`, throwing on errors.
+void writeAll(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t written = write(fd, data, size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                std::system_error, errno, std::generic_category,
+                "Error in write to descriptor " << fd);
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+// Move the complete contents of `temp_file` to `entry_path`.
+void renameIntoPlace(const TemporaryFile &temp_file,
+                     const std::string &entry_path)
+{
+    if (rename(temp_file.name(), entry_path.c_str()) != 0) {
+        BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+            std::system_error, errno, std::system_category,
+            "Could not rename temporary file \""
+                << temp_file.name() << "\" to \"" << entry_path << "\"");
+    }
+}
+
+// Pass the contents of `fd`, in chunks, to `callback`.
+template <typename Callback> void readAll(int fd, const Callback &callback)
+{
+    std::vector<char> buffer(65536);
+    while (true) {
+        const ssize_t bytesRead = ::read(fd, buffer.data(), buffer.size());
+        if (bytesRead == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                std::system_error, errno, std::generic_category,
+                "Error in read from descriptor " << fd);
+        }
+        if (bytesRead == 0) {
+            return;
+        }
+        callback(buffer.data(), static_cast<size_t>(bytesRead));
+    }
+}
+} // namespace
+
+const std::string LocalBlobCache::s_hitsMetricName = "local_blob_cache_hits";
+const std::string LocalBlobCache::s_missesMetricName =
+    "local_blob_cache_misses";
+
+LocalBlobCache::LocalBlobCache(const std::string &root, int64_t quotaBytes)
+    : d_root(root), d_quotaBytes(quotaBytes)
+{
+    if (quotaBytes <= 0) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(
+            std::invalid_argument,
+            "The quota of a local blob cache must be positive");
+    }
+
+    FileUtils::createDirectory(d_root.c_str());
+
+    // Index the blobs left by earlier runs, the most recently modified
+    // first. Files being written by other processes have a temporary name.
+    typedef std::tuple<time_t, std::string, int64_t> ExistingEntry;
+    std::vector<ExistingEntry> existing;
+    DirentWrapper directory(d_root);
+    while (directory.entry() != nullptr) {
+        const std::string name = directory.entry()->d_name;
+        struct stat st;
+        if (directory.currentEntryIsFile() &&
+            name.compare(0, strlen(TempDefaults::DEFAULT_TMP_PREFIX),
+                         TempDefaults::DEFAULT_TMP_PREFIX) != 0 &&
+            fstatat(directory.fd(), name.c_str(), &st, 0) == 0) {
+            existing.emplace_back(st.st_mtime, name, st.st_size);
+        }
+        directory.next();
+    }
+    std::sort(existing.begin(), existing.end(),
+              [](const ExistingEntry &a, const ExistingEntry &b) {
+                  return std::get<0>(a) > std::get<0>(b);
+              });
+
+    const std::lock_guard<std::mutex> lock(d_mutex);
+    for (const ExistingEntry &entry : existing) {
+        d_entries.emplace_back(std::get<1>(entry), std::get<2>(entry));
+        d_index.emplace(std::get<1>(entry), std::prev(d_entries.end()));
+        d_sizeBytes += std::get<2>(entry);
+    }
+    evictLocked();
+}
+
+std::string LocalBlobCache::entryName(const Digest &digest)
+{
+    return hashToHex(digest) + "_" + std::to_string(digest.size_bytes());
+}
+
+std::string LocalBlobCache::path(const Digest &digest) const
+{
+    return d_root + "/" + entryName(digest);
+}
+
+bool LocalBlobCache::fitsQuota(const Digest &digest) const
+{
+    return digest.size_bytes() <= d_quotaBytes;
+}
+
+bool LocalBlobCache::contains(const Digest &digest)
+{
+    const int fd = openEntry(digest);
+    if (fd == -1) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+int LocalBlobCache::openEntry(const Digest &digest)
+{
+    const std::string name = entryName(digest);
+    const int fd = open((d_root + "/" + name).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            BUILDBOX_LOG_WARNING("Could not open cached blob \""
+                                 << name << "\": " << strerror(errno));
+        }
+        forget(name);
+        recordLookup(false);
+        return -1;
+    }
+
+    touch(name, digest.size_bytes());
+    recordLookup(true);
+    return fd;
+}
+
+bool LocalBlobCache::read(const Digest &digest, std::string *data)
+{
+    const int fd = openEntry(digest);
+    if (fd == -1) {
+        return false;
+    }
+
+    data->clear();
+    data->reserve(static_cast<size_t>(digest.size_bytes()));
+    try {
+        readAll(fd, [data](const char *chunk, size_t size) {
+            data->append(chunk, size);
+        });
+    }
+    catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    return true;
+}
+
+bool LocalBlobCache::readToFile(const Digest &digest, int fd)
+{
+    const int entry_fd = openEntry(digest);
+    if (entry_fd == -1) {
+        return false;
+    }
+
+    try {
+        readAll(entry_fd, [fd](const char *chunk, size_t size) {
+            writeAll(fd, chunk, size);
+        });
+    }
+    catch (...) {
+        close(entry_fd);
+        throw;
+    }
+    close(entry_fd);
+    return true;
+}
+
+bool LocalBlobCache::stage(const Digest &digest, const std::string &path,
+                           mode_t mode, bool allowHardLink)
+{
+    const std::string name = entryName(digest);
+    const std::string entry_path = d_root + "/" + name;
+
+    if (allowHardLink && (mode & (S_IXUSR | S_IXGRP | S_IXOTH)) == 0) {
+        int result = link(entry_path.c_str(), path.c_str());
+        if (result != 0 && errno == EEXIST) {
+            // Match `copyFileAtomically()`, which replaces existing files.
+            if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+                BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                    std::system_error, errno, std::system_category,
+                    "Could not remove \"" << path << "\" to replace it");
+            }
+            result = link(entry_path.c_str(), path.c_str());
+        }
+
+        if (result == 0) {
+            touch(name, digest.size_bytes());
+            recordLookup(true);
+            return true;
+        }
+        if (errno == ENOENT && access(entry_path.c_str(), F_OK) != 0) {
+            forget(name);
+            recordLookup(false);
+            return false;
+        }
+        // For instance, the paths are on different filesystems. Copy.
+        BUILDBOX_LOG_DEBUG("Could not hardlink \"" << path << "\" to \""
+                                                   << entry_path << "\": "
+                                                   << strerror(errno));
+    }
+
+    if (access(entry_path.c_str(), F_OK) != 0) {
+        forget(name);
+        recordLookup(false);
+        return false;
+    }
+
+    try {
+        FileUtils::copyFileAtomically(entry_path, path, mode);
+    }
+    catch (const std::system_error &e) {
+        // The entry may have been evicted in the meantime.
+        if (e.code().value() != ENOENT ||
+            access(entry_path.c_str(), F_OK) == 0) {
+            throw;
+        }
+        forget(name);
+        recordLookup(false);
+        return false;
+    }
+
+    touch(name, digest.size_bytes());
+    recordLookup(true);
+    return true;
+}
+
+void LocalBlobCache::insert(const Digest &digest, const std::string &data)
+{
+    if (!fitsQuota(digest)) {
+        return;
+    }
+
+    const std::string name = entryName(digest);
+    try {
+        // The entry is read-only from the start, so it is written through
+        // the descriptor opened before its mode was set.
+        TemporaryFile temp_file(d_root.c_str(),
+                                TempDefaults::DEFAULT_TMP_PREFIX, ENTRY_MODE);
+        writeAll(temp_file.fd(), data.data(), data.size());
+        renameIntoPlace(temp_file, d_root + "/" + name);
+    }
+    catch (const std::system_error &e) {
+        BUILDBOX_LOG_WARNING("Could not cache blob \"" << name
+                                                        << "\": " << e.what());
+        return;
+    }
+    touch(name, digest.size_bytes());
+}
+
+void LocalBlobCache::insertFile(const Digest &digest, int fd)
+{
+    if (!fitsQuota(digest)) {
+        return;
+    }
+
+    const std::string name = entryName(digest);
+    try {
+        TemporaryFile temp_file(d_root.c_str(),
+                                TempDefaults::DEFAULT_TMP_PREFIX, ENTRY_MODE);
+
+        // Reading with `pread()` leaves the offset of `fd` untouched.
+        std::vector<char> buffer(65536);
+        off_t offset = 0;
+        while (true) {
+            const ssize_t bytesRead =
+                pread(fd, buffer.data(), buffer.size(), offset);
+            if (bytesRead == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                    std::system_error, errno, std::generic_category,
+                    "Error in read from descriptor " << fd);
+            }
+            if (bytesRead == 0) {
+                break;
+            }
+            writeAll(temp_file.fd(), buffer.data(),
+                     static_cast<size_t>(bytesRead));
+            offset += bytesRead;
+        }
+
+        if (offset != digest.size_bytes()) {
+            BUILDBOX_LOG_WARNING("Not caching blob \""
+                                 << name << "\": file has " << offset
+                                 << " bytes");
+            return;
+        }
+
+        renameIntoPlace(temp_file, d_root + "/" + name);
+    }
+    catch (const std::system_error &e) {
+        BUILDBOX_LOG_WARNING("Could not cache blob \"" << name
+                                                        << "\": " << e.what());
+        return;
+    }
+    touch(name, digest.size_bytes());
+}
+
+void LocalBlobCache::touch(const std::string &name, int64_t size)
+{
+    const std::lock_guard<std::mutex> lock(d_mutex);
+
+    const auto it = d_index.find(name);
+    if (it != d_index.end()) {
+        d_entries.splice(d_entries.begin(), d_entries, it->second);
+        return;
+    }
+
+    d_entries.emplace_front(name, size);
+    d_index.emplace(name, d_entries.begin());
+    d_sizeBytes += size;
+    evictLocked();
+}
+
+void LocalBlobCache::evictLocked()
+{
+    // The most recently used entry is always kept: it fits in the quota.
+    while (d_sizeBytes > d_quotaBytes && d_entries.size() > 1) {
+        const auto &victim = d_entries.back();
+        const std::string victim_path = d_root + "/" + victim.first;
+        if (unlink(victim_path.c_str()) != 0 && errno != ENOENT) {
+            BUILDBOX_LOG_WARNING("Could not evict cached blob \""
+                                 << victim_path << "\": " << strerror(errno));
+        }
+
+        d_sizeBytes -= victim.second;
+        d_index.erase(victim.first);
+        d_entries.pop_back();
+    }
+}
+
+void LocalBlobCache::forget(const std::string &name)
+{
+    const std::lock_guard<std::mutex> lock(d_mutex);
+
+    const auto it = d_index.find(name);
+    if (it == d_index.end()) {
+        return;
+    }
+
+    d_sizeBytes -= it->second->second;
+    d_entries.erase(it->second);
+    d_index.erase(it);
+}
+
+int64_t LocalBlobCache::sizeBytes() const
+{
+    const std::lock_guard<std::mutex> lock(d_mutex);
+    return d_sizeBytes;
+}
+
+} // namespace buildboxcommon
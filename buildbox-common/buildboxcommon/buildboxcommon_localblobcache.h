@@ -0,0 +1,118 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDED_BUILDBOXCOMMON_LOCALBLOBCACHE
+#define INCLUDED_BUILDBOXCOMMON_LOCALBLOBCACHE
+
+#include <buildboxcommon_protos.h>
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace buildboxcommon {
+
+class LocalBlobCache {
+    /*
+     * Keeps copies of downloaded blobs in a local directory, each in a file
+     * named after its digest, so that they need not be fetched again.
+     *
+     * Files are written to a temporary name and renamed into place, so a
+     * directory can be shared by several processes. Each of them evicts the
+     * least recently used blobs it knows of once the ones it has seen or
+     * stored exceed `quotaBytes`. Entries are made read-only and trusted:
+     * callers must only insert blobs that match their digest.
+     *
+     * It is safe to use from multiple threads.
+     */
+  public:
+    // Counters recorded with buildboxcommonmetrics on lookups.
+    static const std::string s_hitsMetricName;
+    static const std::string s_missesMetricName;
+
+    // Creates `root` if needed and indexes the blobs already in it.
+    // Throws `std::invalid_argument` if `quotaBytes` is not positive, and
+    // `std::system_error` if the directory cannot be created or read.
+    LocalBlobCache(const std::string &root, int64_t quotaBytes);
+
+    LocalBlobCache(const LocalBlobCache &) = delete;
+    LocalBlobCache &operator=(const LocalBlobCache &) = delete;
+
+    bool contains(const Digest &digest);
+
+    // Read the blob into `data`. Return false if it is not cached.
+    bool read(const Digest &digest, std::string *data);
+
+    // Write the blob to `fd` at its current offset. Return false if it is
+    // not cached.
+    bool readToFile(const Digest &digest, int fd);
+
+    // Create the file at `path` with the contents of the blob, replacing
+    // it if it exists. Return false if it is not cached.
+    //
+    // If `allowHardLink` is set and `mode` is not executable, the file is a
+    // hardlink to the entry and therefore read-only; it must not be
+    // modified in place. Otherwise it is a reflink or a copy with `mode`.
+    bool stage(const Digest &digest, const std::string &path, mode_t mode,
+               bool allowHardLink);
+
+    // Store a blob from memory or from the whole file open for reading in
+    // `fd`, evicting others if needed. Blobs larger than the quota are not
+    // stored. Errors are logged and otherwise ignored, since the blob can
+    // always be fetched again.
+    void insert(const Digest &digest, const std::string &data);
+    void insertFile(const Digest &digest, int fd);
+
+    // Total size of the blobs accounted for by this instance.
+    int64_t sizeBytes() const;
+
+    std::string path(const Digest &digest) const;
+
+  private:
+    // Most recently used entries first.
+    typedef std::list<std::pair<std::string, int64_t>> EntryList;
+
+    const std::string d_root;
+    const int64_t d_quotaBytes;
+
+    mutable std::mutex d_mutex;
+    EntryList d_entries;
+    std::unordered_map<std::string, EntryList::iterator> d_index;
+    int64_t d_sizeBytes = 0;
+
+    static std::string entryName(const Digest &digest);
+
+    // Open the entry for reading and mark it used, or return -1 and forget
+    // it if it is gone. Counts a hit or a miss.
+    int openEntry(const Digest &digest);
+
+    // Record that the entry with the given name is present and was just
+    // used, then evict others until the quota is met.
+    void touch(const std::string &name, int64_t size);
+    void evictLocked();
+    void forget(const std::string &name);
+
+    bool fitsQuota(const Digest &digest) const;
+};
+
+} // namespace buildboxcommon
+
+#endif
@@ -15,6 +15,7 @@
  */
 #include <buildboxcommon_logstreamwriter.h>
 
+#include <buildboxcommon_channelregistry.h>
 #include <buildboxcommon_exception.h>
 #include <buildboxcommon_grpcretry.h>
 #include <buildboxcommon_logging.h>
@@ -25,10 +26,11 @@ namespace buildboxcommon {
 
 LogStreamWriter::LogStreamWriter(const std::string &resourceName,
                                  const ConnectionOptions &connectionOptions)
-    : LogStreamWriter(resourceName,
-                      ByteStream::NewStub(connectionOptions.createChannel()),
-                      std::stoi(connectionOptions.d_retryLimit),
-                      std::stoi(connectionOptions.d_retryDelay))
+    : LogStreamWriter(
+          resourceName,
+          ByteStream::NewStub(ChannelRegistry::channel(connectionOptions)),
+          std::stoi(connectionOptions.d_retryLimit),
+          std::stoi(connectionOptions.d_retryDelay))
 {
 }
 
@@ -188,7 +190,7 @@ LogStream LogStreamWriter::createLogStream(
     const std::string &parent,
     const buildboxcommon::ConnectionOptions &connectionOptions)
 {
-    const auto channel = connectionOptions.createChannel();
+    const auto channel = ChannelRegistry::channel(connectionOptions);
     std::unique_ptr<LogStreamService::StubInterface> logStreamClient =
         LogStreamService::NewStub(channel);
 
@@ -24,6 +24,7 @@
 #include <cstring>
 #include <dirent.h>
 #include <iostream>
+#include <memory>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <system_error>
@@ -151,57 +152,69 @@ void NestedDirectory::addDirectory(const char *directory)
     }
 }
 
-Digest NestedDirectory::to_digest(digest_string_map *digestMap) const
+namespace {
+
+// Fill in `directoryMessage` for `directory` and return its Digest. The
+// messages of all the subdirectories are appended to `tree` in post-order
+// (every directory after its descendants), which is the order in which
+// `to_tree()` has always listed them.
+Digest fill_directory(const NestedDirectory &directory,
+                      digest_string_map *digestMap, Tree *tree,
+                      Directory *directoryMessage)
 {
     // The 'd_files' and 'd_subdirs' maps make sure everything is sorted by
     // name thus the iterators will iterate lexicographically
-
-    Directory directoryMessage;
-    for (const auto &fileIter : d_files) {
-        *directoryMessage.add_files() =
+    for (const auto &fileIter : directory.d_files) {
+        *directoryMessage->add_files() =
             fileIter.second.to_filenode(fileIter.first);
     }
-    for (const auto &symlinkIter : d_symlinks) {
-        SymlinkNode symlinkNode;
-        symlinkNode.set_name(symlinkIter.first);
-        symlinkNode.set_target(symlinkIter.second);
-        *directoryMessage.add_symlinks() = symlinkNode;
+    for (const auto &symlinkIter : directory.d_symlinks) {
+        SymlinkNode *symlinkNode = directoryMessage->add_symlinks();
+        symlinkNode->set_name(symlinkIter.first);
+        symlinkNode->set_target(symlinkIter.second);
     }
-    for (const auto &subdirIter : *d_subdirs) {
-        auto subdirNode = directoryMessage.add_directories();
+    for (const auto &subdirIter : *directory.d_subdirs) {
+        auto subdirNode = directoryMessage->add_directories();
         subdirNode->set_name(subdirIter.first);
-        auto subdirDigest = subdirIter.second.to_digest(digestMap);
-        *subdirNode->mutable_digest() = subdirDigest;
+
+        Directory subdirMessage;
+        *subdirNode->mutable_digest() = fill_directory(
+            subdirIter.second, digestMap, tree, &subdirMessage);
+        if (tree != nullptr) {
+            tree->add_children()->Swap(&subdirMessage);
+        }
     }
-    auto blob = directoryMessage.SerializeAsString();
-    auto digest = make_digest(blob);
+
+    std::string blob = directoryMessage->SerializeAsString();
+    const Digest digest = make_digest(blob);
     if (digestMap != nullptr) {
-        (*digestMap)[digest] = blob;
+        (*digestMap)[digest] = std::move(blob);
     }
     return digest;
 }
 
-Tree NestedDirectory::to_tree() const
+} // namespace
+
+Digest NestedDirectory::to_digest(digest_string_map *digestMap,
+                                  Tree *tree) const
 {
-    Tree result;
-    auto root = result.mutable_root();
-    for (const auto &fileIter : d_files) {
-        *root->add_files() = fileIter.second.to_filenode(fileIter.first);
-    }
-    for (const auto &symlinkIter : d_symlinks) {
-        SymlinkNode symlinkNode;
-        symlinkNode.set_name(symlinkIter.first);
-        symlinkNode.set_target(symlinkIter.second);
-        *root->add_symlinks() = symlinkNode;
+    if (tree != nullptr) {
+        tree->Clear();
     }
-    for (const auto &subdirIter : *d_subdirs) {
-        auto subtree = subdirIter.second.to_tree();
-        result.mutable_children()->MergeFrom(subtree.children());
-        *result.add_children() = subtree.root();
-        auto subdirNode = root->add_directories();
-        subdirNode->set_name(subdirIter.first);
-        *subdirNode->mutable_digest() = make_digest(subtree.root());
+
+    Directory directoryMessage;
+    const Digest digest =
+        fill_directory(*this, digestMap, tree, &directoryMessage);
+    if (tree != nullptr) {
+        tree->mutable_root()->Swap(&directoryMessage);
     }
+    return digest;
+}
+
+Tree NestedDirectory::to_tree() const
+{
+    Tree result;
+    to_digest(nullptr, &result);
     return result;
 }
 
@@ -346,6 +359,168 @@ make_nesteddirectory(int basedirfd, const std::string prefix, const char *path,
     return result;
 }
 
+namespace {
+
+// Contents of a directory read by `make_nesteddirectory_parallel()`. The
+// entries are kept in `readdir()` order so that the fileMap can later be
+// filled in the exact same sequence as the serial traversal does, which
+// matters when several files share a digest.
+struct ScannedDirectory {
+    enum class EntryType { RegularFile, Directory, Symlink };
+
+    struct Entry {
+        EntryType d_type;
+        std::string d_name;
+        File d_file;
+        std::string d_symlinkTarget;
+        std::unique_ptr<ScannedDirectory> d_subdir;
+    };
+
+    std::vector<Entry> d_entries;
+};
+
+void scan_directory(ThreadPool &pool, int basedirfd, const std::string &prefix,
+                    const char *path, const FileDigestFunction &fileDigestFunc,
+                    const std::vector<std::string> &capture_properties,
+                    const bool followSymlinks, ScannedDirectory *result)
+{
+    const int dirfd = openat(basedirfd, path, O_RDONLY | O_DIRECTORY);
+    if (dirfd < 0) {
+        BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+            std::system_error, errno, std::system_category,
+            "Failed to open path \"" << path << "\"");
+    }
+    const auto dir = fdopendir(dirfd);
+    if (dir == nullptr) {
+        close(dirfd);
+        BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+            std::system_error, errno, std::system_category,
+            "Failed to open path \"" << path << "\"");
+    }
+
+    const std::string newprefix(prefix + path + "/");
+    try {
+        // Listing the directory is cheap, so it is done here; hashing the
+        // files and descending into subdirectories is spread across the pool.
+        std::vector<size_t> pendingEntries;
+        for (auto dirent = readdir(dir); dirent != nullptr;
+             dirent = readdir(dir)) {
+            if (strcmp(dirent->d_name, ".") == 0 ||
+                strcmp(dirent->d_name, "..") == 0) {
+                continue;
+            }
+
+            struct stat statResult;
+            int statFlags = 0;
+            if (!followSymlinks) {
+                statFlags = AT_SYMLINK_NOFOLLOW;
+            }
+            if (fstatat(dirfd, dirent->d_name, &statResult, statFlags) != 0) {
+                continue;
+            }
+
+            ScannedDirectory::Entry entry;
+            entry.d_name = dirent->d_name;
+            if (S_ISDIR(statResult.st_mode)) {
+                entry.d_type = ScannedDirectory::EntryType::Directory;
+                pendingEntries.push_back(result->d_entries.size());
+            }
+            else if (S_ISREG(statResult.st_mode)) {
+                entry.d_type = ScannedDirectory::EntryType::RegularFile;
+                pendingEntries.push_back(result->d_entries.size());
+            }
+            else if (S_ISLNK(statResult.st_mode)) {
+                entry.d_type = ScannedDirectory::EntryType::Symlink;
+                entry.d_symlinkTarget.resize(
+                    static_cast<size_t>(statResult.st_size));
+                if (readlinkat(dirfd, dirent->d_name,
+                               &entry.d_symlinkTarget[0],
+                               entry.d_symlinkTarget.size()) < 0) {
+                    BUILDBOXCOMMON_THROW_SYSTEM_EXCEPTION(
+                        std::system_error, errno, std::system_category,
+                        "Error reading symlink at \""
+                            << newprefix << entry.d_name
+                            << "\", st_size = " << statResult.st_size);
+                }
+            }
+            else {
+                continue;
+            }
+            result->d_entries.push_back(std::move(entry));
+        }
+
+        pool.parallelFor(pendingEntries.size(), [&](size_t i) {
+            ScannedDirectory::Entry &entry =
+                result->d_entries[pendingEntries[i]];
+            if (entry.d_type == ScannedDirectory::EntryType::Directory) {
+                entry.d_subdir.reset(new ScannedDirectory());
+                scan_directory(pool, dirfd, newprefix, entry.d_name.c_str(),
+                               fileDigestFunc, capture_properties,
+                               followSymlinks, entry.d_subdir.get());
+            }
+            else {
+                entry.d_file = File(dirfd, entry.d_name.c_str(),
+                                    fileDigestFunc, capture_properties);
+            }
+        });
+    }
+    catch (...) {
+        closedir(dir);
+        throw;
+    }
+
+    // This will implicitly close `dirfd`.
+    closedir(dir);
+}
+
+NestedDirectory to_nesteddirectory(const ScannedDirectory &scanned,
+                                   const std::string &prefix,
+                                   digest_string_map *fileMap)
+{
+    NestedDirectory result;
+    for (const auto &entry : scanned.d_entries) {
+        switch (entry.d_type) {
+            case ScannedDirectory::EntryType::Directory:
+                (*result.d_subdirs)[entry.d_name] = to_nesteddirectory(
+                    *entry.d_subdir, prefix + entry.d_name + "/", fileMap);
+                break;
+            case ScannedDirectory::EntryType::RegularFile:
+                result.d_files[entry.d_name] = entry.d_file;
+                if (fileMap != nullptr) {
+                    (*fileMap)[entry.d_file.d_digest] = prefix + entry.d_name;
+                }
+                break;
+            case ScannedDirectory::EntryType::Symlink:
+                result.d_symlinks[entry.d_name] = entry.d_symlinkTarget;
+                break;
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+NestedDirectory make_nesteddirectory_parallel(
+    ThreadPool &pool, const char *path, digest_string_map *fileMap,
+    const std::vector<std::string> &capture_properties,
+    const bool followSymlinks)
+{
+    return make_nesteddirectory_parallel(pool, path, hashFile, fileMap,
+                                         capture_properties, followSymlinks);
+}
+
+NestedDirectory make_nesteddirectory_parallel(
+    ThreadPool &pool, const char *path,
+    const FileDigestFunction &fileDigestFunc, digest_string_map *fileMap,
+    const std::vector<std::string> &capture_properties,
+    const bool followSymlinks)
+{
+    ScannedDirectory scanned;
+    scan_directory(pool, AT_FDCWD, "", path, fileDigestFunc,
+                   capture_properties, followSymlinks, &scanned);
+    return to_nesteddirectory(scanned, std::string(path) + "/", fileMap);
+}
+
 std::ostream &operator<<(std::ostream &out, const NestedDirectory &obj)
 {
     obj.print(out);
@@ -16,6 +16,7 @@
 #define INCLUDED_BUILDBOXCOMMON_MERKLIZE
 
 #include <buildboxcommon_protos.h>
+#include <buildboxcommon_threadpool.h>
 
 #include <google/protobuf/message.h>
 #include <set>
@@ -105,8 +106,13 @@ struct NestedDirectory {
      * this directory and its subdirectories will be stored in it using their
      * Digest messages as the keys. (This is recursive -- nested subdirectories
      * will also be stored.
+     *
+     * If a tree is passed, it is overwritten with the Tree message for this
+     * directory, as returned by `to_tree()`. Everything is produced in a
+     * single traversal, serializing each Directory message once.
      */
-    Digest to_digest(digest_string_map *digestMap = nullptr) const;
+    Digest to_digest(digest_string_map *digestMap = nullptr,
+                     Tree *tree = nullptr) const;
 
     /**
      * Convert this NestedDirectory to a Tree message.
@@ -152,6 +158,27 @@ make_nesteddirectory(const char *path,
                          std::vector<std::string>(),
                      const bool followSymlinks = false);
 
+/**
+ * Like `make_nesteddirectory()`, but reading subdirectories and hashing files
+ * concurrently on the given pool.
+ *
+ * The resulting NestedDirectory and fileMap are identical to those produced
+ * by the serial version. `fileDigestFunc` will be invoked from several threads
+ * at once.
+ */
+NestedDirectory make_nesteddirectory_parallel(
+    ThreadPool &pool, const char *path, digest_string_map *fileMap = nullptr,
+    const std::vector<std::string> &capture_properties =
+        std::vector<std::string>(),
+    const bool followSymlinks = false);
+NestedDirectory make_nesteddirectory_parallel(
+    ThreadPool &pool, const char *path,
+    const FileDigestFunction &fileDigestFunc,
+    digest_string_map *fileMap = nullptr,
+    const std::vector<std::string> &capture_properties =
+        std::vector<std::string>(),
+    const bool followSymlinks = false);
+
 std::ostream &operator<<(std::ostream &out, const NestedDirectory &obj);
 
 } // namespace buildboxcommon
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_presencecache.h>
+
+#include <buildboxcommon_exception.h>
+#include <buildboxcommonmetrics_countingmetricutil.h>
+
+#include <stdexcept>
+
+namespace buildboxcommon {
+
+const std::string PresenceCache::s_hitsMetricName = "cas_presence_cache_hits";
+const std::string PresenceCache::s_missesMetricName =
+    "cas_presence_cache_misses";
+
+PresenceCache::PresenceCache(size_t maxEntries, Clock::duration ttl)
+    : d_maxEntries(maxEntries), d_ttl(ttl)
+{
+    if (maxEntries == 0) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(
+            std::invalid_argument,
+            "A presence cache must be able to hold at least one entry");
+    }
+}
+
+void PresenceCache::insert(const Digest &digest)
+{
+    const auto now = Clock::now();
+    const std::lock_guard<std::mutex> lock(d_mutex);
+
+    const auto it = d_index.find(digest);
+    if (it != d_index.end()) {
+        it->second->second = now;
+        d_entries.splice(d_entries.begin(), d_entries, it->second);
+        return;
+    }
+
+    d_entries.emplace_front(digest, now);
+    d_index.emplace(digest, d_entries.begin());
+    if (d_entries.size() > d_maxEntries) {
+        d_index.erase(d_entries.back().first);
+        d_entries.pop_back();
+    }
+}
+
+bool PresenceCache::contains(const Digest &digest)
+{
+    const auto now = Clock::now();
+    const std::lock_guard<std::mutex> lock(d_mutex);
+    return containsLocked(digest, now);
+}
+
+bool PresenceCache::containsLocked(const Digest &digest,
+                                   Clock::time_point now)
+{
+    const auto it = d_index.find(digest);
+    if (it == d_index.end()) {
+        return false;
+    }
+
+    if (now - it->second->second >= d_ttl) {
+        d_entries.erase(it->second);
+        d_index.erase(it);
+        return false;
+    }
+
+    d_entries.splice(d_entries.begin(), d_entries, it->second);
+    return true;
+}
+
+std::vector<Digest>
+PresenceCache::filterUnknown(const std::vector<Digest> &digests)
+{
+    std::vector<Digest> unknown;
+    {
+        const auto now = Clock::now();
+        const std::lock_guard<std::mutex> lock(d_mutex);
+        for (const Digest &digest : digests) {
+            if (!containsLocked(digest, now)) {
+                unknown.push_back(digest);
+            }
+        }
+    }
+
+    typedef buildboxcommonmetrics::CountingMetricValue::Count Count;
+    buildboxcommonmetrics::CountingMetricUtil::recordCounterMetric(
+        s_hitsMetricName, static_cast<Count>(digests.size() - unknown.size()));
+    buildboxcommonmetrics::CountingMetricUtil::recordCounterMetric(
+        s_missesMetricName, static_cast<Count>(unknown.size()));
+    return unknown;
+}
+
+void PresenceCache::clear()
+{
+    const std::lock_guard<std::mutex> lock(d_mutex);
+    d_entries.clear();
+    d_index.clear();
+}
+
+size_t PresenceCache::size() const
+{
+    const std::lock_guard<std::mutex> lock(d_mutex);
+    return d_entries.size();
+}
+
+} // namespace buildboxcommon
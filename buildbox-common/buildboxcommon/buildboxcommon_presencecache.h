@@ -0,0 +1,87 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDED_BUILDBOXCOMMON_PRESENCECACHE
+#define INCLUDED_BUILDBOXCOMMON_PRESENCECACHE
+
+#include <buildboxcommon_protos.h>
+
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace buildboxcommon {
+
+class PresenceCache {
+    /*
+     * Remembers the digests that a CAS server recently confirmed it has, so
+     * that they need not be queried or uploaded again.
+     *
+     * Entries expire `ttl` after they were last confirmed, since the server
+     * may evict blobs, and the least recently used ones are dropped once the
+     * cache holds `maxEntries`. It is safe to use from multiple threads and
+     * can be shared by the clients of one CAS instance, but not between
+     * different instances.
+     */
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Counters recorded with buildboxcommonmetrics by `filterUnknown()`.
+    static const std::string s_hitsMetricName;
+    static const std::string s_missesMetricName;
+
+    // Throws `std::invalid_argument` if `maxEntries` is 0.
+    PresenceCache(size_t maxEntries, Clock::duration ttl);
+
+    PresenceCache(const PresenceCache &) = delete;
+    PresenceCache &operator=(const PresenceCache &) = delete;
+
+    // Record that the server has the blob, refreshing its expiry.
+    void insert(const Digest &digest);
+
+    // Return whether the blob is known to be present and has not expired.
+    bool contains(const Digest &digest);
+
+    // Return the digests, in order, that are not known to be present, and
+    // count the hits and misses.
+    std::vector<Digest> filterUnknown(const std::vector<Digest> &digests);
+
+    // Forget everything.
+    void clear();
+
+    size_t size() const;
+
+  private:
+    // Most recently used entries first.
+    typedef std::list<std::pair<Digest, Clock::time_point>> EntryList;
+
+    bool containsLocked(const Digest &digest, Clock::time_point now);
+
+    const size_t d_maxEntries;
+    const Clock::duration d_ttl;
+
+    mutable std::mutex d_mutex;
+    EntryList d_entries;
+    std::unordered_map<Digest, EntryList::iterator> d_index;
+};
+
+} // namespace buildboxcommon
+
+#endif
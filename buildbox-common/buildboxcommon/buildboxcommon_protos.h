@@ -25,7 +25,10 @@
 
 #include <buildboxcommon_exception.h>
 
+#include <cstdint>
+#include <cstring>
 #include <fcntl.h>
+#include <string>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -90,7 +93,40 @@ namespace std {
 template <> struct hash<buildboxcommon::Digest> {
     std::size_t operator()(const buildboxcommon::Digest &digest) const noexcept
     {
-        return std::hash<std::string>{}(digest.hash_other());
+        // Hash values are already uniformly distributed, so instead of
+        // hashing them again we read a few of their leading bytes and mix
+        // in the size. (Either `hash_other` or `hash_blake3zcc` is set,
+        // depending on the digest function.)
+        uint64_t key = mix(leadingBytes(digest.hash_other())) ^
+                       leadingBytes(digest.hash_blake3zcc());
+        key ^= static_cast<uint64_t>(digest.size_bytes()) *
+               0x9e3779b97f4a7c15ULL;
+        return static_cast<std::size_t>(mix(key));
+    }
+
+  private:
+    // Return the first 16 bytes of `value` folded into 64 bits, or a hash
+    // of the whole string if it is shorter than that.
+    static uint64_t leadingBytes(const std::string &value) noexcept
+    {
+        if (value.size() < 16) {
+            return value.empty() ? 0 : std::hash<std::string>{}(value);
+        }
+        uint64_t words[2];
+        std::memcpy(words, value.data(), sizeof(words));
+        return words[0] ^ ((words[1] << 32) | (words[1] >> 32));
+    }
+
+    // The finalizer of MurmurHash3. For hexadecimal `hash_other` strings,
+    // which only use 4 bits of every byte, this spreads those bits out.
+    static uint64_t mix(uint64_t x) noexcept
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
     }
 };
 } // namespace std
@@ -103,7 +139,9 @@ namespace v2 {
 inline bool operator==(const buildboxcommon::Digest &a,
                        const buildboxcommon::Digest &b)
 {
-    return a.hash_other() == b.hash_other() && a.size_bytes() == b.size_bytes();
+    return a.size_bytes() == b.size_bytes() &&
+           a.hash_blake3zcc() == b.hash_blake3zcc() &&
+           a.hash_other() == b.hash_other();
 }
 
 inline bool operator!=(const buildboxcommon::Digest &a,
@@ -119,12 +157,70 @@ inline bool operator<(const buildboxcommon::Digest &a,
         return a.hash_other() < b.hash_other();
     }
 
+    if (a.hash_blake3zcc() != b.hash_blake3zcc()) {
+        return a.hash_blake3zcc() < b.hash_blake3zcc();
+    }
+
     return a.size_bytes() < b.size_bytes();
 }
 
+// Return `bytes` as a lowercase hexadecimal string.
+inline std::string bytesToHex(const std::string &bytes)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(2 * bytes.size());
+    for (const char c : bytes) {
+        const auto byte = static_cast<unsigned char>(c);
+        hex.push_back(hexDigits[byte >> 4]);
+        hex.push_back(hexDigits[byte & 0xf]);
+    }
+    return hex;
+}
+
+// Inverse of `bytesToHex()`. Return false, leaving `bytes` unspecified, if
+// `hex` is not a valid lowercase hexadecimal string.
+inline bool hexToBytes(const std::string &hex, std::string *bytes)
+{
+    const auto nibble = [](char c) {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        return -1;
+    };
+
+    if (hex.size() % 2 != 0) {
+        return false;
+    }
+    bytes->clear();
+    bytes->reserve(hex.size() / 2);
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        const int high = nibble(hex[i]);
+        const int low = nibble(hex[i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        bytes->push_back(static_cast<char>((high << 4) | low));
+    }
+    return true;
+}
+
+// Return the hash of a digest as a hexadecimal string, regardless of
+// whether it is stored in `hash_other` or in binary in `hash_blake3zcc`.
+inline std::string hashToHex(const buildboxcommon::Digest &digest)
+{
+    if (digest.hash_blake3zcc().empty()) {
+        return digest.hash_other();
+    }
+    return bytesToHex(digest.hash_blake3zcc());
+}
+
 inline std::string toString(const buildboxcommon::Digest &digest)
 {
-    return digest.hash_other() + "/" + std::to_string(digest.size_bytes());
+    return hashToHex(digest) + "/" + std::to_string(digest.size_bytes());
 }
 
 inline std::ostream &operator<<(std::ostream &os,
@@ -0,0 +1,197 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_requesthedger.h>
+
+#include <buildboxcommon_exception.h>
+#include <buildboxcommon_logging.h>
+#include <buildboxcommonmetrics_countingmetricutil.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+
+namespace buildboxcommon {
+
+namespace {
+// Number of latencies kept, and needed before following the percentile.
+const size_t LATENCY_SAMPLES = 100;
+const size_t MIN_LATENCY_SAMPLES = 20;
+
+// Shared between a call to `issue()` and the task that hedges it, which can
+// outlive the call if it never got to run.
+struct HedgeState {
+    std::mutex d_mutex;
+    std::condition_variable d_condition;
+
+    bool d_firstDone = false;
+    bool d_hedgeStarted = false;
+    bool d_hedgeDone = false;
+
+    grpc::Status d_hedgeStatus;
+    std::unique_ptr<grpc::ClientContext> d_hedgeContext;
+};
+} // namespace
+
+const std::string RequestHedger::s_hedgesIssuedMetricName =
+    "hedged_requests_issued";
+const std::string RequestHedger::s_hedgesWonMetricName = "hedged_requests_won";
+
+RequestHedger::RequestHedger(std::chrono::milliseconds delay,
+                             unsigned int percentile, size_t numThreads)
+    : d_delay(delay), d_percentile(percentile),
+      d_pool(numThreads == 0 ? 1 : numThreads)
+{
+    if (delay.count() < 0 || percentile > 100 || numThreads == 0) {
+        BUILDBOXCOMMON_THROW_EXCEPTION(
+            std::invalid_argument,
+            "Invalid hedging configuration: delay "
+                << delay.count() << " ms, percentile " << percentile << ", "
+                << numThreads << " threads");
+    }
+    d_latencies.reserve(LATENCY_SAMPLES);
+}
+
+std::chrono::milliseconds RequestHedger::delay() const
+{
+    if (d_percentile == 0) {
+        return d_delay;
+    }
+
+    std::vector<Clock::duration> latencies;
+    {
+        const std::lock_guard<std::mutex> lock(d_mutex);
+        if (d_latencies.size() < MIN_LATENCY_SAMPLES) {
+            return d_delay;
+        }
+        latencies = d_latencies;
+    }
+
+    const size_t index =
+        std::min(latencies.size() - 1,
+                 latencies.size() * d_percentile / 100);
+    std::nth_element(latencies.begin(), latencies.begin() + index,
+                     latencies.end());
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        latencies[index]);
+}
+
+void RequestHedger::recordLatency(Clock::duration latency)
+{
+    const std::lock_guard<std::mutex> lock(d_mutex);
+    if (d_latencies.size() < LATENCY_SAMPLES) {
+        d_latencies.push_back(latency);
+    }
+    else {
+        d_latencies[d_nextLatency] = latency;
+    }
+    d_nextLatency = (d_nextLatency + 1) % LATENCY_SAMPLES;
+}
+
+grpc::Status RequestHedger::issue(grpc::ClientContext &context,
+                                  const Invocation &invocation,
+                                  const MetadataAttacher &metadataAttacher,
+                                  size_t *winner)
+{
+    const auto start = Clock::now();
+    const auto hedgeTime = start + delay();
+    const auto state = std::make_shared<HedgeState>();
+
+    // The task only touches `context` and `invocation` once it has set
+    // `d_hedgeStarted`, after which this call waits for it to finish.
+    d_pool.submit([state, hedgeTime, &context, &invocation,
+                   metadataAttacher]() {
+        {
+            std::unique_lock<std::mutex> lock(state->d_mutex);
+            if (state->d_condition.wait_until(lock, hedgeTime, [&] {
+                    return state->d_firstDone;
+                })) {
+                return;
+            }
+
+            state->d_hedgeStarted = true;
+            state->d_hedgeContext.reset(new grpc::ClientContext());
+            state->d_hedgeContext->set_deadline(context.deadline());
+            if (metadataAttacher) {
+                metadataAttacher(state->d_hedgeContext.get());
+            }
+        }
+
+        buildboxcommonmetrics::CountingMetricUtil::recordCounterMetric(
+            s_hedgesIssuedMetricName, 1);
+        grpc::Status status;
+        try {
+            status = invocation(*state->d_hedgeContext, 1);
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_DEBUG("Hedged request failed: " << e.what());
+            status = grpc::Status(grpc::StatusCode::UNKNOWN, e.what());
+        }
+
+        const std::lock_guard<std::mutex> lock(state->d_mutex);
+        state->d_hedgeDone = true;
+        state->d_hedgeStatus = status;
+        if (status.ok() && !state->d_firstDone) {
+            context.TryCancel();
+        }
+        state->d_condition.notify_all();
+    });
+
+    grpc::Status status;
+    std::exception_ptr error;
+    try {
+        status = invocation(context, 0);
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    const bool firstSucceeded = error == nullptr && status.ok();
+
+    std::unique_lock<std::mutex> lock(state->d_mutex);
+    state->d_firstDone = true;
+    state->d_condition.notify_all();
+    if (state->d_hedgeStarted) {
+        if (firstSucceeded && !state->d_hedgeDone) {
+            state->d_hedgeContext->TryCancel();
+        }
+        state->d_condition.wait(lock, [&] { return state->d_hedgeDone; });
+
+        // A successful first request that was not cancelled by the hedge
+        // was the first to finish.
+        if (!firstSucceeded && state->d_hedgeStatus.ok()) {
+            lock.unlock();
+            buildboxcommonmetrics::CountingMetricUtil::recordCounterMetric(
+                s_hedgesWonMetricName, 1);
+            recordLatency(Clock::now() - start);
+            *winner = 1;
+            return state->d_hedgeStatus;
+        }
+    }
+    lock.unlock();
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if (firstSucceeded) {
+        recordLatency(Clock::now() - start);
+    }
+    *winner = 0;
+    return status;
+}
+
+} // namespace buildboxcommon
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDED_BUILDBOXCOMMON_REQUESTHEDGER
+#define INCLUDED_BUILDBOXCOMMON_REQUESTHEDGER
+
+#include <buildboxcommon_threadpool.h>
+
+#include <grpcpp/client_context.h>
+#include <grpcpp/support/status.h>
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace buildboxcommon {
+
+class RequestHedger {
+    /*
+     * Issues an idempotent request a second time if the first one is slow
+     * to complete, and keeps the result of whichever succeeds first. The
+     * other one is then cancelled.
+     *
+     * The second request is sent after a fixed delay or, once enough
+     * requests have been timed, after the given percentile of their
+     * latencies. It is issued from one of `numThreads` threads, which also
+     * wait for that delay: if they are all busy, hedges are sent late.
+     *
+     * It is safe to use from multiple threads.
+     */
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Counters recorded with buildboxcommonmetrics.
+    static const std::string s_hedgesIssuedMetricName;
+    static const std::string s_hedgesWonMetricName;
+
+    // Issue the request on `context`. `attempt` is 0 for the first request
+    // and 1 for the hedged one, which may run concurrently, so that they
+    // can write their results to different places.
+    typedef std::function<grpc::Status(grpc::ClientContext &context,
+                                       size_t attempt)>
+        Invocation;
+
+    typedef std::function<void(grpc::ClientContext *)> MetadataAttacher;
+
+    // If `percentile` is not 0, the delay follows that percentile (at most
+    // 100) of the recent latencies as soon as enough are known, and is
+    // `delay` until then. Throws `std::invalid_argument` on invalid values.
+    RequestHedger(std::chrono::milliseconds delay, unsigned int percentile = 0,
+                  size_t numThreads = 4);
+
+    RequestHedger(const RequestHedger &) = delete;
+    RequestHedger &operator=(const RequestHedger &) = delete;
+
+    // Invoke `invocation(context, 0)` and, if it has not returned after the
+    // hedging delay, `invocation(hedgeContext, 1)`, where `hedgeContext`
+    // has the deadline of `context` and the metadata from
+    // `metadataAttacher`.
+    //
+    // Returns the status of the request that succeeded first, or of the
+    // first request if neither did, and sets `winner` to its `attempt`.
+    // Exceptions thrown by the hedged request are ignored; those thrown by
+    // the first one are rethrown unless the hedged request succeeded.
+    grpc::Status issue(grpc::ClientContext &context,
+                       const Invocation &invocation,
+                       const MetadataAttacher &metadataAttacher,
+                       size_t *winner);
+
+    // Current delay before a request is hedged.
+    std::chrono::milliseconds delay() const;
+
+  private:
+    const std::chrono::milliseconds d_delay;
+    const unsigned int d_percentile;
+
+    // Latencies of the most recent successful requests, used as a ring
+    // buffer.
+    mutable std::mutex d_mutex;
+    std::vector<Clock::duration> d_latencies;
+    size_t d_nextLatency = 0;
+
+    void recordLatency(Clock::duration latency);
+
+    // Declared last so that it is destroyed first, waiting for the tasks
+    // that use the rest of the members.
+    ThreadPool d_pool;
+};
+
+} // namespace buildboxcommon
+
+#endif
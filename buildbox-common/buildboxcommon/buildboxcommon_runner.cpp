@@ -673,36 +673,32 @@ std::pair<Digest, Digest>
 Runner::uploadOutputs(const std::string &stdout_file,
                       const std::string &stderr_file) const
 {
-    Digest stdout_digest = CASHash::hashFile(stdout_file);
-    Digest stderr_digest = CASHash::hashFile(stderr_file);
-
-    const std::vector<Client::UploadRequest> upload_requests = {
-        Client::UploadRequest::from_path(stdout_digest, stdout_file),
-        Client::UploadRequest::from_path(stderr_digest, stderr_file),
-    };
-
-    // If some output fails to be uploaded, we'll return an empty digest for
-    // it.
-    std::vector<Client::UploadResult> failed_blobs;
+    // Small outputs are read only once, both to hash and upload them, and
+    // large ones are only read again if the server is missing them.
+    std::vector<Client::UploadResult> results;
     try {
-        failed_blobs = this->d_casClient->uploadBlobs(upload_requests);
+        results =
+            this->d_casClient->hashAndUploadFiles({stdout_file, stderr_file});
     }
     catch (const std::exception &e) {
         BUILDBOX_LOG_ERROR("Failed to upload stdout and stderr: " << e.what());
         return std::make_pair(Digest(), Digest());
     }
 
-    for (const auto &blob : failed_blobs) {
-        if (blob.digest == stdout_digest) {
-            BUILDBOX_LOG_ERROR("Failed to upload stdout contents. Received: "
-                               << blob.status.error_message());
-            stdout_digest = Digest();
-        }
-        else {
-            BUILDBOX_LOG_ERROR("Failed to upload stderr contents. Received: "
-                               << blob.status.error_message());
-            stderr_digest = Digest();
-        }
+    // If some output fails to be uploaded, we'll return an empty digest for
+    // it.
+    Digest stdout_digest = results[0].digest;
+    if (!results[0].status.ok()) {
+        BUILDBOX_LOG_ERROR("Failed to upload stdout contents. Received: "
+                           << results[0].status.error_message());
+        stdout_digest = Digest();
+    }
+
+    Digest stderr_digest = results[1].digest;
+    if (!results[1].status.ok()) {
+        BUILDBOX_LOG_ERROR("Failed to upload stderr contents. Received: "
+                           << results[1].status.error_message());
+        stderr_digest = Digest();
     }
 
     return std::make_pair(std::move(stdout_digest), std::move(stderr_digest));
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_threadpool.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+namespace buildboxcommon {
+
+ThreadPool::ThreadPool(size_t numThreads) : d_stopping(false)
+{
+    if (numThreads == 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    d_workers.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; i++) {
+        d_workers.emplace_back(&ThreadPool::run, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        const std::lock_guard<std::mutex> lock(d_mutex);
+        d_stopping = true;
+    }
+    d_condition.notify_all();
+
+    for (std::thread &worker : d_workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(Task task)
+{
+    {
+        const std::lock_guard<std::mutex> lock(d_mutex);
+        d_queue.push_back(std::move(task));
+    }
+    d_condition.notify_one();
+}
+
+void ThreadPool::run()
+{
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(d_mutex);
+            d_condition.wait(
+                lock, [this]() { return d_stopping || !d_queue.empty(); });
+            // Drain the queue before exiting so that no submitted task is
+            // silently dropped.
+            if (d_queue.empty()) {
+                return;
+            }
+            task = std::move(d_queue.front());
+            d_queue.pop_front();
+        }
+
+        try {
+            task();
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_ERROR("Uncaught exception in thread pool task: "
+                               << e.what());
+        }
+        catch (...) {
+            BUILDBOX_LOG_ERROR("Uncaught exception in thread pool task");
+        }
+    }
+}
+
+namespace {
+// State of a `parallelFor()` call. It is shared with the helper tasks,
+// which may only start running after the call has returned, in which case
+// they find no work left and exit without touching the caller's function.
+struct ParallelForState {
+    explicit ParallelForState(size_t count) : d_count(count) {}
+
+    const size_t d_count;
+    std::atomic<size_t> d_next{0};
+
+    std::mutex d_mutex;
+    std::condition_variable d_done;
+    size_t d_completed = 0;
+    std::exception_ptr d_exception;
+
+    // Run iterations until there are none left to claim. `function` is
+    // only dereferenced after claiming one, which guarantees that the caller
+    // is still waiting.
+    void work(const std::function<void(size_t)> *function)
+    {
+        size_t index;
+        while ((index = d_next.fetch_add(1)) < d_count) {
+            std::exception_ptr exception;
+            try {
+                (*function)(index);
+            }
+            catch (...) {
+                exception = std::current_exception();
+            }
+
+            const std::lock_guard<std::mutex> lock(d_mutex);
+            if (exception && !d_exception) {
+                d_exception = exception;
+            }
+            if (++d_completed == d_count) {
+                d_done.notify_all();
+            }
+        }
+    }
+};
+} // namespace
+
+void ThreadPool::parallelFor(size_t count,
+                             const std::function<void(size_t)> &function,
+                             size_t maxParallelism)
+{
+    if (count == 0) {
+        return;
+    }
+
+    const auto state = std::make_shared<ParallelForState>(count);
+    const std::function<void(size_t)> *functionPtr = &function;
+
+    size_t helpers = std::min(count - 1, d_workers.size());
+    if (maxParallelism > 0) {
+        helpers = std::min(helpers, maxParallelism - 1);
+    }
+    for (size_t i = 0; i < helpers; i++) {
+        submit([state, functionPtr]() { state->work(functionPtr); });
+    }
+
+    state->work(functionPtr);
+
+    std::unique_lock<std::mutex> lock(state->d_mutex);
+    state->d_done.wait(
+        lock, [&state, count]() { return state->d_completed == count; });
+    if (state->d_exception) {
+        std::rethrow_exception(state->d_exception);
+    }
+}
+
+ThreadPool &ThreadPool::defaultPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+} // namespace buildboxcommon
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDED_BUILDBOXCOMMON_THREADPOOL
+#define INCLUDED_BUILDBOXCOMMON_THREADPOOL
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace buildboxcommon {
+
+class ThreadPool {
+    /*
+     * A fixed-size pool of worker threads that run queued tasks in FIFO
+     * order.
+     *
+     * Besides fire-and-forget tasks, it offers `parallelFor()`, in which the
+     * calling thread takes part in the work. That makes it safe to use from
+     * inside a task that is itself running on the pool: even if every worker
+     * is busy, the caller will make progress on its own.
+     */
+  public:
+    typedef std::function<void()> Task;
+
+    // Start `numThreads` workers. A value of 0 uses the number of hardware
+    // threads reported by the system.
+    explicit ThreadPool(size_t numThreads = 0);
+
+    // Wait for the queued tasks to finish and join the workers.
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const { return d_workers.size(); }
+
+    // Queue a task. Exceptions thrown by it are ignored, use `async()` to
+    // observe them.
+    void submit(Task task);
+
+    // Queue a callable and return a future for its result.
+    template <typename Function>
+    auto async(Function function)
+        -> std::future<decltype(function())>
+    {
+        typedef decltype(function()) Result;
+        const auto packagedTask =
+            std::make_shared<std::packaged_task<Result()>>(
+                std::move(function));
+        std::future<Result> result = packagedTask->get_future();
+        submit([packagedTask]() { (*packagedTask)(); });
+        return result;
+    }
+
+    // Invoke `function(i)` for every `i` in `[0, count)`, spreading the
+    // calls across the pool and the calling thread, and return once all of
+    // them have completed. If any invocation throws, the first exception is
+    // rethrown here after the others have finished.
+    //
+    // If `maxParallelism` is not 0, at most that many invocations (counting
+    // the one on the calling thread) run at the same time.
+    void parallelFor(size_t count, const std::function<void(size_t)> &function,
+                     size_t maxParallelism = 0);
+
+    // Return a pool shared by the whole process, sized to the number of
+    // hardware threads. It is created on first use.
+    static ThreadPool &defaultPool();
+
+  private:
+    std::vector<std::thread> d_workers;
+    std::deque<Task> d_queue;
+    std::mutex d_mutex;
+    std::condition_variable d_condition;
+    bool d_stopping;
+
+    void run();
+};
+
+} // namespace buildboxcommon
+
+#endif
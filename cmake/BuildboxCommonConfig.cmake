@@ -29,6 +29,10 @@ else()
     set(GRPC_TARGET PkgConfig::grpc++)
 endif()
 
+find_dependency(ZLIB)
+find_dependency(PkgConfig)
+pkg_check_modules(zstd IMPORTED_TARGET libzstd>=1.4.0)
+
 if(NOT APPLE)
     find_dependency(PkgConfig)
     pkg_check_modules(uuid REQUIRED IMPORTED_TARGET uuid)
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_actioncacheclient.h>
+#include <buildboxcommon_cashash.h>
+#include <buildboxcommon_grpcretry.h>
+#include <buildboxcommon_protos.h>
+
+#include <memory>
+#include <string>
+
+#include <build/bazel/remote/execution/v2/remote_execution_mock.grpc.pb.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace buildboxcommon;
+using namespace testing;
+
+class ActionCacheClientTestFixture : public testing::Test {
+  protected:
+    const std::string INSTANCE_NAME = "instance";
+    const int GRPC_RETRY_LIMIT = 1;
+    const int GRPC_RETRY_DELAY = 1;
+
+    std::shared_ptr<MockActionCacheStub> actionCacheStub =
+        std::make_shared<MockActionCacheStub>();
+
+    const Digest actionDigest = CASHash::hash("action");
+    ActionResult actionResult;
+
+    ActionCacheClientTestFixture() { actionResult.set_exit_code(42); }
+
+    std::unique_ptr<ActionCacheClient> makeClient(size_t cacheEntries)
+    {
+        return std::make_unique<ActionCacheClient>(
+            actionCacheStub, INSTANCE_NAME, GRPC_RETRY_LIMIT,
+            GRPC_RETRY_DELAY, cacheEntries);
+    }
+};
+
+TEST_F(ActionCacheClientTestFixture, GetActionResultHit)
+{
+    GetActionResultRequest request;
+    EXPECT_CALL(*actionCacheStub, GetActionResult(_, _, _))
+        .WillOnce(DoAll(SaveArg<1>(&request), SetArgPointee<2>(actionResult),
+                        Return(grpc::Status::OK)));
+
+    auto client = makeClient(0);
+    ActionResult result;
+    ASSERT_TRUE(client->getActionResult(actionDigest, &result, true, false,
+                                        {"out/a", "out/b"}));
+    EXPECT_EQ(result.exit_code(), 42);
+
+    EXPECT_EQ(request.instance_name(), INSTANCE_NAME);
+    EXPECT_EQ(request.action_digest(), actionDigest);
+    EXPECT_TRUE(request.inline_stdout());
+    EXPECT_FALSE(request.inline_stderr());
+    ASSERT_EQ(request.inline_output_files_size(), 2);
+    EXPECT_EQ(request.inline_output_files(1), "out/b");
+}
+
+TEST_F(ActionCacheClientTestFixture, GetActionResultNotFound)
+{
+    EXPECT_CALL(*actionCacheStub, GetActionResult(_, _, _))
+        .WillOnce(Return(grpc::Status(grpc::StatusCode::NOT_FOUND, "")));
+
+    auto client = makeClient(0);
+    ActionResult result;
+    EXPECT_FALSE(client->getActionResult(actionDigest, &result));
+}
+
+TEST_F(ActionCacheClientTestFixture, GetActionResultRetriesThenThrows)
+{
+    EXPECT_CALL(*actionCacheStub, GetActionResult(_, _, _))
+        .Times(GRPC_RETRY_LIMIT + 1)
+        .WillRepeatedly(
+            Return(grpc::Status(grpc::StatusCode::UNAVAILABLE, "")));
+
+    auto client = makeClient(0);
+    ActionResult result;
+    EXPECT_THROW(client->getActionResult(actionDigest, &result), GrpcError);
+}
+
+TEST_F(ActionCacheClientTestFixture, RepeatedLookupsAreAnsweredLocally)
+{
+    EXPECT_CALL(*actionCacheStub, GetActionResult(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(actionResult),
+                        Return(grpc::Status::OK)));
+
+    auto client = makeClient(8);
+    ActionResult result;
+    ASSERT_TRUE(client->getActionResult(actionDigest, &result, true, true,
+                                        {"out/a"}));
+    ASSERT_TRUE(client->getActionResult(actionDigest, &result, true));
+    ASSERT_TRUE(client->getActionResult(actionDigest, &result, false, false,
+                                        {"out/a"}));
+    EXPECT_EQ(result.exit_code(), 42);
+    EXPECT_EQ(client->cacheSize(), 1);
+}
+
+TEST_F(ActionCacheClientTestFixture, LookupsNeedingMoreInlineOutputsAreSent)
+{
+    EXPECT_CALL(*actionCacheStub, GetActionResult(_, _, _))
+        .Times(3)
+        .WillRepeatedly(DoAll(SetArgPointee<2>(actionResult),
+                              Return(grpc::Status::OK)));
+
+    auto client = makeClient(8);
+    ActionResult result;
+    ASSERT_TRUE(client->getActionResult(actionDigest, &result));
+    ASSERT_TRUE(client->getActionResult(actionDigest, &result, true));
+    ASSERT_TRUE(client->getActionResult(actionDigest, &result, true, false,
+                                        {"out/a"}));
+
+    // The last result fetched covers the previous lookups:
+    ASSERT_TRUE(client->getActionResult(actionDigest, &result));
+    ASSERT_TRUE(client->getActionResult(actionDigest, &result, true));
+}
+
+TEST_F(ActionCacheClientTestFixture, MissesAreNotRemembered)
+{
+    EXPECT_CALL(*actionCacheStub, GetActionResult(_, _, _))
+        .Times(2)
+        .WillRepeatedly(
+            Return(grpc::Status(grpc::StatusCode::NOT_FOUND, "")));
+
+    auto client = makeClient(8);
+    ActionResult result;
+    EXPECT_FALSE(client->getActionResult(actionDigest, &result));
+    EXPECT_FALSE(client->getActionResult(actionDigest, &result));
+    EXPECT_EQ(client->cacheSize(), 0);
+}
+
+TEST_F(ActionCacheClientTestFixture, CacheEvictsLeastRecentlyUsed)
+{
+    EXPECT_CALL(*actionCacheStub, GetActionResult(_, _, _))
+        .Times(4)
+        .WillRepeatedly(DoAll(SetArgPointee<2>(actionResult),
+                              Return(grpc::Status::OK)));
+
+    auto client = makeClient(2);
+    const Digest a = CASHash::hash("a");
+    const Digest b = CASHash::hash("b");
+    const Digest c = CASHash::hash("c");
+    ActionResult result;
+
+    client->getActionResult(a, &result);
+    client->getActionResult(b, &result);
+    client->getActionResult(a, &result); // local hit, `b` is now the oldest
+    client->getActionResult(c, &result);
+    EXPECT_EQ(client->cacheSize(), 2);
+
+    client->getActionResult(a, &result); // local hit
+    client->getActionResult(b, &result);
+}
+
+TEST_F(ActionCacheClientTestFixture, UpdateActionResultIsRemembered)
+{
+    UpdateActionResultRequest request;
+    EXPECT_CALL(*actionCacheStub, UpdateActionResult(_, _, _))
+        .WillOnce(DoAll(SaveArg<1>(&request), SetArgPointee<2>(actionResult),
+                        Return(grpc::Status::OK)));
+    EXPECT_CALL(*actionCacheStub, GetActionResult(_, _, _)).Times(0);
+
+    auto client = makeClient(8);
+    EXPECT_EQ(client->updateActionResult(actionDigest, actionResult)
+                  .exit_code(),
+              42);
+    EXPECT_EQ(request.instance_name(), INSTANCE_NAME);
+    EXPECT_EQ(request.action_digest(), actionDigest);
+    EXPECT_EQ(request.action_result().exit_code(), 42);
+
+    ActionResult result;
+    ASSERT_TRUE(client->getActionResult(actionDigest, &result));
+    EXPECT_EQ(result.exit_code(), 42);
+
+    client->clearCache();
+    EXPECT_EQ(client->cacheSize(), 0);
+}
+
+TEST_F(ActionCacheClientTestFixture, UpdateActionResultThrowsOnError)
+{
+    EXPECT_CALL(*actionCacheStub, UpdateActionResult(_, _, _))
+        .WillOnce(
+            Return(grpc::Status(grpc::StatusCode::PERMISSION_DENIED, "")));
+
+    auto client = makeClient(8);
+    EXPECT_THROW(client->updateActionResult(actionDigest, actionResult),
+                 GrpcError);
+    EXPECT_EQ(client->cacheSize(), 0);
+}
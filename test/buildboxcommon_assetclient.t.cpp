@@ -0,0 +1,299 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_assetclient.h>
+#include <buildboxcommon_cashash.h>
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_grpcretry.h>
+#include <buildboxcommon_protos.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include <build/bazel/remote/asset/v1/remote_asset_mock.grpc.pb.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace buildboxcommon;
+using namespace testing;
+
+class AssetClientTestFixture : public testing::Test {
+  protected:
+    const std::string INSTANCE_NAME = "instance";
+    const int GRPC_RETRY_LIMIT = 1;
+    const int GRPC_RETRY_DELAY = 1;
+    const std::string URI = "https://example.com/archive.tar.gz";
+
+    std::shared_ptr<MockFetchStub> fetchStub =
+        std::make_shared<MockFetchStub>();
+    std::shared_ptr<MockPushStub> pushStub = std::make_shared<MockPushStub>();
+
+    TemporaryDirectory directory;
+    const std::string memoPath = std::string(directory.name()) + "/memo";
+
+    const Digest blobDigest = CASHash::hash("archive");
+    std::vector<Qualifier> qualifiers;
+    FetchBlobResponse fetchBlobResponse;
+
+    AssetClientTestFixture()
+    {
+        Qualifier qualifier;
+        qualifier.set_name("checksum.sri");
+        qualifier.set_value("sha256-abc");
+        qualifiers.push_back(qualifier);
+
+        fetchBlobResponse.set_uri(URI);
+        *fetchBlobResponse.mutable_blob_digest() = blobDigest;
+    }
+
+    std::unique_ptr<AssetClient> makeClient(const std::string &path = "")
+    {
+        return makeClient(path, INSTANCE_NAME);
+    }
+
+    std::unique_ptr<AssetClient> makeClient(const std::string &path,
+                                            const std::string &instanceName)
+    {
+        return std::make_unique<AssetClient>(fetchStub, pushStub,
+                                             instanceName, GRPC_RETRY_LIMIT,
+                                             GRPC_RETRY_DELAY, path);
+    }
+};
+
+TEST_F(AssetClientTestFixture, FetchBlob)
+{
+    FetchBlobRequest request;
+    EXPECT_CALL(*fetchStub, FetchBlob(_, _, _))
+        .WillOnce(DoAll(SaveArg<1>(&request),
+                        SetArgPointee<2>(fetchBlobResponse),
+                        Return(grpc::Status::OK)));
+
+    auto client = makeClient();
+    const FetchBlobResponse response =
+        client->fetchBlob({"https://mirror/archive.tar.gz", URI}, qualifiers);
+    EXPECT_EQ(response.uri(), URI);
+    EXPECT_EQ(response.blob_digest(), blobDigest);
+
+    EXPECT_EQ(request.instance_name(), INSTANCE_NAME);
+    ASSERT_EQ(request.uris_size(), 2);
+    EXPECT_EQ(request.uris(1), URI);
+    ASSERT_EQ(request.qualifiers_size(), 1);
+    EXPECT_EQ(request.qualifiers(0).name(), "checksum.sri");
+}
+
+TEST_F(AssetClientTestFixture, RepeatedFetchesAreMemoized)
+{
+    EXPECT_CALL(*fetchStub, FetchBlob(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(fetchBlobResponse),
+                        Return(grpc::Status::OK)));
+
+    auto client = makeClient();
+    client->fetchBlob({URI}, qualifiers);
+
+    const FetchBlobResponse response =
+        client->fetchBlob({"https://other/archive.tar.gz", URI}, qualifiers);
+    EXPECT_EQ(response.uri(), URI);
+    EXPECT_EQ(response.blob_digest(), blobDigest);
+    EXPECT_EQ(response.qualifiers_size(), 1);
+    EXPECT_EQ(client->memoSize(), 1);
+}
+
+TEST_F(AssetClientTestFixture, MemoDependsOnQualifiersAndType)
+{
+    EXPECT_CALL(*fetchStub, FetchBlob(_, _, _))
+        .Times(2)
+        .WillRepeatedly(DoAll(SetArgPointee<2>(fetchBlobResponse),
+                              Return(grpc::Status::OK)));
+    FetchDirectoryResponse fetchDirectoryResponse;
+    fetchDirectoryResponse.set_uri(URI);
+    EXPECT_CALL(*fetchStub, FetchDirectory(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(fetchDirectoryResponse),
+                        Return(grpc::Status::OK)));
+
+    auto client = makeClient();
+    client->fetchBlob({URI}, qualifiers);
+    client->fetchBlob({URI});
+    client->fetchDirectory({URI}, qualifiers);
+    EXPECT_EQ(client->memoSize(), 3);
+}
+
+TEST_F(AssetClientTestFixture, ExpiredEntriesAreFetchedAgain)
+{
+    fetchBlobResponse.mutable_expires_at()->set_seconds(1);
+    EXPECT_CALL(*fetchStub, FetchBlob(_, _, _))
+        .Times(2)
+        .WillRepeatedly(DoAll(SetArgPointee<2>(fetchBlobResponse),
+                              Return(grpc::Status::OK)));
+
+    auto client = makeClient();
+    client->fetchBlob({URI}, qualifiers);
+    client->fetchBlob({URI}, qualifiers);
+}
+
+TEST_F(AssetClientTestFixture, FetchErrorInResponseThrows)
+{
+    fetchBlobResponse.mutable_status()->set_code(grpc::StatusCode::NOT_FOUND);
+    EXPECT_CALL(*fetchStub, FetchBlob(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(fetchBlobResponse),
+                        Return(grpc::Status::OK)));
+
+    auto client = makeClient();
+    try {
+        client->fetchBlob({URI}, qualifiers);
+        FAIL() << "Expected GrpcError";
+    }
+    catch (const GrpcError &e) {
+        EXPECT_EQ(e.status.error_code(), grpc::StatusCode::NOT_FOUND);
+    }
+    EXPECT_EQ(client->memoSize(), 0);
+}
+
+TEST_F(AssetClientTestFixture, FetchRetriesThenThrows)
+{
+    EXPECT_CALL(*fetchStub, FetchBlob(_, _, _))
+        .Times(GRPC_RETRY_LIMIT + 1)
+        .WillRepeatedly(
+            Return(grpc::Status(grpc::StatusCode::UNAVAILABLE, "")));
+
+    auto client = makeClient();
+    EXPECT_THROW(client->fetchBlob({URI}, qualifiers), GrpcError);
+}
+
+TEST_F(AssetClientTestFixture, PushedAssetsAreMemoized)
+{
+    PushDirectoryRequest request;
+    EXPECT_CALL(*pushStub, PushDirectory(_, _, _))
+        .WillOnce(DoAll(SaveArg<1>(&request), Return(grpc::Status::OK)));
+    EXPECT_CALL(*fetchStub, FetchDirectory(_, _, _)).Times(0);
+
+    auto client = makeClient();
+    const Digest rootDigest = CASHash::hash("root");
+    client->pushDirectory({URI, "https://mirror/archive.tar.gz"}, qualifiers,
+                          rootDigest);
+    EXPECT_EQ(request.instance_name(), INSTANCE_NAME);
+    EXPECT_EQ(request.root_directory_digest(), rootDigest);
+    EXPECT_EQ(request.uris_size(), 2);
+
+    EXPECT_EQ(client->fetchDirectory({"https://mirror/archive.tar.gz"},
+                                     qualifiers)
+                  .root_directory_digest(),
+              rootDigest);
+}
+
+TEST_F(AssetClientTestFixture, MemoIsPersisted)
+{
+    EXPECT_CALL(*pushStub, PushBlob(_, _, _))
+        .WillOnce(Return(grpc::Status::OK));
+    EXPECT_CALL(*fetchStub, FetchBlob(_, _, _)).Times(0);
+
+    Qualifier qualifier;
+    qualifier.set_name("arch");
+    qualifier.set_value("x86_64");
+    qualifiers.push_back(qualifier);
+    makeClient(memoPath)->pushBlob({URI}, qualifiers, blobDigest);
+
+    // Qualifiers in a different order resolve to the same entry:
+    std::reverse(qualifiers.begin(), qualifiers.end());
+    auto client = makeClient(memoPath);
+    EXPECT_EQ(client->memoSize(), 1);
+    EXPECT_EQ(client->fetchBlob({URI}, qualifiers).blob_digest(), blobDigest);
+
+    FileUtils::writeFileAtomically(
+        memoPath, FileUtils::getFileContents(memoPath.c_str()) + "invalid\n");
+    EXPECT_EQ(makeClient(memoPath)->memoSize(), 1);
+}
+
+TEST_F(AssetClientTestFixture, SharedMemoIsScopedByInstance)
+{
+    EXPECT_CALL(*pushStub, PushBlob(_, _, _))
+        .WillOnce(Return(grpc::Status::OK));
+    FetchBlobRequest request;
+    EXPECT_CALL(*fetchStub, FetchBlob(_, _, _))
+        .WillOnce(DoAll(SaveArg<1>(&request),
+                        SetArgPointee<2>(fetchBlobResponse),
+                        Return(grpc::Status::OK)));
+
+    makeClient(memoPath, "instanceA")
+        ->pushBlob({URI}, qualifiers, CASHash::hash("other"));
+
+    // The entry of the other instance does not answer this one:
+    auto client = makeClient(memoPath, "instanceB");
+    EXPECT_EQ(client->fetchBlob({URI}, qualifiers).blob_digest(), blobDigest);
+    EXPECT_EQ(request.instance_name(), "instanceB");
+}
+
+TEST_F(AssetClientTestFixture, MemoFileIsCompactedOnLoad)
+{
+    EXPECT_CALL(*pushStub, PushBlob(_, _, _))
+        .Times(3)
+        .WillRepeatedly(Return(grpc::Status::OK));
+
+    {
+        auto client = makeClient(memoPath);
+        client->pushBlob({URI}, qualifiers, CASHash::hash("old"));
+        client->pushBlob({URI}, qualifiers, blobDigest);
+        client->pushBlob({"https://other/archive.tar.gz"}, qualifiers,
+                         blobDigest);
+    }
+    // An expired entry, left by an earlier fetch:
+    const std::string expiredLine =
+        AssetClient::memoKey("", INSTANCE_NAME, AssetClient::AssetType::Blob,
+                             "https://expired/archive.tar.gz", qualifiers) +
+        " " + bytesToHex(blobDigest.SerializeAsString()) + " 1\n";
+    FileUtils::writeFileAtomically(
+        memoPath, FileUtils::getFileContents(memoPath.c_str()) + expiredLine +
+                      "invalid\n");
+
+    EXPECT_EQ(makeClient(memoPath)->memoSize(), 2);
+
+    // Only the live entries are left in the file:
+    const std::string contents = FileUtils::getFileContents(memoPath.c_str());
+    EXPECT_EQ(std::count(contents.cbegin(), contents.cend(), '\n'), 2);
+    auto client = makeClient(memoPath);
+    EXPECT_EQ(client->memoSize(), 2);
+    EXPECT_EQ(client->fetchBlob({URI}, qualifiers).blob_digest(), blobDigest);
+}
+
+TEST(AssetClientMemoKeyTest, KeysAreHexadecimalForEveryDigestFunction)
+{
+    for (const DigestFunction_Value digestFunction :
+         {DigestFunction_Value_SHA256, DigestFunction_Value_BLAKE3ZCC}) {
+        const auto key = [digestFunction](const std::string &remoteUrl,
+                                          const std::string &instanceName,
+                                          AssetClient::AssetType type,
+                                          const std::string &uri) {
+            return AssetClient::memoKey(remoteUrl, instanceName, type, uri,
+                                        {}, digestFunction);
+        };
+        const std::string blobKey = key("http://cas", "instance",
+                                        AssetClient::AssetType::Blob, "a");
+        EXPECT_FALSE(blobKey.empty());
+        EXPECT_EQ(blobKey.find_first_not_of("0123456789abcdef"),
+                  std::string::npos);
+
+        // Different remotes, instances, URIs and types must not collide:
+        EXPECT_NE(blobKey, key("http://other", "instance",
+                               AssetClient::AssetType::Blob, "a"));
+        EXPECT_NE(blobKey, key("http://cas", "other",
+                               AssetClient::AssetType::Blob, "a"));
+        EXPECT_NE(blobKey, key("http://cas", "instance",
+                               AssetClient::AssetType::Blob, "b"));
+        EXPECT_NE(blobKey, key("http://cas", "instance",
+                               AssetClient::AssetType::Directory, "a"));
+    }
+}
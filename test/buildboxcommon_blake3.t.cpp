@@ -0,0 +1,319 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <blake3_impl.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+typedef void (*HashManyFunction)(const uint8_t *const *inputs,
+                                 size_t num_inputs, size_t blocks,
+                                 const uint32_t key[8], uint64_t counter,
+                                 bool increment_counter, uint8_t flags,
+                                 uint8_t flags_start, uint8_t flags_end,
+                                 uint8_t *out);
+
+typedef void (*CompressXofFunction)(const uint32_t cv[8],
+                                    const uint8_t block[BLAKE3_BLOCK_LEN],
+                                    uint8_t block_len, uint64_t counter,
+                                    uint8_t flags, uint8_t out[64]);
+
+typedef void (*CompressInPlaceFunction)(uint32_t cv[8],
+                                        const uint8_t block[BLAKE3_BLOCK_LEN],
+                                        uint8_t block_len, uint64_t counter,
+                                        uint8_t flags);
+
+struct Backend {
+    std::string name;
+    HashManyFunction hashMany;
+    CompressXofFunction compressXof;
+    CompressInPlaceFunction compressInPlace;
+};
+
+// Backends that were compiled in and that the current CPU can run. The
+// dispatching entry points are always included.
+std::vector<Backend> availableBackends()
+{
+    std::vector<Backend> backends = {{"dispatch", blake3_hash_many,
+                                      blake3_compress_xof,
+                                      blake3_compress_in_place}};
+#if defined(IS_X86) && defined(__GNUC__)
+#if !defined(BLAKE3_NO_SSE2)
+    if (__builtin_cpu_supports("sse2")) {
+        backends.push_back({"sse2", blake3_hash_many_sse2,
+                            blake3_compress_xof_sse2,
+                            blake3_compress_in_place_sse2});
+    }
+#endif
+#if !defined(BLAKE3_NO_SSE41)
+    if (__builtin_cpu_supports("sse4.1")) {
+        backends.push_back({"sse41", blake3_hash_many_sse41,
+                            blake3_compress_xof_sse41,
+                            blake3_compress_in_place_sse41});
+    }
+#endif
+#if !defined(BLAKE3_NO_AVX2)
+    // AVX2 only provides `hash_many()`.
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.1")) {
+        backends.push_back({"avx2", blake3_hash_many_avx2,
+                            blake3_compress_xof_portable,
+                            blake3_compress_in_place_portable});
+    }
+#endif
+#if !defined(BLAKE3_NO_AVX512)
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512vl")) {
+        backends.push_back({"avx512", blake3_hash_many_avx512,
+                            blake3_compress_xof_avx512,
+                            blake3_compress_in_place_avx512});
+    }
+#endif
+#endif
+    return backends;
+}
+
+std::vector<uint8_t> testInput(size_t length)
+{
+    std::vector<uint8_t> input(length);
+    for (size_t i = 0; i < length; i++) {
+        input[i] = static_cast<uint8_t>(i % 251);
+    }
+    return input;
+}
+
+std::string toHex(const uint8_t *data, size_t length)
+{
+    std::ostringstream os;
+    for (size_t i = 0; i < length; i++) {
+        os << std::hex << std::setw(2) << std::setfill('0')
+           << static_cast<int>(data[i]);
+    }
+    return os.str();
+}
+
+std::string finalizeToHex(const blake3_hasher &hasher)
+{
+    uint8_t out[BLAKE3_OUT_LEN];
+    blake3_hasher_finalize(&hasher, out, BLAKE3_OUT_LEN);
+    return toHex(out, BLAKE3_OUT_LEN);
+}
+
+std::string blake3zcc(const std::vector<uint8_t> &input)
+{
+    blake3_hasher hasher;
+    blake3_hasher_init(&hasher);
+    blake3_hasher_update(&hasher, input.data(), input.size());
+    return finalizeToHex(hasher);
+}
+
+// Runs the tasks in reverse order, to make sure that the result does not
+// depend on the order in which parts complete.
+void reverseParallelFor(void *context, size_t count,
+                        void (*task)(void *task_context, size_t index),
+                        void *task_context)
+{
+    *static_cast<size_t *>(context) += count;
+    for (size_t i = count; i > 0; i--) {
+        task(task_context, i - 1);
+    }
+}
+
+} // namespace
+
+TEST(Blake3Test, HashManyMatchesPortable)
+{
+    const size_t maxInputs = 2 * MAX_SIMD_DEGREE + 3;
+    const size_t maxBlocks = BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN;
+    const std::vector<uint8_t> data =
+        testInput(maxInputs * maxBlocks * BLAKE3_BLOCK_LEN);
+
+    for (const Backend &backend : availableBackends()) {
+        for (size_t numInputs = 0; numInputs <= maxInputs; numInputs++) {
+            for (const size_t blocks : {size_t(1), size_t(2), maxBlocks}) {
+                std::vector<const uint8_t *> inputs;
+                for (size_t i = 0; i < numInputs; i++) {
+                    inputs.push_back(&data[i * blocks * BLAKE3_BLOCK_LEN]);
+                }
+
+                std::vector<uint8_t> expected(numInputs * BLAKE3_OUT_LEN + 1);
+                std::vector<uint8_t> actual(expected.size());
+                blake3_hash_many_portable(inputs.data(), numInputs, blocks,
+                                          IV, 12345, true, 0, CHUNK_START,
+                                          CHUNK_END, expected.data());
+                backend.hashMany(inputs.data(), numInputs, blocks, IV, 12345,
+                                 true, 0, CHUNK_START, CHUNK_END,
+                                 actual.data());
+
+                EXPECT_EQ(expected, actual)
+                    << backend.name << ": " << numInputs << " inputs of "
+                    << blocks << " blocks";
+            }
+        }
+    }
+}
+
+TEST(Blake3Test, HashManyParentsMatchesPortable)
+{
+    // Parent nodes are hashed as single blocks with no start/end flags.
+    const size_t numInputs = MAX_SIMD_DEGREE + 5;
+    const std::vector<uint8_t> data =
+        testInput(numInputs * BLAKE3_BLOCK_LEN);
+    std::vector<const uint8_t *> inputs;
+    for (size_t i = 0; i < numInputs; i++) {
+        inputs.push_back(&data[i * BLAKE3_BLOCK_LEN]);
+    }
+
+    for (const Backend &backend : availableBackends()) {
+        std::vector<uint8_t> expected(numInputs * BLAKE3_OUT_LEN);
+        std::vector<uint8_t> actual(expected.size());
+        blake3_hash_many_portable(inputs.data(), numInputs, 1, IV, 0, false,
+                                  PARENT, 0, 0, expected.data());
+        backend.hashMany(inputs.data(), numInputs, 1, IV, 0, false, PARENT, 0,
+                         0, actual.data());
+        EXPECT_EQ(expected, actual) << backend.name;
+    }
+}
+
+TEST(Blake3Test, CompressMatchesPortable)
+{
+    const std::vector<uint8_t> block = testInput(BLAKE3_BLOCK_LEN);
+    const uint8_t flagCombinations[] = {
+        0, CHUNK_START, CHUNK_END, CHUNK_START | CHUNK_END | ROOT, PARENT,
+        PARENT | ROOT};
+
+    for (const Backend &backend : availableBackends()) {
+        for (const uint8_t flags : flagCombinations) {
+            for (const uint8_t blockLength : {0, 1, 33, BLAKE3_BLOCK_LEN}) {
+                // The counter must be ignored by every backend.
+                uint8_t expectedXof[64], actualXof[64];
+                blake3_compress_xof_portable(IV, block.data(), blockLength, 7,
+                                             flags, expectedXof);
+                backend.compressXof(IV, block.data(), blockLength, 7, flags,
+                                    actualXof);
+                EXPECT_EQ(toHex(expectedXof, 64), toHex(actualXof, 64))
+                    << backend.name;
+
+                uint32_t expectedCv[8], actualCv[8];
+                memcpy(expectedCv, IV, sizeof(expectedCv));
+                memcpy(actualCv, IV, sizeof(actualCv));
+                blake3_compress_in_place_portable(expectedCv, block.data(),
+                                                  blockLength, 7, flags);
+                backend.compressInPlace(actualCv, block.data(), blockLength,
+                                        7, flags);
+                EXPECT_EQ(0, memcmp(expectedCv, actualCv, sizeof(actualCv)))
+                    << backend.name;
+            }
+        }
+    }
+}
+
+TEST(Blake3Test, SimdDegreeMatchesDispatch)
+{
+    const size_t degree = blake3_simd_degree();
+    EXPECT_GE(degree, 1);
+    EXPECT_LE(degree, MAX_SIMD_DEGREE);
+}
+
+TEST(Blake3Test, KnownDigests)
+{
+    // BLAKE3ZCC digests of inputs where byte `i` is `i % 251`. These were
+    // produced with the portable implementation, so they guard against any
+    // backend reintroducing a chunk counter.
+    const std::vector<std::pair<size_t, std::string>> vectors = {
+        {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+        {1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+        {63,
+         "e9bc37a594daad83be9470df7f7b3798297c3d834ce80ba85d6e207627b7db7b"},
+        {64,
+         "4eed7141ea4a5cd4b788606bd23f46e212af9cacebacdc7d1f4c6dc7f2511b98"},
+        {65,
+         "de1e5fa0be70df6d2be8fffd0e99ceaa8eb6e8c93a63f2d8d1c30ecb6b263dee"},
+        {1023,
+         "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"},
+        {1024,
+         "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+        {1025,
+         "c8f3d3293fc52e525bcb33e182a4e160a5bdf219b951bac5e7b41da5c737f1d5"},
+        {2048,
+         "dfdc7b9119fcedb2a1b4a10e0893b6108e321d3eb48e41063fb7501be23574c4"},
+        {3073,
+         "916a44123313176d32abf666238c573038a2354488d253eb8b648855d99ed39a"},
+        {8192,
+         "73c932bec255516b229488d6af3d29fc780e186bcae1b48bbbf8120ecd40cc43"},
+        {16391,
+         "aee0d957bab4b6bdcc79114c2ed6d7b8f6d611ed1921c8cf5559a8d6acda0b89"},
+        {65536,
+         "1f01495ea07c69853f317f13b1a52a70b709805768e649409e52b691da33e284"},
+        {100000,
+         "6e5e3bd4fdf1cfc00b737f09df32f160ab2c551862bc50e3d6875682dfa9d157"},
+        {1048593,
+         "0bfc48dbada05a98855148dbed87588da1cb744ede85eeec6e2f5aa62c58c736"},
+    };
+
+    for (const auto &vector : vectors) {
+        EXPECT_EQ(blake3zcc(testInput(vector.first)), vector.second)
+            << "length " << vector.first;
+    }
+}
+
+TEST(Blake3Test, UnalignedUpdatesMatchSingleUpdate)
+{
+    const std::vector<uint8_t> input = testInput(3 * 1024 * 1024 + 17);
+    const std::string expected = blake3zcc(input);
+
+    for (const size_t step : {size_t(1000), size_t(1025), size_t(65537)}) {
+        blake3_hasher hasher;
+        blake3_hasher_init(&hasher);
+        for (size_t offset = 0; offset < input.size(); offset += step) {
+            blake3_hasher_update(&hasher, &input[offset],
+                                 std::min(step, input.size() - offset));
+        }
+        EXPECT_EQ(finalizeToHex(hasher), expected) << "step " << step;
+    }
+}
+
+TEST(Blake3Test, ParallelUpdateMatchesSequential)
+{
+    const size_t minPartLength = BLAKE3_PARALLEL_MIN_PART_LEN;
+    for (const size_t length :
+         {size_t(0), size_t(1), 2 * minPartLength - 1, 2 * minPartLength,
+          16 * minPartLength + 3 * BLAKE3_CHUNK_LEN + 5,
+          size_t(40 * 1024 * 1024 + 1)}) {
+        const std::vector<uint8_t> input = testInput(length);
+        for (const size_t maxParts : {size_t(2), size_t(5), size_t(64)}) {
+            size_t partsHashed = 0;
+            blake3_hasher hasher;
+            blake3_hasher_init(&hasher);
+            blake3_hasher_update_parallel(&hasher, input.data(), input.size(),
+                                          maxParts, reverseParallelFor,
+                                          &partsHashed);
+            EXPECT_EQ(finalizeToHex(hasher), blake3zcc(input))
+                << "length " << length << ", maxParts " << maxParts;
+            if (length >= 2 * minPartLength) {
+                EXPECT_GT(partsHashed, 0);
+            }
+        }
+    }
+}
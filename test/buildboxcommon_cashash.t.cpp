@@ -287,3 +287,23 @@ TEST_F(DigestGeneratorFixture, DigestFromFileSHA512)
 {
     assert_digest_is_correct(DigestFunction_Value_SHA512);
 }
+
+TEST_F(DigestGeneratorFixture, DigestFromFileBLAKE3ZCCParallel)
+{
+    const DigestGenerator dg(DigestFunction_Value_BLAKE3ZCC);
+    const Digest sequential = dg.hash(d_data);
+
+    DigestGenerator::setParallelHashing(4, 512 * 1024);
+    const Digest from_file = dg.hash(d_fd);
+    const Digest from_string = dg.hash(d_data);
+    DigestGenerator::setParallelHashing(0);
+
+    EXPECT_EQ(from_file.hash_blake3zcc(), sequential.hash_blake3zcc());
+    EXPECT_EQ(from_string.hash_blake3zcc(), sequential.hash_blake3zcc());
+    EXPECT_EQ(from_file.size_bytes(), sequential.size_bytes());
+}
+
+TEST_F(DigestGeneratorFixture, DigestFromFileBLAKE3ZCC)
+{
+    assert_digest_is_correct(DigestFunction_Value_BLAKE3ZCC);
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_channelregistry.h>
+#include <buildboxcommon_connectionoptions.h>
+#include <buildboxcommon_protos.h>
+#include <buildboxcommon_temporaryfile.h>
+
+#include <grpcpp/server.h>
+#include <grpcpp/server_builder.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+using namespace buildboxcommon;
+
+namespace {
+ConnectionOptions makeOptions(const char *url)
+{
+    ConnectionOptions options;
+    options.d_url = url;
+    options.d_instanceName = "instanceA";
+    return options;
+}
+} // namespace
+
+TEST(ChannelRegistryTest, EquivalentOptionsShareAChannel)
+{
+    const ConnectionOptions options = makeOptions("http://example.com/");
+
+    // The instance name and retry settings do not affect the channel:
+    ConnectionOptions otherInstance = makeOptions("http://example.com/");
+    otherInstance.d_instanceName = "instanceB";
+    otherInstance.d_retryLimit = "10";
+
+    const auto channel = ChannelRegistry::channel(options);
+    EXPECT_EQ(ChannelRegistry::channel(options), channel);
+    EXPECT_EQ(ChannelRegistry::channel(otherInstance), channel);
+    EXPECT_EQ(ChannelRegistry::channels(options).front(), channel);
+}
+
+TEST(ChannelRegistryTest, DifferentOptionsGetDifferentChannels)
+{
+    const ConnectionOptions options = makeOptions("http://example.com/");
+    ConnectionOptions otherUrl = makeOptions("http://example.org/");
+    ConnectionOptions otherPolicy = makeOptions("http://example.com/");
+    otherPolicy.d_loadBalancingPolicy = "round_robin";
+    TemporaryFile token;
+    ConnectionOptions otherToken = makeOptions("https://example.com/");
+    otherToken.d_accessTokenPath = token.name();
+    ConnectionOptions otherReload = otherToken;
+    otherReload.d_tokenReloadInterval = "60";
+
+    const auto channel = ChannelRegistry::channel(options);
+    EXPECT_NE(ChannelRegistry::channel(otherUrl), channel);
+    EXPECT_NE(ChannelRegistry::channel(otherPolicy), channel);
+    EXPECT_NE(ChannelRegistry::channel(otherToken),
+              ChannelRegistry::channel(otherReload));
+}
+
+TEST(ChannelRegistryTest, ChannelsAreReleasedWithTheirLastUser)
+{
+    const ConnectionOptions options = makeOptions("http://example.net/");
+    const size_t initialSize = ChannelRegistry::size();
+
+    auto channel = ChannelRegistry::channel(options);
+    auto sameChannel = ChannelRegistry::channel(options);
+    EXPECT_EQ(ChannelRegistry::size(), initialSize + 1);
+
+    channel.reset();
+    EXPECT_EQ(ChannelRegistry::size(), initialSize + 1);
+    sameChannel.reset();
+    EXPECT_EQ(ChannelRegistry::size(), initialSize);
+
+    EXPECT_NE(ChannelRegistry::channel(options), nullptr);
+}
+
+TEST(ChannelRegistryTest, SeveralChannelsAreNotShared)
+{
+    ConnectionOptions options = makeOptions("http://example.com/");
+    options.d_channelCount = "2";
+
+    const auto channels = ChannelRegistry::channels(options);
+    ASSERT_EQ(channels.size(), 2);
+    EXPECT_NE(channels[0], ChannelRegistry::channel(options));
+    EXPECT_NE(channels[1], ChannelRegistry::channel(options));
+}
+
+TEST(ChannelRegistryTest, InvalidOptionsThrow)
+{
+    const ConnectionOptions options = makeOptions("ftp://example.com/");
+    EXPECT_THROW(ChannelRegistry::channel(options), std::runtime_error);
+}
+
+TEST(ChannelRegistryTest, ClientsOfAServerReuseItsConnection)
+{
+    // The server needs a service to start; its methods are not called.
+    ContentAddressableStorage::Service service;
+    grpc::ServerBuilder builder;
+    builder.RegisterService(&service);
+    int port = 0;
+    builder.AddListeningPort("localhost:0", grpc::InsecureServerCredentials(),
+                             &port);
+    const std::unique_ptr<grpc::Server> server = builder.BuildAndStart();
+    ASSERT_NE(port, 0);
+
+    const std::string url = "http://localhost:" + std::to_string(port);
+    const ConnectionOptions options = makeOptions(url.c_str());
+
+    const auto channel = ChannelRegistry::channel(options);
+    ASSERT_TRUE(channel->WaitForConnected(std::chrono::system_clock::now() +
+                                          std::chrono::seconds(10)));
+
+    // A later user gets the connection that is already established:
+    const auto laterChannel = ChannelRegistry::channel(options);
+    EXPECT_EQ(laterChannel, channel);
+    EXPECT_EQ(laterChannel->GetState(false), GRPC_CHANNEL_READY);
+
+    server->Shutdown();
+}
@@ -14,23 +14,32 @@
  * limitations under the License.
  */
 
+#include "buildboxcommontest_asyncmocks.h"
 #include "buildboxcommontest_utils.h"
 #include <buildboxcommon_client.h>
+#include <buildboxcommon_compression.h>
 #include <buildboxcommon_fileutils.h>
 #include <buildboxcommon_grpcretry.h>
 #include <buildboxcommon_merklize.h>
 #include <buildboxcommon_temporarydirectory.h>
 #include <buildboxcommon_temporaryfile.h>
 #include <buildboxcommon_timeutils.h>
+#include <buildboxcommonmetrics_testingutils.h>
 #include <gtest/gtest.h>
 
 #include <build/bazel/remote/execution/v2/remote_execution_mock.grpc.pb.h>
 #include <build/buildgrid/local_cas_mock.grpc.pb.h>
 #include <google/bytestream/bytestream_mock.grpc.pb.h>
+#include <grpcpp/alarm.h>
 #include <grpcpp/test/mock_stream.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <future>
+#include <mutex>
+#include <thread>
 
 using namespace buildboxcommon;
 using namespace testing;
@@ -176,6 +185,42 @@ TEST_F(ClientTestFixture, FetchStringEmptyResponse)
     EXPECT_EQ(this->fetchString(digest), readResponse.data());
 }
 
+TEST_F(ClientTestFixture, FetchStringMultipleChunks)
+{
+    const std::string data = "first chunk, second chunk, third chunk";
+    digest = CASHash::hash(data);
+
+    ReadResponse chunk1, chunk2, chunk3;
+    chunk1.set_data(data.substr(0, 13));
+    chunk2.set_data(data.substr(13, 14));
+    chunk3.set_data(data.substr(27));
+
+    EXPECT_CALL(*bytestreamClient, ReadRaw(_, _)).WillOnce(Return(reader));
+    EXPECT_CALL(*reader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(chunk1), Return(true)))
+        .WillOnce(DoAll(SetArgPointee<0>(chunk2), Return(true)))
+        .WillOnce(DoAll(SetArgPointee<0>(chunk3), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*reader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    EXPECT_EQ(this->fetchString(digest), data);
+}
+
+TEST_F(ClientTestFixture, FetchStringMoreDataThanExpected)
+{
+    readResponse.set_data(content);
+    digest = CASHash::hash(content);
+
+    EXPECT_CALL(*bytestreamClient, ReadRaw(_, _)).WillOnce(Return(reader));
+    EXPECT_CALL(*reader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(readResponse), Return(true)))
+        .WillOnce(DoAll(SetArgPointee<0>(readResponse), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*reader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    EXPECT_THROW(this->fetchString(digest), std::runtime_error);
+}
+
 TEST_F(ClientTestFixture, FetchStringSizeMismatch)
 {
     readResponse.set_data(content);
@@ -194,6 +239,37 @@ TEST_F(ClientTestFixture, FetchStringSizeMismatch)
     EXPECT_THROW(this->fetchString(digest), std::runtime_error);
 }
 
+TEST_F(ClientTestFixture, FetchStringHashMismatch)
+{
+    readResponse.set_data(content);
+    digest.set_hash_other("invalid-hash");
+    digest.set_size_bytes(content.length());
+
+    EXPECT_CALL(*bytestreamClient, ReadRaw(_, _)).WillOnce(Return(reader));
+    EXPECT_CALL(*reader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(readResponse), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*reader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    EXPECT_THROW(this->fetchString(digest), std::runtime_error);
+}
+
+TEST_F(ClientTestFixture, FetchStringFromTrustedServerIsNotHashed)
+{
+    readResponse.set_data(content);
+    digest.set_hash_other("unchecked-hash");
+    digest.set_size_bytes(content.length());
+    this->setVerifyDownloads(false);
+
+    EXPECT_CALL(*bytestreamClient, ReadRaw(_, _)).WillOnce(Return(reader));
+    EXPECT_CALL(*reader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(readResponse), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*reader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    EXPECT_EQ(this->fetchString(digest), content);
+}
+
 TEST_F(ClientTestFixture, FetchStringServerError)
 {
     readResponse.set_data(content);
@@ -320,6 +396,28 @@ TEST_F(ClientTestFixture, DownloadTest)
               client_instance_name);
 }
 
+TEST_F(ClientTestFixture, DownloadMultipleChunks)
+{
+    const std::string data = "first chunk, second chunk";
+    digest = CASHash::hash(data);
+
+    ReadResponse chunk1, chunk2;
+    chunk1.set_data(data.substr(0, 13));
+    chunk2.set_data(data.substr(13));
+
+    EXPECT_CALL(*bytestreamClient, ReadRaw(_, _)).WillOnce(Return(reader));
+    EXPECT_CALL(*reader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(chunk1), Return(true)))
+        .WillOnce(DoAll(SetArgPointee<0>(chunk2), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*reader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    this->download(tmpfile.fd(), digest);
+    tmpfile.close();
+
+    EXPECT_EQ(FileUtils::getFileContents(tmpfile.name()), data);
+}
+
 TEST_F(ClientTestFixture, DownloadFdNotWritable)
 {
     readResponse.set_data(content);
@@ -366,6 +464,23 @@ TEST_F(ClientTestFixture, DownloadHashMismatch)
     EXPECT_THROW(this->download(tmpfile.fd(), digest), std::runtime_error);
 }
 
+TEST_F(ClientTestFixture, DownloadFromTrustedServerIsNotHashed)
+{
+    readResponse.set_data(content);
+    digest.set_hash_other("unchecked-hash");
+    digest.set_size_bytes(content.length());
+    this->setVerifyDownloads(false);
+
+    EXPECT_CALL(*bytestreamClient, ReadRaw(_, _)).WillOnce(Return(reader));
+    EXPECT_CALL(*reader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(readResponse), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*reader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    this->download(tmpfile.fd(), digest);
+    EXPECT_EQ(FileUtils::getFileContents(tmpfile.name()), content);
+}
+
 TEST_F(ClientTestFixture, DownloadServerError)
 {
     readResponse.set_data(content);
@@ -588,9 +703,111 @@ TEST_F(ClientTestFixture, UploadStringRetriableError)
         .WillOnce(Return(
             grpc::Status(grpc::UNAVAILABLE, "Something is wrong right now")));
 
+    // Before retrying, the client asks where to resume from:
+    EXPECT_CALL(*bytestreamClient, QueryWriteStatus(_, _, _))
+        .WillOnce(Return(grpc::Status(grpc::NOT_FOUND, "Unknown upload")));
+
     EXPECT_THROW(this->upload(content, CASHash::hash(content)), GrpcError);
 }
 
+// Call `upload()` for a blob of `dataSize` bytes, failing its first
+// `Write()` with UNAVAILABLE. `QueryWriteStatus()` then returns
+// `queryStatus` and `committedSize`. Return the requests of the retry.
+std::vector<WriteRequest>
+uploadWithRetry(google::bytestream::MockByteStreamStub *bytestreamClient,
+                const std::function<void()> &upload, size_t dataSize,
+                const grpc::Status &queryStatus, size_t committedSize)
+{
+    auto *writer1 = new grpc::testing::MockClientWriter<WriteRequest>();
+    auto *writer2 = new grpc::testing::MockClientWriter<WriteRequest>();
+
+    WriteResponse response;
+    response.set_committed_size(
+        static_cast<google::protobuf::int64>(dataSize));
+    EXPECT_CALL(*bytestreamClient, WriteRaw(_, _))
+        .WillOnce(Return(writer1))
+        .WillOnce(DoAll(SetArgPointee<1>(response), Return(writer2)));
+
+    EXPECT_CALL(*writer1, Write(_, _)).WillRepeatedly(Return(true));
+    EXPECT_CALL(*writer1, WritesDone()).WillOnce(Return(true));
+    EXPECT_CALL(*writer1, Finish())
+        .WillOnce(Return(grpc::Status(grpc::UNAVAILABLE, "Connection lost")));
+
+    QueryWriteStatusResponse queryResponse;
+    queryResponse.set_committed_size(
+        static_cast<google::protobuf::int64>(committedSize));
+    EXPECT_CALL(*bytestreamClient, QueryWriteStatus(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(queryResponse), Return(queryStatus)));
+
+    std::vector<WriteRequest> requests;
+    EXPECT_CALL(*writer2, Write(_, _))
+        .WillRepeatedly(
+            Invoke([&requests](const WriteRequest &r, grpc::WriteOptions) {
+                requests.push_back(r);
+                return true;
+            }));
+    EXPECT_CALL(*writer2, WritesDone()).WillOnce(Return(true));
+    EXPECT_CALL(*writer2, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    upload();
+    return requests;
+}
+
+TEST_F(ClientTestFixture, UploadStringResumesFromCommittedSize)
+{
+    const size_t chunkSize = bytestreamChunkSizeBytes();
+    const std::string data =
+        std::string(2 * chunkSize, 'a') + std::string(chunkSize, 'b');
+    const Digest digest = CASHash::hash(data);
+
+    const auto requests = uploadWithRetry(
+        bytestreamClient.get(), [&]() { this->upload(data, digest); },
+        data.size(),
+        grpc::Status::OK, 2 * chunkSize);
+
+    ASSERT_EQ(requests.size(), 1);
+    EXPECT_EQ(requests[0].write_offset(), 2 * chunkSize);
+    EXPECT_EQ(requests[0].data(), std::string(chunkSize, 'b'));
+    EXPECT_TRUE(requests[0].finish_write());
+}
+
+TEST_F(ClientTestFixture, UploadStringRestartsIfQueryWriteStatusFails)
+{
+    const std::string data(3 * bytestreamChunkSizeBytes(), 'a');
+    const Digest digest = CASHash::hash(data);
+
+    const auto requests = uploadWithRetry(
+        bytestreamClient.get(), [&]() { this->upload(data, digest); },
+        data.size(),
+        grpc::Status(grpc::UNIMPLEMENTED, "No QueryWriteStatus()"),
+        bytestreamChunkSizeBytes());
+
+    ASSERT_EQ(requests.size(), 3);
+    EXPECT_EQ(requests[0].write_offset(), 0);
+}
+
+TEST_F(ClientTestFixture, UploadStringRetryFinishesIfAllCommitted)
+{
+    const std::string data(2 * bytestreamChunkSizeBytes(), 'a');
+    const Digest digest = CASHash::hash(data);
+
+    auto *writer1 = new grpc::testing::MockClientWriter<WriteRequest>();
+    EXPECT_CALL(*bytestreamClient, WriteRaw(_, _)).WillOnce(Return(writer1));
+    EXPECT_CALL(*writer1, Write(_, _)).WillRepeatedly(Return(true));
+    EXPECT_CALL(*writer1, WritesDone()).WillOnce(Return(true));
+    EXPECT_CALL(*writer1, Finish())
+        .WillOnce(Return(grpc::Status(grpc::UNAVAILABLE, "Connection lost")));
+
+    QueryWriteStatusResponse queryResponse;
+    queryResponse.set_committed_size(digest.size_bytes());
+    queryResponse.set_complete(true);
+    EXPECT_CALL(*bytestreamClient, QueryWriteStatus(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(queryResponse),
+                        Return(grpc::Status::OK)));
+
+    EXPECT_NO_THROW(this->upload(data, digest));
+}
+
 TEST_F(ClientTestFixture, FileTooLargeToBatchUpload)
 {
     const auto data = std::string(3 * MAX_BATCH_SIZE_BYTES, '_');
@@ -705,6 +922,476 @@ TEST_F(ClientTestFixture, UploadBlobsReturnsFailures)
               1);
 }
 
+TEST_F(ClientTestFixture, UploadBlobsConcurrently)
+{
+    // Two blobs fit in each batch, so these are sent in 20 batches.
+    std::vector<Client::UploadRequest> requests;
+    for (int i = 0; i < 40; i++) {
+        const std::string data = std::to_string(i) + std::string(500, 'x');
+        requests.emplace_back(CASHash::hash(data), data);
+    }
+    const Digest failing_digest = requests[7].digest;
+
+    this->setTransferConcurrency(4, 2);
+
+    std::atomic<int> batch_requests(0);
+    EXPECT_CALL(*casClient.get(), BatchUpdateBlobs(_, _, _))
+        .WillRepeatedly(Invoke([&](grpc::ClientContext *,
+                                   const BatchUpdateBlobsRequest &request,
+                                   BatchUpdateBlobsResponse *response) {
+            batch_requests++;
+            for (const auto &entry : request.requests()) {
+                auto response_entry = response->add_responses();
+                response_entry->mutable_digest()->CopyFrom(entry.digest());
+                response_entry->mutable_status()->set_code(
+                    entry.digest() == failing_digest
+                        ? grpc::StatusCode::INTERNAL
+                        : grpc::StatusCode::OK);
+            }
+            return grpc::Status::OK;
+        }));
+
+    const auto failed_uploads = this->uploadBlobs(requests);
+    EXPECT_EQ(batch_requests, 20);
+    ASSERT_EQ(failed_uploads.size(), 1);
+    EXPECT_EQ(failed_uploads[0].digest, failing_digest);
+    EXPECT_EQ(failed_uploads[0].status.error_code(),
+              grpc::StatusCode::INTERNAL);
+}
+
+TEST_F(ClientTestFixture, DownloadBlobsConcurrently)
+{
+    std::unordered_map<Digest, std::string> blobs;
+    std::vector<Digest> digests;
+    for (int i = 0; i < 40; i++) {
+        const std::string data = std::to_string(i) + std::string(500, 'x');
+        const Digest digest = CASHash::hash(data);
+        blobs[digest] = data;
+        digests.push_back(digest);
+    }
+
+    this->setTransferConcurrency(4, 2);
+
+    EXPECT_CALL(*casClient.get(), BatchReadBlobs(_, _, _))
+        .WillRepeatedly(Invoke([&](grpc::ClientContext *,
+                                   const BatchReadBlobsRequest &request,
+                                   BatchReadBlobsResponse *response) {
+            for (const auto &digest : request.digests()) {
+                auto entry = response->add_responses();
+                entry->mutable_digest()->CopyFrom(digest);
+                entry->set_data(blobs.at(digest));
+                entry->mutable_status()->set_code(grpc::StatusCode::OK);
+            }
+            return grpc::Status::OK;
+        }));
+
+    const auto results = this->downloadBlobs(digests);
+    ASSERT_EQ(results.size(), blobs.size());
+    for (const auto &blob : blobs) {
+        const auto &result = results.at(blob.first.hash_other());
+        EXPECT_EQ(result.first.code(), grpc::StatusCode::OK);
+        EXPECT_EQ(result.second, blob.second);
+    }
+}
+
+TEST_F(ClientTestFixture, ConcurrentTransferErrorsPreferBatches)
+{
+    const std::string small_data = "small";
+    const std::string large_data(MAX_BATCH_SIZE_BYTES * 2, 'x');
+    const std::vector<Digest> digests = {CASHash::hash(small_data),
+                                         CASHash::hash(large_data)};
+
+    this->setTransferConcurrency(1, 1);
+
+    EXPECT_CALL(*casClient.get(), BatchReadBlobs(_, _, _))
+        .WillOnce(Return(
+            grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "batch error")));
+    EXPECT_CALL(*bytestreamClient, ReadRaw(_, _)).WillOnce(Return(reader));
+    EXPECT_CALL(*reader, Read(_)).WillOnce(Return(false));
+    EXPECT_CALL(*reader, Finish())
+        .WillOnce(Return(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                                      "bytestream error")));
+
+    TemporaryDirectory output_dir;
+    OutputMap outputs;
+    for (const Digest &digest : digests) {
+        outputs.emplace(digest.hash_other(),
+                        std::make_pair(std::string(output_dir.name()) + "/" +
+                                           digest.hash_other(),
+                                       false));
+    }
+
+    // Both transfers are made, and the batch error is the one reported:
+    try {
+        this->downloadBlobs(digests, outputs);
+        FAIL() << "Expected an exception";
+    }
+    catch (const std::runtime_error &e) {
+        EXPECT_THAT(e.what(), HasSubstr("batch error"));
+    }
+}
+
+TEST_F(ClientTestFixture, SetTransferConcurrencyRejectsZero)
+{
+    EXPECT_THROW(this->setTransferConcurrency(0, 1), std::invalid_argument);
+    EXPECT_THROW(this->setTransferConcurrency(1, 0), std::invalid_argument);
+}
+
+TEST_F(ClientTestFixture, HedgedBatchReadReturnsFasterResponse)
+{
+    const std::string data = "hedged contents";
+    const Digest digest = CASHash::hash(data);
+    this->setReadHedging(nullptr, std::make_shared<RequestHedger>(
+                                      std::chrono::milliseconds(10)));
+
+    // The first request only fails once the hedged one got its response.
+    std::promise<void> hedgeAnswered;
+    std::atomic<int> calls(0);
+    EXPECT_CALL(*casClient.get(), BatchReadBlobs(_, _, _))
+        .Times(2)
+        .WillRepeatedly(Invoke([&](grpc::ClientContext *,
+                                   const BatchReadBlobsRequest &,
+                                   BatchReadBlobsResponse *response) {
+            if (calls++ == 0) {
+                hedgeAnswered.get_future().wait();
+                return grpc::Status(grpc::StatusCode::CANCELLED, "slow");
+            }
+            auto entry = response->add_responses();
+            entry->mutable_digest()->CopyFrom(digest);
+            entry->set_data(data);
+            entry->mutable_status()->set_code(grpc::StatusCode::OK);
+            hedgeAnswered.set_value();
+            return grpc::Status::OK;
+        }));
+
+    const auto results = this->downloadBlobs({digest});
+    ASSERT_EQ(results.size(), 1);
+    EXPECT_EQ(results.at(digest.hash_other()).first.code(),
+              grpc::StatusCode::OK);
+    EXPECT_EQ(results.at(digest.hash_other()).second, data);
+}
+
+TEST_F(ClientTestFixture, HedgedReadIsCountedOnce)
+{
+    const std::string data = "hedged contents";
+    const Digest digest = CASHash::hash(data);
+    this->setReadHedging(
+        std::make_shared<RequestHedger>(std::chrono::milliseconds(10)),
+        nullptr);
+    buildboxcommonmetrics::clearAllMetricCollection();
+
+    ReadResponse response;
+    response.set_data(data);
+
+    // Both reads succeed, the first one once the hedged one has finished.
+    std::promise<void> hedgeAnswered;
+    std::shared_future<void> hedgeFinished = hedgeAnswered.get_future();
+    auto slowReader = new grpc::testing::MockClientReader<ReadResponse>();
+    EXPECT_CALL(*slowReader, Read(_))
+        .WillOnce(Invoke([&](ReadResponse *out) {
+            hedgeFinished.wait();
+            *out = response;
+            return true;
+        }))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*slowReader, Finish()).WillOnce(Return(grpc::Status::OK));
+    EXPECT_CALL(*reader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(response), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*reader, Finish()).WillOnce(Invoke([&]() {
+        hedgeAnswered.set_value();
+        return grpc::Status::OK;
+    }));
+    EXPECT_CALL(*bytestreamClient, ReadRaw(_, _))
+        .WillOnce(Return(slowReader))
+        .WillOnce(Return(reader));
+
+    EXPECT_EQ(this->fetchString(digest), data);
+    EXPECT_TRUE(buildboxcommonmetrics::collectedByNameWithValue<
+                buildboxcommonmetrics::CountingMetricValue>(
+        Client::s_bytesVerifiedMetricName,
+        buildboxcommonmetrics::CountingMetricValue(
+            static_cast<buildboxcommonmetrics::CountingMetricValue::Count>(
+                data.size()))));
+}
+
+class DownloadDuplicatesFixture : public ClientTestFixture {
+  protected:
+    // Fetch blobs "a" and "b", which appear repeatedly in the digest list,
+    // into files under `directory`. Each blob must be requested once.
+    void downloadDuplicatedBlobs(const std::string &directory);
+};
+
+void DownloadDuplicatesFixture::downloadDuplicatedBlobs(
+    const std::string &directory)
+{
+    const std::string data_a = "shared contents";
+    const std::string data_b = "other contents";
+    const Digest digest_a = CASHash::hash(data_a);
+    const Digest digest_b = CASHash::hash(data_b);
+
+    EXPECT_CALL(*casClient.get(), BatchReadBlobs(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *,
+                             const BatchReadBlobsRequest &request,
+                             BatchReadBlobsResponse *response) {
+            EXPECT_EQ(request.digests_size(), 2);
+            for (const auto &digest : request.digests()) {
+                auto entry = response->add_responses();
+                entry->mutable_digest()->CopyFrom(digest);
+                entry->set_data(digest == digest_a ? data_a : data_b);
+                entry->mutable_status()->set_code(grpc::StatusCode::OK);
+            }
+            return grpc::Status::OK;
+        }));
+
+    Client::OutputMap outputs;
+    outputs.emplace(digest_a.hash_other(),
+                    std::make_pair(directory + "/a1", false));
+    outputs.emplace(digest_a.hash_other(),
+                    std::make_pair(directory + "/a2", false));
+    outputs.emplace(digest_a.hash_other(),
+                    std::make_pair(directory + "/a3", true));
+    outputs.emplace(digest_b.hash_other(),
+                    std::make_pair(directory + "/b", false));
+
+    this->downloadBlobs({digest_a, digest_b, digest_a, digest_a}, outputs);
+
+    for (const std::string name : {"a1", "a2", "a3"}) {
+        EXPECT_EQ(
+            FileUtils::getFileContents((directory + "/" + name).c_str()),
+            data_a);
+    }
+    EXPECT_EQ(FileUtils::getFileContents((directory + "/b").c_str()),
+              data_b);
+    EXPECT_FALSE(FileUtils::isExecutable((directory + "/a1").c_str()));
+    EXPECT_FALSE(FileUtils::isExecutable((directory + "/a2").c_str()));
+    EXPECT_TRUE(FileUtils::isExecutable((directory + "/a3").c_str()));
+}
+
+ino_t inode(const std::string &path)
+{
+    struct stat stat_buf;
+    EXPECT_EQ(stat(path.c_str(), &stat_buf), 0);
+    return stat_buf.st_ino;
+}
+
+TEST_F(DownloadDuplicatesFixture, FetchesDuplicatesOnce)
+{
+    TemporaryDirectory directory;
+    const std::string path(directory.name());
+    downloadDuplicatedBlobs(path);
+
+    // Without hardlinks, every path is a separate file:
+    EXPECT_NE(inode(path + "/a1"), inode(path + "/a2"));
+    EXPECT_NE(inode(path + "/a1"), inode(path + "/a3"));
+}
+
+TEST_F(DownloadDuplicatesFixture, HardLinksPathsWithSameMode)
+{
+    TemporaryDirectory directory;
+    const std::string path(directory.name());
+    this->setDownloadHardLinks(true);
+    downloadDuplicatedBlobs(path);
+
+    // Paths with the same executable bit share a file:
+    EXPECT_EQ(inode(path + "/a1"), inode(path + "/a2"));
+    EXPECT_NE(inode(path + "/a1"), inode(path + "/a3"));
+}
+
+TEST_F(DownloadDuplicatesFixture, StagesFromLocalBlobCache)
+{
+    TemporaryDirectory cache_directory;
+    this->setLocalBlobCache(std::make_shared<LocalBlobCache>(
+        std::string(cache_directory.name()) + "/cache", 1024));
+
+    TemporaryDirectory first_directory;
+    downloadDuplicatedBlobs(first_directory.name());
+
+    // The second time around nothing is requested from the server:
+    EXPECT_CALL(*casClient.get(), BatchReadBlobs(_, _, _)).Times(0);
+    EXPECT_CALL(*bytestreamClient.get(), ReadRaw(_, _)).Times(0);
+
+    const Digest digest_a = CASHash::hash("shared contents");
+    TemporaryDirectory second_directory;
+    const std::string path(second_directory.name());
+    Client::OutputMap outputs;
+    outputs.emplace(digest_a.hash_other(),
+                    std::make_pair(path + "/a", false));
+    outputs.emplace(digest_a.hash_other(), std::make_pair(path + "/x", true));
+    this->downloadBlobs({digest_a}, outputs);
+
+    EXPECT_EQ(FileUtils::getFileContents((path + "/a").c_str()),
+              "shared contents");
+    EXPECT_EQ(FileUtils::getFileContents((path + "/x").c_str()),
+              "shared contents");
+    EXPECT_FALSE(FileUtils::isExecutable((path + "/a").c_str()));
+    EXPECT_TRUE(FileUtils::isExecutable((path + "/x").c_str()));
+    EXPECT_EQ(this->fetchString(digest_a), "shared contents");
+}
+
+namespace {
+// Build enough distinct digests to need several `FindMissingBlobs()`
+// requests.
+std::vector<Digest> manyDigests(size_t count)
+{
+    std::vector<Digest> digests;
+    digests.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        digests.push_back(CASHash::hash(std::to_string(i)));
+    }
+    return digests;
+}
+} // namespace
+
+TEST_F(ClientTestFixture, FindMissingBlobsDeduplicatesDigests)
+{
+    const Digest a = CASHash::hash("a");
+    const Digest b = CASHash::hash("b");
+
+    FindMissingBlobsRequest request;
+    FindMissingBlobsResponse response;
+    response.add_missing_blob_digests()->CopyFrom(b);
+    EXPECT_CALL(*casClient.get(), FindMissingBlobs(_, _, _))
+        .WillOnce(DoAll(SaveArg<1>(&request), SetArgPointee<2>(response),
+                        Return(grpc::Status::OK)));
+
+    EXPECT_EQ(this->findMissingBlobs({a, b, a, b, a}),
+              std::vector<Digest>({b}));
+    ASSERT_EQ(request.blob_digests_size(), 2);
+    EXPECT_EQ(request.blob_digests(0), a);
+    EXPECT_EQ(request.blob_digests(1), b);
+}
+
+TEST_F(ClientTestFixture, FindMissingBlobsSplitsRequestsBySize)
+{
+    const std::vector<Digest> digests = manyDigests(40000);
+
+    std::vector<FindMissingBlobsRequest> requests;
+    EXPECT_CALL(*casClient.get(), FindMissingBlobs(_, _, _))
+        .WillRepeatedly(Invoke([&](grpc::ClientContext *,
+                                   const FindMissingBlobsRequest &request,
+                                   FindMissingBlobsResponse *) {
+            requests.push_back(request);
+            return grpc::Status::OK;
+        }));
+
+    EXPECT_TRUE(this->findMissingBlobs(digests).empty());
+
+    ASSERT_GT(requests.size(), 1);
+    std::vector<Digest> sent;
+    for (const auto &request : requests) {
+        EXPECT_LE(request.ByteSizeLong(), bytestreamChunkSizeBytes());
+        sent.insert(sent.end(), request.blob_digests().cbegin(),
+                    request.blob_digests().cend());
+    }
+    EXPECT_EQ(sent, digests);
+
+    // Requests are filled as much as possible: the first digest of each one
+    // would not have fit in the previous.
+    for (size_t i = 1; i < requests.size(); i++) {
+        FindMissingBlobsRequest previous = requests[i - 1];
+        previous.add_blob_digests()->CopyFrom(requests[i].blob_digests(0));
+        EXPECT_GT(previous.ByteSizeLong(), bytestreamChunkSizeBytes());
+    }
+}
+
+TEST_F(ClientTestFixture, FindMissingBlobsConcurrentRequestsKeepOrder)
+{
+    this->setFindMissingBlobsConcurrency(4);
+    const std::vector<Digest> digests = manyDigests(60000);
+
+    // Every blob is missing. The request holding the first digest answers
+    // last, so that the responses arrive out of order.
+    std::atomic<size_t> calls(0);
+    EXPECT_CALL(*casClient.get(), FindMissingBlobs(_, _, _))
+        .WillRepeatedly(Invoke([&](grpc::ClientContext *,
+                                   const FindMissingBlobsRequest &request,
+                                   FindMissingBlobsResponse *response) {
+            calls++;
+            if (request.blob_digests(0) == digests.front()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+            response->mutable_missing_blob_digests()->CopyFrom(
+                request.blob_digests());
+            return grpc::Status::OK;
+        }));
+
+    EXPECT_EQ(this->findMissingBlobs(digests), digests);
+    EXPECT_GT(calls.load(), 2);
+}
+
+TEST_F(ClientTestFixture, FindMissingBlobsConcurrentRequestFailureThrows)
+{
+    this->setFindMissingBlobsConcurrency(2);
+    const std::vector<Digest> digests = manyDigests(40000);
+
+    EXPECT_CALL(*casClient.get(), FindMissingBlobs(_, _, _))
+        .WillRepeatedly(Invoke([&](grpc::ClientContext *,
+                                   const FindMissingBlobsRequest &request,
+                                   FindMissingBlobsResponse *) {
+            if (request.blob_digests(0) == digests.front()) {
+                return grpc::Status::OK;
+            }
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Bad");
+        }));
+
+    EXPECT_THROW(this->findMissingBlobs(digests), GrpcError);
+}
+
+TEST_F(ClientTestFixture, FindMissingBlobsZeroConcurrencyThrows)
+{
+    EXPECT_THROW(this->setFindMissingBlobsConcurrency(0),
+                 std::invalid_argument);
+}
+
+TEST_F(ClientTestFixture, FindMissingBlobsSkipsKnownPresentDigests)
+{
+    this->setPresenceCache(
+        std::make_shared<PresenceCache>(100, std::chrono::hours(1)));
+    const Digest present = CASHash::hash("present");
+    const Digest missing = CASHash::hash("missing");
+
+    // The first query reports `present` as present...
+    FindMissingBlobsResponse response;
+    response.add_missing_blob_digests()->CopyFrom(missing);
+    EXPECT_CALL(*casClient.get(), FindMissingBlobs(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(response), Return(grpc::Status::OK)));
+    EXPECT_EQ(this->findMissingBlobs({present, missing}),
+              std::vector<Digest>({missing}));
+
+    // ...so the next one only asks about the other blob:
+    FindMissingBlobsRequest request;
+    EXPECT_CALL(*casClient.get(), FindMissingBlobs(_, _, _))
+        .WillOnce(DoAll(SaveArg<1>(&request), SetArgPointee<2>(response),
+                        Return(grpc::Status::OK)));
+    EXPECT_EQ(this->findMissingBlobs({present, missing}),
+              std::vector<Digest>({missing}));
+    ASSERT_EQ(request.blob_digests_size(), 1);
+    EXPECT_EQ(request.blob_digests(0), missing);
+
+    // And none is needed if every digest is known:
+    EXPECT_TRUE(this->findMissingBlobs({present}).empty());
+}
+
+TEST_F(ClientTestFixture, UploadBlobsSkipsBlobsUploadedBefore)
+{
+    this->setPresenceCache(
+        std::make_shared<PresenceCache>(100, std::chrono::hours(1)));
+    const std::string data = "uploaded once";
+    const Digest digest = CASHash::hash(data);
+
+    BatchUpdateBlobsResponse response;
+    auto entry = response.add_responses();
+    entry->mutable_digest()->CopyFrom(digest);
+    entry->mutable_status()->set_code(grpc::StatusCode::OK);
+    EXPECT_CALL(*casClient.get(), BatchUpdateBlobs(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(response), Return(grpc::Status::OK)));
+
+    EXPECT_TRUE(this->uploadBlobs({UploadRequest(digest, data)}).empty());
+    EXPECT_TRUE(this->uploadBlobs({UploadRequest(digest, data)}).empty());
+    EXPECT_TRUE(this->findMissingBlobs({digest}).empty());
+}
+
 TEST_F(ClientTestFixture, CaptureDirectory)
 {
     const std::string path_to_capture = "/path/to/stage";
@@ -1040,15 +1727,246 @@ TEST_F(GetTreeFixture, GetTreeFail)
     EXPECT_THROW(this->getTree(d_digest), std::runtime_error);
 }
 
-class UploadFileFixture : public ClientTestFixture {
-    /**
-     * Instantiates a tempfile with some data for use in upload tests.
-     * Inherits from the pre-instantiated client fixture.
-     */
-  protected:
-    UploadFileFixture()
-    {
-        write(tmpfile.fd(), content.c_str(), content.length());
+TEST_F(GetTreeFixture, GetTreeVisitsPagesAndResumesAfterError)
+{
+    // The first attempt fails after one page, and the second one resumes
+    // from its token:
+    auto resumedreader = new grpc::testing::MockClientReader<
+        typename build::bazel::remote::execution::v2::GetTreeResponse>();
+    std::vector<GetTreeRequest> requests(2);
+    EXPECT_CALL(*casClient, GetTreeRaw(_, _))
+        .WillOnce(DoAll(SaveArg<1>(&requests[0]), Return(gettreereader)))
+        .WillOnce(DoAll(SaveArg<1>(&requests[1]), Return(resumedreader)));
+
+    GetTreeResponse first_page;
+    first_page.add_directories()->CopyFrom(d_directories[0]);
+    first_page.add_directories()->CopyFrom(d_directories[1]);
+    first_page.set_next_page_token("page-2");
+    EXPECT_CALL(*gettreereader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(first_page), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*gettreereader, Finish())
+        .WillOnce(Return(grpc::Status(grpc::StatusCode::UNAVAILABLE, "")));
+
+    GetTreeResponse second_page;
+    second_page.add_directories()->CopyFrom(d_directories[2]);
+    second_page.add_directories()->CopyFrom(d_directories[3]);
+    EXPECT_CALL(*resumedreader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(second_page), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*resumedreader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    std::vector<int> page_sizes;
+    const auto visitor = [&page_sizes](const GetTreeResponse &page) {
+        page_sizes.push_back(page.directories_size());
+        return true;
+    };
+    EXPECT_EQ(this->getTree(d_digest, visitor, 2), "");
+
+    EXPECT_EQ(page_sizes, std::vector<int>({2, 2}));
+    EXPECT_EQ(requests[0].page_size(), 2);
+    EXPECT_EQ(requests[0].page_token(), "");
+    EXPECT_EQ(requests[1].page_size(), 2);
+    EXPECT_EQ(requests[1].page_token(), "page-2");
+}
+
+TEST_F(GetTreeFixture, GetTreeVisitorStopsAtPage)
+{
+    GetTreeRequest request;
+    EXPECT_CALL(*casClient, GetTreeRaw(_, _))
+        .WillOnce(DoAll(SaveArg<1>(&request), Return(gettreereader)));
+
+    GetTreeResponse page;
+    page.add_directories()->CopyFrom(d_directories[0]);
+    page.set_next_page_token("page-3");
+    EXPECT_CALL(*gettreereader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(page), Return(true)));
+    EXPECT_CALL(*gettreereader, Finish())
+        .WillOnce(Return(grpc::Status(grpc::StatusCode::CANCELLED, "")));
+
+    const auto visitor = [](const GetTreeResponse &) { return false; };
+    EXPECT_EQ(this->getTree(d_digest, visitor, 1, "page-2"), "page-3");
+    EXPECT_EQ(request.page_token(), "page-2");
+}
+
+TEST_F(GetTreeFixture, DownloadDirectoryFromTreeWhileStreaming)
+{
+    EXPECT_CALL(*casClient, GetTreeRaw(_, _)).WillOnce(Return(gettreereader));
+
+    // `headers/` is received before the directory that references it, and
+    // `cpp/` only in the second page:
+    GetTreeResponse first_page;
+    first_page.add_directories()->CopyFrom(d_directories[3]);
+    first_page.add_directories()->CopyFrom(d_directories[0]);
+    first_page.add_directories()->CopyFrom(d_directories[1]);
+    GetTreeResponse second_page;
+    second_page.add_directories()->CopyFrom(d_directories[2]);
+    EXPECT_CALL(*gettreereader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(first_page), Return(true)))
+        .WillOnce(DoAll(SetArgPointee<0>(second_page), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*gettreereader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    std::unordered_map<Digest, std::string> blobs;
+    for (const Directory &directory : d_directories) {
+        for (const FileNode &file : directory.files()) {
+            blobs[file.digest()] = file.name() + "_contents";
+        }
+    }
+
+    std::vector<int> requested_digests;
+    EXPECT_CALL(*casClient, BatchReadBlobs(_, _, _))
+        .WillRepeatedly(Invoke([&](grpc::ClientContext *,
+                                   const BatchReadBlobsRequest &request,
+                                   BatchReadBlobsResponse *response) {
+            requested_digests.push_back(request.digests_size());
+            for (const auto &blob_digest : request.digests()) {
+                auto entry = response->add_responses();
+                entry->mutable_digest()->CopyFrom(blob_digest);
+                entry->set_data(blobs.at(blob_digest));
+                entry->mutable_status()->set_code(grpc::StatusCode::OK);
+            }
+            return grpc::Status::OK;
+        }));
+
+    TemporaryDirectory output_dir;
+    this->downloadDirectoryFromTree(d_digest, output_dir.name());
+
+    // The files of the first page are fetched as soon as it is placed, and
+    // those of the second one in the following transfer:
+    EXPECT_EQ(requested_digests, std::vector<int>({4, 3}));
+
+    const std::string root_path(output_dir.name());
+    EXPECT_EQ(FileUtils::getFileContents(
+                  (root_path + "/src/headers/file2.h").c_str()),
+              "file2.h_contents");
+    EXPECT_EQ(FileUtils::getFileContents(
+                  (root_path + "/src/cpp/file3.cpp").c_str()),
+              "file3.cpp_contents");
+    EXPECT_TRUE(
+        FileUtils::isExecutable((root_path + "/src/build.sh").c_str()));
+    EXPECT_TRUE(
+        FileUtils::isSymlink((root_path + "/src/cpp/file4.cpp").c_str()));
+}
+
+TEST_F(GetTreeFixture, DownloadDirectoryFromTreeRequestsSharedBlobsOnce)
+{
+    // ./a/shared.txt and ./b/shared.sh* have the same contents, and `b/` is
+    // only received in the second page:
+    const std::string shared_contents = "shared_contents";
+    const std::string other_contents = "other_contents";
+    Directory a_directory;
+    FileNode *file_node = a_directory.add_files();
+    file_node->set_name("shared.txt");
+    file_node->mutable_digest()->CopyFrom(make_digest(shared_contents));
+    Directory b_directory;
+    file_node = b_directory.add_files();
+    file_node->set_name("shared.sh");
+    file_node->set_is_executable(true);
+    file_node->mutable_digest()->CopyFrom(make_digest(shared_contents));
+    file_node = b_directory.add_files();
+    file_node->set_name("other.txt");
+    file_node->mutable_digest()->CopyFrom(make_digest(other_contents));
+    Directory root_directory;
+    DirectoryNode *directory_node = root_directory.add_directories();
+    directory_node->set_name("a");
+    directory_node->mutable_digest()->CopyFrom(make_digest(a_directory));
+    directory_node = root_directory.add_directories();
+    directory_node->set_name("b");
+    directory_node->mutable_digest()->CopyFrom(make_digest(b_directory));
+    const Digest root_digest = make_digest(root_directory);
+
+    EXPECT_CALL(*casClient, GetTreeRaw(_, _)).WillOnce(Return(gettreereader));
+
+    GetTreeResponse first_page;
+    first_page.add_directories()->CopyFrom(root_directory);
+    first_page.add_directories()->CopyFrom(a_directory);
+    GetTreeResponse second_page;
+    second_page.add_directories()->CopyFrom(b_directory);
+    std::promise<void> second_page_read;
+    EXPECT_CALL(*gettreereader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(first_page), Return(true)))
+        .WillOnce(DoAll(SetArgPointee<0>(second_page),
+                        InvokeWithoutArgs(
+                            [&]() { second_page_read.set_value(); }),
+                        Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*gettreereader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    // The first transfer only completes once the second page was read, which
+    // would time out if pages waited for their files:
+    std::future<void> second_page_future = second_page_read.get_future();
+    bool streamed_during_transfer = false;
+    std::vector<std::string> requested_contents;
+    EXPECT_CALL(*casClient, BatchReadBlobs(_, _, _))
+        .WillRepeatedly(Invoke([&](grpc::ClientContext *,
+                                   const BatchReadBlobsRequest &request,
+                                   BatchReadBlobsResponse *response) {
+            if (requested_contents.empty()) {
+                streamed_during_transfer =
+                    second_page_future.wait_for(std::chrono::seconds(10)) ==
+                    std::future_status::ready;
+            }
+            for (const auto &blob_digest : request.digests()) {
+                const std::string &data =
+                    blob_digest == make_digest(shared_contents)
+                        ? shared_contents
+                        : other_contents;
+                requested_contents.push_back(data);
+                auto entry = response->add_responses();
+                entry->mutable_digest()->CopyFrom(blob_digest);
+                entry->set_data(data);
+                entry->mutable_status()->set_code(grpc::StatusCode::OK);
+            }
+            return grpc::Status::OK;
+        }));
+
+    TemporaryDirectory output_dir;
+    this->downloadDirectoryFromTree(root_digest, output_dir.name());
+
+    EXPECT_TRUE(streamed_during_transfer);
+    EXPECT_EQ(requested_contents,
+              std::vector<std::string>({shared_contents, other_contents}));
+
+    const std::string root_path(output_dir.name());
+    EXPECT_EQ(
+        FileUtils::getFileContents((root_path + "/a/shared.txt").c_str()),
+        shared_contents);
+    EXPECT_EQ(
+        FileUtils::getFileContents((root_path + "/b/shared.sh").c_str()),
+        shared_contents);
+    EXPECT_EQ(FileUtils::getFileContents((root_path + "/b/other.txt").c_str()),
+              other_contents);
+    EXPECT_FALSE(
+        FileUtils::isExecutable((root_path + "/a/shared.txt").c_str()));
+    EXPECT_TRUE(FileUtils::isExecutable((root_path + "/b/shared.sh").c_str()));
+}
+
+TEST_F(GetTreeFixture, DownloadDirectoryFromIncompleteTreeThrows)
+{
+    EXPECT_CALL(*casClient, GetTreeRaw(_, _)).WillOnce(Return(gettreereader));
+
+    GetTreeResponse page;
+    page.add_directories()->CopyFrom(d_directories[0]);
+    EXPECT_CALL(*gettreereader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(page), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*gettreereader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    TemporaryDirectory output_dir;
+    EXPECT_THROW(this->downloadDirectoryFromTree(d_digest, output_dir.name()),
+                 std::runtime_error);
+}
+
+class UploadFileFixture : public ClientTestFixture {
+    /**
+     * Instantiates a tempfile with some data for use in upload tests.
+     * Inherits from the pre-instantiated client fixture.
+     */
+  protected:
+    UploadFileFixture()
+    {
+        write(tmpfile.fd(), content.c_str(), content.length());
     }
 };
 
@@ -1182,6 +2100,85 @@ TEST_F(UploadFileFixture, UploadJustSmallerThanExactFileTest)
     this->upload(tmpfile.fd(), digest);
 }
 
+TEST_F(UploadFileFixture, UploadLargeFileSendsChunksInOrder)
+{
+    // Every chunk has different contents:
+    const size_t chunkSize = bytestreamChunkSizeBytes();
+    std::string content;
+    for (char c = 'a'; c < 'f'; c++) {
+        content += std::string(chunkSize, c);
+    }
+    content += "tail";
+
+    lseek(tmpfile.fd(), 0, SEEK_SET);
+    write(tmpfile.fd(), content.c_str(), content.size());
+
+    digest.set_size_bytes(
+        static_cast<google::protobuf::int64>(content.size()));
+    digest.set_hash_other("fakehash");
+
+    writeResponse.set_committed_size(digest.size_bytes());
+    EXPECT_CALL(*bytestreamClient, WriteRaw(_, _))
+        .WillOnce(DoAll(SetArgPointee<1>(writeResponse), Return(writer)));
+
+    std::string received;
+    std::vector<WriteRequest> requests;
+    EXPECT_CALL(*writer, Write(_, _))
+        .Times(6)
+        .WillRepeatedly(Invoke([&](const WriteRequest &request,
+                                   grpc::WriteOptions) {
+            EXPECT_EQ(request.write_offset(), received.size());
+            received += request.data();
+            requests.push_back(request);
+            return true;
+        }));
+    EXPECT_CALL(*writer, WritesDone()).WillOnce(Return(true));
+    EXPECT_CALL(*writer, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    this->upload(tmpfile.fd(), digest);
+    EXPECT_EQ(received, content);
+    ASSERT_EQ(requests.size(), 6);
+    for (size_t i = 0; i < 5; i++) {
+        EXPECT_FALSE(requests[i].finish_write());
+    }
+    EXPECT_TRUE(requests[5].finish_write());
+}
+
+TEST_F(UploadFileFixture, UploadTruncatedFileThrows)
+{
+    // The digest claims more data than the file contains:
+    digest.set_size_bytes(
+        static_cast<google::protobuf::int64>(content.length() + 100));
+    digest.set_hash_other("fakehash");
+
+    EXPECT_CALL(*bytestreamClient, WriteRaw(_, _)).WillOnce(Return(writer));
+    EXPECT_CALL(*writer, Write(_, _)).WillOnce(Return(true));
+
+    EXPECT_THROW(this->upload(tmpfile.fd(), digest), std::runtime_error);
+}
+
+TEST_F(UploadFileFixture, UploadFileResumesFromCommittedSize)
+{
+    const size_t chunkSize = bytestreamChunkSizeBytes();
+    const std::string data = std::string(chunkSize, 'a') +
+                             std::string(chunkSize, 'b') + "tail";
+    lseek(tmpfile.fd(), 0, SEEK_SET);
+    write(tmpfile.fd(), data.c_str(), data.size());
+    const Digest digest = CASHash::hash(data);
+
+    const auto requests = uploadWithRetry(
+        bytestreamClient.get(),
+        [&]() { this->upload(tmpfile.fd(), digest); }, data.size(),
+        grpc::Status::OK, chunkSize);
+
+    ASSERT_EQ(requests.size(), 2);
+    EXPECT_EQ(requests[0].write_offset(), chunkSize);
+    EXPECT_EQ(requests[0].data(), std::string(chunkSize, 'b'));
+    EXPECT_EQ(requests[1].write_offset(), 2 * chunkSize);
+    EXPECT_EQ(requests[1].data(), "tail");
+    EXPECT_TRUE(requests[1].finish_write());
+}
+
 TEST_F(UploadFileFixture, UploadFileReadFailure)
 {
     digest.set_size_bytes(content.length());
@@ -1237,6 +2234,100 @@ TEST_F(UploadFileFixture, UploadFileDidntReturnOk)
     EXPECT_THROW(this->upload(tmpfile.fd(), digest), std::runtime_error);
 }
 
+TEST_F(UploadFileFixture, HashAndUploadSmallFileReadsItOnce)
+{
+    // Small files are batched directly, without asking the server first:
+    EXPECT_CALL(*casClient.get(), FindMissingBlobs(_, _, _)).Times(0);
+
+    BatchUpdateBlobsRequest request;
+    BatchUpdateBlobsResponse response;
+    auto entry = response.add_responses();
+    entry->mutable_digest()->CopyFrom(CASHash::hash(content));
+    entry->mutable_status()->set_code(grpc::StatusCode::OK);
+    EXPECT_CALL(*casClient.get(), BatchUpdateBlobs(_, _, _))
+        .WillOnce(DoAll(SaveArg<1>(&request), SetArgPointee<2>(response),
+                        Return(grpc::Status::OK)));
+
+    EXPECT_EQ(this->hashAndUploadFile(tmpfile.fd()), CASHash::hash(content));
+    ASSERT_EQ(request.requests_size(), 1);
+    EXPECT_EQ(request.requests(0).data(), content);
+}
+
+TEST_F(UploadFileFixture, HashAndUploadLargeFileSkipsPresentBlob)
+{
+    const std::string data(2 * MAX_BATCH_SIZE_BYTES, 'x');
+    lseek(tmpfile.fd(), 0, SEEK_SET);
+    write(tmpfile.fd(), data.c_str(), data.size());
+
+    EXPECT_CALL(*casClient.get(), FindMissingBlobs(_, _, _))
+        .WillOnce(Return(grpc::Status::OK));
+    EXPECT_CALL(*bytestreamClient, WriteRaw(_, _)).Times(0);
+
+    EXPECT_EQ(this->hashAndUploadFile(tmpfile.fd()), CASHash::hash(data));
+}
+
+TEST_F(UploadFileFixture, HashAndUploadLargeFileStreamsMissingBlob)
+{
+    const std::string data(2 * MAX_BATCH_SIZE_BYTES, 'x');
+    lseek(tmpfile.fd(), 0, SEEK_SET);
+    write(tmpfile.fd(), data.c_str(), data.size());
+    const Digest digest = CASHash::hash(data);
+
+    FindMissingBlobsResponse missing;
+    missing.add_missing_blob_digests()->CopyFrom(digest);
+    EXPECT_CALL(*casClient.get(), FindMissingBlobs(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(missing), Return(grpc::Status::OK)));
+
+    writeResponse.set_committed_size(digest.size_bytes());
+    EXPECT_CALL(*bytestreamClient, WriteRaw(_, _))
+        .WillOnce(DoAll(SetArgPointee<1>(writeResponse), Return(writer)));
+    EXPECT_CALL(*writer, Write(_, _)).WillOnce(Return(true));
+    EXPECT_CALL(*writer, WritesDone()).WillOnce(Return(true));
+    EXPECT_CALL(*writer, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    EXPECT_EQ(this->hashAndUploadFile(tmpfile.fd()), digest);
+}
+
+TEST_F(ClientTestFixture, HashAndUploadFilesReportsEachFile)
+{
+    TemporaryDirectory directory;
+    const std::string small_path = std::string(directory.name()) + "/small";
+    const std::string large_path = std::string(directory.name()) + "/large";
+    const std::string small_data = "small output";
+    const std::string large_data(2 * MAX_BATCH_SIZE_BYTES, 'x');
+    FileUtils::writeFileAtomically(large_path, large_data);
+    FileUtils::writeFileAtomically(small_path, small_data);
+
+    // Only the large file is checked, and it is already present:
+    FindMissingBlobsRequest find_request;
+    EXPECT_CALL(*casClient.get(), FindMissingBlobs(_, _, _))
+        .WillOnce(DoAll(SaveArg<1>(&find_request), Return(grpc::Status::OK)));
+
+    // The small one fails to upload:
+    BatchUpdateBlobsResponse response;
+    auto entry = response.add_responses();
+    entry->mutable_digest()->CopyFrom(CASHash::hash(small_data));
+    entry->mutable_status()->set_code(grpc::StatusCode::INTERNAL);
+    EXPECT_CALL(*casClient.get(), BatchUpdateBlobs(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(response), Return(grpc::Status::OK)));
+
+    const auto results = this->hashAndUploadFiles({large_path, small_path});
+    ASSERT_EQ(find_request.blob_digests_size(), 1);
+    EXPECT_EQ(find_request.blob_digests(0), CASHash::hash(large_data));
+
+    ASSERT_EQ(results.size(), 2);
+    EXPECT_EQ(results[0].digest, CASHash::hash(large_data));
+    EXPECT_TRUE(results[0].status.ok());
+    EXPECT_EQ(results[1].digest, CASHash::hash(small_data));
+    EXPECT_EQ(results[1].status.error_code(), grpc::StatusCode::INTERNAL);
+}
+
+TEST_F(ClientTestFixture, HashAndUploadFilesMissingFileThrows)
+{
+    EXPECT_THROW(this->hashAndUploadFiles({"/this/path/does/not/exist"}),
+                 std::system_error);
+}
+
 class TransferDirectoryFixture : public ClientTestFixture {
     /**
      * Instantiates a tempfile with some data for use in upload tests.
@@ -1392,6 +2483,91 @@ TEST_F(TransferDirectoryFixture, UploadDirectoryWritesTree)
     ASSERT_EQ(returned_directory_digest, directory_digest);
 }
 
+TEST_F(TransferDirectoryFixture, UploadDirectorySendsFileContents)
+{
+    FindMissingBlobsResponse missing_blobs_response;
+    for (const auto &entry : directory_file_map) {
+        missing_blobs_response.add_missing_blob_digests()->CopyFrom(
+            entry.first);
+    }
+    EXPECT_CALL(*casClient.get(), FindMissingBlobs(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(missing_blobs_response),
+                        Return(grpc::Status::OK)));
+
+    BatchUpdateBlobsRequest update_request;
+    EXPECT_CALL(*casClient.get(), BatchUpdateBlobs(_, _, _))
+        .WillOnce(
+            DoAll(SaveArg<1>(&update_request), Return(grpc::Status::OK)));
+
+    this->uploadDirectory(std::string(directory.name()));
+
+    // Files are sent with their contents and Directory messages serialized,
+    // each identified by the map it came from rather than by its data.
+    std::unordered_map<Digest, std::string> uploaded;
+    for (const auto &entry : update_request.requests()) {
+        uploaded[entry.digest()] = entry.data();
+    }
+    ASSERT_EQ(uploaded.size(), directory_file_map.size());
+    EXPECT_EQ(uploaded.at(file_a_digest), file_a_contents);
+    EXPECT_EQ(uploaded.at(file_b_digest), file_b_contents);
+    EXPECT_EQ(uploaded.at(directory_digest), serialized_directory);
+}
+
+TEST_F(TransferDirectoryFixture, UploadDirectoryWithMemoryLimitStreamsBlobs)
+{
+    FindMissingBlobsResponse missing_blobs_response;
+    for (const auto &entry : directory_file_map) {
+        missing_blobs_response.add_missing_blob_digests()->CopyFrom(
+            entry.first);
+    }
+    EXPECT_CALL(*casClient.get(), FindMissingBlobs(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(missing_blobs_response),
+                        Return(grpc::Status::OK)));
+
+    // No blob fits in a batch under this limit, so every one of them is
+    // written with ByteStream.
+    this->setUploadMemoryLimit(1);
+    EXPECT_CALL(*casClient.get(), BatchUpdateBlobs(_, _, _)).Times(0);
+
+    // Reserved up front so that the pointers handed to the writers remain
+    // valid.
+    std::vector<std::string> written;
+    written.reserve(directory_file_map.size());
+    EXPECT_CALL(*bytestreamClient, WriteRaw(_, _))
+        .Times(static_cast<int>(directory_file_map.size()))
+        .WillRepeatedly(Invoke([&written](grpc::ClientContext *,
+                                          WriteResponse *response) {
+            auto blob_writer = new grpc::testing::MockClientWriter<
+                google::bytestream::WriteRequest>();
+            written.emplace_back();
+            std::string *data = &written.back();
+            EXPECT_CALL(*blob_writer, Write(_, _))
+                .WillRepeatedly(Invoke([response, data](
+                                           const WriteRequest &request,
+                                           grpc::WriteOptions) {
+                    data->append(request.data());
+                    response->set_committed_size(
+                        static_cast<google::protobuf::int64>(data->size()));
+                    return true;
+                }));
+            EXPECT_CALL(*blob_writer, WritesDone()).WillOnce(Return(true));
+            EXPECT_CALL(*blob_writer, Finish())
+                .WillOnce(Return(grpc::Status::OK));
+            return blob_writer;
+        }));
+
+    const auto results = this->uploadDirectory(std::string(directory.name()));
+    EXPECT_TRUE(results.empty());
+
+    EXPECT_NE(std::find(written.cbegin(), written.cend(), file_a_contents),
+              written.cend());
+    EXPECT_NE(std::find(written.cbegin(), written.cend(), file_b_contents),
+              written.cend());
+    EXPECT_NE(
+        std::find(written.cbegin(), written.cend(), serialized_directory),
+        written.cend());
+}
+
 TEST_F(ClientTestFixture, DownloadDirectoryTestActualDownload)
 {
     TemporaryDirectory capture_dir;
@@ -1448,21 +2624,83 @@ TEST_F(TransferDirectoryFixture, DownloadDirectoryMissingDigestThrows)
     digest.set_hash_other("ThisDoesNotExist");
     digest.set_size_bytes(1234);
 
-    EXPECT_CALL(*bytestreamClient, ReadRaw(_, _)).WillOnce(Return(reader));
-
-    EXPECT_CALL(*reader, Read(_))
-        .WillOnce(DoAll(SetArgPointee<0>(readResponse), Return(true)))
-        .WillOnce(Return(false));
-
-    EXPECT_CALL(*reader, Finish())
-        .WillOnce(Return(grpc::Status(grpc::StatusCode::NOT_FOUND,
-                                      "Blob not found in CAS")));
+    // Directory messages are fetched in batches:
+    BatchReadBlobsResponse response;
+    auto entry = response.add_responses();
+    entry->mutable_digest()->CopyFrom(digest);
+    entry->mutable_status()->set_code(grpc::StatusCode::NOT_FOUND);
+    entry->mutable_status()->set_message("Blob not found in CAS");
+    EXPECT_CALL(*casClient.get(), BatchReadBlobs(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(response), Return(grpc::Status::OK)));
 
     TemporaryDirectory output_dir;
     ASSERT_THROW(this->downloadDirectory(digest, output_dir.name()),
                  std::runtime_error);
 }
 
+TEST_F(TransferDirectoryFixture, DownloadDirectoryFetchesLevelsInBatches)
+{
+    /* root/
+     *   |-- a/
+     *   |   |-- file  ("same")
+     *   |   |-- c/
+     *   |       |-- file  ("other")
+     *   |-- b/        (identical to a/)
+     *   |-- link -> a/file
+     */
+    std::unordered_map<Digest, std::string> blobs;
+    const auto add_blob = [&blobs](const std::string &data) {
+        const Digest blob_digest = make_digest(data);
+        blobs[blob_digest] = data;
+        return blob_digest;
+    };
+
+    NestedDirectory tree;
+    tree.add(File(add_blob("same"), false), "a/file");
+    tree.add(File(add_blob("other"), true), "a/c/file");
+    tree.add(File(add_blob("same"), false), "b/file");
+    tree.add(File(add_blob("other"), true), "b/c/file");
+    tree.addSymlink("a/file", "link");
+
+    digest_string_map directory_blobs;
+    const Digest root_digest = tree.to_digest(&directory_blobs);
+    for (const auto &entry : directory_blobs) {
+        blobs[entry.first] = entry.second;
+    }
+
+    std::vector<int> requested_digests;
+    EXPECT_CALL(*casClient.get(), BatchReadBlobs(_, _, _))
+        .WillRepeatedly(Invoke([&](grpc::ClientContext *,
+                                   const BatchReadBlobsRequest &request,
+                                   BatchReadBlobsResponse *response) {
+            requested_digests.push_back(request.digests_size());
+            for (const auto &blob_digest : request.digests()) {
+                auto entry = response->add_responses();
+                entry->mutable_digest()->CopyFrom(blob_digest);
+                entry->set_data(blobs.at(blob_digest));
+                entry->mutable_status()->set_code(grpc::StatusCode::OK);
+            }
+            return grpc::Status::OK;
+        }));
+
+    TemporaryDirectory output_dir;
+    this->downloadDirectory(root_digest, output_dir.name());
+
+    // One request per level of the tree (the root, {a, b} which are the same
+    // Directory, and c) and another for the two distinct files.
+    EXPECT_EQ(requested_digests, std::vector<int>({1, 1, 1, 2}));
+
+    const std::string root_path(output_dir.name());
+    EXPECT_EQ(FileUtils::getFileContents((root_path + "/a/file").c_str()),
+              "same");
+    EXPECT_EQ(FileUtils::getFileContents((root_path + "/b/file").c_str()),
+              "same");
+    EXPECT_EQ(FileUtils::getFileContents((root_path + "/b/c/file").c_str()),
+              "other");
+    EXPECT_TRUE(FileUtils::isExecutable((root_path + "/a/c/file").c_str()));
+    EXPECT_TRUE(FileUtils::isSymlink((root_path + "/link").c_str()));
+}
+
 TEST_F(TransferDirectoryFixture, StageDirectory)
 {
     EXPECT_CALL(*localCasClient.get(), StageTreeRaw(_))
@@ -1802,3 +3040,737 @@ TEST_F(DownloadBlobsFixture,
     ASSERT_EQ(result_status.code(), grpc::StatusCode::OK);
     ASSERT_EQ(result_data, data);
 }
+
+class CompressedTransferFixture : public ClientTestFixture {
+  protected:
+    // Have the server advertise support for DEFLATE, in ByteStream and
+    // `BatchReadBlobs()` transfers and, if `batchUpdates` is set, in
+    // `BatchUpdateBlobs()`, and ask the client to use it.
+    void enableCompression(bool batchUpdates = true)
+    {
+        ServerCapabilities capabilities;
+        CacheCapabilities *cache = capabilities.mutable_cache_capabilities();
+        cache->add_supported_compressors(Compressor::DEFLATE);
+        if (batchUpdates) {
+            cache->add_supported_batch_update_compressors(
+                Compressor::DEFLATE);
+        }
+        EXPECT_CALL(*capabilitiesClient, GetCapabilities(_, _, _))
+            .WillOnce(DoAll(SetArgPointee<2>(capabilities),
+                            Return(grpc::Status::OK)));
+        this->init(bytestreamClient, casClient, localCasClient,
+                   capabilitiesClient);
+        this->setCompressor(Compressor::DEFLATE);
+    }
+
+    // Data that compresses to about half its size, so that it takes
+    // several ByteStream messages even when compressed.
+    static std::string halfCompressibleData(size_t size)
+    {
+        std::string data(size, 0);
+        uint32_t state = 1;
+        for (char &c : data) {
+            state = state * 1103515245 + 12345;
+            c = static_cast<char>('a' + ((state >> 16) & 0xf));
+        }
+        return data;
+    }
+
+    const std::string compressible_data = std::string(10000, 'z');
+};
+
+TEST_F(CompressedTransferFixture, SetUnsupportedCompressorThrows)
+{
+    EXPECT_THROW(this->setCompressor(Compressor::BROTLI),
+                 std::invalid_argument);
+}
+
+TEST_F(CompressedTransferFixture, FetchStringCompressed)
+{
+    enableCompression();
+    digest = CASHash::hash(compressible_data);
+    const std::string compressed =
+        Compression::compress(Compressor::DEFLATE, compressible_data);
+
+    ReadResponse chunk1, chunk2;
+    chunk1.set_data(compressed.substr(0, 10));
+    chunk2.set_data(compressed.substr(10));
+
+    ReadRequest request;
+    EXPECT_CALL(*bytestreamClient, ReadRaw(_, _))
+        .WillOnce(DoAll(SaveArg<1>(&request), Return(reader)));
+    EXPECT_CALL(*reader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(chunk1), Return(true)))
+        .WillOnce(DoAll(SetArgPointee<0>(chunk2), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*reader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    EXPECT_EQ(this->fetchString(digest), compressible_data);
+    EXPECT_EQ(request.resource_name(),
+              client_instance_name + "/compressed-blobs/deflate/" +
+                  digest.hash_other() + "/" +
+                  std::to_string(digest.size_bytes()));
+}
+
+TEST_F(CompressedTransferFixture, FetchStringUncompressedIfNotAdvertised)
+{
+    EXPECT_CALL(*capabilitiesClient, GetCapabilities(_, _, _))
+        .WillOnce(Return(grpc::Status::OK));
+    this->init(bytestreamClient, casClient, localCasClient,
+               capabilitiesClient);
+    this->setCompressor(Compressor::DEFLATE);
+
+    readResponse.set_data(content);
+    digest = CASHash::hash(content);
+
+    ReadRequest request;
+    EXPECT_CALL(*bytestreamClient, ReadRaw(_, _))
+        .WillOnce(DoAll(SaveArg<1>(&request), Return(reader)));
+    EXPECT_CALL(*reader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(readResponse), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*reader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    EXPECT_EQ(this->fetchString(digest), content);
+    EXPECT_EQ(request.resource_name(), client_instance_name + "/blobs/" +
+                                           digest.hash_other() + "/" +
+                                           std::to_string(content.size()));
+}
+
+TEST_F(CompressedTransferFixture, FetchStringMalformedDataThrows)
+{
+    enableCompression();
+    digest = CASHash::hash(compressible_data);
+    readResponse.set_data(std::string(100, 'x'));
+
+    EXPECT_CALL(*bytestreamClient, ReadRaw(_, _)).WillOnce(Return(reader));
+    EXPECT_CALL(*reader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(readResponse), Return(true)));
+    EXPECT_CALL(*reader, Finish())
+        .WillOnce(Return(grpc::Status(grpc::StatusCode::CANCELLED, "")));
+
+    EXPECT_THROW(this->fetchString(digest), std::runtime_error);
+}
+
+TEST_F(CompressedTransferFixture, DownloadCompressed)
+{
+    enableCompression();
+    digest = CASHash::hash(compressible_data);
+    readResponse.set_data(
+        Compression::compress(Compressor::DEFLATE, compressible_data));
+
+    EXPECT_CALL(*bytestreamClient, ReadRaw(_, _)).WillOnce(Return(reader));
+    EXPECT_CALL(*reader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(readResponse), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*reader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    this->download(tmpfile.fd(), digest);
+    EXPECT_EQ(FileUtils::getFileContents(tmpfile.strname().c_str()),
+              compressible_data);
+}
+
+TEST_F(CompressedTransferFixture, UploadStringCompressed)
+{
+    enableCompression();
+    const std::string data = halfCompressibleData(4 * 1024 * 1024);
+    digest = CASHash::hash(data);
+
+    writeResponse.set_committed_size(digest.size_bytes());
+    EXPECT_CALL(*bytestreamClient, WriteRaw(_, _))
+        .WillOnce(DoAll(SetArgPointee<1>(writeResponse), Return(writer)));
+
+    std::vector<WriteRequest> requests;
+    std::string compressed;
+    EXPECT_CALL(*writer, Write(_, _))
+        .WillRepeatedly(Invoke(
+            [&](const WriteRequest &request, grpc::WriteOptions) {
+                EXPECT_EQ(request.write_offset(), compressed.size());
+                EXPECT_LE(request.data().size(), bytestreamChunkSizeBytes());
+                compressed += request.data();
+                requests.push_back(request);
+                return true;
+            }));
+    EXPECT_CALL(*writer, WritesDone()).WillOnce(Return(true));
+    EXPECT_CALL(*writer, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    this->upload(data, digest);
+
+    ASSERT_GT(requests.size(), 1);
+    const std::string suffix = "/compressed-blobs/deflate/" +
+                               digest.hash_other() + "/" +
+                               std::to_string(data.size());
+    const std::string &resource_name = requests[0].resource_name();
+    EXPECT_EQ(resource_name.find(client_instance_name + "/uploads/"), 0);
+    EXPECT_EQ(resource_name.substr(resource_name.size() - suffix.size()),
+              suffix);
+    for (size_t i = 0; i + 1 < requests.size(); i++) {
+        EXPECT_FALSE(requests[i].finish_write());
+    }
+    EXPECT_TRUE(requests.back().finish_write());
+    EXPECT_LT(compressed.size(), data.size());
+    EXPECT_EQ(
+        Compression::decompress(Compressor::DEFLATE, compressed, data.size()),
+        data);
+}
+
+TEST_F(CompressedTransferFixture, UploadFileCompressed)
+{
+    enableCompression();
+    FileUtils::writeFileAtomically(tmpfile.strname(), compressible_data);
+    const int fd = open(tmpfile.strname().c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    digest = CASHash::hash(compressible_data);
+
+    // Servers may report -1 for compressed uploads.
+    writeResponse.set_committed_size(-1);
+    EXPECT_CALL(*bytestreamClient, WriteRaw(_, _))
+        .WillOnce(DoAll(SetArgPointee<1>(writeResponse), Return(writer)));
+
+    std::string compressed;
+    EXPECT_CALL(*writer, Write(_, _))
+        .WillOnce(Invoke([&](const WriteRequest &request, grpc::WriteOptions) {
+            EXPECT_TRUE(request.finish_write());
+            compressed = request.data();
+            return true;
+        }));
+    EXPECT_CALL(*writer, WritesDone()).WillOnce(Return(true));
+    EXPECT_CALL(*writer, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    this->upload(fd, digest);
+    close(fd);
+    EXPECT_EQ(Compression::decompress(Compressor::DEFLATE, compressed,
+                                      compressible_data.size()),
+              compressible_data);
+}
+
+TEST_F(CompressedTransferFixture, BatchUploadCompressesWhenSmaller)
+{
+    enableCompression();
+    const Digest compressible_digest = CASHash::hash(compressible_data);
+    const Digest short_digest = CASHash::hash(content);
+
+    BatchUpdateBlobsRequest request;
+    EXPECT_CALL(*casClient.get(), BatchUpdateBlobs(_, _, _))
+        .WillOnce(DoAll(SaveArg<1>(&request), Return(grpc::Status::OK)));
+
+    EXPECT_TRUE(this->uploadBlobs({UploadRequest(compressible_digest,
+                                                 compressible_data),
+                                   UploadRequest(short_digest, content)})
+                    .empty());
+
+    ASSERT_EQ(request.requests_size(), 2);
+    for (const auto &entry : request.requests()) {
+        if (entry.digest() == compressible_digest) {
+            EXPECT_EQ(entry.compressor(), Compressor::DEFLATE);
+            EXPECT_EQ(Compression::decompress(Compressor::DEFLATE,
+                                              entry.data(),
+                                              compressible_data.size()),
+                      compressible_data);
+        }
+        else {
+            // Compressing it would not save anything:
+            EXPECT_EQ(entry.compressor(), Compressor::IDENTITY);
+            EXPECT_EQ(entry.data(), content);
+        }
+    }
+}
+
+TEST_F(CompressedTransferFixture, BatchUploadUncompressedIfNotAdvertised)
+{
+    enableCompression(false);
+    const Digest compressible_digest = CASHash::hash(compressible_data);
+
+    BatchUpdateBlobsRequest request;
+    EXPECT_CALL(*casClient.get(), BatchUpdateBlobs(_, _, _))
+        .WillOnce(DoAll(SaveArg<1>(&request), Return(grpc::Status::OK)));
+
+    this->uploadBlobs({UploadRequest(compressible_digest, compressible_data)});
+
+    ASSERT_EQ(request.requests_size(), 1);
+    EXPECT_EQ(request.requests(0).compressor(), Compressor::IDENTITY);
+    EXPECT_EQ(request.requests(0).data(), compressible_data);
+}
+
+TEST_F(CompressedTransferFixture, BatchDownloadCompressed)
+{
+    enableCompression();
+    const Digest good_digest = CASHash::hash(compressible_data);
+    const Digest bad_digest = CASHash::hash(content);
+
+    BatchReadBlobsRequest request;
+    BatchReadBlobsResponse response;
+    auto good = response.add_responses();
+    good->mutable_digest()->CopyFrom(good_digest);
+    good->set_data(
+        Compression::compress(Compressor::DEFLATE, compressible_data));
+    good->set_compressor(Compressor::DEFLATE);
+    auto bad = response.add_responses();
+    bad->mutable_digest()->CopyFrom(bad_digest);
+    bad->set_data("not deflate data");
+    bad->set_compressor(Compressor::DEFLATE);
+
+    EXPECT_CALL(*casClient.get(), BatchReadBlobs(_, _, _))
+        .WillOnce(DoAll(SaveArg<1>(&request), SetArgPointee<2>(response),
+                        Return(grpc::Status::OK)));
+
+    const auto results = this->downloadBlobs({good_digest, bad_digest});
+
+    ASSERT_EQ(request.acceptable_compressors_size(), 1);
+    EXPECT_EQ(request.acceptable_compressors(0), Compressor::DEFLATE);
+
+    const auto &good_result = results.at(good_digest.hash_other());
+    EXPECT_EQ(good_result.first.code(), grpc::StatusCode::OK);
+    EXPECT_EQ(good_result.second, compressible_data);
+
+    const auto &bad_result = results.at(bad_digest.hash_other());
+    EXPECT_EQ(bad_result.first.code(), grpc::StatusCode::INTERNAL);
+}
+
+class AsyncClientFixture : public CompressedTransferFixture {
+    /**
+     * Fixture for the asynchronous methods, whose mocked readers and
+     * writers complete their events on the client's completion queue like
+     * gRPC would.
+     */
+  protected:
+    typedef buildboxcommontest::MockAsyncReader<ReadResponse> MockReader;
+    typedef buildboxcommontest::MockAsyncWriter<WriteRequest> MockWriter;
+
+    ~AsyncClientFixture() override
+    {
+        // Waits for the calls in flight, which use the alarms and readers.
+        this->setCompletionQueueThreads(1);
+    }
+
+    // Complete the event tagged with `tag`, with `ok` as the result that
+    // the completion queue reports.
+    void completeEvent(grpc::CompletionQueue *queue, void *tag,
+                       bool ok = true)
+    {
+        std::unique_ptr<grpc::Alarm> alarm(new grpc::Alarm());
+        if (ok) {
+            alarm->Set(queue, std::chrono::system_clock::now(), tag);
+        }
+        else {
+            // A cancelled alarm completes with `ok` set to false.
+            alarm->Set(queue,
+                       std::chrono::system_clock::now() +
+                           std::chrono::hours(1),
+                       tag);
+            alarm->Cancel();
+        }
+
+        const std::lock_guard<std::mutex> lock(d_mutex);
+        d_alarms.push_back(std::move(alarm));
+    }
+
+    // Return a reader that streams `chunks` and then finishes with
+    // `status`. The client deletes it.
+    MockReader *makeReader(grpc::CompletionQueue *queue,
+                           const std::vector<std::string> &chunks,
+                           const grpc::Status &status = grpc::Status::OK)
+    {
+        auto reader = new MockReader();
+        const auto nextChunk = std::make_shared<size_t>(0);
+        EXPECT_CALL(*reader, StartCall(_))
+            .WillOnce(Invoke([=](void *tag) { completeEvent(queue, tag); }));
+        EXPECT_CALL(*reader, Read(_, _))
+            .WillRepeatedly(Invoke([=](ReadResponse *response, void *tag) {
+                if (*nextChunk < chunks.size()) {
+                    response->set_data(chunks[(*nextChunk)++]);
+                    completeEvent(queue, tag);
+                }
+                else {
+                    completeEvent(queue, tag, false);
+                }
+            }));
+        EXPECT_CALL(*reader, Finish(_, _))
+            .WillOnce(Invoke([=](grpc::Status *s, void *tag) {
+                *s = status;
+                completeEvent(queue, tag);
+            }));
+        return reader;
+    }
+
+    // Return a writer that appends the requests written to it to
+    // `requests` and then finishes with `status`, reporting
+    // `committedSize` in `response`. The client deletes it.
+    MockWriter *makeWriter(grpc::CompletionQueue *queue,
+                           WriteResponse *response,
+                           std::vector<WriteRequest> *requests,
+                           google::protobuf::int64 committedSize,
+                           const grpc::Status &status = grpc::Status::OK)
+    {
+        auto writer = new MockWriter();
+        EXPECT_CALL(*writer, StartCall(_))
+            .WillOnce(Invoke([=](void *tag) { completeEvent(queue, tag); }));
+        EXPECT_CALL(*writer, Write(_, _))
+            .WillRepeatedly(
+                Invoke([=](const WriteRequest &request, void *tag) {
+                    requests->push_back(request);
+                    completeEvent(queue, tag);
+                }));
+        EXPECT_CALL(*writer, WritesDone(_))
+            .WillOnce(Invoke([=](void *tag) { completeEvent(queue, tag); }));
+        EXPECT_CALL(*writer, Finish(_, _))
+            .WillOnce(Invoke([=](grpc::Status *s, void *tag) {
+                response->set_committed_size(committedSize);
+                *s = status;
+                completeEvent(queue, tag);
+            }));
+        return writer;
+    }
+
+    // Return a reader for a unary call that answers `response` with
+    // `status`. gRPC never deletes those readers through the interface, so
+    // the fixture owns them.
+    template <typename Response>
+    grpc::ClientAsyncResponseReaderInterface<Response> *
+    makeResponseReader(grpc::CompletionQueue *queue,
+                       const grpc::Status &status, const Response &response)
+    {
+        auto reader =
+            new buildboxcommontest::MockAsyncResponseReader<Response>();
+        EXPECT_CALL(*reader, Finish(_, _, _))
+            .WillOnce(Invoke([=](Response *r, grpc::Status *s, void *tag) {
+                *r = response;
+                *s = status;
+                completeEvent(queue, tag);
+            }));
+
+        const std::lock_guard<std::mutex> lock(d_mutex);
+        d_responseReaders.emplace_back(reader);
+        return reader;
+    }
+
+    static BatchReadBlobsResponse
+    batchReadResponse(const std::vector<std::string> &blobs)
+    {
+        BatchReadBlobsResponse response;
+        for (const std::string &blob : blobs) {
+            auto entry = response.add_responses();
+            entry->mutable_digest()->CopyFrom(CASHash::hash(blob));
+            entry->set_data(blob);
+            entry->mutable_status()->set_code(grpc::StatusCode::OK);
+        }
+        return response;
+    }
+
+  private:
+    std::mutex d_mutex;
+    std::vector<std::unique_ptr<grpc::Alarm>> d_alarms;
+    std::vector<std::shared_ptr<void>> d_responseReaders;
+};
+
+TEST_F(AsyncClientFixture, FetchStringAsync)
+{
+    const std::string data = "first chunk, second chunk";
+    digest = CASHash::hash(data);
+
+    ReadRequest request;
+    EXPECT_CALL(*bytestreamClient, PrepareAsyncReadRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *, const ReadRequest &r,
+                             grpc::CompletionQueue *queue) {
+            request = r;
+            return makeReader(queue, {data.substr(0, 13), data.substr(13)});
+        }));
+
+    EXPECT_EQ(this->fetchStringAsync(digest).get(), data);
+    EXPECT_EQ(request.resource_name(),
+              client_instance_name + "/blobs/" + digest.hash_other() + "/" +
+                  std::to_string(digest.size_bytes()));
+}
+
+TEST_F(AsyncClientFixture, FetchStringAsyncIsRetried)
+{
+    digest = CASHash::hash(content);
+
+    EXPECT_CALL(*bytestreamClient, PrepareAsyncReadRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *, const ReadRequest &,
+                             grpc::CompletionQueue *queue) {
+            return makeReader(
+                queue, {},
+                grpc::Status(grpc::StatusCode::UNAVAILABLE, "retry"));
+        }))
+        .WillOnce(Invoke([&](grpc::ClientContext *, const ReadRequest &,
+                             grpc::CompletionQueue *queue) {
+            return makeReader(queue, {content});
+        }));
+
+    EXPECT_EQ(this->fetchStringAsync(digest).get(), content);
+}
+
+TEST_F(AsyncClientFixture, FetchStringAsyncExceedsRetryLimit)
+{
+    digest = CASHash::hash(content);
+
+    EXPECT_CALL(*bytestreamClient, PrepareAsyncReadRaw(_, _, _))
+        .Times(2)
+        .WillRepeatedly(Invoke([&](grpc::ClientContext *, const ReadRequest &,
+                                   grpc::CompletionQueue *queue) {
+            return makeReader(
+                queue, {},
+                grpc::Status(grpc::StatusCode::UNAVAILABLE, "down"));
+        }));
+
+    try {
+        this->fetchStringAsync(digest).get();
+        FAIL() << "Expected GrpcError";
+    }
+    catch (const GrpcError &e) {
+        EXPECT_EQ(e.status.error_code(), grpc::StatusCode::UNAVAILABLE);
+    }
+}
+
+TEST_F(AsyncClientFixture, FetchStringAsyncDigestMismatchThrows)
+{
+    digest = CASHash::hash(content);
+    const std::string otherContent(content.size(), 'x');
+
+    EXPECT_CALL(*bytestreamClient, PrepareAsyncReadRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *, const ReadRequest &,
+                             grpc::CompletionQueue *queue) {
+            return makeReader(queue, {otherContent});
+        }));
+
+    EXPECT_THROW(this->fetchStringAsync(digest).get(), std::runtime_error);
+}
+
+TEST_F(AsyncClientFixture, FetchStringAsyncCompressed)
+{
+    enableCompression();
+    digest = CASHash::hash(compressible_data);
+    const std::string compressed =
+        Compression::compress(Compressor::DEFLATE, compressible_data);
+
+    ReadRequest request;
+    EXPECT_CALL(*bytestreamClient, PrepareAsyncReadRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *, const ReadRequest &r,
+                             grpc::CompletionQueue *queue) {
+            request = r;
+            return makeReader(
+                queue, {compressed.substr(0, 10), compressed.substr(10)});
+        }));
+
+    EXPECT_EQ(this->fetchStringAsync(digest).get(), compressible_data);
+    EXPECT_EQ(request.resource_name(),
+              client_instance_name + "/compressed-blobs/deflate/" +
+                  digest.hash_other() + "/" +
+                  std::to_string(digest.size_bytes()));
+}
+
+TEST_F(AsyncClientFixture, FetchStringAsyncMalformedCompressedDataThrows)
+{
+    enableCompression();
+    digest = CASHash::hash(compressible_data);
+
+    EXPECT_CALL(*bytestreamClient, PrepareAsyncReadRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *, const ReadRequest &,
+                             grpc::CompletionQueue *queue) {
+            return makeReader(queue, {std::string(100, 'x')},
+                              grpc::Status(grpc::StatusCode::CANCELLED, ""));
+        }));
+
+    EXPECT_THROW(this->fetchStringAsync(digest).get(), std::runtime_error);
+}
+
+TEST_F(AsyncClientFixture, UploadAsync)
+{
+    digest = CASHash::hash(content);
+
+    std::vector<WriteRequest> requests;
+    EXPECT_CALL(*bytestreamClient, PrepareAsyncWriteRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *, WriteResponse *response,
+                             grpc::CompletionQueue *queue) {
+            return makeWriter(queue, response, &requests,
+                              digest.size_bytes());
+        }));
+
+    this->uploadAsync(content, digest).get();
+    ASSERT_EQ(requests.size(), 1);
+    EXPECT_EQ(requests[0].data(), content);
+    EXPECT_EQ(requests[0].write_offset(), 0);
+    EXPECT_TRUE(requests[0].finish_write());
+    EXPECT_NE(requests[0].resource_name().find(
+                  "/blobs/" + digest.hash_other() + "/" +
+                  std::to_string(digest.size_bytes())),
+              std::string::npos);
+}
+
+TEST_F(AsyncClientFixture, UploadAsyncIsRetriedFromTheStart)
+{
+    digest = CASHash::hash(content);
+
+    std::vector<WriteRequest> failedRequests, requests;
+    EXPECT_CALL(*bytestreamClient, PrepareAsyncWriteRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *, WriteResponse *response,
+                             grpc::CompletionQueue *queue) {
+            return makeWriter(
+                queue, response, &failedRequests, 0,
+                grpc::Status(grpc::StatusCode::UNAVAILABLE, "retry"));
+        }))
+        .WillOnce(Invoke([&](grpc::ClientContext *, WriteResponse *response,
+                             grpc::CompletionQueue *queue) {
+            return makeWriter(queue, response, &requests,
+                              digest.size_bytes());
+        }));
+
+    this->uploadAsync(content, digest).get();
+    ASSERT_EQ(requests.size(), 1);
+    EXPECT_EQ(requests[0].write_offset(), 0);
+    EXPECT_EQ(requests[0].data(), content);
+}
+
+TEST_F(AsyncClientFixture, UploadAsyncCommittedSizeMismatchThrows)
+{
+    digest = CASHash::hash(content);
+
+    std::vector<WriteRequest> requests;
+    EXPECT_CALL(*bytestreamClient, PrepareAsyncWriteRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *, WriteResponse *response,
+                             grpc::CompletionQueue *queue) {
+            return makeWriter(queue, response, &requests, 1);
+        }));
+
+    EXPECT_THROW(this->uploadAsync(content, digest).get(),
+                 std::runtime_error);
+}
+
+TEST_F(AsyncClientFixture, UploadAsyncSizeMismatchThrowsRightAway)
+{
+    digest = CASHash::hash(content);
+    EXPECT_CALL(*bytestreamClient, PrepareAsyncWriteRaw(_, _, _)).Times(0);
+    EXPECT_THROW(this->uploadAsync(content + "!", digest), std::logic_error);
+}
+
+TEST_F(AsyncClientFixture, FindMissingBlobsAsyncIsRetried)
+{
+    const Digest present = CASHash::hash("present");
+    const Digest missing = CASHash::hash("missing");
+    FindMissingBlobsResponse response;
+    response.add_missing_blob_digests()->CopyFrom(missing);
+
+    FindMissingBlobsRequest request;
+    EXPECT_CALL(*casClient, AsyncFindMissingBlobsRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *,
+                             const FindMissingBlobsRequest &,
+                             grpc::CompletionQueue *queue) {
+            return makeResponseReader(
+                queue, grpc::Status(grpc::StatusCode::UNAVAILABLE, "retry"),
+                FindMissingBlobsResponse());
+        }))
+        .WillOnce(Invoke([&](grpc::ClientContext *,
+                             const FindMissingBlobsRequest &r,
+                             grpc::CompletionQueue *queue) {
+            request = r;
+            return makeResponseReader(queue, grpc::Status::OK, response);
+        }));
+
+    const std::vector<Digest> result =
+        this->findMissingBlobsAsync({present, missing}).get();
+    ASSERT_EQ(result.size(), 1);
+    EXPECT_EQ(result[0], missing);
+    EXPECT_EQ(request.instance_name(), client_instance_name);
+    EXPECT_EQ(request.blob_digests_size(), 2);
+}
+
+TEST_F(AsyncClientFixture, FindMissingBlobsAsyncErrorThrows)
+{
+    EXPECT_CALL(*casClient, AsyncFindMissingBlobsRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *,
+                             const FindMissingBlobsRequest &,
+                             grpc::CompletionQueue *queue) {
+            return makeResponseReader(
+                queue, grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "bad"),
+                FindMissingBlobsResponse());
+        }));
+
+    EXPECT_THROW(this->findMissingBlobsAsync({CASHash::hash("a")}).get(),
+                 GrpcError);
+}
+
+TEST_F(AsyncClientFixture, DownloadBlobsAsyncFailedBatchIsInternal)
+{
+    const Digest digest_a = CASHash::hash("a");
+    const Digest digest_b = CASHash::hash("b");
+
+    EXPECT_CALL(*casClient, AsyncBatchReadBlobsRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *,
+                             const BatchReadBlobsRequest &,
+                             grpc::CompletionQueue *queue) {
+            return makeResponseReader(
+                queue, grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "bad"),
+                BatchReadBlobsResponse());
+        }));
+
+    const auto results =
+        this->downloadBlobsAsync({digest_a, digest_b}).get();
+    ASSERT_EQ(results.size(), 2);
+    for (const Digest &d : {digest_a, digest_b}) {
+        EXPECT_EQ(results.at(d.hash_other()).first.code(),
+                  grpc::StatusCode::INTERNAL);
+        EXPECT_TRUE(results.at(d.hash_other()).second.empty());
+    }
+}
+
+TEST_F(AsyncClientFixture, DownloadBlobsAsyncSplitsBatchAndByteStream)
+{
+    // Blobs that do not fit in a batch are read with ByteStream.
+    const std::string small_a = "a", small_b = "b";
+    const std::string large(MAX_BATCH_SIZE_BYTES + 1, 'l');
+    const Digest digest_a = CASHash::hash(small_a);
+    const Digest digest_b = CASHash::hash(small_b);
+    const Digest digest_large = CASHash::hash(large);
+
+    BatchReadBlobsRequest batchRequest;
+    EXPECT_CALL(*casClient, AsyncBatchReadBlobsRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *,
+                             const BatchReadBlobsRequest &r,
+                             grpc::CompletionQueue *queue) {
+            batchRequest = r;
+            return makeResponseReader(queue, grpc::Status::OK,
+                                      batchReadResponse({small_a, small_b}));
+        }));
+    ReadRequest readRequest;
+    EXPECT_CALL(*bytestreamClient, PrepareAsyncReadRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *, const ReadRequest &r,
+                             grpc::CompletionQueue *queue) {
+            readRequest = r;
+            return makeReader(queue, {large});
+        }));
+
+    const auto results =
+        this->downloadBlobsAsync({digest_large, digest_a, digest_b}).get();
+
+    EXPECT_EQ(batchRequest.digests_size(), 2);
+    EXPECT_NE(readRequest.resource_name().find(digest_large.hash_other()),
+              std::string::npos);
+
+    ASSERT_EQ(results.size(), 3);
+    EXPECT_EQ(results.at(digest_a.hash_other()).first.code(),
+              grpc::StatusCode::OK);
+    EXPECT_EQ(results.at(digest_a.hash_other()).second, small_a);
+    EXPECT_EQ(results.at(digest_b.hash_other()).second, small_b);
+    EXPECT_EQ(results.at(digest_large.hash_other()).first.code(),
+              grpc::StatusCode::OK);
+    EXPECT_EQ(results.at(digest_large.hash_other()).second, large);
+}
+
+TEST_F(AsyncClientFixture, DownloadBlobsAsyncReportsByteStreamErrors)
+{
+    const std::string large(MAX_BATCH_SIZE_BYTES + 1, 'l');
+    const Digest digest_large = CASHash::hash(large);
+
+    EXPECT_CALL(*bytestreamClient, PrepareAsyncReadRaw(_, _, _))
+        .WillOnce(Invoke([&](grpc::ClientContext *, const ReadRequest &,
+                             grpc::CompletionQueue *queue) {
+            return makeReader(
+                queue, {}, grpc::Status(grpc::StatusCode::NOT_FOUND, "gone"));
+        }));
+
+    const auto results = this->downloadBlobsAsync({digest_large}).get();
+    ASSERT_EQ(results.size(), 1);
+    EXPECT_EQ(results.at(digest_large.hash_other()).first.code(),
+              grpc::StatusCode::NOT_FOUND);
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "buildboxcommontest_asyncmocks.h"
+#include <buildboxcommon_completionqueuerunner.h>
+#include <buildboxcommon_grpcretrier.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+using namespace buildboxcommon;
+using namespace testing;
+
+namespace {
+typedef buildboxcommontest::MockAsyncResponseReader<FindMissingBlobsResponse>
+    MockResponseReader;
+typedef std::unique_ptr<
+    grpc::ClientAsyncResponseReaderInterface<FindMissingBlobsResponse>>
+    ResponseReaderPtr;
+
+struct CallResult {
+    grpc::Status status;
+    bool threw;
+    int missingDigests;
+};
+
+GrpcRetrier makeRetrier(unsigned int retryLimit)
+{
+    return GrpcRetrier(retryLimit, std::chrono::milliseconds(1), nullptr,
+                       "FindMissingBlobs()");
+}
+} // namespace
+
+class AsyncUnaryCallFixture : public ::testing::Test {
+  protected:
+    // Return a reader whose `Finish()` yields `status` and `response`. gRPC
+    // never deletes readers through the interface, so the fixture owns them.
+    ResponseReaderPtr makeReader(grpc::CompletionQueue *queue,
+                                 const grpc::Status &status,
+                                 const FindMissingBlobsResponse &response)
+    {
+        auto reader = new MockResponseReader();
+        EXPECT_CALL(*reader, Finish(_, _, _))
+            .WillOnce(Invoke([=](FindMissingBlobsResponse *r,
+                                 grpc::Status *s, void *tag) {
+                *r = response;
+                *s = status;
+                completeEvent(queue, tag);
+            }));
+
+        const std::lock_guard<std::mutex> lock(d_mutex);
+        d_readers.emplace_back(reader);
+        return ResponseReaderPtr(reader);
+    }
+
+    // Complete the event tagged with `tag` as gRPC would.
+    void completeEvent(grpc::CompletionQueue *queue, void *tag)
+    {
+        std::unique_ptr<grpc::Alarm> alarm(new grpc::Alarm());
+        alarm->Set(queue, std::chrono::system_clock::now(), tag);
+
+        const std::lock_guard<std::mutex> lock(d_mutex);
+        d_alarms.push_back(std::move(alarm));
+    }
+
+    std::promise<CallResult> promise;
+
+    const AsyncUnaryCall<FindMissingBlobsResponse>::Callback callback =
+        [this](const grpc::Status &status, std::exception_ptr error,
+               FindMissingBlobsResponse *response) {
+            promise.set_value({status, error != nullptr,
+                               response->missing_blob_digests_size()});
+        };
+
+  private:
+    std::mutex d_mutex;
+    std::vector<std::unique_ptr<grpc::Alarm>> d_alarms;
+    std::vector<std::unique_ptr<MockResponseReader>> d_readers;
+
+  protected:
+    // Declared last so that it waits for the calls before the alarms and
+    // readers go away.
+    CompletionQueueRunner runner{2};
+};
+
+TEST(CompletionQueueRunnerTest, ZeroThreadsThrows)
+{
+    EXPECT_THROW(CompletionQueueRunner(0), std::invalid_argument);
+}
+
+TEST_F(AsyncUnaryCallFixture, CallSucceeds)
+{
+    FindMissingBlobsResponse response;
+    response.add_missing_blob_digests()->set_hash_other("a");
+
+    (new AsyncUnaryCall<FindMissingBlobsResponse>(
+         &runner, makeRetrier(1),
+         [&](grpc::ClientContext *, grpc::CompletionQueue *queue) {
+             return makeReader(queue, grpc::Status::OK, response);
+         },
+         callback))
+        ->start();
+
+    const CallResult result = promise.get_future().get();
+    EXPECT_TRUE(result.status.ok());
+    EXPECT_FALSE(result.threw);
+    EXPECT_EQ(result.missingDigests, 1);
+}
+
+TEST_F(AsyncUnaryCallFixture, CallIsRetried)
+{
+    FindMissingBlobsResponse response;
+    response.add_missing_blob_digests()->set_hash_other("a");
+
+    std::atomic<int> attempts(0);
+    (new AsyncUnaryCall<FindMissingBlobsResponse>(
+         &runner, makeRetrier(1),
+         [&](grpc::ClientContext *, grpc::CompletionQueue *queue) {
+             const grpc::Status status =
+                 attempts++ == 0
+                     ? grpc::Status(grpc::StatusCode::UNAVAILABLE, "retry")
+                     : grpc::Status::OK;
+             return makeReader(queue, status, response);
+         },
+         callback))
+        ->start();
+
+    const CallResult result = promise.get_future().get();
+    EXPECT_TRUE(result.status.ok());
+    EXPECT_EQ(result.missingDigests, 1);
+    EXPECT_EQ(attempts, 2);
+}
+
+TEST_F(AsyncUnaryCallFixture, CallExceedsRetryLimit)
+{
+    std::atomic<int> attempts(0);
+    (new AsyncUnaryCall<FindMissingBlobsResponse>(
+         &runner, makeRetrier(2),
+         [&](grpc::ClientContext *, grpc::CompletionQueue *queue) {
+             attempts++;
+             return makeReader(
+                 queue, grpc::Status(grpc::StatusCode::UNAVAILABLE, "down"),
+                 FindMissingBlobsResponse());
+         },
+         callback))
+        ->start();
+
+    const CallResult result = promise.get_future().get();
+    EXPECT_EQ(result.status.error_code(), grpc::StatusCode::UNAVAILABLE);
+    EXPECT_FALSE(result.threw);
+    EXPECT_EQ(attempts, 3);
+}
+
+TEST_F(AsyncUnaryCallFixture, CallNotRetriedOnFinalError)
+{
+    std::atomic<int> attempts(0);
+    (new AsyncUnaryCall<FindMissingBlobsResponse>(
+         &runner, makeRetrier(2),
+         [&](grpc::ClientContext *, grpc::CompletionQueue *queue) {
+             attempts++;
+             return makeReader(
+                 queue,
+                 grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "bad"),
+                 FindMissingBlobsResponse());
+         },
+         callback))
+        ->start();
+
+    const CallResult result = promise.get_future().get();
+    EXPECT_EQ(result.status.error_code(), grpc::StatusCode::INVALID_ARGUMENT);
+    EXPECT_EQ(attempts, 1);
+}
+
+TEST_F(AsyncUnaryCallFixture, ExceptionFinishesCall)
+{
+    (new AsyncUnaryCall<FindMissingBlobsResponse>(
+         &runner, makeRetrier(1),
+         [&](grpc::ClientContext *, grpc::CompletionQueue *)
+             -> ResponseReaderPtr {
+             throw std::runtime_error("could not start");
+         },
+         callback))
+        ->start();
+
+    EXPECT_TRUE(promise.get_future().get().threw);
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_compression.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace buildboxcommon;
+
+namespace {
+// Compressible data spanning several of the streams' internal buffers.
+std::string sampleData()
+{
+    std::string data;
+    for (int i = 0; data.size() < 512 * 1024; i++) {
+        data += "line " + std::to_string(i) + " of a build log\n";
+    }
+    return data;
+}
+} // namespace
+
+TEST(CompressionTest, Names)
+{
+    EXPECT_EQ(Compression::name(Compressor::IDENTITY), "identity");
+    EXPECT_EQ(Compression::name(Compressor::ZSTD), "zstd");
+    EXPECT_EQ(Compression::name(Compressor::DEFLATE), "deflate");
+}
+
+TEST(CompressionTest, SupportedCompressors)
+{
+    EXPECT_TRUE(Compression::isSupported(Compressor::IDENTITY));
+    EXPECT_TRUE(Compression::isSupported(Compressor::DEFLATE));
+    EXPECT_FALSE(Compression::isSupported(Compressor::BROTLI));
+
+    for (const auto compressor : Compression::supportedCompressors()) {
+        EXPECT_TRUE(Compression::isSupported(compressor));
+        EXPECT_NE(compressor, Compressor::IDENTITY);
+    }
+
+    EXPECT_THROW(Compression::makeCompressor(Compressor::BROTLI),
+                 std::invalid_argument);
+    EXPECT_THROW(Compression::makeDecompressor(Compressor::BROTLI, 1),
+                 std::invalid_argument);
+}
+
+TEST(CompressionTest, RoundTrip)
+{
+    const std::string data = sampleData();
+    for (const auto compressor : Compression::supportedCompressors()) {
+        SCOPED_TRACE(Compression::name(compressor));
+        const std::string compressed = Compression::compress(compressor, data);
+        EXPECT_LT(compressed.size(), data.size() / 3);
+        EXPECT_EQ(Compression::decompress(compressor, compressed, data.size()),
+                  data);
+    }
+}
+
+TEST(CompressionTest, RoundTripEmpty)
+{
+    for (const auto compressor : Compression::supportedCompressors()) {
+        SCOPED_TRACE(Compression::name(compressor));
+        const std::string compressed = Compression::compress(compressor, "");
+        EXPECT_EQ(Compression::decompress(compressor, compressed, 0), "");
+    }
+}
+
+TEST(CompressionTest, StreamsInPieces)
+{
+    const std::string data = sampleData();
+    const size_t pieceSize = 1000;
+    for (const auto compressor : Compression::supportedCompressors()) {
+        SCOPED_TRACE(Compression::name(compressor));
+
+        std::string compressed;
+        const auto compressorStream = Compression::makeCompressor(compressor);
+        for (size_t offset = 0; offset < data.size(); offset += pieceSize) {
+            const size_t length = std::min(pieceSize, data.size() - offset);
+            compressorStream->process(&data[offset], length,
+                                      offset + length == data.size(),
+                                      &compressed);
+        }
+        EXPECT_EQ(compressed, Compression::compress(compressor, data));
+
+        std::string decompressed;
+        const auto decompressor =
+            Compression::makeDecompressor(compressor, data.size());
+        for (size_t offset = 0; offset < compressed.size();
+             offset += pieceSize) {
+            const size_t length =
+                std::min(pieceSize, compressed.size() - offset);
+            decompressor->process(&compressed[offset], length, false,
+                                  &decompressed);
+        }
+        decompressor->process(nullptr, 0, true, &decompressed);
+        EXPECT_EQ(decompressed, data);
+    }
+}
+
+TEST(CompressionTest, MalformedDataThrows)
+{
+    const std::string garbage(100, 'x');
+    for (const auto compressor : Compression::supportedCompressors()) {
+        SCOPED_TRACE(Compression::name(compressor));
+        EXPECT_THROW(Compression::decompress(compressor, garbage, 1000),
+                     std::runtime_error);
+    }
+}
+
+TEST(CompressionTest, TruncatedDataThrows)
+{
+    const std::string data = sampleData();
+    for (const auto compressor : Compression::supportedCompressors()) {
+        SCOPED_TRACE(Compression::name(compressor));
+        const std::string compressed = Compression::compress(compressor, data);
+        EXPECT_THROW(
+            Compression::decompress(
+                compressor, compressed.substr(0, compressed.size() / 2),
+                data.size()),
+            std::runtime_error);
+    }
+}
+
+TEST(CompressionTest, TrailingDataThrows)
+{
+    const std::string compressed =
+        Compression::compress(Compressor::DEFLATE, "data");
+    EXPECT_THROW(
+        Compression::decompress(Compressor::DEFLATE, compressed + "x", 4),
+        std::runtime_error);
+}
+
+TEST(CompressionTest, OutputLargerThanExpectedThrows)
+{
+    const std::string data = sampleData();
+    for (const auto compressor : Compression::supportedCompressors()) {
+        SCOPED_TRACE(Compression::name(compressor));
+        const std::string compressed = Compression::compress(compressor, data);
+        EXPECT_THROW(
+            Compression::decompress(compressor, compressed, data.size() - 1),
+            std::runtime_error);
+    }
+}
@@ -33,6 +33,8 @@ TEST(ConnectionOptionsTest, DefaultsToNullptrs)
     EXPECT_EQ(opts.d_clientCert, nullptr);
     EXPECT_EQ(opts.d_clientCertPath, nullptr);
     EXPECT_EQ(opts.d_loadBalancingPolicy, nullptr);
+    EXPECT_EQ(opts.d_channelCount, nullptr);
+    EXPECT_FALSE(opts.d_trustedEndpoint);
 }
 
 TEST(ConnectionOptionsTest, ParseArgIgnoresInvalidArgs)
@@ -146,6 +148,8 @@ TEST(ConnectionOptionsTest, PutArgsFull)
     opts.d_retryDelay = "200";
     opts.d_tokenReloadInterval = "7200";
     opts.d_loadBalancingPolicy = "round_robin";
+    opts.d_channelCount = "4";
+    opts.d_trustedEndpoint = true;
 
     std::vector<std::string> result;
 
@@ -161,7 +165,9 @@ TEST(ConnectionOptionsTest, PutArgsFull)
         "--token-reload-interval=7200",
         "--retry-limit=2",
         "--retry-delay=200",
-        "--load-balancing-policy=round_robin"};
+        "--trusted-endpoint",
+        "--load-balancing-policy=round_robin",
+        "--channel-count=4"};
     EXPECT_EQ(result, expected);
 
     opts.putArgs(&result, "cas-");
@@ -174,7 +180,9 @@ TEST(ConnectionOptionsTest, PutArgsFull)
     expected.push_back("--cas-token-reload-interval=7200");
     expected.push_back("--cas-retry-limit=2");
     expected.push_back("--cas-retry-delay=200");
+    expected.push_back("--cas-trusted-endpoint");
     expected.push_back("--cas-load-balancing-policy=round_robin");
+    expected.push_back("--cas-channel-count=4");
     EXPECT_EQ(result, expected);
 }
 
@@ -221,6 +229,35 @@ TEST(ConnectionOptionTest, CreateSimpleChannelGRPCSTest)
     ASSERT_NO_THROW(channel = opts.createChannel());
 }
 
+TEST(ConnectionOptionsTest, CreateChannelsDefaultsToOne)
+{
+    ConnectionOptions opts;
+    opts.d_url = "http://example.com/";
+
+    EXPECT_EQ(opts.createChannels().size(), 1);
+}
+
+TEST(ConnectionOptionsTest, CreateChannelsWithCount)
+{
+    ConnectionOptions opts;
+    ASSERT_TRUE(opts.parseArg("--remote=http://example.com/"));
+    ASSERT_TRUE(opts.parseArg("--channel-count=3"));
+
+    const auto channels = opts.createChannels();
+    ASSERT_EQ(channels.size(), 3);
+    EXPECT_NE(channels[0], channels[1]);
+    EXPECT_NE(channels[1], channels[2]);
+}
+
+TEST(ConnectionOptionsTest, CreateChannelsInvalidCount)
+{
+    ConnectionOptions opts;
+    opts.d_url = "http://example.com/";
+    opts.d_channelCount = "0";
+
+    EXPECT_THROW(opts.createChannels(), std::invalid_argument);
+}
+
 TEST(ConnectionOptionsTest, AccessTokenExists)
 {
     ConnectionOptions opts;
@@ -35,7 +35,9 @@ const char *argvTest[] = {
     "--cas-googleapi-auth=true",
     "--cas-retry-limit=10",
     "--cas-retry-delay=500",
-    "--cas-load-balancing-policy=round_robin"
+    "--cas-load-balancing-policy=round_robin",
+    "--cas-channel-count=4",
+    "--cas-trusted-endpoint=true"
 };
 
 const char *argvTestDefaults[] = {
@@ -91,6 +93,11 @@ TEST(ConnectionOptionsCommandLineTest, Test)
 
     ASSERT_TRUE(channel.d_loadBalancingPolicy != nullptr);
     EXPECT_STREQ("round_robin", channel.d_loadBalancingPolicy);
+
+    ASSERT_TRUE(channel.d_channelCount != nullptr);
+    EXPECT_STREQ("4", channel.d_channelCount);
+
+    EXPECT_TRUE(channel.d_trustedEndpoint);
 }
 
 TEST(ConnectionOptionsCommandLineTest, TestDefaults)
@@ -116,6 +123,7 @@ TEST(ConnectionOptionsCommandLineTest, TestDefaults)
     EXPECT_STREQ("4", channel.d_retryLimit);
     ASSERT_TRUE(channel.d_retryDelay != nullptr);
     EXPECT_STREQ("1000", channel.d_retryDelay);
+    EXPECT_FALSE(channel.d_trustedEndpoint);
 
     // untouched
     EXPECT_TRUE(channel.d_serverCertPath == nullptr);
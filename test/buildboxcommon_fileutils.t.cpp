@@ -26,6 +26,7 @@
 #include <fstream>
 #include <iostream>
 
+#include <cstring>
 #include <dirent.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -1224,6 +1225,59 @@ TEST(FileUtilsTests, CopyFile)
     ASSERT_EQ(file_permissions, 0744);
 }
 
+TEST(FileUtilsTests, CopyFileAtomically)
+{
+    TemporaryDirectory output_directory;
+
+    const std::string source_path =
+        std::string(output_directory.name()) + "/source";
+    // Large enough to take several iterations of a buffered copy:
+    const std::string data(1024 * 1024 + 7, 'x');
+    FileUtils::writeFileAtomically(source_path, data, 0644);
+
+    // The destination exists and is replaced:
+    const std::string copy_path =
+        std::string(output_directory.name()) + "/copy.sh";
+    FileUtils::writeFileAtomically(copy_path, "old contents", 0644);
+    FileUtils::copyFileAtomically(source_path, copy_path, 0755);
+
+    std::ifstream file(copy_path, std::ifstream::binary);
+    std::stringstream read_data;
+    read_data << file.rdbuf();
+    ASSERT_EQ(read_data.str(), data);
+
+    // The copy has the requested permissions, not the source's:
+    struct stat stat_buf;
+    ASSERT_EQ(stat(copy_path.c_str(), &stat_buf), 0);
+    ASSERT_EQ(stat_buf.st_mode & 0777, 0755);
+
+    // No intermediate files are left behind:
+    DIR *dir = opendir(output_directory.name());
+    ASSERT_NE(dir, nullptr);
+    int entries = 0;
+    while (const dirent *entry = readdir(dir)) {
+        if (strcmp(entry->d_name, ".") != 0 &&
+            strcmp(entry->d_name, "..") != 0) {
+            entries++;
+        }
+    }
+    closedir(dir);
+    ASSERT_EQ(entries, 2);
+}
+
+TEST(FileUtilsTests, CopyFileAtomicallyMissingSourceThrows)
+{
+    TemporaryDirectory output_directory;
+    const std::string copy_path =
+        std::string(output_directory.name()) + "/copy";
+
+    ASSERT_THROW(FileUtils::copyFileAtomically(
+                     std::string(output_directory.name()) + "/missing",
+                     copy_path, 0644),
+                 std::system_error);
+    ASSERT_FALSE(buildboxcommontest::TestUtils::pathExists(copy_path.c_str()));
+}
+
 TEST(FileUtilsTests, ThrowOnPermissionsError)
 {
     TemporaryDirectory top_level;
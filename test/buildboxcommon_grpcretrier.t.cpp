@@ -226,6 +226,55 @@ TEST(GrpcRetrier, SimpleRetryFailTest)
     EXPECT_EQ(r.retryAttempts(), 2);
 }
 
+TEST(GrpcRetrier, ExpectedStatusCodeIsFinal)
+{
+    const int retryLimit = 2;
+    const std::chrono::milliseconds retryDelay(100);
+
+    int numRequests = 0;
+    auto lambda = [&](grpc::ClientContext &) {
+        numRequests++;
+        return grpc::Status(grpc::NOT_FOUND, "missing in test");
+    };
+
+    GrpcRetrier r(retryLimit, retryDelay, lambda, "lambda()");
+    EXPECT_TRUE(r.expectedStatusCodes().empty());
+    r.setExpectedStatusCodes({grpc::StatusCode::NOT_FOUND});
+    EXPECT_EQ(r.expectedStatusCodes().count(grpc::StatusCode::NOT_FOUND), 1);
+
+    EXPECT_TRUE(r.issueRequest());
+    EXPECT_EQ(r.status().error_code(), grpc::NOT_FOUND);
+    EXPECT_EQ(numRequests, 1);
+    EXPECT_EQ(r.retryAttempts(), 0);
+}
+
+TEST(GrpcRetrier, StepwiseAttempts)
+{
+    const int retryLimit = 2;
+    const std::chrono::milliseconds retryDelay(100);
+
+    GrpcRetrier r(retryLimit, retryDelay, nullptr, "stepwise()");
+    const grpc::Status unavailable(grpc::UNAVAILABLE, "failing in test");
+
+    std::chrono::milliseconds delay(0);
+    EXPECT_EQ(r.attemptFinished(unavailable, &delay),
+              GrpcRetrier::AttemptResult::Retry);
+    EXPECT_EQ(delay, std::chrono::milliseconds(100));
+    EXPECT_EQ(r.attemptFinished(unavailable, &delay),
+              GrpcRetrier::AttemptResult::Retry);
+    EXPECT_EQ(delay, std::chrono::milliseconds(160));
+    EXPECT_EQ(r.attemptFinished(unavailable, &delay),
+              GrpcRetrier::AttemptResult::RetryLimitExceeded);
+    EXPECT_EQ(r.retryAttempts(), 2);
+
+    GrpcRetrier r2(retryLimit, retryDelay, nullptr, "stepwise()");
+    EXPECT_EQ(r2.attemptFinished(
+                  grpc::Status(grpc::NOT_FOUND, "final error"), &delay),
+              GrpcRetrier::AttemptResult::Done);
+    EXPECT_EQ(r2.status().error_code(), grpc::NOT_FOUND);
+    EXPECT_EQ(r2.retryAttempts(), 0);
+}
+
 TEST(GrpcRetrier, ServerProvidedDelay)
 {
     const int retryLimit = 2;
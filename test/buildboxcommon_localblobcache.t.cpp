@@ -0,0 +1,191 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_cashash.h>
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_localblobcache.h>
+#include <buildboxcommon_temporarydirectory.h>
+#include <buildboxcommon_temporaryfile.h>
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace buildboxcommon;
+
+class LocalBlobCacheFixture : public ::testing::Test {
+  protected:
+    TemporaryDirectory directory;
+    const std::string root = std::string(directory.name()) + "/cache";
+
+    ino_t inode(const std::string &path)
+    {
+        struct stat st;
+        EXPECT_EQ(stat(path.c_str(), &st), 0);
+        return st.st_ino;
+    }
+};
+
+TEST_F(LocalBlobCacheFixture, InvalidQuotaThrows)
+{
+    EXPECT_THROW(LocalBlobCache(root, 0), std::invalid_argument);
+}
+
+TEST_F(LocalBlobCacheFixture, ReadsInsertedBlobs)
+{
+    LocalBlobCache cache(root, 1024);
+    const Digest a = CASHash::hash("a");
+    const Digest b = CASHash::hash("b");
+
+    cache.insert(a, "a");
+    EXPECT_TRUE(cache.contains(a));
+    EXPECT_FALSE(cache.contains(b));
+    EXPECT_EQ(cache.sizeBytes(), 1);
+
+    std::string data;
+    EXPECT_TRUE(cache.read(a, &data));
+    EXPECT_EQ(data, "a");
+    EXPECT_FALSE(cache.read(b, &data));
+
+    TemporaryFile file;
+    EXPECT_TRUE(cache.readToFile(a, file.fd()));
+    EXPECT_EQ(FileUtils::getFileContents(file.name()), "a");
+}
+
+TEST_F(LocalBlobCacheFixture, InsertsWithoutPermissionOverrides)
+{
+    // Root may write to the read-only entries regardless of their mode, so
+    // when running as root the insertion is done as an unprivileged user.
+    // The directories stay writable by both users.
+    const uid_t unprivileged = 65534;
+    ASSERT_EQ(chmod(directory.name(), 0777), 0);
+    const pid_t pid = fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0) {
+        if (geteuid() == 0 &&
+            (setgid(unprivileged) != 0 || setuid(unprivileged) != 0)) {
+            _exit(2);
+        }
+        LocalBlobCache cache(root, 1024);
+        const Digest digest = CASHash::hash("a");
+        cache.insert(digest, "a");
+        std::string data;
+        const bool inserted = cache.read(digest, &data) && data == "a";
+        _exit(chmod(root.c_str(), 0777) == 0 && inserted ? 0 : 1);
+    }
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+
+    // The entry is found again, read-only:
+    LocalBlobCache cache(root, 1024);
+    const Digest digest = CASHash::hash("a");
+    EXPECT_TRUE(cache.contains(digest));
+    struct stat st;
+    ASSERT_EQ(stat(cache.path(digest).c_str(), &st), 0);
+    EXPECT_EQ(st.st_mode & 0777, 0444);
+}
+
+TEST_F(LocalBlobCacheFixture, InsertsFromFile)
+{
+    LocalBlobCache cache(root, 1024);
+    const Digest digest = CASHash::hash("file contents");
+
+    TemporaryFile file;
+    FileUtils::writeFileAtomically(file.name(), "file contents");
+    const int fd = open(file.name(), O_RDONLY);
+    ASSERT_NE(fd, -1);
+    cache.insertFile(digest, fd);
+    close(fd);
+
+    std::string data;
+    EXPECT_TRUE(cache.read(digest, &data));
+    EXPECT_EQ(data, "file contents");
+}
+
+TEST_F(LocalBlobCacheFixture, EvictsLeastRecentlyUsed)
+{
+    LocalBlobCache cache(root, 8);
+    const Digest a = CASHash::hash("aaaa");
+    const Digest b = CASHash::hash("bbbb");
+    const Digest c = CASHash::hash("cccc");
+
+    cache.insert(a, "aaaa");
+    cache.insert(b, "bbbb");
+    EXPECT_TRUE(cache.contains(a));
+
+    // `b` is now the least recently used:
+    cache.insert(c, "cccc");
+    EXPECT_TRUE(cache.contains(a));
+    EXPECT_FALSE(cache.contains(b));
+    EXPECT_TRUE(cache.contains(c));
+    EXPECT_FALSE(FileUtils::isRegularFile(cache.path(b).c_str()));
+    EXPECT_EQ(cache.sizeBytes(), 8);
+}
+
+TEST_F(LocalBlobCacheFixture, SkipsBlobsLargerThanQuota)
+{
+    LocalBlobCache cache(root, 2);
+    const Digest digest = CASHash::hash("abc");
+
+    cache.insert(digest, "abc");
+    EXPECT_FALSE(cache.contains(digest));
+    EXPECT_EQ(cache.sizeBytes(), 0);
+}
+
+TEST_F(LocalBlobCacheFixture, IndexesExistingEntries)
+{
+    const Digest digest = CASHash::hash("persisted");
+    {
+        LocalBlobCache cache(root, 1024);
+        cache.insert(digest, "persisted");
+    }
+
+    LocalBlobCache cache(root, 1024);
+    EXPECT_EQ(cache.sizeBytes(), 9);
+    std::string data;
+    EXPECT_TRUE(cache.read(digest, &data));
+    EXPECT_EQ(data, "persisted");
+}
+
+TEST_F(LocalBlobCacheFixture, StagesWithHardLinkOrCopy)
+{
+    LocalBlobCache cache(root, 1024);
+    const Digest digest = CASHash::hash("staged");
+    cache.insert(digest, "staged");
+
+    const std::string linked = std::string(directory.name()) + "/linked";
+    EXPECT_TRUE(cache.stage(digest, linked, 0644, true));
+    EXPECT_EQ(inode(linked), inode(cache.path(digest)));
+
+    // Executables get their own copy with the requested mode:
+    const std::string copied = std::string(directory.name()) + "/copied";
+    EXPECT_TRUE(cache.stage(digest, copied, 0755, true));
+    EXPECT_NE(inode(copied), inode(cache.path(digest)));
+    EXPECT_TRUE(FileUtils::isExecutable(copied.c_str()));
+    EXPECT_EQ(FileUtils::getFileContents(copied.c_str()), "staged");
+
+    const std::string missing = std::string(directory.name()) + "/missing";
+    EXPECT_FALSE(cache.stage(CASHash::hash("other"), missing, 0644, true));
+    EXPECT_FALSE(FileUtils::isRegularFile(missing.c_str()));
+}
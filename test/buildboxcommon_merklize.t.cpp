@@ -14,8 +14,13 @@
 
 #include <buildboxcommon_fileutils.h>
 #include <buildboxcommon_merklize.h>
+#include <buildboxcommon_temporarydirectory.h>
+#include <buildboxcommon_threadpool.h>
 #include <gtest/gtest.h>
 
+#include <system_error>
+#include <unordered_set>
+
 using namespace buildboxcommon;
 
 TEST(FileTest, ToFilenode)
@@ -255,6 +260,46 @@ TEST(NestedDirectoryTest, SubdirectoriesToTree)
     EXPECT_EQ("HASH2", subdir2.files(0).digest().hash_other());
 }
 
+TEST(NestedDirectoryTest, ToDigestWithTree)
+{
+    File file;
+    file.d_digest.set_hash_other("HASH1");
+
+    NestedDirectory directory;
+    directory.add(file, "a/b/c/file");
+    directory.add(file, "a/d/file");
+    directory.add(file, "e/file");
+    directory.addSymlink("a/d/file", "link");
+
+    digest_string_map digestMap;
+    Tree tree;
+    const auto digest = directory.to_digest(&digestMap, &tree);
+
+    // Same results as computing the digest and the tree separately.
+    digest_string_map separateDigestMap;
+    EXPECT_EQ(directory.to_digest(&separateDigestMap), digest);
+    EXPECT_EQ(separateDigestMap, digestMap);
+    EXPECT_EQ(make_digest(tree.root()), digest);
+
+    // Every directory is listed after its descendants.
+    ASSERT_EQ(5, tree.children_size());
+    std::unordered_set<Digest> listedDigests;
+    for (const auto &child : tree.children()) {
+        EXPECT_EQ(1, digestMap.count(make_digest(child)));
+        for (const auto &subdir : child.directories()) {
+            EXPECT_EQ(1, listedDigests.count(subdir.digest()));
+        }
+        listedDigests.insert(make_digest(child));
+    }
+    EXPECT_EQ("c", tree.children(1).directories(0).name());
+    EXPECT_EQ("b", tree.children(3).directories(0).name());
+    EXPECT_EQ("d", tree.children(3).directories(1).name());
+
+    // A previous Tree is overwritten.
+    directory.to_digest(nullptr, &tree);
+    EXPECT_EQ(5, tree.children_size());
+}
+
 TEST(NestedDirectoryTest, MakeNestedDirectory)
 {
     std::unordered_map<buildboxcommon::Digest, std::string> fileMap;
@@ -312,6 +357,68 @@ TEST(NestedDirectoryTest, MakeNestedDirectoryFollowingSymlinks)
                   fileMap[subdirectory->d_files["abc.txt"].d_digest].c_str()));
 }
 
+TEST(NestedDirectoryTest, MakeNestedDirectoryParallelMatchesSerial)
+{
+    for (const bool followSymlinks : {false, true}) {
+        digest_string_map serialFileMap;
+        const auto serial = make_nesteddirectory(".", &serialFileMap,
+                                                 {"mtime"}, followSymlinks);
+
+        ThreadPool pool(4);
+        digest_string_map parallelFileMap;
+        const auto parallel = make_nesteddirectory_parallel(
+            pool, ".", &parallelFileMap, {"mtime"}, followSymlinks);
+
+        EXPECT_EQ(serialFileMap, parallelFileMap);
+
+        digest_string_map serialDigestMap, parallelDigestMap;
+        EXPECT_EQ(serial.to_digest(&serialDigestMap),
+                  parallel.to_digest(&parallelDigestMap));
+        EXPECT_EQ(serialDigestMap, parallelDigestMap);
+    }
+}
+
+TEST(NestedDirectoryTest, MakeNestedDirectoryParallelLargeTree)
+{
+    // Several levels of directories, with files that share their contents
+    // so that the choice of path stored in the fileMap is exercised.
+    TemporaryDirectory root;
+    const std::string rootPath(root.name());
+    for (int i = 0; i < 8; i++) {
+        const std::string dir = rootPath + "/dir" + std::to_string(i);
+        FileUtils::createDirectory(dir.c_str());
+        for (int j = 0; j < 4; j++) {
+            const std::string subdir = dir + "/sub" + std::to_string(j);
+            FileUtils::createDirectory(subdir.c_str());
+            for (int k = 0; k < 16; k++) {
+                FileUtils::writeFileAtomically(subdir + "/file" +
+                                                   std::to_string(k),
+                                               std::to_string(k % 5));
+            }
+        }
+        FileUtils::writeFileAtomically(dir + "/top", std::to_string(i));
+    }
+
+    digest_string_map serialFileMap;
+    const auto serial = make_nesteddirectory(root.name(), &serialFileMap);
+
+    ThreadPool pool(3);
+    digest_string_map parallelFileMap;
+    const auto parallel =
+        make_nesteddirectory_parallel(pool, root.name(), &parallelFileMap);
+
+    EXPECT_EQ(serialFileMap, parallelFileMap);
+    EXPECT_EQ(serial.to_digest(), parallel.to_digest());
+    EXPECT_EQ(8, parallel.d_subdirs->size());
+}
+
+TEST(NestedDirectoryTest, MakeNestedDirectoryParallelMissingPath)
+{
+    ThreadPool pool(2);
+    EXPECT_THROW(make_nesteddirectory_parallel(pool, "does-not-exist"),
+                 std::system_error);
+}
+
 // Make sure the digest is calculated correctly regardless of the order in
 // which the files are added. Important for caching.
 TEST(NestedDirectoryTest, ConsistentDigestRegardlessOfFileOrder)
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_cashash.h>
+#include <buildboxcommon_presencecache.h>
+#include <buildboxcommonmetrics_countingmetricvalue.h>
+#include <buildboxcommonmetrics_testingutils.h>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace buildboxcommon;
+using namespace buildboxcommon::buildboxcommonmetrics;
+
+namespace {
+const auto LONG_TTL = std::chrono::hours(1);
+}
+
+TEST(PresenceCacheTest, RemembersInsertedDigests)
+{
+    PresenceCache cache(10, LONG_TTL);
+    const Digest a = CASHash::hash("a");
+    const Digest b = CASHash::hash("b");
+
+    cache.insert(a);
+    EXPECT_TRUE(cache.contains(a));
+    EXPECT_FALSE(cache.contains(b));
+    EXPECT_EQ(cache.size(), 1);
+
+    cache.clear();
+    EXPECT_FALSE(cache.contains(a));
+    EXPECT_EQ(cache.size(), 0);
+}
+
+TEST(PresenceCacheTest, EntriesExpire)
+{
+    PresenceCache cache(10, std::chrono::milliseconds(20));
+    const Digest a = CASHash::hash("a");
+
+    cache.insert(a);
+    EXPECT_TRUE(cache.contains(a));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    EXPECT_FALSE(cache.contains(a));
+    EXPECT_EQ(cache.size(), 0);
+}
+
+TEST(PresenceCacheTest, EvictsLeastRecentlyUsed)
+{
+    PresenceCache cache(2, LONG_TTL);
+    const Digest a = CASHash::hash("a");
+    const Digest b = CASHash::hash("b");
+    const Digest c = CASHash::hash("c");
+
+    cache.insert(a);
+    cache.insert(b);
+    // Using `a` makes `b` the oldest entry:
+    EXPECT_TRUE(cache.contains(a));
+    cache.insert(c);
+
+    EXPECT_EQ(cache.size(), 2);
+    EXPECT_TRUE(cache.contains(a));
+    EXPECT_FALSE(cache.contains(b));
+    EXPECT_TRUE(cache.contains(c));
+}
+
+TEST(PresenceCacheTest, FilterUnknownKeepsOrderAndCountsLookups)
+{
+    clearAllMetricCollection();
+
+    PresenceCache cache(10, LONG_TTL);
+    const Digest a = CASHash::hash("a");
+    const Digest b = CASHash::hash("b");
+    const Digest c = CASHash::hash("c");
+    cache.insert(b);
+
+    const std::vector<Digest> unknown = cache.filterUnknown({c, b, a});
+    EXPECT_EQ(unknown, std::vector<Digest>({c, a}));
+
+    EXPECT_TRUE(allCollectedByNameWithValues<CountingMetricValue>(
+        {{PresenceCache::s_hitsMetricName, CountingMetricValue(1)},
+         {PresenceCache::s_missesMetricName, CountingMetricValue(2)}}));
+}
+
+TEST(PresenceCacheTest, ZeroCapacityThrows)
+{
+    EXPECT_THROW(PresenceCache(0, LONG_TTL), std::invalid_argument);
+}
@@ -23,8 +23,77 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+
 using namespace buildboxcommon;
 
+namespace {
+// Deterministic, well-distributed pseudo-random numbers (SplitMix64).
+uint64_t nextRandom(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Generate a digest that looks like a BLAKE3ZCC one.
+Digest randomBlake3Digest(uint64_t *state)
+{
+    std::string hash(32, '\0');
+    for (size_t i = 0; i < hash.size(); i += 8) {
+        const uint64_t word = nextRandom(state);
+        memcpy(&hash[i], &word, sizeof(word));
+    }
+
+    Digest digest;
+    digest.set_hash_blake3zcc(hash);
+    digest.set_size_bytes(static_cast<int64_t>(nextRandom(state) % 4096));
+    return digest;
+}
+
+// Generate a digest that looks like a SHA-256 one.
+Digest randomSha256Digest(uint64_t *state)
+{
+    Digest digest = randomBlake3Digest(state);
+    digest.set_hash_other(hashToHex(digest));
+    digest.clear_hash_blake3zcc();
+    return digest;
+}
+
+// Insert `count` distinct digests into a map and check that they are spread
+// out over the buckets and can all be found again.
+void checkLargeMap(Digest (*generate)(uint64_t *), size_t count)
+{
+    uint64_t state = 42;
+    std::vector<Digest> digests;
+    digests.reserve(count);
+    std::unordered_map<Digest, size_t> map;
+    map.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        digests.push_back(generate(&state));
+        map.emplace(digests.back(), i);
+    }
+    ASSERT_EQ(map.size(), count);
+
+    size_t largestBucket = 0;
+    for (size_t i = 0; i < map.bucket_count(); i++) {
+        largestBucket = std::max(largestBucket, map.bucket_size(i));
+    }
+    // With a uniform hash, the largest of ~1M buckets holds around 10
+    // entries.
+    EXPECT_LT(largestBucket, 16);
+
+    for (size_t i = 0; i < count; i++) {
+        const auto it = map.find(digests[i]);
+        ASSERT_NE(it, map.end());
+        EXPECT_EQ(it->second, i);
+    }
+}
+} // namespace
+
 TEST(ProtosHeaderTest, DigestComparisonEqual)
 {
     Digest d1, d2;
@@ -118,6 +187,80 @@ TEST(ProtosHeaderTest, DigestToString)
     ASSERT_EQ(output.str(), expected_output);
 }
 
+TEST(ProtosHeaderTest, Blake3DigestComparison)
+{
+    uint64_t state = 1;
+    const Digest d1 = randomBlake3Digest(&state);
+    Digest d2 = randomBlake3Digest(&state);
+    d2.set_size_bytes(d1.size_bytes());
+
+    Digest d1Copy;
+    d1Copy.CopyFrom(d1);
+
+    EXPECT_EQ(d1, d1Copy);
+    EXPECT_NE(d1, d2);
+    EXPECT_NE(d1 < d2, d2 < d1);
+    EXPECT_FALSE(d1 < d1Copy);
+    EXPECT_EQ(std::hash<Digest>{}(d1), std::hash<Digest>{}(d1Copy));
+    EXPECT_NE(std::hash<Digest>{}(d1), std::hash<Digest>{}(d2));
+}
+
+TEST(ProtosHeaderTest, Blake3DigestsInOrderedSet)
+{
+    uint64_t state = 2;
+    std::set<Digest> digests;
+    for (int i = 0; i < 1000; i++) {
+        digests.insert(randomBlake3Digest(&state));
+    }
+    EXPECT_EQ(digests.size(), 1000);
+}
+
+TEST(ProtosHeaderTest, Blake3DigestToString)
+{
+    Digest digest;
+    digest.set_hash_blake3zcc(std::string("\x00\x01\xab\xff", 4));
+    digest.set_size_bytes(3);
+    EXPECT_EQ(toString(digest), "0001abff/3");
+
+    digest.set_hash_other("1234");
+    digest.clear_hash_blake3zcc();
+    EXPECT_EQ(toString(digest), "1234/3");
+}
+
+TEST(ProtosHeaderTest, HexRoundTrip)
+{
+    const std::string bytes("\x00\x01\xab\xff", 4);
+    EXPECT_EQ(bytesToHex(bytes), "0001abff");
+
+    std::string decoded;
+    ASSERT_TRUE(hexToBytes("0001abff", &decoded));
+    EXPECT_EQ(decoded, bytes);
+
+    EXPECT_FALSE(hexToBytes("abc", &decoded));
+    EXPECT_FALSE(hexToBytes("0g", &decoded));
+    EXPECT_FALSE(hexToBytes("AB", &decoded));
+}
+
+TEST(ProtosHeaderTest, HashingShortHashes)
+{
+    // Hashes shorter than what `std::hash<Digest>` reads are still
+    // distinguished.
+    Digest d1, d2;
+    d1.set_hash_other("a");
+    d2.set_hash_other("b");
+    EXPECT_NE(std::hash<Digest>{}(d1), std::hash<Digest>{}(d2));
+}
+
+TEST(ProtosHeaderTest, MillionBlake3DigestsInUnorderedMap)
+{
+    checkLargeMap(randomBlake3Digest, 1000000);
+}
+
+TEST(ProtosHeaderTest, MillionSha256DigestsInUnorderedMap)
+{
+    checkLargeMap(randomSha256Digest, 1000000);
+}
+
 TEST(ProtosUtilsTest, WriteProtoToFile)
 {
     const Digest digest =
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_requesthedger.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+using namespace buildboxcommon;
+
+namespace {
+const std::chrono::milliseconds SHORT_DELAY(10);
+const std::chrono::milliseconds LONG_DELAY(60 * 1000);
+} // namespace
+
+TEST(RequestHedgerTest, InvalidArgumentsThrow)
+{
+    EXPECT_THROW(RequestHedger(std::chrono::milliseconds(-1)),
+                 std::invalid_argument);
+    EXPECT_THROW(RequestHedger(SHORT_DELAY, 101), std::invalid_argument);
+    EXPECT_THROW(RequestHedger(SHORT_DELAY, 0, 0), std::invalid_argument);
+}
+
+TEST(RequestHedgerTest, FastRequestIsNotHedged)
+{
+    RequestHedger hedger(LONG_DELAY);
+    std::atomic<int> attempts(0);
+
+    grpc::ClientContext context;
+    size_t winner = 1;
+    const grpc::Status status = hedger.issue(
+        context,
+        [&](grpc::ClientContext &, size_t) {
+            attempts++;
+            return grpc::Status::OK;
+        },
+        nullptr, &winner);
+
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(winner, 0);
+    EXPECT_EQ(attempts, 1);
+}
+
+TEST(RequestHedgerTest, SlowRequestIsHedged)
+{
+    RequestHedger hedger(SHORT_DELAY);
+    std::promise<void> hedgeFinished;
+    bool metadataAttached = false;
+
+    grpc::ClientContext context;
+    size_t winner = 0;
+    const grpc::Status status = hedger.issue(
+        context,
+        [&](grpc::ClientContext &, size_t attempt) {
+            if (attempt == 0) {
+                hedgeFinished.get_future().wait();
+                return grpc::Status(grpc::StatusCode::CANCELLED, "slow");
+            }
+            hedgeFinished.set_value();
+            return grpc::Status::OK;
+        },
+        [&](grpc::ClientContext *) { metadataAttached = true; }, &winner);
+
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(winner, 1);
+    EXPECT_TRUE(metadataAttached);
+}
+
+TEST(RequestHedgerTest, FailedHedgeKeepsFirstResult)
+{
+    RequestHedger hedger(SHORT_DELAY);
+    std::promise<void> hedgeFinished;
+
+    grpc::ClientContext context;
+    size_t winner = 1;
+    const grpc::Status status = hedger.issue(
+        context,
+        [&](grpc::ClientContext &, size_t attempt) {
+            if (attempt == 0) {
+                hedgeFinished.get_future().wait();
+                return grpc::Status::OK;
+            }
+            hedgeFinished.set_value();
+            return grpc::Status(grpc::StatusCode::UNAVAILABLE, "down");
+        },
+        nullptr, &winner);
+
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(winner, 0);
+}
+
+TEST(RequestHedgerTest, FirstExceptionIsRethrownIfBothFail)
+{
+    RequestHedger hedger(SHORT_DELAY);
+    std::promise<void> hedgeFinished;
+
+    grpc::ClientContext context;
+    size_t winner = 0;
+    EXPECT_THROW(hedger.issue(
+                     context,
+                     [&](grpc::ClientContext &, size_t attempt) {
+                         if (attempt == 0) {
+                             hedgeFinished.get_future().wait();
+                             throw std::runtime_error("first");
+                         }
+                         hedgeFinished.set_value();
+                         throw std::runtime_error("hedge");
+                         return grpc::Status::OK;
+                     },
+                     nullptr, &winner),
+                 std::runtime_error);
+}
+
+TEST(RequestHedgerTest, DelayFollowsPercentile)
+{
+    RequestHedger hedger(LONG_DELAY, 90);
+    EXPECT_EQ(hedger.delay(), LONG_DELAY);
+
+    for (int i = 0; i < 20; i++) {
+        grpc::ClientContext context;
+        size_t winner = 0;
+        hedger.issue(
+            context,
+            [](grpc::ClientContext &, size_t) { return grpc::Status::OK; },
+            nullptr, &winner);
+    }
+    EXPECT_LT(hedger.delay(), LONG_DELAY);
+}
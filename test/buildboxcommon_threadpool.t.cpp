@@ -0,0 +1,122 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <buildboxcommon_threadpool.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace buildboxcommon;
+
+TEST(ThreadPoolTest, DefaultSizeIsNotZero)
+{
+    ThreadPool pool;
+    EXPECT_GT(pool.size(), 0);
+}
+
+TEST(ThreadPoolTest, AsyncReturnsResult)
+{
+    ThreadPool pool(2);
+    auto result = pool.async([]() { return 42; });
+    EXPECT_EQ(result.get(), 42);
+}
+
+TEST(ThreadPoolTest, AsyncPropagatesException)
+{
+    ThreadPool pool(1);
+    auto result =
+        pool.async([]() -> int { throw std::runtime_error("failed"); });
+    EXPECT_THROW(result.get(), std::runtime_error);
+}
+
+TEST(ThreadPoolTest, DestructorRunsQueuedTasks)
+{
+    std::atomic<int> counter(0);
+    {
+        ThreadPool pool(2);
+        for (int i = 0; i < 100; i++) {
+            pool.submit([&counter]() { counter++; });
+        }
+    }
+    EXPECT_EQ(counter, 100);
+}
+
+TEST(ThreadPoolTest, ParallelForVisitsEveryIndexOnce)
+{
+    ThreadPool pool(4);
+    std::vector<std::atomic<int>> visits(1000);
+    pool.parallelFor(visits.size(), [&visits](size_t i) { visits[i]++; });
+
+    for (const auto &v : visits) {
+        EXPECT_EQ(v, 1);
+    }
+}
+
+TEST(ThreadPoolTest, ParallelForRethrows)
+{
+    ThreadPool pool(4);
+    std::atomic<int> completed(0);
+    EXPECT_THROW(pool.parallelFor(100,
+                                  [&completed](size_t i) {
+                                      if (i == 50) {
+                                          throw std::runtime_error("failed");
+                                      }
+                                      completed++;
+                                  }),
+                 std::runtime_error);
+    // The remaining iterations still ran.
+    EXPECT_EQ(completed, 99);
+}
+
+TEST(ThreadPoolTest, ParallelForHonoursMaxParallelism)
+{
+    ThreadPool pool(8);
+    std::mutex mutex;
+    int running = 0;
+    int maxRunning = 0;
+    pool.parallelFor(
+        64,
+        [&](size_t) {
+            {
+                const std::lock_guard<std::mutex> lock(mutex);
+                maxRunning = std::max(maxRunning, ++running);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            const std::lock_guard<std::mutex> lock(mutex);
+            running--;
+        },
+        3);
+    EXPECT_LE(maxRunning, 3);
+}
+
+TEST(ThreadPoolTest, NestedParallelForDoesNotDeadlock)
+{
+    // Every worker is blocked in an outer iteration; the inner loops must
+    // still complete thanks to the calling threads doing the work.
+    ThreadPool pool(2);
+    std::atomic<int> counter(0);
+    pool.parallelFor(8, [&pool, &counter](size_t) {
+        pool.parallelFor(8, [&counter](size_t) { counter++; });
+    });
+    EXPECT_EQ(counter, 64);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2020 Bloomberg Finance LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDED_BUILDBOXCOMMONTEST_ASYNCMOCKS
+#define INCLUDED_BUILDBOXCOMMONTEST_ASYNCMOCKS
+
+#include <gmock/gmock.h>
+#include <grpcpp/support/async_stream.h>
+#include <grpcpp/support/async_unary_call.h>
+
+namespace buildboxcommontest {
+
+// Mocks of the asynchronous gRPC reader and writer interfaces.
+//
+// The ones in `grpcpp/test/mock_stream.h` lack methods that were added to
+// those interfaces since, such as `StartCall()`, and cannot be instantiated.
+
+template <class R>
+class MockAsyncResponseReader
+    : public grpc::ClientAsyncResponseReaderInterface<R> {
+  public:
+    MOCK_METHOD0_T(StartCall, void());
+    MOCK_METHOD1_T(ReadInitialMetadata, void(void *));
+    MOCK_METHOD3_T(Finish, void(R *, grpc::Status *, void *));
+};
+
+template <class R>
+class MockAsyncReader : public grpc::ClientAsyncReaderInterface<R> {
+  public:
+    MOCK_METHOD1_T(StartCall, void(void *));
+    MOCK_METHOD1_T(ReadInitialMetadata, void(void *));
+    MOCK_METHOD2_T(Finish, void(grpc::Status *, void *));
+    MOCK_METHOD2_T(Read, void(R *, void *));
+};
+
+template <class W>
+class MockAsyncWriter : public grpc::ClientAsyncWriterInterface<W> {
+  public:
+    MOCK_METHOD1_T(StartCall, void(void *));
+    MOCK_METHOD1_T(ReadInitialMetadata, void(void *));
+    MOCK_METHOD2_T(Finish, void(grpc::Status *, void *));
+    MOCK_METHOD2_T(Write, void(const W &, void *));
+    MOCK_METHOD3_T(Write, void(const W &, grpc::WriteOptions, void *));
+    MOCK_METHOD1_T(WritesDone, void(void *));
+};
+
+} // namespace buildboxcommontest
+
+#endif